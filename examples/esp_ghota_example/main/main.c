@@ -214,6 +214,8 @@ void app_main() {
         .storagepartitionname = "storage",
         /* 1 minute as a example, but in production you should pick something larger (remember, Github has ratelimites on the API! )*/
         .updateInterval = 1,
+        /* spread the downloads of a fleet over CONFIG_GHOTA_DOWNLOAD_WINDOW */
+        .downloadWindow = GHOTA_DOWNLOAD_WINDOW_DEFAULT,
     };
     /* initialize ghota. */
     ghota_client_handle_t *ghota_client = ghota_init(&ghconfig);
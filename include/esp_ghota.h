@@ -30,14 +30,17 @@ ghota_client_handle_t *ghota_init(ghota_config_t *config);
  * @param handle the handle returned by ghota_init
  * @param username the username to authenticate with
  * @param password this Github Personal Access Token
- * @return esp_err_t ESP_OK if all is good, ESP_FAIL if there is an error
+ * @return esp_err_t ESP_OK if all is good, ESP_ERR_INVALID_STATE while a check or update of the handle runs,
+ * ESP_ERR_NO_MEM if there is an error
  */
 esp_err_t ghota_set_auth(ghota_client_handle_t *handle, const char *username, const char *password);
 /**
  * @brief Free the ghota client handle and all resources
  * 
+ * Stops the update timer of the handle. 
+ * 
  * @param handle the Handle
- * @return esp_err_t if there was a error
+ * @return esp_err_t ESP_ERR_INVALID_STATE while a check or update of the handle runs
  */
 esp_err_t ghota_free(ghota_client_handle_t *handle);
 
@@ -47,8 +50,11 @@ esp_err_t ghota_free(ghota_client_handle_t *handle);
  * This will just check if there is a available update on Github releases with download resources that match your configuration
  * for firmware and storage files. If it returns ESP_OK, you can call ghota_get_latest_version to get the version of the latest release
  * 
+ * Each handle runs one check or update at a time, different handles run independently.
+ * 
  * @param handle the ghota_client_handle_t handle
- * @return esp_err_t ESP_OK if there is a update available, ESP_FAIL if there is no update available or an error
+ * @return esp_err_t ESP_OK if there is a update available, ESP_FAIL if there is no update available or an error,
+ * ESP_ERR_INVALID_STATE if the handle is busy
  */
 esp_err_t ghota_check(ghota_client_handle_t *handle);
 
@@ -58,10 +64,30 @@ esp_err_t ghota_check(ghota_client_handle_t *handle);
  * You should only call this after calling ghota_check and ensuring that there is a update available. 
  * 
  * @param handle the ghota_client_handle_t handle
- * @return esp_err_t ESP_FAIL if there is a error. If the Update is successful, it will not return, but reboot the device
+ * @return esp_err_t ESP_FAIL if there is a error, ESP_ERR_INVALID_STATE if the handle is busy. If the Update is successful,
+ * it will not return, but reboot the device
  */
 esp_err_t ghota_update(ghota_client_handle_t *handle);
 
+/**
+ * @brief Downloads and writes only the storage partition of the latest release
+ * 
+ * @param handle the ghota_client_handle_t handle
+ * @return esp_err_t ESP_OK if the storage partition is up to date, ESP_ERR_INVALID_STATE if the handle is busy
+ */
+esp_err_t ghota_storage_update(ghota_client_handle_t *handle);
+
+/**
+ * @brief Get what the client is doing
+ * 
+ * Does not block and can be called from any task, also while a check or download of this
+ * or another handle runs.
+ * 
+ * @param handle the ghota_client_handle_t handle
+ * @return ghota_phase_t the phase of the handle
+ */
+ghota_phase_t ghota_get_phase(ghota_client_handle_t *handle);
+
 /**
  * @brief Get the currently running version of the firmware
  * 
@@ -98,14 +124,66 @@ esp_err_t ghota_start_update_task(ghota_client_handle_t *handle);
 /**
  * @brief Install a Timer to automatically check for new updates and update if available
  * 
- * Install a timer that will check for new updates every updateInterval seconds and update if available.
+ * Install a timer that will check for new updates every updateInterval minutes (or updateIntervalSeconds)
+ * and update if available. The timer only wakes up for the next check, or once a day on the way to it.
  * 
  * @param handle ghota_client_handle_t handle
- * @return esp_err_t ESP_OK if no error, otherwise ESP_FAIL
+ * @return esp_err_t ESP_OK if no error, ESP_ERR_INVALID_STATE if the timer is already started,
+ * ESP_ERR_INVALID_ARG if no interval is configured, otherwise ESP_FAIL
  */
 
 esp_err_t ghota_start_update_timer(ghota_client_handle_t *handle);
 
+/**
+ * @brief Stop the Timer installed with ghota_start_update_timer
+ * 
+ * A check that is already running is not interrupted, a timer callback that is running is waited for.
+ * ghota_free stops the timer as well.
+ * 
+ * @param handle ghota_client_handle_t handle
+ * @return esp_err_t ESP_OK if no error, ESP_ERR_INVALID_STATE if the timer is not started
+ */
+esp_err_t ghota_stop_update_timer(ghota_client_handle_t *handle);
+
+/**
+ * @brief Move the next check of the update Timer
+ * 
+ * The check after it is scheduled as usual.
+ * 
+ * @param handle ghota_client_handle_t handle
+ * @param delay seconds from now, 0 to check right away
+ * @return esp_err_t ESP_OK if no error, ESP_ERR_INVALID_STATE if the timer is not started
+ */
+esp_err_t ghota_reschedule_update_timer(ghota_client_handle_t *handle, uint32_t delay);
+
+/**
+ * @brief Get the connection statistics of the client
+ * 
+ * The check, the firmware and the storage download share keep-alive connections per host.
+ * requests - handshakes is the number of TLS handshakes that were avoided.
+ * With CONFIG_GHOTA_TLS_SESSION_RESUMPTION, offered counts the handshakes that offered
+ * the session ticket of an earlier connection. ESP-TLS does not tell whether the server
+ * accepted it, handshakes - offered is the least number of full handshakes.
+ * 
+ * @param handle ghota_client_handle_t handle
+ * @param stats [out] the statistics since ghota_init
+ * @return esp_err_t ESP_OK if no error, ESP_ERR_INVALID_ARG if handle or stats is NULL
+ */
+esp_err_t ghota_get_connection_stats(ghota_client_handle_t *handle, ghota_connection_stats_t *stats);
+
+/**
+ * @brief Get the schedule of the next check
+ * 
+ * After each check, the update timer is set to updateInterval, to the reset of a nearly used up
+ * or exceeded rate limit, or to an exponential backoff with jitter after failures. The same
+ * schedule is posted with GHOTA_EVENT_CHECK_SCHEDULED.
+ * 
+ * @param handle ghota_client_handle_t handle
+ * @param schedule [out] the schedule decided after the last check
+ * @return esp_err_t ESP_OK if no error, ESP_ERR_INVALID_ARG if handle or schedule is NULL
+ */
+esp_err_t ghota_get_schedule(ghota_client_handle_t *handle, ghota_schedule_t *schedule);
+
 #ifdef __cplusplus
 }
 #endif
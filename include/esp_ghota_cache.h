@@ -0,0 +1,85 @@
+#ifndef GITHUB_OTA_CACHE_H
+#define GITHUB_OTA_CACHE_H
+
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "esp_ghota_client.h"
+#include "interface/ghota_interface.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Release check result persisted in NVS together with its HTTP validators
+     */
+    typedef struct ghota_release_cache ghota_release_cache_t;
+
+    /**
+     * @brief Load the cached release for a release url
+     *
+     * The entry is only returned if it was stored for the same url and asset patterns.
+     *
+     * @param handle the ghota_client_handle_t handle
+     * @param url the release url the entry was stored for
+     * @param validators [out] validators to send with the next request
+     * @return ghota_release_cache_t* the cached entry, NULL if there is none. Free with ghota_cache_free
+     */
+    ghota_release_cache_t *ghota_cache_load(
+        ghota_client_handle_t *handle,
+        const char *url,
+        ghota_release_validators_t *validators);
+
+    /**
+     * @brief Restore the release check result from a cached entry
+     *
+     * @param handle the ghota_client_handle_t handle
+     * @param cache entry returned by ghota_cache_load
+     */
+    void ghota_cache_apply(
+        ghota_client_handle_t *handle,
+        const ghota_release_cache_t *cache);
+
+    /**
+     * @brief Store the current release check result and its validators
+     *
+     * @param handle the ghota_client_handle_t handle
+     * @param url the release url the result was fetched from
+     * @param validators validators of the response
+     * @return esp_err_t ESP_OK on success
+     */
+    esp_err_t ghota_cache_store(
+        ghota_client_handle_t *handle,
+        const char *url,
+        const ghota_release_validators_t *validators);
+
+    void ghota_cache_free(
+        ghota_release_cache_t *cache);
+
+    /**
+     * @brief Check if the content with digest is what was last installed to partition
+     *
+     * @param partition the partition the content has to be in
+     * @param digest hex SHA-256 of the release asset
+     * @return true if the asset does not need to be installed again
+     */
+    bool ghota_cache_is_installed(
+        const esp_partition_t *partition,
+        const char *digest);
+
+    /**
+     * @brief Record the digest of the content installed to partition
+     *
+     * An empty digest removes the record.
+     */
+    esp_err_t ghota_cache_set_installed(
+        const esp_partition_t *partition,
+        const char *digest);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GITHUB_OTA_CACHE_H
@@ -4,18 +4,82 @@
 #include "semver.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/timers.h"
 #include "esp_partition.h"
 #include "esp_ghota_config.h"
+#include "esp_ghota_decompress.h"
 
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
+/* hex SHA-256 digest and its terminator */
+#define GHOTA_SHA256_HEX_LEN 65
+/* end of a part of the release notes kept to find a "rollout: N%" line split across two parts */
+#define GHOTA_NOTES_TAIL_LEN 16
+
     typedef struct
         ghota_client_handle
             ghota_client_handle_t;
 
+    /**
+     * @brief Connection statistics of a client handle
+     *
+     * Every request that did not need a new connection saved a TLS handshake.
+     */
+    typedef struct
+    {
+        uint32_t requests;   /*!< HTTP requests sent, including redirects */
+        uint32_t handshakes; /*!< New connections opened */
+        uint32_t offered;    /*!< New connections that offered a saved TLS session ticket, the server may still have refused it */
+    } ghota_connection_stats_t;
+
+    /**
+     * @brief Rate limit reported by the release server
+     */
+    typedef struct
+    {
+        int32_t remaining;    /*!< x-ratelimit-remaining of the last response, -1 if unknown */
+        uint32_t reset;       /*!< x-ratelimit-reset, unix time the limit resets at, 0 if unknown */
+        uint32_t retry_after; /*!< Retry-After of the last response in seconds, 0 if none */
+        bool limited;         /*!< The last check was refused with 403 or 429 */
+    } ghota_rate_limit_t;
+
+    /**
+     * @brief Why the next check was scheduled when it is
+     */
+    typedef enum
+    {
+        GHOTA_SCHEDULE_INTERVAL = 0,  /*!< the configured updateInterval */
+        GHOTA_SCHEDULE_STRETCHED,     /*!< after the rate limit resets, because it is nearly used up */
+        GHOTA_SCHEDULE_RATE_LIMITED,  /*!< after Retry-After or the rate limit reset, the last check was refused */
+        GHOTA_SCHEDULE_BACKOFF,       /*!< exponential backoff after failed checks */
+    } ghota_schedule_reason_t;
+
+    /**
+     * @brief Time of the next check, decided after each check
+     */
+    typedef struct
+    {
+        uint32_t delay;                 /*!< Seconds from the last check to the next one */
+        ghota_schedule_reason_t reason; /*!< Why */
+        uint32_t failures;              /*!< Failed checks in a row */
+        int32_t remaining;              /*!< Requests left in the rate limit window, -1 if unknown */
+    } ghota_schedule_t;
+
+    /**
+     * @brief What a client handle is doing
+     */
+    typedef enum
+    {
+        GHOTA_PHASE_IDLE,           /*!< ready for a check or an update */
+        GHOTA_PHASE_CHECKING,       /*!< asking for the latest release */
+        GHOTA_PHASE_DOWNLOADING,    /*!< downloading and writing the firmware or storage image */
+        GHOTA_PHASE_VERIFYING,      /*!< verifying the written image */
+        GHOTA_PHASE_PENDING_REBOOT, /*!< the new firmware is installed, the device restarts */
+    } ghota_phase_t;
+
     char *ghota_client_get_username(
         ghota_client_handle_t *handle);
 
@@ -32,19 +96,19 @@ extern "C"
 
     void ghota_client_set_result_flag(
         ghota_client_handle_t *handle,
-        uint8_t flag);
+        uint16_t flag);
 
     void ghota_client_set_result_flags(
         ghota_client_handle_t *handle,
-        uint8_t value);
+        uint16_t value);
 
-    uint8_t ghota_client_get_result_flag(
+    uint16_t ghota_client_get_result_flag(
         ghota_client_handle_t *handle,
-        uint8_t flag);
+        uint16_t flag);
 
     void ghota_client_clear_result_flag(
         ghota_client_handle_t *handle,
-        uint8_t flag);
+        uint16_t flag);
 
     char *ghota_client_get_result_tag_name(
         ghota_client_handle_t *handle);
@@ -74,6 +138,76 @@ extern "C"
         ghota_client_handle_t *handle,
         char *url);
 
+    uint32_t ghota_client_get_result_size(
+        ghota_client_handle_t *handle);
+
+    void ghota_client_set_result_size(
+        ghota_client_handle_t *handle,
+        uint32_t size);
+
+    uint32_t ghota_client_get_result_storage_size(
+        ghota_client_handle_t *handle);
+
+    void ghota_client_set_result_storage_size(
+        ghota_client_handle_t *handle,
+        uint32_t size);
+
+    char *ghota_client_get_result_digest(
+        ghota_client_handle_t *handle);
+
+    void ghota_client_set_result_digest(
+        ghota_client_handle_t *handle,
+        const char *digest);
+
+    char *ghota_client_get_result_storage_digest(
+        ghota_client_handle_t *handle);
+
+    void ghota_client_set_result_storage_digest(
+        ghota_client_handle_t *handle,
+        const char *digest);
+
+    char *ghota_client_get_result_storage_digest_url(
+        ghota_client_handle_t *handle);
+
+    void ghota_client_set_result_storage_digest_url(
+        ghota_client_handle_t *handle,
+        const char *url);
+
+    char *ghota_client_get_result_patch_url(
+        ghota_client_handle_t *handle);
+
+    void ghota_client_set_result_patch_url(
+        ghota_client_handle_t *handle,
+        const char *url);
+
+    uint32_t ghota_client_get_result_patch_size(
+        ghota_client_handle_t *handle);
+
+    void ghota_client_set_result_patch_size(
+        ghota_client_handle_t *handle,
+        uint32_t size);
+
+    ghota_compression_t ghota_client_get_result_compression(
+        ghota_client_handle_t *handle);
+
+    void ghota_client_set_result_compression(
+        ghota_client_handle_t *handle,
+        ghota_compression_t compression);
+
+    ghota_compression_t ghota_client_get_result_storage_compression(
+        ghota_client_handle_t *handle);
+
+    void ghota_client_set_result_storage_compression(
+        ghota_client_handle_t *handle,
+        ghota_compression_t compression);
+
+    uint8_t ghota_client_get_result_rollout(
+        ghota_client_handle_t *handle);
+
+    void ghota_client_set_result_rollout(
+        ghota_client_handle_t *handle,
+        uint8_t percent);
+
     size_t ghota_client_get_handle_size();
 
     ghota_config_t *ghota_client_get_config(
@@ -90,12 +224,22 @@ extern "C"
         ghota_client_handle_t *handle,
         semver_t curr_ver);
         
-    TaskHandle_t ghota_client_get_task_handle(
-        ghota_client_handle_t *client_handle);
+    /**
+     * @brief Phase of the handle, safe to read from any task
+     */
+    ghota_phase_t ghota_client_get_phase(
+        ghota_client_handle_t *handle);
 
-    void ghota_client_set_task_handle(
-        ghota_client_handle_t *client_handle,
-        TaskHandle_t task_handle);
+    void ghota_client_set_phase(
+        ghota_client_handle_t *handle,
+        ghota_phase_t phase);
+
+    /**
+     * @brief Move an idle handle to phase without blocking, returns the phase it found
+     */
+    ghota_phase_t ghota_client_claim_phase(
+        ghota_client_handle_t *handle,
+        ghota_phase_t phase);
 
     semver_t *ghota_client_get_latest_version(
         ghota_client_handle_t *handle);
@@ -118,6 +262,27 @@ extern "C"
         ghota_client_handle_t *handle,
         char *url);
 
+    uint32_t ghota_client_get_scratch_size(
+        ghota_client_handle_t *handle);
+
+    void ghota_client_set_scratch_size(
+        ghota_client_handle_t *handle,
+        uint32_t size);
+
+    char *ghota_client_get_scratch_digest(
+        ghota_client_handle_t *handle);
+
+    void ghota_client_set_scratch_digest(
+        ghota_client_handle_t *handle,
+        const char *digest);
+
+    char *ghota_client_get_scratch_notes(
+        ghota_client_handle_t *handle);
+
+    void ghota_client_set_scratch_notes(
+        ghota_client_handle_t *handle,
+        const char *notes);
+
     const esp_partition_t *ghota_client_get_storage_partition(
         ghota_client_handle_t *handle);
 
@@ -128,12 +293,67 @@ extern "C"
         ghota_client_handle_t *handle,
         const esp_partition_t *storage_partition);
 
-    uint32_t ghota_client_get_countdown(
+    void *ghota_client_get_interface_ctx(
+        ghota_client_handle_t *handle);
+
+    void ghota_client_set_interface_ctx(
+        ghota_client_handle_t *handle,
+        void *ctx);
+
+    ghota_connection_stats_t *ghota_client_get_connection_stats(
+        ghota_client_handle_t *handle);
+
+    ghota_rate_limit_t *ghota_client_get_rate_limit(
+        ghota_client_handle_t *handle);
+
+    ghota_schedule_t *ghota_client_get_schedule(
+        ghota_client_handle_t *handle);
+
+    TimerHandle_t ghota_client_get_timer(
+        ghota_client_handle_t *handle);
+
+    void ghota_client_set_timer(
+        ghota_client_handle_t *handle,
+        TimerHandle_t timer);
+
+    /**
+     * @brief Set the timer if the handle has none
+     *
+     * @return true if timer is now the timer of the handle
+     */
+    bool ghota_client_claim_timer(
+        ghota_client_handle_t *handle,
+        TimerHandle_t timer);
+
+    /**
+     * @brief The update task was started by the update timer
+     */
+    bool ghota_client_get_scheduled(
+        ghota_client_handle_t *handle);
+
+    void ghota_client_set_scheduled(
+        ghota_client_handle_t *handle,
+        bool scheduled);
+
+    /**
+     * @brief The download window of a release has passed, the next check downloads it at once
+     */
+    bool ghota_client_get_download_due(
+        ghota_client_handle_t *handle);
+
+    void ghota_client_set_download_due(
+        ghota_client_handle_t *handle,
+        bool download_due);
+
+    /**
+     * @brief Time of the next timer check, in esp_timer_get_time() microseconds
+     */
+    int64_t ghota_client_get_deadline(
         ghota_client_handle_t *handle);
 
-    uint32_t ghota_client_set_countdown(
+    void ghota_client_set_deadline(
         ghota_client_handle_t *handle,
-        uint32_t countdown);
+        int64_t deadline);
 
 #ifdef __cplusplus
 }
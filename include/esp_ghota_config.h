@@ -14,6 +14,11 @@ extern "C"
      */
     typedef struct ghota_interface ghota_interface_t;
 
+    /**
+     * @brief downloadWindow of CONFIG_GHOTA_DOWNLOAD_WINDOW
+     */
+#define GHOTA_DOWNLOAD_WINDOW_DEFAULT UINT32_MAX
+
     /**
      * @brief Github OTA Configuration
      */
@@ -22,10 +27,18 @@ extern "C"
         char filenamematch[CONFIG_MAX_FILENAME_LEN];    /*!< Filename to match against on Github indicating this is a firmware file */
         char storagenamematch[CONFIG_MAX_FILENAME_LEN]; /*!< Filename to match against on Github indicating this is a storage file */
         char storagepartitionname[17];                  /*!< Name of the storage partition to update */
+        char patchnamematch[CONFIG_MAX_FILENAME_LEN];   /*!< Filename to match against on Github indicating this is a firmware patch file, named "<prefix>-<base version>-to-<version>.patch". Empty to always download the full image */
         char *hostname;                                 /*!< Hostname of the Github server. Defaults to api.github.com*/
         char *orgname;                                  /*!< Name of the Github organization */
         char *reponame;                                 /*!< Name of the Github repository */
+        char *manifesturl;                              /*!< Url of a release manifest on any HTTP server, used instead of the Github API. Defaults to CONFIG_GHOTA_MANIFEST_URL, empty for Github */
+        char variant[CONFIG_MAX_FILENAME_LEN];          /*!< Variant of this device in the release manifest. Defaults to CONFIG_GHOTA_MANIFEST_VARIANT or the chip target */
+        char *probeurl;                                 /*!< Latest release page that redirects to the latest tag, "{host}", "{org}" and "{repo}" are replaced. Defaults to CONFIG_GHOTA_PROBE_URL with the api.github.com hostname, empty to always ask the API */
         uint32_t updateInterval;                        /*!< Interval in Minutes to check for updates if using the ghota_start_update_timer function */
+        uint32_t updateIntervalSeconds;                 /*!< Interval in Seconds, used instead of updateInterval if set. For short intervals while testing */
+        char *deviceid;                                 /*!< Stable identity of this device, used to spread the checks of a fleet. Defaults to the base MAC address */
+        uint32_t checkSpread;                           /*!< Minutes the first timer check of a fleet is spread over, at an offset derived from deviceid. 0 for updateInterval */
+        uint32_t downloadWindow;                        /*!< Seconds at most, chosen at random, until the update timer checks a release it found again and downloads it. 0 to download at once, GHOTA_DOWNLOAD_WINDOW_DEFAULT for CONFIG_GHOTA_DOWNLOAD_WINDOW */
         ghota_interface_t *interface;                   /*!< Execution interface that uses a specific communication layer (Wi-Fi, GSM, etc) */
     } ghota_config_t;
 
@@ -0,0 +1,116 @@
+#ifndef GITHUB_OTA_DECOMPRESS_H
+#define GITHUB_OTA_DECOMPRESS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Compression of a release asset, selected by the suffix of its name
+     */
+    typedef enum
+    {
+        GHOTA_COMPRESSION_NONE = 0,    /*!< raw image */
+        GHOTA_COMPRESSION_GZIP,        /*!< ".gz", needs a 32 KB window and the 11 KB inflate state */
+        GHOTA_COMPRESSION_HEATSHRINK,  /*!< ".hs", window and lookahead from CONFIG_GHOTA_HEATSHRINK_WINDOW / _LOOKAHEAD */
+        GHOTA_COMPRESSION_UNSUPPORTED, /*!< a compressed asset this build cannot decompress, such as ".xz" */
+    } ghota_compression_t;
+
+    /**
+     * @brief Streaming decompressor between the download and the writer
+     *
+     * Memory is bounded by the window of the format, the input is not buffered. The
+     * decompressed data is passed to a callback as it is produced.
+     */
+    typedef struct ghota_decompress ghota_decompress_t;
+
+    /**
+     * @brief Append len bytes to the decompressed image
+     */
+    typedef esp_err_t (*ghota_decompress_write_t)(
+        void *ctx,
+        const void *data,
+        size_t len);
+
+    /**
+     * @brief Compression of an asset from the suffix of its name
+     */
+    ghota_compression_t ghota_compression_from_name(
+        const char *name);
+
+    /**
+     * @brief Create a decompressor
+     *
+     * @param type GHOTA_COMPRESSION_GZIP or GHOTA_COMPRESSION_HEATSHRINK
+     * @param write receives the decompressed data
+     * @param ctx passed to write
+     * @return ghota_decompress_t* the decompressor, NULL if out of memory or the type is not supported
+     */
+    ghota_decompress_t *ghota_decompress_create(
+        ghota_compression_t type,
+        ghota_decompress_write_t write,
+        void *ctx);
+
+    /**
+     * @brief Compute the SHA-256 of the compressed input, as published for the asset
+     *
+     * Call before the first ghota_decompress_feed.
+     */
+    esp_err_t ghota_decompress_set_sha256(
+        ghota_decompress_t *dec,
+        bool enable);
+
+    /**
+     * @brief SHA-256 of the compressed input
+     *
+     * @return const uint8_t* 32 bytes, NULL if not enabled or not finished
+     */
+    const uint8_t *ghota_decompress_get_sha256(
+        ghota_decompress_t *dec);
+
+    /**
+     * @brief Decompress the next chunk of the asset
+     *
+     * @return esp_err_t ESP_OK, ESP_ERR_INVALID_VERSION for a foreign header,
+     * ESP_ERR_INVALID_STATE for corrupt data, or the error of the callback
+     */
+    esp_err_t ghota_decompress_feed(
+        ghota_decompress_t *dec,
+        const void *data,
+        size_t len);
+
+    /**
+     * @brief Check that the whole stream was decompressed
+     *
+     * @return esp_err_t ESP_OK if the stream is complete, ESP_ERR_INVALID_CRC if the
+     * gzip trailer does not match the data
+     */
+    esp_err_t ghota_decompress_finish(
+        ghota_decompress_t *dec);
+
+    /**
+     * @brief Number of compressed bytes fed so far
+     */
+    uint32_t ghota_decompress_get_in(
+        ghota_decompress_t *dec);
+
+    /**
+     * @brief Number of decompressed bytes written so far
+     */
+    uint32_t ghota_decompress_get_out(
+        ghota_decompress_t *dec);
+
+    void ghota_decompress_free(
+        ghota_decompress_t *dec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GITHUB_OTA_DECOMPRESS_H
@@ -28,6 +28,7 @@ extern "C"
         GHOTA_EVENT_FIRMWARE_UPDATE_PROGRESS = 0x200, /*!< Github OTA firmware update progress */
         GHOTA_EVENT_STORAGE_UPDATE_PROGRESS = 0x400,  /*!< Github OTA storage update progress */
         GHOTA_EVENT_PENDING_REBOOT = 0x800,           /*!< Github OTA pending reboot */
+        GHOTA_EVENT_CHECK_SCHEDULED = 0x1000,         /*!< Github OTA next check scheduled, the event data is a ghota_schedule_t */
     } ghota_event_e;
 
     /**
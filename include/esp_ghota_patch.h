@@ -0,0 +1,110 @@
+#ifndef GITHUB_OTA_PATCH_H
+#define GITHUB_OTA_PATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define GHOTA_PATCH_MAGIC "GHP1"
+
+    /**
+     * @brief Streaming decoder of a delta patch
+     *
+     * A patch rebuilds the target image from the running (source) image. All numbers
+     * are little endian:
+     *
+     * - header: "GHP1", uint32 source size, uint32 target size, SHA-256 of the target image
+     * - 0x01 COPY: uint32 source offset, uint32 length, copied from the source image
+     * - 0x02 INSERT: uint32 length, followed by length bytes of new data
+     * - 0x00 END
+     *
+     * The decoder has no knowledge of flash or HTTP, the source is read and the target
+     * written through callbacks. Patches are created with tools/ghota_mkpatch.py.
+     */
+    typedef struct ghota_patch ghota_patch_t;
+
+    /**
+     * @brief Read len bytes of the source image at offset
+     */
+    typedef esp_err_t (*ghota_patch_read_t)(
+        void *ctx,
+        uint32_t offset,
+        void *data,
+        size_t len);
+
+    /**
+     * @brief Append len bytes to the target image
+     */
+    typedef esp_err_t (*ghota_patch_write_t)(
+        void *ctx,
+        const void *data,
+        size_t len);
+
+    /**
+     * @brief Create a patch decoder
+     *
+     * @param source_size size of the source image available to read, COPY operations beyond it fail
+     * @param read reads the source image
+     * @param write writes the target image
+     * @param ctx passed to read and write
+     * @return ghota_patch_t* the decoder or NULL if out of memory
+     */
+    ghota_patch_t *ghota_patch_create(
+        uint32_t source_size,
+        ghota_patch_read_t read,
+        ghota_patch_write_t write,
+        void *ctx);
+
+    /**
+     * @brief Decode the next chunk of the patch
+     *
+     * @return esp_err_t ESP_OK, ESP_ERR_INVALID_VERSION for a foreign header,
+     * ESP_ERR_INVALID_SIZE / ESP_ERR_INVALID_STATE for a malformed patch, or the
+     * error of a callback
+     */
+    esp_err_t ghota_patch_feed(
+        ghota_patch_t *patch,
+        const void *data,
+        size_t len);
+
+    /**
+     * @brief Check that the whole patch was decoded
+     *
+     * @return esp_err_t ESP_OK if the END operation was reached and the target has the size of the header
+     */
+    esp_err_t ghota_patch_finish(
+        ghota_patch_t *patch);
+
+    /**
+     * @brief Number of patch bytes decoded so far
+     */
+    uint32_t ghota_patch_get_received(
+        ghota_patch_t *patch);
+
+    /**
+     * @brief Number of target bytes written so far
+     */
+    uint32_t ghota_patch_get_written(
+        ghota_patch_t *patch);
+
+    /**
+     * @brief SHA-256 of the target image from the header
+     *
+     * @return const uint8_t* 32 bytes, NULL until the header was decoded
+     */
+    const uint8_t *ghota_patch_get_target_sha256(
+        ghota_patch_t *patch);
+
+    void ghota_patch_free(
+        ghota_patch_t *patch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GITHUB_OTA_PATCH_H
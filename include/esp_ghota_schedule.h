@@ -0,0 +1,68 @@
+#ifndef GITHUB_OTA_SCHEDULE_H
+#define GITHUB_OTA_SCHEDULE_H
+
+#include <stdbool.h>
+#include "esp_ghota_client.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Decide when to check next
+     *
+     * A refused check waits for Retry-After or the rate limit reset, a nearly used up
+     * rate limit stretches the interval to its reset, and failed checks back off
+     * exponentially up to the interval. Random jitter keeps devices behind one address
+     * from checking together.
+     *
+     * @param schedule [in,out] the schedule of the last check, updated for the next one
+     * @param rate_limit the rate limit reported by the last response
+     * @param interval the configured interval in seconds
+     * @param failed the release server could not be reached or answered with an error
+     */
+    void ghota_schedule_next(
+        ghota_schedule_t *schedule,
+        const ghota_rate_limit_t *rate_limit,
+        uint32_t interval,
+        bool failed);
+
+    /**
+     * @brief Stable hash of the device identity, the same on every boot
+     */
+    uint32_t ghota_schedule_device_hash(
+        const char *deviceid);
+
+    /**
+     * @brief Offset of this device in [0, spread), derived from its identity
+     *
+     * Devices that boot together still check at different times, and each device
+     * keeps its offset across reboots.
+     */
+    uint32_t ghota_schedule_phase(
+        const char *deviceid,
+        uint32_t spread);
+
+    /**
+     * @brief Rollout cohort of this device for a release, in [0, 100)
+     *
+     * The device takes part in a rollout to N percent if its cohort is below N, so it
+     * stays in as the percentage grows. Salting with the release keeps the same devices
+     * from going first every time.
+     */
+    uint32_t ghota_schedule_cohort(
+        const char *deviceid,
+        const char *release);
+
+    /**
+     * @brief Random delay in [0, window) before a download starts
+     */
+    uint32_t ghota_schedule_download_delay(
+        uint32_t window);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GITHUB_OTA_SCHEDULE_H
@@ -0,0 +1,144 @@
+#ifndef GITHUB_OTA_WRITER_H
+#define GITHUB_OTA_WRITER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Sequential writer of a downloaded asset to a partition
+     *
+     * Data is collected into whole sectors. Each sector is erased and written in one
+     * call once it is complete, the tail is written by ghota_writer_finish. With
+     * CONFIG_GHOTA_RESUME_DOWNLOADS, the writer keeps a journal in NVS with the asset
+     * identity, its ETag and the last sector aligned offset committed to flash, so an
+     * interrupted download can continue from there, also after a reboot.
+     */
+    typedef struct ghota_writer ghota_writer_t;
+
+    /**
+     * @brief Create a writer and load the journal of the partition
+     *
+     * @param partition the partition to write to
+     * @param url url of the asset, identifies it in the journal
+     * @param size size of the asset from the release, 0 if unknown
+     * @return ghota_writer_t* the writer or NULL if out of memory
+     */
+    ghota_writer_t *ghota_writer_open(
+        const esp_partition_t *partition,
+        const char *url,
+        uint32_t size);
+
+    /**
+     * @brief Only erase and write sectors whose content differs from the flash
+     *
+     * Each complete sector is compared with the flash it replaces by reading it back,
+     * unchanged sectors are skipped. Disables erasing ahead of the write position.
+     * Call before ghota_writer_begin.
+     */
+    void ghota_writer_set_diff(
+        ghota_writer_t *writer,
+        bool enable);
+
+    /**
+     * @brief Keep a journal to resume an interrupted download
+     *
+     * Enabled by default with CONFIG_GHOTA_RESUME_DOWNLOADS. Disable it when the
+     * downloaded data is transformed before it is written, as the written offset is
+     * no offset into the download then. Call before ghota_writer_begin.
+     */
+    void ghota_writer_set_journal(
+        ghota_writer_t *writer,
+        bool enable);
+
+    /**
+     * @brief Compute the SHA-256 of the asset while it is written
+     *
+     * The digest covers exactly the bytes of the asset. For a resumed download, the
+     * part already in flash is read back once by ghota_writer_begin.
+     * Call before ghota_writer_begin.
+     */
+    esp_err_t ghota_writer_set_sha256(
+        ghota_writer_t *writer,
+        bool enable);
+
+    /**
+     * @brief SHA-256 of the asset
+     *
+     * @return const uint8_t* 32 bytes, NULL if not enabled or the asset is not finished
+     */
+    const uint8_t *ghota_writer_get_sha256(
+        ghota_writer_t *writer);
+
+    /**
+     * @brief Number of sectors skipped by the differential writer
+     */
+    uint32_t ghota_writer_get_skipped(
+        ghota_writer_t *writer);
+
+    /**
+     * @brief Offset an interrupted download of the same asset can continue from
+     *
+     * @return uint32_t sector aligned offset, 0 if there is nothing to resume
+     */
+    uint32_t ghota_writer_get_resume_offset(
+        ghota_writer_t *writer);
+
+    /**
+     * @brief ETag of the interrupted download, to send as If-Range
+     *
+     * @return const char* the ETag, empty if unknown
+     */
+    const char *ghota_writer_get_etag(
+        ghota_writer_t *writer);
+
+    /**
+     * @brief Start writing at offset
+     *
+     * @param writer the writer
+     * @param offset 0 or the value of ghota_writer_get_resume_offset
+     * @param etag ETag of the response the data comes from, may be NULL
+     * @return esp_err_t ESP_OK on success
+     */
+    esp_err_t ghota_writer_begin(
+        ghota_writer_t *writer,
+        uint32_t offset,
+        const char *etag);
+
+    /**
+     * @brief Write the next chunk of the asset
+     */
+    esp_err_t ghota_writer_write(
+        ghota_writer_t *writer,
+        const void *data,
+        size_t len);
+
+    /**
+     * @brief Number of bytes of the asset written so far, including the resumed part
+     */
+    uint32_t ghota_writer_get_offset(
+        ghota_writer_t *writer);
+
+    /**
+     * @brief Write the buffered tail, complete the asset and remove its journal
+     */
+    esp_err_t ghota_writer_finish(
+        ghota_writer_t *writer);
+
+    /**
+     * @brief Free the writer. The journal is kept if the asset was not finished
+     */
+    void ghota_writer_close(
+        ghota_writer_t *writer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GITHUB_OTA_WRITER_H
@@ -0,0 +1,155 @@
+#ifndef GITHUB_OTA_HTTP_POOL_H
+#define GITHUB_OTA_HTTP_POOL_H
+
+#include <esp_http_client.h>
+#include "interface/ghota_interface.h"
+#include "esp_ghota_decompress.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Keep-alive HTTP connections of a client handle, one per host
+     */
+    typedef struct ghota_http_pool ghota_http_pool_t;
+
+    /**
+     * @brief A single request made through the pool
+     */
+    typedef struct
+    {
+        const char *url;                        /*!< Url to request, redirects are followed across hosts */
+        const char *accept;                     /*!< Accept header or NULL */
+        const char *accept_encoding;            /*!< Accept-Encoding header or NULL. Encodings other than gzip cannot be decoded */
+        bool authenticate;                      /*!< Send the handle credentials, only to the host of url */
+        ghota_release_validators_t *validators; /*!< Conditional request headers in, response validators out. May be NULL */
+        uint32_t range_start;                   /*!< Request the body from this offset on (206 response), 0 for the whole body */
+        const char *if_range;                   /*!< ETag the range is only valid for, the server sends the whole body (200) if it changed. May be NULL */
+        bool head;                              /*!< Send a HEAD request, the response has no body */
+        const char *post_data;                  /*!< Send a POST request with this body, NULL for GET */
+        const char *content_type;               /*!< Content-Type of post_data */
+        char *location;                         /*!< If set, redirects are not followed and the Location of a redirect is copied here */
+        size_t location_len;                    /*!< Size of location */
+    } ghota_http_request_t;
+
+    ghota_http_pool_t *ghota_http_pool_create(
+        ghota_client_handle_t *handle);
+
+    /**
+     * @brief Close all connections and free the pool
+     */
+    void ghota_http_pool_destroy(
+        ghota_http_pool_t *pool);
+
+    /**
+     * @brief Close all connections but keep the pool
+     */
+    void ghota_http_pool_disconnect(
+        ghota_http_pool_t *pool);
+
+    /**
+     * @brief Send a request and fetch the final response headers
+     *
+     * An open connection to the same host is reused when available.
+     *
+     * @param pool the pool
+     * @param request the request to send
+     * @param client [out] client to read the response body from
+     * @param status_code [out] status code of the final response
+     * @return esp_err_t ESP_OK if a response was received. client must be passed to ghota_http_pool_release
+     */
+    esp_err_t ghota_http_pool_open(
+        ghota_http_pool_t *pool,
+        const ghota_http_request_t *request,
+        esp_http_client_handle_t *client,
+        int *status_code);
+
+    /**
+     * @brief Return a client to the pool after reading the response
+     *
+     * The connection is kept open only if the whole response body was read.
+     */
+    void ghota_http_pool_release(
+        ghota_http_pool_t *pool,
+        esp_http_client_handle_t client);
+
+/* returned by a body callback that needs no more data */
+#define GHOTA_HTTP_BODY_STOP 1
+
+    /**
+     * @brief Receives the decoded response body, chunk by chunk
+     *
+     * @return esp_err_t ESP_OK to continue, GHOTA_HTTP_BODY_STOP or an error to end the body
+     */
+    typedef esp_err_t (*ghota_http_body_cb_t)(
+        void *ctx,
+        const char *data,
+        size_t len);
+
+    /**
+     * @brief Decoding stage of a response body
+     *
+     * Reading the body removes the chunked transfer framing. Writing it undoes the
+     * Content-Encoding and passes the result to the callback. Reading and writing may
+     * run on different tasks, as long as the data is written in the order it was read.
+     */
+    typedef struct
+    {
+        esp_http_client_handle_t client;
+        ghota_decompress_t *dec;
+        ghota_http_body_cb_t cb;
+        void *ctx;
+        uint32_t received;
+    } ghota_http_body_t;
+
+    /**
+     * @brief Start decoding the body of a response opened with ghota_http_pool_open
+     *
+     * @return esp_err_t ESP_OK, ESP_ERR_NOT_SUPPORTED for a Content-Encoding other than
+     * gzip or identity, ESP_ERR_NO_MEM
+     */
+    esp_err_t ghota_http_body_begin(
+        ghota_http_body_t *body,
+        ghota_http_pool_t *pool,
+        esp_http_client_handle_t client,
+        ghota_http_body_cb_t cb,
+        void *ctx);
+
+    /**
+     * @brief Read the next part of the body as sent, without transfer framing
+     *
+     * @return int number of bytes read, 0 at the end of the body, negative on error
+     */
+    int ghota_http_body_read(
+        ghota_http_body_t *body,
+        char *buf,
+        size_t len);
+
+    /**
+     * @brief Decode data returned by ghota_http_body_read and pass it to the callback
+     *
+     * @return esp_err_t ESP_OK or the value of the callback that ended the body
+     */
+    esp_err_t ghota_http_body_write(
+        ghota_http_body_t *body,
+        const char *data,
+        size_t len);
+
+    /**
+     * @brief End the body
+     *
+     * @param body the body
+     * @param err the result of reading and writing it
+     * @return esp_err_t err, or an error if the encoded body is incomplete
+     */
+    esp_err_t ghota_http_body_end(
+        ghota_http_body_t *body,
+        esp_err_t err);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GITHUB_OTA_HTTP_POOL_H
@@ -10,19 +10,85 @@ extern "C"
 {
 #endif
 
+#define GHOTA_VALIDATOR_LEN 80
+
+    /**
+     * @brief HTTP cache validators exchanged with get_release_info
+     *
+     * On input, non empty values are sent as If-None-Match / If-Modified-Since.
+     * On output, they hold the ETag / Last-Modified headers of the response.
+     */
+    typedef struct
+    {
+        char etag[GHOTA_VALIDATOR_LEN];          /*!< ETag of the release response */
+        char last_modified[GHOTA_VALIDATOR_LEN]; /*!< Last-Modified of the release response */
+        bool not_modified;                       /*!< Set when the server answered 304 Not Modified, nothing was parsed */
+    } ghota_release_validators_t;
+
+    /**
+     * @brief Transport used by ghota to talk to the release server
+     *
+     * get_release_info must feed the response body to the JSON stream parser.
+     * Once the parser returns lwjsonSTREAMSTOP, all needed fields were found and the
+     * transport should stop receiving, close the connection and return ESP_OK.
+     * A 304 response sets validators->not_modified and returns ESP_OK without parsing.
+     *
+     * install_storage writes the storage asset to ghota_client_get_storage_partition(handle)
+     * and must fail if it does not match ghota_client_get_result_storage_digest(handle), or
+     * the digest published at ghota_client_get_result_storage_digest_url(handle).
+     *
+     * query_release_info is optional. It POSTs the GraphQL query, a JSON document, to url
+     * with the handle credentials and feeds the response body to the parser, like
+     * get_release_info.
+     *
+     * get_latest_tag is optional. It sends a HEAD request to url without following
+     * redirects, and copies the last path segment of the redirect location to tag.
+     *
+     * install_firmware_patch is optional. It applies the patch at
+     * ghota_client_get_result_patch_url(handle) to the running partition and writes the
+     * result to the next OTA partition, like install_firmware. If it fails, the full image
+     * is installed with install_firmware instead.
+     *
+     * A transport may keep connections open between calls, in its
+     * ghota_client_get_interface_ctx(handle) state. disconnect is called when a check
+     * or update run is over and should close them. cleanup is called from ghota_free
+     * and must release the state. Both are optional.
+     */
     typedef struct ghota_interface
     {
         esp_err_t (*get_release_info)(
-            ghota_client_handle_t *,  // handle
-            char *,                   // url
-            lwjson_stream_parser_t *  // JSON stream parser
+            ghota_client_handle_t *,     // handle
+            char *,                      // url
+            lwjson_stream_parser_t *,    // JSON stream parser
+            ghota_release_validators_t * // cache validators, in and out
+        );
+        esp_err_t (*query_release_info)(
+            ghota_client_handle_t *, // handle
+            const char *,            // url
+            const char *,            // query
+            lwjson_stream_parser_t * // JSON stream parser
+        );
+        esp_err_t (*get_latest_tag)(
+            ghota_client_handle_t *, // handle
+            const char *,            // url
+            char *,                  // tag, out
+            size_t                   // size of tag
         );
         esp_err_t (*install_firmware)(
             ghota_client_handle_t *   // handle
         );
+        esp_err_t (*install_firmware_patch)(
+            ghota_client_handle_t *   // handle
+        );
         esp_err_t (*install_storage)(
             ghota_client_handle_t *   // handle
         );
+        void (*disconnect)(
+            ghota_client_handle_t *   // handle
+        );
+        void (*cleanup)(
+            ghota_client_handle_t *   // handle
+        );
     } ghota_interface_t;
 
 #ifdef __cplusplus
@@ -1,20 +1,24 @@
 #include <stdlib.h>
+#include <stdatomic.h>
+#include <strings.h>
+#include <ctype.h>
 #include <fnmatch.h>
 #include <libgen.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/event_groups.h>
-#include <esp_http_client.h>
-#include <esp_tls.h>
-#include <esp_crt_bundle.h>
+#include <freertos/timers.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <esp_app_format.h>
 #include <esp_ota_ops.h>
-#include <esp_https_ota.h>
 
 #include "esp_ghota.h"
 #include "lwjson.h"
 #include "interface/ghota_interface.h"
+#include "interface/ghota_wifi_interface.h"
+#include "esp_ghota_cache.h"
+#include "esp_ghota_schedule.h"
 
 static const char *TAG = "GHOTA";
 
@@ -27,9 +31,111 @@ enum release_flags
     GHOTA_RELEASE_GOT_URL = 0x04,
     GHOTA_RELEASE_GOT_STORAGE = 0x08,
     GHOTA_RELEASE_VALID_ASSET = 0x10,
+    GHOTA_RELEASE_GOT_DIGEST = 0x20,
+    GHOTA_RELEASE_GOT_PATCH = 0x40,
+    GHOTA_RELEASE_VARIANT = 0x80, /* the assets being parsed are for this device */
+    GHOTA_RELEASE_GOT_ROLLOUT = 0x100, /* the rollout is final */
+    GHOTA_RELEASE_GOT_ASSETS = 0x200,  /* the whole asset list was read */
+    GHOTA_RELEASE_GOT_NOTES = 0x400,   /* the whole release notes were read */
 } release_flags;
 
-SemaphoreHandle_t ghota_lock = NULL;
+enum release_paths
+{
+    GHOTA_PATH_TAG_NAME,
+    GHOTA_PATH_ASSET,
+    GHOTA_PATH_ASSET_NAME,
+    GHOTA_PATH_ASSET_URL,
+    GHOTA_PATH_ASSET_SIZE,
+    GHOTA_PATH_ASSET_DIGEST,
+    GHOTA_PATH_ROLLOUT,
+    GHOTA_PATH_ASSETS,
+    GHOTA_PATH_ROOT,
+    GHOTA_PATH_GITHUB_MAX,
+    /* only in a release manifest */
+    GHOTA_PATH_VARIANT = GHOTA_PATH_GITHUB_MAX,
+    GHOTA_PATH_VARIANT_NAME,
+    GHOTA_PATH_MAX,
+};
+
+/* the rollout percentage was not seen (yet) */
+#define GHOTA_ROLLOUT_UNKNOWN 0xff
+
+/* JSON paths of the release object we are interested in, indexed by release_paths */
+static const char *release_path_exprs[GHOTA_PATH_GITHUB_MAX] = {
+    [GHOTA_PATH_TAG_NAME] = "tag_name",
+    [GHOTA_PATH_ASSET] = "assets[*]",
+    [GHOTA_PATH_ASSET_NAME] = "assets[*].name",
+    [GHOTA_PATH_ASSET_URL] = "assets[*].url",
+    [GHOTA_PATH_ASSET_SIZE] = "assets[*].size",
+    [GHOTA_PATH_ASSET_DIGEST] = "assets[*].digest",
+    [GHOTA_PATH_ROLLOUT] = "body",
+    [GHOTA_PATH_ASSETS] = "assets",
+    [GHOTA_PATH_ROOT] = "",
+};
+
+static lwjson_stream_path_t release_paths[GHOTA_PATH_GITHUB_MAX];
+
+/* the paths are compiled once, by the first ghota_init */
+enum
+{
+    GHOTA_PATHS_NONE,
+    GHOTA_PATHS_COMPILING,
+    GHOTA_PATHS_COMPILED,
+};
+static atomic_int release_paths_state = GHOTA_PATHS_NONE;
+
+/* the same fields in a release manifest:
+{
+    "version": "1.4.0",
+    "rollout": 25,
+    "variants": [
+        {
+            "name": "esp32s3",
+            "assets": [
+                {"name": "fw.bin", "url": "https://...", "size": 1024, "digest": "sha256:..."}
+            ]
+        }
+    ]
+}
+the name of a variant must come before its assets */
+static const char *manifest_path_exprs[GHOTA_PATH_MAX] = {
+    [GHOTA_PATH_TAG_NAME] = "version",
+    [GHOTA_PATH_ASSET] = "variants[*].assets[*]",
+    [GHOTA_PATH_ASSET_NAME] = "variants[*].assets[*].name",
+    [GHOTA_PATH_ASSET_URL] = "variants[*].assets[*].url",
+    [GHOTA_PATH_ASSET_SIZE] = "variants[*].assets[*].size",
+    [GHOTA_PATH_ASSET_DIGEST] = "variants[*].assets[*].digest",
+    [GHOTA_PATH_ROLLOUT] = "rollout",
+    [GHOTA_PATH_ASSETS] = "variants[*].assets",
+    [GHOTA_PATH_ROOT] = "",
+    [GHOTA_PATH_VARIANT] = "variants[*]",
+    [GHOTA_PATH_VARIANT_NAME] = "variants[*].name",
+};
+
+static lwjson_stream_path_t manifest_paths[GHOTA_PATH_MAX];
+
+#ifdef CONFIG_GHOTA_GRAPHQL
+/* the same fields in the reply to ghota_graphql_query */
+static const char *graphql_path_exprs[GHOTA_PATH_GITHUB_MAX] = {
+    [GHOTA_PATH_TAG_NAME] = "data.repository.latestRelease.tagName",
+    [GHOTA_PATH_ASSET] = "data.repository.latestRelease.releaseAssets.nodes[*]",
+    [GHOTA_PATH_ASSET_NAME] = "data.repository.latestRelease.releaseAssets.nodes[*].name",
+    [GHOTA_PATH_ASSET_URL] = "data.repository.latestRelease.releaseAssets.nodes[*].url",
+    [GHOTA_PATH_ASSET_SIZE] = "data.repository.latestRelease.releaseAssets.nodes[*].size",
+    [GHOTA_PATH_ASSET_DIGEST] = "data.repository.latestRelease.releaseAssets.nodes[*].digest",
+    [GHOTA_PATH_ROLLOUT] = "data.repository.latestRelease.description",
+    [GHOTA_PATH_ASSETS] = "data.repository.latestRelease.releaseAssets.nodes",
+    [GHOTA_PATH_ROOT] = "",
+};
+
+static lwjson_stream_path_t graphql_paths[GHOTA_PATH_GITHUB_MAX];
+
+/* asks only for the fields in graphql_path_exprs, owner, name and number of assets */
+static const char *ghota_graphql_query =
+    "{\"query\":\"query{repository(owner:\\\"%s\\\",name:\\\"%s\\\")"
+    "{latestRelease{tagName description releaseAssets(first:%d)"
+    "{nodes{name url size digest}}}}}\"}";
+#endif
 
 static void SetFlag(
     ghota_client_handle_t *handle,
@@ -54,18 +160,122 @@ static void ClearFlag(
         handle, flag);
 }
 
-ghota_client_handle_t *ghota_init(
-    ghota_config_t *newconfig)
+static bool ghota_compile_paths(
+    lwjson_stream_path_t *paths,
+    const char **exprs,
+    int count)
 {
-    if (!ghota_lock)
+    for (int i = 0; i < count; i++)
     {
-        ghota_lock = xSemaphoreCreateMutex();
+        if (lwjson_stream_path_compile(
+                &paths[i],
+                exprs[i]) != lwjsonOK)
+        {
+            ESP_LOGE(
+                TAG,
+                "Failed to compile JSON path %s",
+                exprs[i]);
+            return false;
+        }
     }
-    if (xSemaphoreTake(
-            ghota_lock,
-            pdMS_TO_TICKS(1000)) != pdPASS)
+    return true;
+}
+
+static bool ghota_compile_release_paths(void)
+{
+    int state = GHOTA_PATHS_NONE;
+    while (!atomic_compare_exchange_weak(
+        &release_paths_state,
+        &state,
+        GHOTA_PATHS_COMPILING))
+    {
+        if (state == GHOTA_PATHS_COMPILED)
+        {
+            return true;
+        }
+        /* another handle is being initialized */
+        state = GHOTA_PATHS_NONE;
+        vTaskDelay(1);
+    }
+    bool ok = ghota_compile_paths(
+                  release_paths,
+                  release_path_exprs,
+                  GHOTA_PATH_GITHUB_MAX) &&
+              ghota_compile_paths(
+                  manifest_paths,
+                  manifest_path_exprs,
+                  GHOTA_PATH_MAX);
+#ifdef CONFIG_GHOTA_GRAPHQL
+    ok = ok &&
+         ghota_compile_paths(
+             graphql_paths,
+             graphql_path_exprs,
+             GHOTA_PATH_GITHUB_MAX);
+#endif
+    atomic_store(
+        &release_paths_state,
+        ok ? GHOTA_PATHS_COMPILED : GHOTA_PATHS_NONE);
+    return ok;
+}
+
+/* move an idle handle to phase. Each handle runs one operation at a time.
+Never blocks, so the timer task can claim a handle too */
+static bool ghota_claim(
+    ghota_client_handle_t *handle,
+    ghota_phase_t phase)
+{
+    ghota_phase_t current =
+        ghota_client_claim_phase(handle, phase);
+    if (current != GHOTA_PHASE_IDLE)
+    {
+        ESP_LOGW(
+            TAG,
+            "Client is busy (phase %d)",
+            current);
+        return false;
+    }
+    return true;
+}
+
+static void ghota_release(
+    ghota_client_handle_t *handle)
+{
+    ghota_client_set_phase(handle, GHOTA_PHASE_IDLE);
+}
+
+static void ghota_free_resources(
+    ghota_client_handle_t *handle)
+{
+    ghota_config_t *config =
+        ghota_client_get_config(handle);
+    if (config->interface &&
+        config->interface->cleanup)
+    {
+        config->interface->cleanup(handle);
+    }
+    free(config->hostname);
+    free(config->orgname);
+    free(config->reponame);
+    free(config->probeurl);
+    free(config->manifesturl);
+    free(config->deviceid);
+
+    free(ghota_client_get_username(handle));
+    free(ghota_client_get_token(handle));
+
+    semver_free(
+        ghota_client_get_current_version(handle));
+    semver_free(
+        ghota_client_get_latest_version(handle));
+
+    free(handle);
+}
+
+ghota_client_handle_t *ghota_init(
+    ghota_config_t *newconfig)
+{
+    if (!ghota_compile_release_paths())
     {
-        ESP_LOGE(TAG, "Failed to take lock");
         return NULL;
     }
     ghota_client_handle_t *handle = malloc(
@@ -76,11 +286,17 @@ ghota_client_handle_t *ghota_init(
             TAG,
             "Failed to allocate memory "
             "for client handle");
-        xSemaphoreGive(ghota_lock);
         return NULL;
     }
     bzero(handle, ghota_client_get_handle_size());
+    ghota_client_get_rate_limit(handle)->remaining = -1;
+    ghota_client_get_schedule(handle)->remaining = -1;
     ghota_client_set_config(handle, newconfig);
+    ghota_config_t *config = ghota_client_get_config(handle);
+    if (config->interface == NULL)
+    {
+        config->interface = get_ghota_wifi_interface();
+    }
 #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
     const esp_app_desc_t *app_desc =
         esp_app_get_description();
@@ -94,16 +310,13 @@ ghota_client_handle_t *ghota_init(
         ESP_LOGE(
             TAG,
             "Failed to parse current version");
-        ghota_free(handle);
-        xSemaphoreGive(ghota_lock);
+        ghota_free_resources(handle);
         return NULL;
     }
     ghota_client_set_current_version(
         handle, curr_ver);
     ghota_client_set_result_flags(handle, 0);
-    ghota_client_set_task_handle(handle, NULL);
-
-    xSemaphoreGive(ghota_lock);
+    ghota_client_set_phase(handle, GHOTA_PHASE_IDLE);
 
     return handle;
 }
@@ -111,39 +324,21 @@ ghota_client_handle_t *ghota_init(
 esp_err_t ghota_free(
     ghota_client_handle_t *handle)
 {
-    if (xSemaphoreTake(
-            ghota_lock,
-            pdMS_TO_TICKS(1000)) != pdPASS)
+    if (handle == NULL)
     {
-        ESP_LOGE(TAG, "Failed to take lock");
-        return ESP_FAIL;
+        return ESP_ERR_INVALID_ARG;
     }
-
-    ghota_config_t *config =
-        ghota_client_get_config(handle);
-    free(config->hostname);
-    free(config->orgname);
-    free(config->reponame);
-
-    char *username =
-        ghota_client_get_username(handle);
-    char *token =
-        ghota_client_get_token(handle);
-
-    if (username)
-        free(username);
-    if (token)
-        free(token);
-
-    semver_t *curr_ver =
-        ghota_client_get_current_version(handle);
-    semver_t *latest_ver =
-        ghota_client_get_latest_version(handle);
-
-    semver_free(curr_ver);
-    semver_free(latest_ver);
-
-    xSemaphoreGive(ghota_lock);
+    /* keeps the handle busy for anyone still holding it, a busy handle keeps its timer */
+    if (!ghota_claim(handle, GHOTA_PHASE_CHECKING))
+    {
+        ESP_LOGE(TAG, "Cannot free a busy client");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (ghota_client_get_timer(handle))
+    {
+        ghota_stop_update_timer(handle);
+    }
+    ghota_free_resources(handle);
 
     return ESP_OK;
 }
@@ -153,20 +348,291 @@ esp_err_t ghota_set_auth(
     const char *username,
     const char *password)
 {
-    if (xSemaphoreTake(
-            ghota_lock,
-            pdMS_TO_TICKS(1000)) != pdPASS)
+    /* the credentials are in use while the handle is busy */
+    if (!ghota_claim(handle, GHOTA_PHASE_CHECKING))
     {
-        ESP_LOGE(TAG, "Failed to take lock");
-        return ESP_FAIL;
+        ESP_LOGE(TAG, "Cannot change the credentials of a busy client");
+        return ESP_ERR_INVALID_STATE;
+    }
+    free(ghota_client_get_username(handle));
+    free(ghota_client_get_token(handle));
+    int ret = ghota_client_set_username(handle, username);
+    if (ret >= 0)
+    {
+        ret = ghota_client_set_token(handle, password);
     }
+    ghota_release(handle);
 
-    ghota_client_set_username(handle, username);
-    ghota_client_set_token(handle, password);
+    return ret < 0 ? ESP_ERR_NO_MEM : ESP_OK;
+}
 
-    xSemaphoreGive(ghota_lock);
+/* a patch "<prefix>-<base version>-to-<version>.patch" only applies to the running base version */
+static bool ghota_is_patch_for_current(
+    ghota_client_handle_t *handle,
+    const char *name)
+{
+    char version[64] = {0};
+    semver_render(
+        ghota_client_get_current_version(handle),
+        version);
+    char base[sizeof(version) + sizeof("-v-to-")];
+    snprintf(base, sizeof(base), "-%s-to-", version);
+    if (strstr(name, base))
+    {
+        return true;
+    }
+    snprintf(base, sizeof(base), "-v%s-to-", version);
+    return strstr(name, base) != NULL;
+}
 
-    return ESP_OK;
+/* the rollout the release declares, it takes precedence over a line in the notes */
+static void ghota_set_rollout(
+    ghota_client_handle_t *handle,
+    unsigned long percent)
+{
+    ghota_client_set_result_rollout(
+        handle,
+        percent > 100 ? 100 : percent);
+    SetFlag(handle, GHOTA_RELEASE_GOT_ROLLOUT);
+    ESP_LOGD(
+        TAG,
+        "Release rolled out to %d%%",
+        ghota_client_get_result_rollout(handle));
+}
+
+/* the rollout is final once everything that can carry it was read.
+A release that declares none goes to every device */
+static void ghota_finish_rollout(
+    ghota_client_handle_t *handle)
+{
+    if (GetFlag(handle, GHOTA_RELEASE_GOT_ROLLOUT) ||
+        !GetFlag(handle, GHOTA_RELEASE_GOT_ASSETS))
+    {
+        return;
+    }
+#ifdef CONFIG_GHOTA_ROLLOUT_NOTES
+    if (!GetFlag(handle, GHOTA_RELEASE_GOT_NOTES))
+    {
+        return;
+    }
+#endif
+    if (ghota_client_get_result_rollout(handle) == GHOTA_ROLLOUT_UNKNOWN)
+    {
+        ghota_client_set_result_rollout(handle, 100);
+    }
+    SetFlag(handle, GHOTA_RELEASE_GOT_ROLLOUT);
+}
+
+static void ghota_match_asset(
+    ghota_client_handle_t *handle)
+{
+    ghota_config_t *config =
+        ghota_client_get_config(handle);
+    char *scratch_name =
+        ghota_client_get_scratch_name(handle);
+    char *scratch_url =
+        ghota_client_get_scratch_url(handle);
+    ghota_compression_t compression =
+        ghota_compression_from_name(scratch_name);
+
+    /* an empty "rollout-<N>" asset stages the release to N percent of the fleet */
+    if (strncmp(scratch_name, "rollout-", 8) == 0 &&
+        isdigit((unsigned char)scratch_name[8]))
+    {
+        ghota_set_rollout(
+            handle,
+            strtoul(&scratch_name[8], NULL, 10));
+        return;
+    }
+
+    ESP_LOGD(
+        TAG,
+        "Testing Firmware filenames %s -> "
+        "%s - Matching Filename against %s and %s",
+        scratch_name,
+        scratch_url,
+        config->filenamematch,
+        config->storagenamematch);
+    /* a "<storage asset>.sha256" sidecar carries the digest of the storage image */
+    char sidecar[CONFIG_MAX_FILENAME_LEN + sizeof(".sha256")];
+    snprintf(
+        sidecar,
+        sizeof(sidecar),
+        "%s.sha256",
+        config->storagenamematch);
+    if (strlen(config->storagenamematch) &&
+        fnmatch(sidecar, scratch_name, 0) == 0)
+    {
+        if (!strlen(ghota_client_get_result_storage_digest_url(handle)))
+        {
+            ghota_client_set_result_storage_digest_url(
+                handle, scratch_url);
+            ESP_LOGD(
+                TAG,
+                "Storage Digest Asset Found: %s - %s",
+                scratch_name,
+                scratch_url);
+        }
+        SetFlag(handle, GHOTA_RELEASE_GOT_DIGEST);
+    }
+    /* patches for other base versions are neither firmware nor storage images */
+    else if (strlen(config->patchnamematch) &&
+             fnmatch(config->patchnamematch, scratch_name, 0) == 0)
+    {
+        if (!GetFlag(handle, GHOTA_RELEASE_GOT_PATCH) &&
+            ghota_is_patch_for_current(handle, scratch_name))
+        {
+            ghota_client_set_result_patch_url(
+                handle, scratch_url);
+            ghota_client_set_result_patch_size(
+                handle,
+                ghota_client_get_scratch_size(handle));
+            ESP_LOGD(
+                TAG,
+                "Firmware Patch Found: %s - %s (%" PRIu32 " bytes)",
+                scratch_name,
+                scratch_url,
+                ghota_client_get_scratch_size(handle));
+            SetFlag(handle, GHOTA_RELEASE_GOT_PATCH);
+        }
+    }
+    else if (compression == GHOTA_COMPRESSION_UNSUPPORTED &&
+             (fnmatch(config->filenamematch, scratch_name, 0) == 0 ||
+              fnmatch(config->storagenamematch, scratch_name, 0) == 0))
+    {
+        ESP_LOGW(
+            TAG,
+            "Compression of asset %s is not supported, skipping",
+            scratch_name);
+    }
+    /* see if the filename matches */
+    else if (!GetFlag(handle, GHOTA_RELEASE_VALID_ASSET) &&
+             fnmatch(config->filenamematch, scratch_name, 0) == 0)
+    {
+        ghota_client_set_result_name(handle, scratch_name);
+        ghota_client_set_result_url(handle, scratch_url);
+        ghota_client_set_result_size(
+            handle,
+            ghota_client_get_scratch_size(handle));
+        ghota_client_set_result_digest(
+            handle,
+            ghota_client_get_scratch_digest(handle));
+        ghota_client_set_result_compression(handle, compression);
+        ESP_LOGD(
+            TAG,
+            "Valid Firmware Found: %s - %s (%" PRIu32 " bytes)",
+            ghota_client_get_result_name(handle),
+            ghota_client_get_result_url(handle),
+            ghota_client_get_result_size(handle));
+        SetFlag(handle, GHOTA_RELEASE_VALID_ASSET);
+    }
+    else if (!GetFlag(handle, GHOTA_RELEASE_GOT_STORAGE) &&
+             fnmatch(
+                 config->storagenamematch,
+                 scratch_name,
+                 0) == 0)
+    {
+        ghota_client_set_result_storage_url(
+            handle, scratch_url);
+        ghota_client_set_result_storage_size(
+            handle,
+            ghota_client_get_scratch_size(handle));
+        ghota_client_set_result_storage_compression(handle, compression);
+        if (strlen(ghota_client_get_scratch_digest(handle)))
+        {
+            ghota_client_set_result_storage_digest(
+                handle,
+                ghota_client_get_scratch_digest(handle));
+            SetFlag(handle, GHOTA_RELEASE_GOT_DIGEST);
+        }
+        ESP_LOGD(
+            TAG,
+            "Valid Storage Asset Found: %s - %s (%" PRIu32 " bytes)",
+            scratch_name,
+            ghota_client_get_result_storage_url(handle),
+            ghota_client_get_result_storage_size(handle));
+        SetFlag(handle, GHOTA_RELEASE_GOT_STORAGE);
+    }
+    else
+    {
+        ESP_LOGD(
+            TAG,
+            "Invalid Asset Found: %s",
+            scratch_name);
+    }
+}
+
+static bool ghota_release_complete(
+    ghota_client_handle_t *handle)
+{
+    ghota_config_t *config =
+        ghota_client_get_config(handle);
+    if (!GetFlag(handle, GHOTA_RELEASE_GOT_TAG) ||
+        !GetFlag(handle, GHOTA_RELEASE_VALID_ASSET))
+    {
+        return false;
+    }
+    /* a rollout marker may follow the asset we match, the rollout line is in the notes
+    after the assets and a manifest may put its rollout after the variants */
+    if (!GetFlag(handle, GHOTA_RELEASE_GOT_ROLLOUT))
+    {
+        return false;
+    }
+    /* a release without a patch for our version is only known once all assets are seen */
+    if (strlen(config->patchnamematch) &&
+        !GetFlag(handle, GHOTA_RELEASE_GOT_PATCH))
+    {
+        return false;
+    }
+    /* without a storage pattern there is no storage asset to wait for.
+    a storage asset without a digest field may still get a sidecar further down */
+    return (GetFlag(handle, GHOTA_RELEASE_GOT_STORAGE) &&
+            GetFlag(handle, GHOTA_RELEASE_GOT_DIGEST)) ||
+           !strlen(config->storagenamematch);
+}
+
+/* search a part of the release notes for a "rollout: N%" line. Notes longer than the
+string buffer arrive in parts, the end of each part is searched again with the next */
+static void ghota_scan_notes(
+    ghota_client_handle_t *handle,
+    lwjson_stream_parser_t *jsp)
+{
+    char text[GHOTA_NOTES_TAIL_LEN + LWJSON_CFG_STREAM_STRING_MAX_LEN + 1];
+    size_t len = strlcpy(
+        text,
+        ghota_client_get_scratch_notes(handle),
+        sizeof(text));
+    len += strlcpy(
+        &text[len],
+        jsp->data.str.buff,
+        sizeof(text) - len);
+    /* a line starting in the kept end is complete in the next part */
+    size_t end = len;
+    if (!jsp->data.str.is_last)
+    {
+        end = len > GHOTA_NOTES_TAIL_LEN - 1 ? len - (GHOTA_NOTES_TAIL_LEN - 1) : 0;
+    }
+    for (size_t i = 0; i < end; i++)
+    {
+        if (strncasecmp(&text[i], "rollout:", 8) == 0)
+        {
+            if (!GetFlag(handle, GHOTA_RELEASE_GOT_ROLLOUT))
+            {
+                unsigned long percent = strtoul(&text[i + 8], NULL, 10);
+                ghota_client_set_result_rollout(
+                    handle,
+                    percent > 100 ? 100 : percent);
+            }
+            SetFlag(handle, GHOTA_RELEASE_GOT_NOTES);
+            return;
+        }
+    }
+    if (jsp->data.str.is_last)
+    {
+        SetFlag(handle, GHOTA_RELEASE_GOT_NOTES);
+        return;
+    }
+    ghota_client_set_scratch_notes(handle, &text[end]);
 }
 
 static void lwjson_callback(
@@ -185,154 +651,434 @@ static void lwjson_callback(
 #ifdef DEBUG
     ESP_LOGI(
         TAG,
-        "Lwjson Called: %d %d %d %d",
-        jsp->stack_pos,
-        jsp->stack[jsp->stack_pos - 1].type,
-        type,
-        handle->result.flags);
-    if (jsp->stack[jsp->stack_pos - 1].type ==
-        LWJSON_STREAM_TYPE_KEY)
-    { /* We need key to be before */
-        ESP_LOGI(
-            TAG,
-            "Key: %s",
-            jsp->stack[jsp->stack_pos - 1].meta.name);
-    }
+        "Lwjson Called: %s %d",
+        jsp->paths[jsp->path_idx].path,
+        type);
 #endif
-    /* Get a value corresponsing to "tag_name" key */
-    if (!GetFlag(
-            handle,
-            GHOTA_RELEASE_GOT_TAG))
-    {
-        if (jsp->stack_pos >= 2 /* Number of stack entries must be high */
-            && jsp->stack[0].type ==
-                   LWJSON_STREAM_TYPE_OBJECT /* First must be object */
-            && jsp->stack[1].type ==
-                   LWJSON_STREAM_TYPE_KEY /* We need key to be before */
-            && strcasecmp(
-                   jsp->stack[1].meta.name,
-                   "tag_name") == 0)
+    /* The parser only reports values on the paths in release_paths */
+    switch (jsp->path_idx)
+    {
+    case GHOTA_PATH_TAG_NAME:
+        if (type == LWJSON_STREAM_TYPE_STRING &&
+            !GetFlag(handle, GHOTA_RELEASE_GOT_TAG))
         {
             ESP_LOGD(
                 TAG,
-                "Got '%s' with value '%s'",
-                jsp->stack[1].meta.name,
+                "Got 'tag_name' with value '%s'",
                 jsp->data.str.buff);
             ghota_client_set_result_tag_name(
                 handle,
                 jsp->data.str.buff);
             SetFlag(handle, GHOTA_RELEASE_GOT_TAG);
         }
-    }
-    if (!GetFlag(handle, GHOTA_RELEASE_VALID_ASSET) ||
-        !GetFlag(handle, GHOTA_RELEASE_GOT_STORAGE))
-    {
-        if (jsp->stack_pos == 5 &&
-            jsp->stack[0].type == LWJSON_STREAM_TYPE_OBJECT &&
-            jsp->stack[1].type == LWJSON_STREAM_TYPE_KEY &&
-            strcasecmp(jsp->stack[1].meta.name, "assets") == 0 &&
-            jsp->stack[2].type == LWJSON_STREAM_TYPE_ARRAY &&
-            jsp->stack[3].type == LWJSON_STREAM_TYPE_OBJECT &&
-            jsp->stack[4].type == LWJSON_STREAM_TYPE_KEY)
+        break;
+    case GHOTA_PATH_ASSET:
+        if (type == LWJSON_STREAM_TYPE_OBJECT)
+        {
+            ClearFlag(handle, GHOTA_RELEASE_GOT_FNAME);
+            ClearFlag(handle, GHOTA_RELEASE_GOT_URL);
+            ghota_client_set_scratch_size(handle, 0);
+            ghota_client_set_scratch_digest(handle, "");
+        }
+        else if (type == LWJSON_STREAM_TYPE_OBJECT_END &&
+                 GetFlag(handle, GHOTA_RELEASE_VARIANT) &&
+                 GetFlag(handle, GHOTA_RELEASE_GOT_FNAME) &&
+                 GetFlag(handle, GHOTA_RELEASE_GOT_URL))
+        {
+            /* Now we got the whole asset, test the name */
+            ghota_match_asset(handle);
+        }
+        break;
+    case GHOTA_PATH_ASSET_NAME:
+        if (type == LWJSON_STREAM_TYPE_STRING)
         {
+            ghota_client_set_scratch_name(
+                handle,
+                jsp->data.str.buff);
+            SetFlag(handle, GHOTA_RELEASE_GOT_FNAME);
             ESP_LOGD(
                 TAG,
-                "Assets Got key '%s' with value '%s'",
-                jsp->stack[jsp->stack_pos - 1].meta.name,
+                "Got Filename for Asset: %s",
+                ghota_client_get_scratch_name(handle));
+        }
+        break;
+    case GHOTA_PATH_ASSET_URL:
+        if (type == LWJSON_STREAM_TYPE_STRING)
+        {
+            ghota_client_set_scratch_url(
+                handle,
                 jsp->data.str.buff);
-            if (strcasecmp(jsp->stack[4].meta.name, "name") == 0)
-            {
-                ghota_client_set_scratch_name(
-                    handle,
-                    jsp->data.str.buff);
-                SetFlag(handle, GHOTA_RELEASE_GOT_FNAME);
-                ESP_LOGD(
-                    TAG,
-                    "Got Filename for Asset: %s",
-                    ghota_client_get_scratch_name(handle));
-            }
-            if (strcasecmp(jsp->stack[4].meta.name, "url") == 0)
-            {
-                ghota_client_set_scratch_url(
-                    handle,
-                    jsp->data.str.buff);
-                SetFlag(handle, GHOTA_RELEASE_GOT_URL);
-                ESP_LOGD(
-                    TAG,
-                    "Got URL for Asset: %s",
-                    ghota_client_get_scratch_url(handle));
-            }
-            /* Now test if we got both name an download url */
-            if (GetFlag(handle, GHOTA_RELEASE_GOT_FNAME) &&
-                GetFlag(handle, GHOTA_RELEASE_GOT_URL))
-            {
-                ghota_config_t *config =
-                    ghota_client_get_config(handle);
-                char *scratch_name =
-                    ghota_client_get_scratch_name(handle);
-                char *scratch_url =
-                    ghota_client_get_scratch_url(handle);
-
-                ESP_LOGD(
-                    TAG,
-                    "Testing Firmware filenames %s -> "
-                    "%s - Matching Filename against %s and %s",
-                    scratch_name,
-                    scratch_url,
-                    config->filenamematch,
-                    config->storagenamematch);
-                /* see if the filename matches */
-                if (!GetFlag(handle, GHOTA_RELEASE_VALID_ASSET) &&
-                    fnmatch(config->filenamematch, scratch_name, 0) == 0)
-                {
-                    ghota_client_set_result_name(handle, scratch_name);
-                    ghota_client_set_result_url(handle, scratch_url);
-                    ESP_LOGD(
-                        TAG,
-                        "Valid Firmware Found: %s - %s",
-                        ghota_client_get_result_name(handle),
-                        ghota_client_get_result_url(handle));
-                    SetFlag(handle, GHOTA_RELEASE_VALID_ASSET);
-                }
-                else if (!GetFlag(handle, GHOTA_RELEASE_GOT_STORAGE) &&
-                         fnmatch(
-                             config->storagenamematch,
-                             scratch_name,
-                             0) == 0)
-                {
-                    ghota_client_set_result_storage_url(
-                        handle, scratch_url);
-                    ESP_LOGD(
-                        TAG,
-                        "Valid Storage Asset Found: %s - %s",
-                        scratch_name,
-                        ghota_client_get_result_storage_url(handle));
-                    SetFlag(handle, GHOTA_RELEASE_GOT_STORAGE);
-                }
-                else
-                {
-                    ESP_LOGD(
-                        TAG,
-                        "Invalid Asset Found: %s",
-                        scratch_name);
-                    ClearFlag(handle, GHOTA_RELEASE_GOT_FNAME);
-                    ClearFlag(handle, GHOTA_RELEASE_GOT_URL);
-                }
-            }
+            SetFlag(handle, GHOTA_RELEASE_GOT_URL);
+            ESP_LOGD(
+                TAG,
+                "Got URL for Asset: %s",
+                ghota_client_get_scratch_url(handle));
+        }
+        break;
+    case GHOTA_PATH_ASSET_SIZE:
+        if (type == LWJSON_STREAM_TYPE_NUMBER)
+        {
+            ghota_client_set_scratch_size(
+                handle,
+                strtoul(jsp->data.prim.buff, NULL, 10));
+        }
+        break;
+    case GHOTA_PATH_ASSET_DIGEST:
+        /* "sha256:<hex>", other algorithms are ignored */
+        if (type == LWJSON_STREAM_TYPE_STRING &&
+            strncmp(jsp->data.str.buff, "sha256:", 7) == 0 &&
+            strlen(&jsp->data.str.buff[7]) == GHOTA_SHA256_HEX_LEN - 1)
+        {
+            ghota_client_set_scratch_digest(
+                handle,
+                &jsp->data.str.buff[7]);
+        }
+        break;
+    case GHOTA_PATH_ROLLOUT:
+        /* a number in a manifest, a "rollout: N%" line in the release notes */
+        if (type == LWJSON_STREAM_TYPE_NUMBER)
+        {
+            ghota_set_rollout(
+                handle,
+                strtoul(jsp->data.prim.buff, NULL, 10));
         }
+        else if (type == LWJSON_STREAM_TYPE_STRING &&
+                 !GetFlag(handle, GHOTA_RELEASE_GOT_NOTES))
+        {
+            ghota_scan_notes(handle, jsp);
+        }
+        else if (type == LWJSON_STREAM_TYPE_NULL)
+        {
+            SetFlag(handle, GHOTA_RELEASE_GOT_NOTES);
+        }
+        ghota_finish_rollout(handle);
+        break;
+    case GHOTA_PATH_ASSETS:
+        /* in a manifest the rollout may still follow the variants */
+        if (type == LWJSON_STREAM_TYPE_ARRAY_END &&
+            jsp->paths != manifest_paths)
+        {
+            SetFlag(handle, GHOTA_RELEASE_GOT_ASSETS);
+            ghota_finish_rollout(handle);
+        }
+        break;
+    case GHOTA_PATH_ROOT:
+        /* the whole document was read, whatever it did not declare it does not have */
+        if (type == LWJSON_STREAM_TYPE_OBJECT_END)
+        {
+            SetFlag(handle, GHOTA_RELEASE_GOT_ASSETS);
+            SetFlag(handle, GHOTA_RELEASE_GOT_NOTES);
+            ghota_finish_rollout(handle);
+        }
+        break;
+    case GHOTA_PATH_VARIANT:
+        if (type == LWJSON_STREAM_TYPE_OBJECT)
+        {
+            ClearFlag(handle, GHOTA_RELEASE_VARIANT);
+        }
+        break;
+    case GHOTA_PATH_VARIANT_NAME:
+        if (type == LWJSON_STREAM_TYPE_STRING &&
+            strcmp(
+                jsp->data.str.buff,
+                ghota_client_get_config(handle)->variant) == 0)
+        {
+            ESP_LOGD(
+                TAG,
+                "Got assets of variant %s",
+                jsp->data.str.buff);
+            SetFlag(handle, GHOTA_RELEASE_VARIANT);
+        }
+        break;
+    }
+    if (ghota_release_complete(handle))
+    {
+        ESP_LOGD(
+            TAG,
+            "Got all release fields, stopping JSON parser");
+        lwjson_stream_stop(jsp);
     }
 }
 
-esp_err_t ghota_check(
+#ifdef CONFIG_GHOTA_PROBE
+/* replace "{host}", "{org}" and "{repo}" in a url template */
+static void ghota_expand_url(
+    ghota_config_t *config,
+    const char *tmpl,
+    char *url,
+    size_t len)
+{
+    size_t pos = 0;
+    while (*tmpl && pos + 1 < len)
+    {
+        const char *value = NULL;
+        if (strncmp(tmpl, "{host}", 6) == 0)
+        {
+            /* the web pages of api.github.com are on github.com */
+            value = config->hostname;
+            if (strncmp(value, "api.", 4) == 0)
+                value += 4;
+            tmpl += 6;
+        }
+        else if (strncmp(tmpl, "{org}", 5) == 0)
+        {
+            value = config->orgname;
+            tmpl += 5;
+        }
+        else if (strncmp(tmpl, "{repo}", 6) == 0)
+        {
+            value = config->reponame;
+            tmpl += 6;
+        }
+        if (value)
+        {
+            pos += strlcpy(&url[pos], value, len - pos);
+            if (pos >= len)
+                pos = len - 1;
+        }
+        else
+        {
+            url[pos++] = *tmpl++;
+        }
+    }
+    url[pos] = '\0';
+}
+
+/* true if the latest tag is known without the API and is not newer than the running version */
+static bool ghota_probe_is_current(
+    ghota_client_handle_t *handle)
+{
+    ghota_config_t *config =
+        ghota_client_get_config(handle);
+    if (config->interface->get_latest_tag == NULL ||
+        config->probeurl == NULL ||
+        !strlen(config->probeurl))
+    {
+        return false;
+    }
+    char url[CONFIG_MAX_URL_LEN];
+    ghota_expand_url(
+        config,
+        config->probeurl,
+        url,
+        sizeof(url));
+
+    char tag[CONFIG_MAX_FILENAME_LEN];
+    semver_t latest_version;
+    esp_err_t err = config->interface->get_latest_tag(
+        handle,
+        url,
+        tag,
+        sizeof(tag));
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(
+            TAG,
+            "Probing %s failed, asking the API",
+            url);
+        return false;
+    }
+    if (semver_parse(tag, &latest_version))
+    {
+        ESP_LOGW(
+            TAG,
+            "Latest tag %s is not a version, asking the API",
+            tag);
+        return false;
+    }
+    if (semver_gt(
+            latest_version,
+            *ghota_client_get_current_version(handle)) == 1)
+    {
+        ESP_LOGI(
+            TAG,
+            "Latest tag %s is newer, fetching its assets",
+            tag);
+        semver_free(&latest_version);
+        return false;
+    }
+    ESP_LOGI(
+        TAG,
+        "Latest tag %s is not newer, skipping the API",
+        tag);
+    ghota_client_set_result_tag_name(handle, tag);
+    ghota_client_set_latest_version(
+        handle, latest_version);
+    return true;
+}
+#endif
+
+/* true if this device takes part in the rollout of the release. A response that
+ended before its rollout was known reaches no device */
+static bool ghota_in_rollout(
     ghota_client_handle_t *handle)
 {
-    if (xSemaphoreTake(
-            ghota_lock,
-            pdMS_TO_TICKS(1000)) != pdPASS)
+    uint8_t rollout =
+        ghota_client_get_result_rollout(handle);
+    if (!GetFlag(handle, GHOTA_RELEASE_GOT_ROLLOUT))
+    {
+        ESP_LOGW(
+            TAG,
+            "Release %s ended before its rollout, not updating",
+            ghota_client_get_result_tag_name(handle));
+        return false;
+    }
+    if (rollout >= 100)
     {
-        ESP_LOGE(TAG, "Failed to get lock");
+        return true;
+    }
+    uint32_t cohort = ghota_schedule_cohort(
+        ghota_client_get_config(handle)->deviceid,
+        ghota_client_get_result_tag_name(handle));
+    ESP_LOGI(
+        TAG,
+        "Release %s is rolled out to %d%%, this device is in cohort %" PRIu32,
+        ghota_client_get_result_tag_name(handle),
+        rollout,
+        cohort);
+    return cohort < rollout;
+}
+
+/* true if the firmware image of the release is the one running */
+static bool ghota_firmware_is_installed(
+    ghota_client_handle_t *handle)
+{
+    /* the installed image is only trusted while it is the running partition */
+    return ghota_cache_is_installed(
+        esp_ota_get_running_partition(),
+        ghota_client_get_result_digest(handle));
+}
+
+/* true if the release has no storage image or the one it has is installed */
+static bool ghota_storage_is_installed(
+    ghota_client_handle_t *handle)
+{
+    ghota_config_t *config =
+        ghota_client_get_config(handle);
+    if (!strlen(ghota_client_get_result_storage_url(handle)) ||
+        !strlen(config->storagepartitionname))
+    {
+        return true;
+    }
+    /* a digest only published in a sidecar is unknown until the download,
+    such an image is only installed together with new firmware */
+    if (!strlen(ghota_client_get_result_storage_digest(handle)))
+    {
+        return true;
+    }
+    return ghota_cache_is_installed(
+        esp_partition_find_first(
+            ESP_PARTITION_TYPE_DATA,
+            ESP_PARTITION_SUBTYPE_ANY,
+            config->storagepartitionname),
+        ghota_client_get_result_storage_digest(handle));
+}
+
+/* longest single wait of the update timer, longer delays are waited in parts */
+#define GHOTA_TIMER_MAX_WAIT_MS (24 * 3600 * 1000)
+
+/* the update interval in seconds */
+static uint32_t ghota_update_interval(
+    ghota_config_t *config)
+{
+    if (config->updateIntervalSeconds)
+    {
+        return config->updateIntervalSeconds;
+    }
+    return config->updateInterval * 60;
+}
+
+/* arm the update timer to fire at the deadline, or on the way to a distant one */
+static esp_err_t ghota_arm_timer(
+    ghota_client_handle_t *handle)
+{
+    TimerHandle_t timer =
+        ghota_client_get_timer(handle);
+    if (timer == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    int64_t wait_ms =
+        (ghota_client_get_deadline(handle) - esp_timer_get_time() + 999) / 1000;
+    if (wait_ms < 0)
+    {
+        wait_ms = 0;
+    }
+    else if (wait_ms > GHOTA_TIMER_MAX_WAIT_MS)
+    {
+        wait_ms = GHOTA_TIMER_MAX_WAIT_MS;
+    }
+    /* one tick more, so the timer does not fire before the deadline */
+    TickType_t ticks =
+        (TickType_t)(wait_ms * configTICK_RATE_HZ / 1000) + 1;
+    /* also called from the timer task, which must not block */
+    if (xTimerChangePeriod(timer, ticks, 0) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to arm timer");
         return ESP_FAIL;
     }
+    return ESP_OK;
+}
+
+/* move the next timer check to delay seconds from now */
+static esp_err_t ghota_set_deadline(
+    ghota_client_handle_t *handle,
+    uint32_t delay)
+{
+    ghota_client_set_deadline(
+        handle,
+        esp_timer_get_time() + (int64_t)delay * 1000000);
+    if (ghota_client_get_timer(handle) == NULL)
+    {
+        return ESP_OK;
+    }
+    return ghota_arm_timer(handle);
+}
+
+/* decide when the update timer checks next and tell the application */
+static void ghota_reschedule(
+    ghota_client_handle_t *handle,
+    bool failed)
+{
+    ghota_config_t *config =
+        ghota_client_get_config(handle);
+    ghota_schedule_t *schedule =
+        ghota_client_get_schedule(handle);
+    ghota_schedule_next(
+        schedule,
+        ghota_client_get_rate_limit(handle),
+        ghota_update_interval(config),
+        failed);
+    ghota_set_deadline(
+        handle,
+        schedule->delay);
+    if (schedule->reason != GHOTA_SCHEDULE_INTERVAL)
+    {
+        ESP_LOGI(
+            TAG,
+            "Next check in %" PRIu32 " s",
+            schedule->delay);
+    }
+    esp_err_t err = esp_event_post(
+        GHOTA_EVENTS,
+        GHOTA_EVENT_CHECK_SCHEDULED,
+        schedule,
+        sizeof(ghota_schedule_t),
+        portMAX_DELAY);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(
+            TAG,
+            "event %s post failed: %s",
+            ghota_get_event_str(
+                GHOTA_EVENT_CHECK_SCHEDULED),
+            esp_err_to_name(err));
+    }
+}
+
+static esp_err_t ghota_run_check(
+    ghota_client_handle_t *handle)
+{
     ESP_LOGI(TAG, "Checking for new release");
     esp_err_t err = esp_event_post(
         GHOTA_EVENTS,
@@ -342,12 +1088,63 @@ esp_err_t ghota_check(
         portMAX_DELAY);
     if (err != ESP_OK)
     {
-        xSemaphoreGive(ghota_lock);
         return err;
     }
 
+    /* forget the result of any previous check */
+    ghota_client_set_result_flags(handle, 0);
+    ghota_client_set_result_tag_name(handle, "");
+    ghota_client_set_result_name(handle, "");
+    ghota_client_set_result_url(handle, "");
+    ghota_client_set_result_storage_url(handle, "");
+    ghota_client_set_result_digest(handle, "");
+    ghota_client_set_result_storage_digest(handle, "");
+    ghota_client_set_result_storage_digest_url(handle, "");
+    ghota_client_set_result_patch_url(handle, "");
+    ghota_client_set_result_patch_size(handle, 0);
+    ghota_client_set_result_compression(handle, GHOTA_COMPRESSION_NONE);
+    ghota_client_set_result_storage_compression(handle, GHOTA_COMPRESSION_NONE);
+    ghota_client_set_result_rollout(handle, GHOTA_ROLLOUT_UNKNOWN);
+    ghota_client_set_scratch_notes(handle, "");
+    ghota_client_get_rate_limit(handle)->limited = false;
+
+    ghota_config_t *config =
+        ghota_client_get_config(handle);
+    bool manifest = strlen(config->manifesturl) > 0;
+    /* a manifest lists the assets of all variants, the Github release only ours */
+    if (!manifest)
+    {
+        SetFlag(handle, GHOTA_RELEASE_VARIANT);
+    }
+
+#ifdef CONFIG_GHOTA_PROBE
+    if (!manifest &&
+        ghota_probe_is_current(handle))
+    {
+        ghota_reschedule(handle, false);
+        err = esp_event_post(
+            GHOTA_EVENTS,
+            GHOTA_EVENT_NOUPDATE_AVAILABLE,
+            handle,
+            sizeof(ghota_client_handle_t *),
+            portMAX_DELAY);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(
+                TAG,
+                "event %s post failed: %s",
+                ghota_get_event_str(
+                    GHOTA_EVENT_NOUPDATE_AVAILABLE),
+                esp_err_to_name(err));
+        }
+        return ESP_OK;
+    }
+#endif
+
     lwjson_stream_parser_t stream_parser;
     lwjsonr_t res;
+    /* a refused probe does not count against the API */
+    ghota_client_get_rate_limit(handle)->limited = false;
 
     res = lwjson_stream_init(
         &stream_parser,
@@ -364,29 +1161,114 @@ esp_err_t ghota_check(
             handle,
             sizeof(ghota_client_handle_t *),
             portMAX_DELAY);
-        xSemaphoreGive(ghota_lock);
         if (err != ESP_OK)
             return err;
         return ESP_FAIL;
     }
     stream_parser.udata = (void *)handle;
 
-    ghota_config_t *config =
-        ghota_client_get_config(handle);
-
     char url[CONFIG_MAX_URL_LEN];
-    snprintf(
-        url,
-        CONFIG_MAX_URL_LEN,
-        "https://%s/repos/%s/%s/releases/latest",
-        config->hostname,
-        config->orgname,
-        config->reponame);
+    ghota_release_validators_t validators = {0};
+#ifdef CONFIG_GHOTA_RELEASE_CACHE
+    ghota_release_cache_t *cache = NULL;
+#endif
+#ifdef CONFIG_GHOTA_GRAPHQL
+    /* the API only answers authenticated GraphQL queries */
+    if (!manifest &&
+        config->interface->query_release_info &&
+        ghota_client_get_username(handle))
+    {
+        lwjson_stream_set_paths(
+            &stream_parser,
+            graphql_paths,
+            GHOTA_PATH_GITHUB_MAX);
+        snprintf(
+            url,
+            CONFIG_MAX_URL_LEN,
+            "https://%s/graphql",
+            config->hostname);
+        char query[384];
+        snprintf(
+            query,
+            sizeof(query),
+            ghota_graphql_query,
+            config->orgname,
+            config->reponame,
+            CONFIG_GHOTA_GRAPHQL_MAX_ASSETS);
+        /* a POST is not conditional, there is nothing to cache */
+        err = config->interface->query_release_info(
+            handle,
+            url,
+            query,
+            &stream_parser);
+    }
+    else
+#endif
+    {
+        if (manifest)
+        {
+            lwjson_stream_set_paths(
+                &stream_parser,
+                manifest_paths,
+                GHOTA_PATH_MAX);
+            strlcpy(
+                url,
+                config->manifesturl,
+                CONFIG_MAX_URL_LEN);
+        }
+        else
+        {
+            lwjson_stream_set_paths(
+                &stream_parser,
+                release_paths,
+                GHOTA_PATH_GITHUB_MAX);
+            snprintf(
+                url,
+                CONFIG_MAX_URL_LEN,
+                "https://%s/repos/%s/%s/releases/latest",
+                config->hostname,
+                config->orgname,
+                config->reponame);
+        }
 
-    err = config->interface->get_release_info(
-        handle,
-        url,
-        &stream_parser);
+#ifdef CONFIG_GHOTA_RELEASE_CACHE
+        cache = ghota_cache_load(handle, url, &validators);
+#endif
+
+        err = config->interface->get_release_info(
+            handle,
+            url,
+            &stream_parser,
+            &validators);
+    }
+
+#ifdef CONFIG_GHOTA_RELEASE_CACHE
+    if (err == ESP_OK && validators.not_modified)
+    {
+        if (cache)
+        {
+            ESP_LOGI(
+                TAG,
+                "Release not modified, using cached result");
+            ghota_cache_apply(handle, cache);
+        }
+        else
+        {
+            /* we did not ask for a conditional response */
+            err = ESP_FAIL;
+        }
+    }
+    else if (err == ESP_OK &&
+             GetFlag(handle, GHOTA_RELEASE_VALID_ASSET) &&
+             GetFlag(handle, GHOTA_RELEASE_GOT_ROLLOUT))
+    {
+        ghota_cache_store(handle, url, &validators);
+    }
+    ghota_cache_free(cache);
+#else
+    if (validators.not_modified)
+        err = ESP_FAIL;
+#endif
 
     if (err != ESP_OK)
     {
@@ -394,6 +1276,7 @@ esp_err_t ghota_check(
             TAG,
             "HTTP GET request failed: %s",
             esp_err_to_name(err));
+        ghota_reschedule(handle, true);
         err = esp_event_post(
             GHOTA_EVENTS,
             GHOTA_EVENT_UPDATE_FAILED,
@@ -409,10 +1292,9 @@ esp_err_t ghota_check(
                     GHOTA_EVENT_UPDATE_FAILED),
                 esp_err_to_name(err));
         }
-        xSemaphoreGive(ghota_lock);
-
         return ESP_FAIL;
     }
+    ghota_reschedule(handle, false);
 
     if (GetFlag(handle, GHOTA_RELEASE_VALID_ASSET))
     {
@@ -437,8 +1319,6 @@ esp_err_t ghota_check(
                         GHOTA_EVENT_UPDATE_FAILED),
                     esp_err_to_name(err));
             }
-            xSemaphoreGive(ghota_lock);
-
             return ESP_FAIL;
         }
         ghota_client_set_latest_version(
@@ -466,6 +1346,16 @@ esp_err_t ghota_check(
             TAG,
             "Firmware URL: %s",
             ghota_client_get_result_url(handle));
+        char *patch_url =
+            ghota_client_get_result_patch_url(handle);
+        if (strlen(patch_url))
+        {
+            ESP_LOGI(
+                TAG,
+                "Patch URL: %s (%" PRIu32 " bytes)",
+                patch_url,
+                ghota_client_get_result_patch_size(handle));
+        }
         char *storage_url =
             ghota_client_get_result_storage_url(handle);
         if (strlen(storage_url))
@@ -475,6 +1365,60 @@ esp_err_t ghota_check(
                 "Storage URL: %s",
                 storage_url);
         }
+        /* a staged rollout has not reached this device yet, it downloads nothing */
+        if (semver_gt(
+                latest_version,
+                *current_version) == 1 &&
+            !ghota_in_rollout(handle))
+        {
+            ClearFlag(handle, GHOTA_RELEASE_VALID_ASSET);
+            err = esp_event_post(
+                GHOTA_EVENTS,
+                GHOTA_EVENT_NOUPDATE_AVAILABLE,
+                handle,
+                sizeof(ghota_client_handle_t *),
+                portMAX_DELAY);
+            if (err != ESP_OK)
+            {
+                ESP_LOGE(
+                    TAG,
+                    "event %s post failed: %s",
+                    ghota_get_event_str(
+                        GHOTA_EVENT_NOUPDATE_AVAILABLE),
+                    esp_err_to_name(err));
+            }
+            return ESP_OK;
+        }
+        /* a release can bump the version without changing the images,
+        there is nothing to install and nothing to reboot for */
+        if (semver_gt(
+                latest_version,
+                *current_version) == 1 &&
+            ghota_firmware_is_installed(handle) &&
+            ghota_storage_is_installed(handle))
+        {
+            ESP_LOGI(
+                TAG,
+                "Release %s has the installed images, nothing to update",
+                ghota_client_get_result_tag_name(handle));
+            ClearFlag(handle, GHOTA_RELEASE_VALID_ASSET);
+            err = esp_event_post(
+                GHOTA_EVENTS,
+                GHOTA_EVENT_NOUPDATE_AVAILABLE,
+                handle,
+                sizeof(ghota_client_handle_t *),
+                portMAX_DELAY);
+            if (err != ESP_OK)
+            {
+                ESP_LOGE(
+                    TAG,
+                    "event %s post failed: %s",
+                    ghota_get_event_str(
+                        GHOTA_EVENT_NOUPDATE_AVAILABLE),
+                    esp_err_to_name(err));
+            }
+            return ESP_OK;
+        }
     }
     else
     {
@@ -496,8 +1440,6 @@ esp_err_t ghota_check(
                     GHOTA_EVENT_UPDATE_FAILED),
                 esp_err_to_name(err));
         }
-        xSemaphoreGive(ghota_lock);
-
         return ESP_FAIL;
     }
 
@@ -516,112 +1458,31 @@ esp_err_t ghota_check(
                 GHOTA_EVENT_UPDATE_AVAILABLE),
             esp_err_to_name(err));
     }
-    xSemaphoreGive(ghota_lock);
-
     return err;
 }
 
-esp_err_t _http_event_storage_handler(
-    esp_http_client_event_t *evt)
+esp_err_t ghota_check(
+    ghota_client_handle_t *handle)
 {
-    static int output_pos;
-    static int last_progress;
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wswitch"
-    switch (evt->event_id)
-    {
-    case HTTP_EVENT_ON_CONNECTED:
+    if (handle == NULL)
     {
-        output_pos = 0;
-        last_progress = 0;
-        /* Erase the Partition */
-        break;
-    }
-    case HTTP_EVENT_ON_DATA:
-        if (!esp_http_client_is_chunked_response(
-                evt->client))
-        {
-            ghota_client_handle_t *handle =
-                (ghota_client_handle_t *)evt->user_data;
-            esp_err_t err;
-            const esp_partition_t *storage_partition =
-                ghota_client_get_storage_partition(handle);
-            if (output_pos == 0)
-            {
-                ESP_LOGD(TAG, "Erasing Partition");
-                err = esp_partition_erase_range(
-                    storage_partition,
-                    0,
-                    storage_partition->size);
-                ESP_LOGD(TAG, "Erasing Complete");
-            }
-            err = esp_partition_write(
-                storage_partition,
-                output_pos,
-                evt->data,
-                evt->data_len);
-            output_pos += evt->data_len;
-            int progress =
-                100 * ((float)output_pos /
-                       (float)storage_partition->size);
-            if ((progress % 5 == 0) &&
-                (progress != last_progress))
-            {
-                ESP_LOGV(
-                    TAG,
-                    "Storage Firmware Update Progress: %d%%",
-                    progress);
-                err = esp_event_post(
-                    GHOTA_EVENTS,
-                    GHOTA_EVENT_STORAGE_UPDATE_PROGRESS,
-                    &progress,
-                    sizeof(progress),
-                    portMAX_DELAY);
-                last_progress = progress;
-                if (err != ESP_OK)
-                    return err;
-            }
-        }
-        break;
-    case HTTP_EVENT_DISCONNECTED:
-    {
-        int mbedtls_err = 0;
-        esp_err_t err = esp_tls_get_and_clear_last_error(
-            evt->data,
-            &mbedtls_err,
-            NULL);
-        if (err != 0)
-        {
-            ESP_LOGE(
-                TAG,
-                "Last esp error code: 0x%x",
-                err);
-            ESP_LOGE(
-                TAG,
-                "Last mbedtls failure: 0x%x",
-                mbedtls_err);
-        }
-        break;
+        return ESP_ERR_INVALID_ARG;
     }
+    if (!ghota_claim(handle, GHOTA_PHASE_CHECKING))
+    {
+        return ESP_ERR_INVALID_STATE;
     }
-#pragma GCC diagnostic pop
-    return ESP_OK;
+    esp_err_t err = ghota_run_check(handle);
+    ghota_release(handle);
+    return err;
 }
 
-esp_err_t ghota_storage_update(
+static esp_err_t ghota_run_storage_update(
     ghota_client_handle_t *handle)
 {
-    if (xSemaphoreTake(
-            ghota_lock,
-            pdMS_TO_TICKS(1000)) != pdTRUE)
-    {
-        ESP_LOGE(TAG, "Failed to take lock");
-        return ESP_FAIL;
-    }
     if (handle == NULL)
     {
         ESP_LOGE(TAG, "Invalid Handle");
-        xSemaphoreGive(ghota_lock);
         return ESP_ERR_INVALID_ARG;
     }
     char *storageurl =
@@ -629,7 +1490,6 @@ esp_err_t ghota_storage_update(
     if (!strlen(storageurl))
     {
         ESP_LOGE(TAG, "No Storage URL");
-        xSemaphoreGive(ghota_lock);
         return ESP_FAIL;
     }
     ghota_config_t *ghota_config =
@@ -637,7 +1497,6 @@ esp_err_t ghota_storage_update(
     if (!strlen(ghota_config->storagepartitionname))
     {
         ESP_LOGE(TAG, "No Storage Partition Name");
-        xSemaphoreGive(ghota_lock);
         return ESP_FAIL;
     }
     ghota_client_set_partition(
@@ -651,7 +1510,6 @@ esp_err_t ghota_storage_update(
     if (partition == NULL)
     {
         ESP_LOGE(TAG, "Storage Partition Not Found");
-        xSemaphoreGive(ghota_lock);
         return ESP_FAIL;
     }
     ESP_LOGD(
@@ -663,6 +1521,16 @@ esp_err_t ghota_storage_update(
         partition->subtype,
         partition->address,
         partition->size);
+    if (ghota_cache_is_installed(
+            partition,
+            ghota_client_get_result_storage_digest(handle)))
+    {
+        /* the image of this release is what was installed last time */
+        ESP_LOGI(
+            TAG,
+            "Storage image unchanged, skipping download");
+        return ESP_OK;
+    }
     esp_err_t err = esp_event_post(
         GHOTA_EVENTS,
         GHOTA_EVENT_START_STORAGE_UPDATE,
@@ -671,72 +1539,22 @@ esp_err_t ghota_storage_update(
         portMAX_DELAY);
     if (err != ESP_OK)
     {
-        xSemaphoreGive(ghota_lock);
         return err;
     }
     /* give time for the system to react,
     such as unmounting the filesystems etc */
     vTaskDelay(pdMS_TO_TICKS(1000));
 
-    // ABSTRACTION: config->interface->install_storage(handle)
-
-    esp_http_client_config_t config = {
-        .url = ghota_client_get_result_storage_url(
-            handle),
-        .event_handler = _http_event_storage_handler,
-        .crt_bundle_attach = esp_crt_bundle_attach,
-        .user_data = handle,
-        .buffer_size_tx = 2048};
-    char *username =
-        ghota_client_get_username(handle);
-    if (username)
-    {
-        ESP_LOGD(
-            TAG,
-            "Using Authenticated Request to %s",
-            config.url);
-        config.username = username;
-        config.password =
-            ghota_client_get_token(handle);
-        config.auth_type = HTTP_AUTH_TYPE_BASIC;
-    }
-    esp_http_client_handle_t client =
-        esp_http_client_init(&config);
-    err = esp_http_client_set_header(
-        client,
-        "Accept",
-        "application/octet-stream");
-    if (err != ESP_OK)
-    {
-        esp_http_client_cleanup(client);
-        xSemaphoreGive(ghota_lock);
-        return err;
-    }
-
-    err = esp_http_client_perform(client);
-    if (err == ESP_OK)
+    esp_err_t install_err =
+        ghota_config->interface->install_storage(handle);
+    /* the digest may only be known after the install, from the sidecar */
+    ghota_cache_set_installed(
+        partition,
+        install_err == ESP_OK
+            ? ghota_client_get_result_storage_digest(handle)
+            : "");
+    if (install_err == ESP_OK)
     {
-        ESP_LOGD(
-            TAG,
-            "HTTP GET Status = %d, "
-            "content_length = %" PRId64,
-            esp_http_client_get_status_code(client),
-            esp_http_client_get_content_length(client));
-        uint8_t sha256[32] = {0};
-        err = esp_partition_get_sha256(
-            ghota_client_get_storage_partition(
-                handle),
-            sha256);
-        if (err != ESP_OK)
-        {
-            esp_http_client_cleanup(client);
-            xSemaphoreGive(ghota_lock);
-            return err;
-        }
-        ESP_LOG_BUFFER_HEX(
-            "New Storage Partition SHA256:",
-            sha256,
-            sizeof(sha256));
         err = esp_event_post(
             GHOTA_EVENTS,
             GHOTA_EVENT_FINISH_STORAGE_UPDATE,
@@ -745,8 +1563,6 @@ esp_err_t ghota_storage_update(
             portMAX_DELAY);
         if (err != ESP_OK)
         {
-            esp_http_client_cleanup(client);
-            xSemaphoreGive(ghota_lock);
             return err;
         }
     }
@@ -754,8 +1570,8 @@ esp_err_t ghota_storage_update(
     {
         ESP_LOGE(
             TAG,
-            "HTTP GET request failed: %s",
-            esp_err_to_name(err));
+            "Storage download failed: %s",
+            esp_err_to_name(install_err));
         err = esp_event_post(
             GHOTA_EVENTS,
             GHOTA_EVENT_STORAGE_UPDATE_FAILED,
@@ -764,26 +1580,62 @@ esp_err_t ghota_storage_update(
             portMAX_DELAY);
         if (err != ESP_OK)
         {
-            esp_http_client_cleanup(client);
-            xSemaphoreGive(ghota_lock);
             return err;
         }
     }
 
-    esp_http_client_cleanup(client);
-    xSemaphoreGive(ghota_lock);
-    return ESP_OK;
+    return install_err;
 }
 
-esp_err_t ghota_update(ghota_client_handle_t *handle)
+esp_err_t ghota_storage_update(
+    ghota_client_handle_t *handle)
 {
-    if (xSemaphoreTake(
-            ghota_lock,
-            pdMS_TO_TICKS(1000)) != pdTRUE)
+    if (handle == NULL)
     {
-        ESP_LOGE(TAG, "Failed to take lock");
-        return ESP_FAIL;
+        ESP_LOGE(TAG, "Invalid Handle");
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!ghota_claim(handle, GHOTA_PHASE_DOWNLOADING))
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = ghota_run_storage_update(handle);
+    ghota_release(handle);
+    return err;
+}
+
+static esp_err_t ghota_update_unchanged_firmware(
+    ghota_client_handle_t *handle)
+{
+    /* only the storage partition can differ, no reboot is needed */
+    esp_err_t err = ESP_OK;
+    if (strlen(
+            ghota_client_get_result_storage_url(
+                handle)))
+    {
+        err = ghota_run_storage_update(handle);
+    }
+    esp_err_t post_err = esp_event_post(
+        GHOTA_EVENTS,
+        err == ESP_OK
+            ? GHOTA_EVENT_FINISH_UPDATE
+            : GHOTA_EVENT_UPDATE_FAILED,
+        NULL,
+        0,
+        portMAX_DELAY);
+    if (post_err != ESP_OK)
+    {
+        ESP_LOGE(
+            TAG,
+            "event post failed: %s",
+            esp_err_to_name(post_err));
     }
+    return err;
+}
+
+static esp_err_t ghota_run_update(
+    ghota_client_handle_t *handle)
+{
     ESP_LOGI(
         TAG,
         "Scheduled Check for Firmware Update Starting");
@@ -795,7 +1647,6 @@ esp_err_t ghota_update(ghota_client_handle_t *handle)
         portMAX_DELAY);
     if (err != ESP_OK)
     {
-        xSemaphoreGive(ghota_lock);
         return err;
     }
 
@@ -810,7 +1661,6 @@ esp_err_t ghota_update(ghota_client_handle_t *handle)
             NULL,
             0,
             portMAX_DELAY);
-        xSemaphoreGive(ghota_lock);
         if (err != ESP_OK)
             return err;
         return ESP_FAIL;
@@ -829,16 +1679,49 @@ esp_err_t ghota_update(ghota_client_handle_t *handle)
             NULL,
             0,
             portMAX_DELAY);
-        xSemaphoreGive(ghota_lock);
         if (err != ESP_OK)
             return err;
         return ESP_OK;
     }
 
-    ghota_config_t *config = ghota_client_get_config(handle);
-    err = config->interface->install_firmware(handle);
-    xSemaphoreGive(ghota_lock);
+    /* the check only reports such a release when its storage image changed */
+    if (ghota_firmware_is_installed(handle))
+    {
+        ESP_LOGI(
+            TAG,
+            "Firmware image unchanged, skipping download");
+        return ghota_update_unchanged_firmware(handle);
+    }
 
+    ghota_config_t *config = ghota_client_get_config(handle);
+    /* the download overwrites whatever was recorded for the other slot */
+    ghota_cache_set_installed(
+        esp_ota_get_next_update_partition(NULL),
+        "");
+    err = ESP_ERR_NOT_FOUND;
+    if (strlen(ghota_client_get_result_patch_url(handle)) &&
+        config->interface->install_firmware_patch)
+    {
+        err = config->interface->install_firmware_patch(handle);
+        if (err != ESP_OK)
+        {
+            ESP_LOGW(
+                TAG,
+                "Patch update failed: %s, downloading the full image",
+                esp_err_to_name(err));
+        }
+    }
+    if (err != ESP_OK)
+    {
+        ghota_client_set_phase(handle, GHOTA_PHASE_DOWNLOADING);
+        err = config->interface->install_firmware(handle);
+    }
+    if (err == ESP_OK)
+    {
+        ghota_cache_set_installed(
+            esp_ota_get_boot_partition(),
+            ghota_client_get_result_digest(handle));
+    }
     if (err != ESP_OK)
     {
         err = esp_event_post(
@@ -880,7 +1763,8 @@ esp_err_t ghota_update(ghota_client_handle_t *handle)
             ghota_client_get_result_storage_url(
                 handle)))
     {
-        if (ghota_storage_update(handle) == ESP_OK)
+        ghota_client_set_phase(handle, GHOTA_PHASE_DOWNLOADING);
+        if (ghota_run_storage_update(handle) == ESP_OK)
         {
             ESP_LOGI(
                 TAG,
@@ -898,6 +1782,7 @@ esp_err_t ghota_update(ghota_client_handle_t *handle)
         TAG,
         "ESP_HTTPS_OTA upgrade successful. "
         "Rebooting ...");
+    ghota_client_set_phase(handle, GHOTA_PHASE_PENDING_REBOOT);
     err = esp_event_post(
         GHOTA_EVENTS,
         GHOTA_EVENT_PENDING_REBOOT,
@@ -919,6 +1804,22 @@ esp_err_t ghota_update(ghota_client_handle_t *handle)
     return ESP_OK;
 }
 
+esp_err_t ghota_update(ghota_client_handle_t *handle)
+{
+    if (handle == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!ghota_claim(handle, GHOTA_PHASE_DOWNLOADING))
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    /* only returns if the update failed or was not needed */
+    esp_err_t err = ghota_run_update(handle);
+    ghota_release(handle);
+    return err;
+}
+
 semver_t *ghota_get_current_version(
     ghota_client_handle_t *handle)
 {
@@ -953,6 +1854,68 @@ semver_t *ghota_get_latest_version(
     return new;
 }
 
+/* connections are kept between the check and the update, close them once a run is over */
+static void ghota_disconnect(
+    ghota_client_handle_t *handle)
+{
+    ghota_config_t *config =
+        ghota_client_get_config(handle);
+    if (config->interface->disconnect)
+    {
+        config->interface->disconnect(handle);
+    }
+    ghota_connection_stats_t *stats =
+        ghota_client_get_connection_stats(handle);
+    ESP_LOGD(
+        TAG,
+        "%" PRIu32 " requests, %" PRIu32 " handshakes "
+        "(%" PRIu32 " offered a session ticket), %" PRIu32 " handshakes avoided",
+        stats->requests,
+        stats->handshakes,
+        stats->offered,
+        stats->requests - stats->handshakes);
+}
+
+ghota_phase_t ghota_get_phase(
+    ghota_client_handle_t *handle)
+{
+    if (handle == NULL)
+    {
+        return GHOTA_PHASE_IDLE;
+    }
+    return ghota_client_get_phase(handle);
+}
+
+esp_err_t ghota_get_connection_stats(
+    ghota_client_handle_t *handle,
+    ghota_connection_stats_t *stats)
+{
+    if (!handle || !stats)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(
+        stats,
+        ghota_client_get_connection_stats(handle),
+        sizeof(ghota_connection_stats_t));
+    return ESP_OK;
+}
+
+esp_err_t ghota_get_schedule(
+    ghota_client_handle_t *handle,
+    ghota_schedule_t *schedule)
+{
+    if (handle == NULL || schedule == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(
+        schedule,
+        ghota_client_get_schedule(handle),
+        sizeof(ghota_schedule_t));
+    return ESP_OK;
+}
+
 static void ghota_task(void *pvParameters)
 {
     ghota_client_handle_t *handle =
@@ -960,11 +1923,22 @@ static void ghota_task(void *pvParameters)
     ESP_LOGI(
         TAG,
         "Firmware Update Task Starting");
+    /* ghota_start_update_task has claimed the handle for the check */
     if (handle)
     {
-        if (ghota_check(handle) == ESP_OK)
+        if (ghota_run_check(handle) == ESP_OK)
         {
-            if (semver_gt(
+            /* the wait before a download ends with this check */
+            bool download_due = ghota_client_get_download_due(handle);
+            ghota_client_set_download_due(handle, false);
+            if (!GetFlag(handle, GHOTA_RELEASE_VALID_ASSET))
+            {
+                /* the check found nothing to install and has posted the event */
+                ESP_LOGI(
+                    TAG,
+                    "No New Version Available");
+            }
+            else if (semver_gt(
                     *ghota_client_get_latest_version(
                         handle),
                     *ghota_client_get_current_version(
@@ -973,7 +1947,37 @@ static void ghota_task(void *pvParameters)
                 ESP_LOGI(
                     TAG,
                     "New Version Available");
-                ghota_update(handle);
+                uint32_t wait = 0;
+                /* a release reaches the whole fleet at once, spread the downloads.
+                An update started by hand is not delayed */
+                if (ghota_client_get_scheduled(handle) &&
+                    !download_due)
+                {
+#ifdef CONFIG_GHOTA_FLEET_JITTER
+                    wait = ghota_schedule_download_delay(
+                        ghota_client_get_config(handle)->downloadWindow);
+#endif
+                }
+                if (wait)
+                {
+                    /* the handle is idle meanwhile, the timer checks the release again
+                    at the end of the wait and downloads it then */
+                    ESP_LOGI(
+                        TAG,
+                        "Starting download in %" PRIu32 " s",
+                        wait);
+                    ghota_client_set_download_due(handle, true);
+                    if (esp_timer_get_time() + (int64_t)wait * 1000000 <
+                        ghota_client_get_deadline(handle))
+                    {
+                        ghota_set_deadline(handle, wait);
+                    }
+                }
+                else
+                {
+                    ghota_client_set_phase(handle, GHOTA_PHASE_DOWNLOADING);
+                    ghota_run_update(handle);
+                }
             }
             else
             {
@@ -1002,78 +2006,76 @@ static void ghota_task(void *pvParameters)
             ESP_LOGI(TAG, "No Update Available");
         }
     }
+    if (handle)
+    {
+        ghota_disconnect(handle);
+        ghota_release(handle);
+    }
     ESP_LOGI(TAG, "Firmware Update Task Finished");
-    vTaskDelete(
-        ghota_client_get_task_handle(handle));
-    vTaskDelay(pdMS_TO_TICKS(1000));
-    ghota_client_set_task_handle(handle, NULL);
+    vTaskDelete(NULL);
 }
 
-esp_err_t ghota_start_update_task(
-    ghota_client_handle_t *handle)
+static esp_err_t ghota_start_task(
+    ghota_client_handle_t *handle,
+    bool scheduled)
 {
     if (!handle)
     {
         return ESP_FAIL;
     }
-    eTaskState state = eInvalid;
-    TaskHandle_t tmp =
-        xTaskGetHandle("ghota_task");
-    if (tmp)
-    {
-        state = eTaskGetState(tmp);
-    }
-    if (state == eDeleted || state == eInvalid)
+    /* one task per handle, other handles run their own */
+    if (!ghota_claim(handle, GHOTA_PHASE_CHECKING))
     {
-        ESP_LOGD(
-            TAG,
-            "Starting Task to Check for Updates");
-        if (xTaskCreate(
-                ghota_task,
-                "ghota_task",
-                6144,
-                handle,
-                5,
-                &tmp) != pdPASS)
-        {
-            ESP_LOGW(TAG, "Failed to Start ghota_task");
-            ghota_client_set_task_handle(handle, NULL);
-            return ESP_FAIL;
-        }
-        ghota_client_set_task_handle(handle, tmp);
+        ESP_LOGW(TAG, "ghota_task Already Running");
+        return ESP_FAIL;
     }
-    else
+    ghota_client_set_scheduled(handle, scheduled);
+    ESP_LOGD(
+        TAG,
+        "Starting Task to Check for Updates");
+    if (xTaskCreate(
+            ghota_task,
+            "ghota_task",
+            6144,
+            handle,
+            5,
+            NULL) != pdPASS)
     {
-        ESP_LOGW(TAG, "ghota_task Already Running");
+        ESP_LOGW(TAG, "Failed to Start ghota_task");
+        ghota_release(handle);
         return ESP_FAIL;
     }
     return ESP_OK;
 }
 
+esp_err_t ghota_start_update_task(
+    ghota_client_handle_t *handle)
+{
+    return ghota_start_task(handle, false);
+}
+
 static void ghota_timer_callback(
     TimerHandle_t xTimer)
 {
+    /* ghota_stop_update_timer clears the id of a stopped timer */
     ghota_client_handle_t *handle =
         (ghota_client_handle_t *)pvTimerGetTimerID(
             xTimer);
     if (handle)
     {
-        uint32_t cd =
-            ghota_client_get_countdown(handle);
-
-        cd = ghota_client_set_countdown(
-            handle,
-            cd - 1);
-        if (cd == 0)
+        if (ghota_client_get_deadline(handle) > esp_timer_get_time())
         {
-            ghota_config_t *cfg =
-                ghota_client_get_config(handle);
-            ghota_client_set_countdown(
-                handle,
-                cfg->updateInterval);
-
-            ghota_start_update_task(handle);
+            /* a part of the way to a distant deadline */
+            ghota_arm_timer(handle);
+            return;
         }
+        /* the check sets the real deadline, this one only applies if it does not run */
+        ghota_set_deadline(
+            handle,
+            ghota_update_interval(
+                ghota_client_get_config(handle)));
+
+        ghota_start_task(handle, true);
     }
 }
 
@@ -1084,19 +2086,21 @@ esp_err_t ghota_start_update_timer(ghota_client_handle_t *handle)
         ESP_LOGE(TAG, "Failed to initialize GHOTA Client");
         return ESP_FAIL;
     }
-
     ghota_config_t *cfg =
         ghota_client_get_config(handle);
-    ghota_client_set_countdown(
-        handle,
-        cfg->updateInterval);
+    uint32_t interval =
+        ghota_update_interval(cfg);
+    if (interval == 0)
+    {
+        ESP_LOGE(TAG, "No update interval configured");
+        return ESP_ERR_INVALID_ARG;
+    }
 
-    /* run timer every minute */
-    uint64_t ticks = pdMS_TO_TICKS(1000) * 60;
+    /* the period is replaced when the timer is armed for the deadline */
     TimerHandle_t timer = xTimerCreate(
         "ghota_timer",
-        ticks,
-        pdTRUE,
+        1,
+        pdFALSE,
         (void *)handle,
         ghota_timer_callback);
     if (timer == NULL)
@@ -1104,20 +2108,120 @@ esp_err_t ghota_start_update_timer(ghota_client_handle_t *handle)
         ESP_LOGE(TAG, "Failed to create timer");
         return ESP_FAIL;
     }
+    /* two callers may start the timer at once, only one of them gets the handle */
+    if (!ghota_client_claim_timer(handle, timer))
+    {
+        ESP_LOGW(TAG, "Update Timer Already Started");
+        xTimerDelete(timer, portMAX_DELAY);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+#ifdef CONFIG_GHOTA_FLEET_JITTER
+    /* devices that boot together each check at their own offset, after at least a
+    minute (or the interval, if shorter) */
+    uint32_t delay = (interval < 60 ? interval : 60) +
+                     ghota_schedule_phase(
+                         cfg->deviceid,
+                         cfg->checkSpread ? cfg->checkSpread * 60 : interval);
+#else
+    uint32_t delay = interval;
+#endif
+    if (ghota_set_deadline(handle, delay) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to start timer");
+        xTimerDelete(timer, portMAX_DELAY);
+        ghota_client_set_timer(handle, NULL);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(
+        TAG,
+        "Started Update Timer for %" PRIu32 " Seconds, first check in %" PRIu32 " Seconds",
+        interval,
+        delay);
+    return ESP_OK;
+}
+
+typedef struct
+{
+    ghota_client_handle_t *handle;
+    TaskHandle_t caller;
+    esp_err_t err;
+} ghota_timer_stop_t;
+
+/* runs on the timer task, between callbacks. A callback that fires later
+finds no handle */
+static void ghota_timer_stop(
+    void *param,
+    uint32_t unused)
+{
+    ghota_timer_stop_t *stop = param;
+    TimerHandle_t timer =
+        ghota_client_get_timer(stop->handle);
+    ghota_client_set_timer(stop->handle, NULL);
+    vTimerSetTimerID(timer, NULL);
+    stop->err = xTimerDelete(timer, 0) == pdPASS ? ESP_OK : ESP_FAIL;
+    if (stop->caller != xTimerGetTimerDaemonTaskHandle())
+    {
+        xTaskNotifyGive(stop->caller);
+    }
+}
+
+esp_err_t ghota_stop_update_timer(ghota_client_handle_t *handle)
+{
+    if (!handle)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    TimerHandle_t timer =
+        ghota_client_get_timer(handle);
+    if (timer == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    ghota_timer_stop_t stop = {
+        .handle = handle,
+        .caller = xTaskGetCurrentTaskHandle(),
+    };
+    if (stop.caller == xTimerGetTimerDaemonTaskHandle())
+    {
+        ghota_timer_stop(&stop, 0);
+    }
     else
     {
-        if (xTimerStart(timer, 0) != pdPASS)
+        /* after the callback that may be running, which still uses the timer and the handle */
+        if (xTimerPendFunctionCall(
+                ghota_timer_stop,
+                &stop,
+                0,
+                portMAX_DELAY) != pdPASS)
         {
-            ESP_LOGE(TAG, "Failed to start timer");
+            ESP_LOGE(TAG, "Failed to stop timer");
             return ESP_FAIL;
         }
-        else
-        {
-            ESP_LOGI(
-                TAG,
-                "Started Update Timer for %" PRIu32 " Minutes",
-                cfg->updateInterval);
-        }
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+    if (stop.err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to delete timer");
+        return stop.err;
     }
+    ESP_LOGI(TAG, "Stopped Update Timer");
     return ESP_OK;
 }
+
+esp_err_t ghota_reschedule_update_timer(ghota_client_handle_t *handle, uint32_t delay)
+{
+    if (!handle)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (ghota_client_get_timer(handle) == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    ESP_LOGI(
+        TAG,
+        "Next check in %" PRIu32 " s",
+        delay);
+    return ghota_set_deadline(handle, delay);
+}
@@ -0,0 +1,401 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <inttypes.h>
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+#include <nvs.h>
+
+#include "esp_ghota_cache.h"
+
+static const char *CACHE_TAG = "GHOTA_CACHE";
+
+#define GHOTA_CACHE_NAMESPACE "ghota"
+#define GHOTA_CACHE_VERSION 7
+
+struct ghota_release_cache
+{
+    uint32_t version;
+    uint32_t config_crc;
+    ghota_release_validators_t validators;
+    char tag_name[CONFIG_MAX_FILENAME_LEN];
+    char name[CONFIG_MAX_FILENAME_LEN];
+    char url[CONFIG_MAX_URL_LEN];
+    char storageurl[CONFIG_MAX_URL_LEN];
+    uint32_t size;
+    uint32_t storagesize;
+    char digest[GHOTA_SHA256_HEX_LEN];
+    char storagedigest[GHOTA_SHA256_HEX_LEN];
+    char storagedigesturl[CONFIG_MAX_URL_LEN];
+    char patchurl[CONFIG_MAX_URL_LEN];
+    uint32_t patchsize;
+    uint8_t compression;
+    uint8_t storagecompression;
+    uint8_t rollout;
+    uint16_t flags;
+};
+
+/* one entry per release url, NVS keys are limited to 15 characters */
+static void ghota_cache_key(
+    const char *url,
+    char *key,
+    size_t len)
+{
+    snprintf(
+        key,
+        len,
+        "rel%08" PRIx32,
+        esp_rom_crc32_le(
+            0,
+            (const uint8_t *)url,
+            strlen(url)));
+}
+
+/* the cached result is only valid for the asset patterns it was matched against,
+and a patch only for the version it was selected for */
+static uint32_t ghota_cache_config_crc(
+    ghota_client_handle_t *handle)
+{
+    ghota_config_t *config =
+        ghota_client_get_config(handle);
+    uint32_t crc = esp_rom_crc32_le(
+        0,
+        (const uint8_t *)config->filenamematch,
+        strlen(config->filenamematch));
+    crc = esp_rom_crc32_le(
+        crc,
+        (const uint8_t *)config->storagenamematch,
+        strlen(config->storagenamematch));
+    crc = esp_rom_crc32_le(
+        crc,
+        (const uint8_t *)config->variant,
+        strlen(config->variant));
+    if (strlen(config->patchnamematch))
+    {
+        char version[64] = {0};
+        semver_render(
+            ghota_client_get_current_version(handle),
+            version);
+        crc = esp_rom_crc32_le(
+            crc,
+            (const uint8_t *)config->patchnamematch,
+            strlen(config->patchnamematch));
+        crc = esp_rom_crc32_le(
+            crc,
+            (const uint8_t *)version,
+            strlen(version));
+    }
+    return crc;
+}
+
+ghota_release_cache_t *ghota_cache_load(
+    ghota_client_handle_t *handle,
+    const char *url,
+    ghota_release_validators_t *validators)
+{
+    char key[16];
+    nvs_handle_t nvs;
+    ghota_cache_key(url, key, sizeof(key));
+
+    esp_err_t err = nvs_open(
+        GHOTA_CACHE_NAMESPACE,
+        NVS_READONLY,
+        &nvs);
+    if (err != ESP_OK)
+    {
+        ESP_LOGD(
+            CACHE_TAG,
+            "No release cache: %s",
+            esp_err_to_name(err));
+        return NULL;
+    }
+    ghota_release_cache_t *cache =
+        malloc(sizeof(ghota_release_cache_t));
+    if (cache == NULL)
+    {
+        nvs_close(nvs);
+        return NULL;
+    }
+    size_t len = sizeof(ghota_release_cache_t);
+    err = nvs_get_blob(nvs, key, cache, &len);
+    nvs_close(nvs);
+    if (err != ESP_OK ||
+        len != sizeof(ghota_release_cache_t) ||
+        cache->version != GHOTA_CACHE_VERSION ||
+        cache->config_crc != ghota_cache_config_crc(handle))
+    {
+        ESP_LOGD(
+            CACHE_TAG,
+            "No usable cached release for %s",
+            url);
+        free(cache);
+        return NULL;
+    }
+    memcpy(
+        validators,
+        &cache->validators,
+        sizeof(ghota_release_validators_t));
+    validators->not_modified = false;
+    ESP_LOGD(
+        CACHE_TAG,
+        "Cached release %s, ETag %s",
+        cache->tag_name,
+        cache->validators.etag);
+    return cache;
+}
+
+void ghota_cache_apply(
+    ghota_client_handle_t *handle,
+    const ghota_release_cache_t *cache)
+{
+    ghota_client_set_result_tag_name(
+        handle,
+        (char *)cache->tag_name);
+    ghota_client_set_result_name(
+        handle,
+        (char *)cache->name);
+    ghota_client_set_result_url(
+        handle,
+        (char *)cache->url);
+    ghota_client_set_result_storage_url(
+        handle,
+        (char *)cache->storageurl);
+    ghota_client_set_result_size(
+        handle,
+        cache->size);
+    ghota_client_set_result_storage_size(
+        handle,
+        cache->storagesize);
+    ghota_client_set_result_digest(
+        handle,
+        cache->digest);
+    ghota_client_set_result_storage_digest(
+        handle,
+        cache->storagedigest);
+    ghota_client_set_result_storage_digest_url(
+        handle,
+        cache->storagedigesturl);
+    ghota_client_set_result_patch_url(
+        handle,
+        cache->patchurl);
+    ghota_client_set_result_patch_size(
+        handle,
+        cache->patchsize);
+    ghota_client_set_result_compression(
+        handle,
+        cache->compression);
+    ghota_client_set_result_storage_compression(
+        handle,
+        cache->storagecompression);
+    ghota_client_set_result_rollout(
+        handle,
+        cache->rollout);
+    ghota_client_set_result_flags(
+        handle,
+        cache->flags);
+}
+
+esp_err_t ghota_cache_store(
+    ghota_client_handle_t *handle,
+    const char *url,
+    const ghota_release_validators_t *validators)
+{
+    char key[16];
+    nvs_handle_t nvs;
+
+    if (!strlen(validators->etag) &&
+        !strlen(validators->last_modified))
+    {
+        /* nothing to revalidate against */
+        return ESP_ERR_INVALID_ARG;
+    }
+    ghota_release_cache_t *cache =
+        calloc(1, sizeof(ghota_release_cache_t));
+    if (cache == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    cache->version = GHOTA_CACHE_VERSION;
+    cache->config_crc = ghota_cache_config_crc(handle);
+    memcpy(
+        &cache->validators,
+        validators,
+        sizeof(ghota_release_validators_t));
+    cache->validators.not_modified = false;
+    strlcpy(
+        cache->tag_name,
+        ghota_client_get_result_tag_name(handle),
+        sizeof(cache->tag_name));
+    strlcpy(
+        cache->name,
+        ghota_client_get_result_name(handle),
+        sizeof(cache->name));
+    strlcpy(
+        cache->url,
+        ghota_client_get_result_url(handle),
+        sizeof(cache->url));
+    strlcpy(
+        cache->storageurl,
+        ghota_client_get_result_storage_url(handle),
+        sizeof(cache->storageurl));
+    cache->size =
+        ghota_client_get_result_size(handle);
+    cache->storagesize =
+        ghota_client_get_result_storage_size(handle);
+    strlcpy(
+        cache->digest,
+        ghota_client_get_result_digest(handle),
+        sizeof(cache->digest));
+    strlcpy(
+        cache->storagedigest,
+        ghota_client_get_result_storage_digest(handle),
+        sizeof(cache->storagedigest));
+    strlcpy(
+        cache->storagedigesturl,
+        ghota_client_get_result_storage_digest_url(handle),
+        sizeof(cache->storagedigesturl));
+    strlcpy(
+        cache->patchurl,
+        ghota_client_get_result_patch_url(handle),
+        sizeof(cache->patchurl));
+    cache->patchsize =
+        ghota_client_get_result_patch_size(handle);
+    cache->compression =
+        ghota_client_get_result_compression(handle);
+    cache->storagecompression =
+        ghota_client_get_result_storage_compression(handle);
+    cache->rollout =
+        ghota_client_get_result_rollout(handle);
+    cache->flags =
+        ghota_client_get_result_flag(handle, 0xFFFF);
+
+    ghota_cache_key(url, key, sizeof(key));
+    esp_err_t err = nvs_open(
+        GHOTA_CACHE_NAMESPACE,
+        NVS_READWRITE,
+        &nvs);
+    if (err == ESP_OK)
+    {
+        err = nvs_set_blob(
+            nvs,
+            key,
+            cache,
+            sizeof(ghota_release_cache_t));
+        if (err == ESP_OK)
+            err = nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(
+            CACHE_TAG,
+            "Failed to store release cache: %s",
+            esp_err_to_name(err));
+    }
+    free(cache);
+    return err;
+}
+
+void ghota_cache_free(
+    ghota_release_cache_t *cache)
+{
+    free(cache);
+}
+
+/* one record per partition, so that each slot of the firmware keeps its own */
+static void ghota_installed_key(
+    const esp_partition_t *partition,
+    char *key,
+    size_t len)
+{
+    snprintf(
+        key,
+        len,
+        "inst%08" PRIx32,
+        partition->address);
+}
+
+bool ghota_cache_is_installed(
+    const esp_partition_t *partition,
+    const char *digest)
+{
+    nvs_handle_t nvs;
+    char key[16];
+    char installed[GHOTA_SHA256_HEX_LEN];
+    size_t len = sizeof(installed);
+
+    if (partition == NULL || !strlen(digest))
+    {
+        return false;
+    }
+    if (nvs_open(
+            GHOTA_CACHE_NAMESPACE,
+            NVS_READONLY,
+            &nvs) != ESP_OK)
+    {
+        return false;
+    }
+    ghota_installed_key(
+        partition,
+        key,
+        sizeof(key));
+    esp_err_t err = nvs_get_blob(
+        nvs,
+        key,
+        installed,
+        &len);
+    nvs_close(nvs);
+    return err == ESP_OK &&
+           len == strlen(digest) + 1 &&
+           strncasecmp(installed, digest, len) == 0;
+}
+
+esp_err_t ghota_cache_set_installed(
+    const esp_partition_t *partition,
+    const char *digest)
+{
+    nvs_handle_t nvs;
+    char key[16];
+    char installed[GHOTA_SHA256_HEX_LEN];
+
+    if (partition == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    strlcpy(
+        installed,
+        digest,
+        sizeof(installed));
+    ghota_installed_key(
+        partition,
+        key,
+        sizeof(key));
+    esp_err_t err = nvs_open(
+        GHOTA_CACHE_NAMESPACE,
+        NVS_READWRITE,
+        &nvs);
+    if (err == ESP_OK)
+    {
+        /* an unknown digest must not leave the one of the old content behind */
+        if (strlen(digest))
+            err = nvs_set_blob(
+                nvs,
+                key,
+                installed,
+                strlen(installed) + 1);
+        else
+            nvs_erase_key(nvs, key);
+        if (err == ESP_OK)
+            err = nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(
+            CACHE_TAG,
+            "Failed to store installed digest: %s",
+            esp_err_to_name(err));
+    }
+    return err;
+}
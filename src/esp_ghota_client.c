@@ -1,6 +1,13 @@
+#include <stdatomic.h>
 #include "esp_ghota_client.h"
 #include "esp_ghota_config.h"
 #include "sdkconfig.h"
+#include "esp_idf_version.h"
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#include "esp_mac.h"
+#else
+#include "esp_system.h"
+#endif
 #include "interface/ghota_interface.h"
 
 typedef struct ghota_client_handle
@@ -14,18 +21,38 @@ typedef struct ghota_client_handle
         char name[CONFIG_MAX_FILENAME_LEN];
         char url[CONFIG_MAX_URL_LEN];
         char storageurl[CONFIG_MAX_URL_LEN];
-        uint8_t flags;
+        uint32_t size;
+        uint32_t storagesize;
+        char digest[GHOTA_SHA256_HEX_LEN];
+        char storagedigest[GHOTA_SHA256_HEX_LEN];
+        char storagedigesturl[CONFIG_MAX_URL_LEN];
+        char patchurl[CONFIG_MAX_URL_LEN];
+        uint32_t patchsize;
+        ghota_compression_t compression;
+        ghota_compression_t storagecompression;
+        uint8_t rollout;
+        uint16_t flags;
     } result;
     struct
     {
         char name[CONFIG_MAX_FILENAME_LEN];
         char url[CONFIG_MAX_URL_LEN];
+        uint32_t size;
+        char digest[GHOTA_SHA256_HEX_LEN];
+        char notes[GHOTA_NOTES_TAIL_LEN];
     } scratch;
     semver_t current_version;
     semver_t latest_version;
-    uint32_t countdown;
-    TaskHandle_t task_handle;
+    _Atomic(TimerHandle_t) timer;
+    _Atomic(int64_t) deadline;
+    atomic_int phase;
+    bool scheduled;
+    bool download_due;
     const esp_partition_t *storage_partition;
+    void *interface_ctx;
+    ghota_connection_stats_t connection_stats;
+    ghota_rate_limit_t rate_limit;
+    ghota_schedule_t schedule;
 } ghota_client_handle_t;
 
 char *ghota_client_get_username(
@@ -38,8 +65,13 @@ int ghota_client_set_username(
     ghota_client_handle_t *handle,
     const char *username)
 {
-    return asprintf(
+    int ret = asprintf(
         &handle->username, "%s", username);
+    if (ret < 0)
+    {
+        handle->username = NULL;
+    }
+    return ret;
 }
 
 char *ghota_client_get_token(
@@ -52,34 +84,39 @@ int ghota_client_set_token(
     ghota_client_handle_t *handle,
     const char *token)
 {
-    return asprintf(
+    int ret = asprintf(
         &handle->token, "%s", token);
+    if (ret < 0)
+    {
+        handle->token = NULL;
+    }
+    return ret;
 }
 
 void ghota_client_set_result_flag(
     ghota_client_handle_t *handle,
-    uint8_t flag)
+    uint16_t flag)
 {
     handle->result.flags |= flag;
 }
 
 void ghota_client_set_result_flags(
     ghota_client_handle_t *handle,
-    uint8_t value)
+    uint16_t value)
 {
     handle->result.flags = value;
 }
 
-uint8_t ghota_client_get_result_flag(
+uint16_t ghota_client_get_result_flag(
     ghota_client_handle_t *handle,
-    uint8_t flag)
+    uint16_t flag)
 {
     return handle->result.flags & flag;
 }
 
 void ghota_client_clear_result_flag(
     ghota_client_handle_t *handle,
-    uint8_t flag)
+    uint16_t flag)
 {
     handle->result.flags &= ~flag;
 }
@@ -148,6 +185,148 @@ void ghota_client_set_result_storage_url(
         CONFIG_MAX_URL_LEN);
 }
 
+uint32_t ghota_client_get_result_size(
+    ghota_client_handle_t *handle)
+{
+    return handle->result.size;
+}
+
+void ghota_client_set_result_size(
+    ghota_client_handle_t *handle,
+    uint32_t size)
+{
+    handle->result.size = size;
+}
+
+uint32_t ghota_client_get_result_storage_size(
+    ghota_client_handle_t *handle)
+{
+    return handle->result.storagesize;
+}
+
+void ghota_client_set_result_storage_size(
+    ghota_client_handle_t *handle,
+    uint32_t size)
+{
+    handle->result.storagesize = size;
+}
+
+char *ghota_client_get_result_digest(
+    ghota_client_handle_t *handle)
+{
+    return handle->result.digest;
+}
+
+void ghota_client_set_result_digest(
+    ghota_client_handle_t *handle,
+    const char *digest)
+{
+    strlcpy(
+        handle->result.digest,
+        digest,
+        GHOTA_SHA256_HEX_LEN);
+}
+
+char *ghota_client_get_result_storage_digest(
+    ghota_client_handle_t *handle)
+{
+    return handle->result.storagedigest;
+}
+
+void ghota_client_set_result_storage_digest(
+    ghota_client_handle_t *handle,
+    const char *digest)
+{
+    strlcpy(
+        handle->result.storagedigest,
+        digest,
+        GHOTA_SHA256_HEX_LEN);
+}
+
+char *ghota_client_get_result_storage_digest_url(
+    ghota_client_handle_t *handle)
+{
+    return handle->result.storagedigesturl;
+}
+
+void ghota_client_set_result_storage_digest_url(
+    ghota_client_handle_t *handle,
+    const char *url)
+{
+    strlcpy(
+        handle->result.storagedigesturl,
+        url,
+        CONFIG_MAX_URL_LEN);
+}
+
+char *ghota_client_get_result_patch_url(
+    ghota_client_handle_t *handle)
+{
+    return handle->result.patchurl;
+}
+
+void ghota_client_set_result_patch_url(
+    ghota_client_handle_t *handle,
+    const char *url)
+{
+    strlcpy(
+        handle->result.patchurl,
+        url,
+        CONFIG_MAX_URL_LEN);
+}
+
+uint32_t ghota_client_get_result_patch_size(
+    ghota_client_handle_t *handle)
+{
+    return handle->result.patchsize;
+}
+
+void ghota_client_set_result_patch_size(
+    ghota_client_handle_t *handle,
+    uint32_t size)
+{
+    handle->result.patchsize = size;
+}
+
+ghota_compression_t ghota_client_get_result_compression(
+    ghota_client_handle_t *handle)
+{
+    return handle->result.compression;
+}
+
+void ghota_client_set_result_compression(
+    ghota_client_handle_t *handle,
+    ghota_compression_t compression)
+{
+    handle->result.compression = compression;
+}
+
+ghota_compression_t ghota_client_get_result_storage_compression(
+    ghota_client_handle_t *handle)
+{
+    return handle->result.storagecompression;
+}
+
+void ghota_client_set_result_storage_compression(
+    ghota_client_handle_t *handle,
+    ghota_compression_t compression)
+{
+    handle->result.storagecompression = compression;
+}
+
+uint8_t ghota_client_get_result_rollout(
+    ghota_client_handle_t *handle)
+{
+    return handle->result.rollout;
+}
+
+void ghota_client_set_result_rollout(
+    ghota_client_handle_t *handle,
+    uint8_t percent)
+{
+    handle->result.rollout = percent;
+}
+
 size_t ghota_client_get_handle_size()
 {
     return sizeof(ghota_client_handle_t);
@@ -175,6 +354,10 @@ void ghota_client_set_config(
         handle->config.storagepartitionname,
         config->storagepartitionname,
         17);
+    strncpy(
+        handle->config.patchnamematch,
+        config->patchnamematch,
+        CONFIG_MAX_FILENAME_LEN);
 
     if (config->hostname == NULL)
         asprintf(
@@ -203,8 +386,82 @@ void ghota_client_set_config(
             &handle->config.reponame,
             config->reponame);
 
+    if (config->manifesturl == NULL)
+        asprintf(
+            &handle->config.manifesturl,
+            "%s",
+            CONFIG_GHOTA_MANIFEST_URL);
+    else
+        asprintf(
+            &handle->config.manifesturl,
+            "%s",
+            config->manifesturl);
+
+    if (strlen(config->variant))
+        strlcpy(
+            handle->config.variant,
+            config->variant,
+            CONFIG_MAX_FILENAME_LEN);
+    else if (strlen(CONFIG_GHOTA_MANIFEST_VARIANT))
+        strlcpy(
+            handle->config.variant,
+            CONFIG_GHOTA_MANIFEST_VARIANT,
+            CONFIG_MAX_FILENAME_LEN);
+    else
+        strlcpy(
+            handle->config.variant,
+            CONFIG_IDF_TARGET,
+            CONFIG_MAX_FILENAME_LEN);
+
+#ifdef CONFIG_GHOTA_PROBE
+    /* the default page is on public Github, another API host would probe an unrelated repository */
+    if (config->probeurl == NULL &&
+        strcmp(handle->config.hostname, "api.github.com"))
+        asprintf(
+            &handle->config.probeurl,
+            "%s",
+            "");
+    else if (config->probeurl == NULL)
+        asprintf(
+            &handle->config.probeurl,
+            "%s",
+            CONFIG_GHOTA_PROBE_URL);
+    else
+#endif
+        asprintf(
+            &handle->config.probeurl,
+            "%s",
+            config->probeurl ? config->probeurl : "");
+
+    if (config->deviceid == NULL)
+    {
+        uint8_t mac[6] = {0};
+        esp_efuse_mac_get_default(mac);
+        asprintf(
+            &handle->config.deviceid,
+            "%02x%02x%02x%02x%02x%02x",
+            mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    }
+    else
+        asprintf(
+            &handle->config.deviceid,
+            "%s",
+            config->deviceid);
+
     handle->config.updateInterval =
         config->updateInterval;
+    handle->config.updateIntervalSeconds =
+        config->updateIntervalSeconds;
+    handle->config.checkSpread =
+        config->checkSpread;
+    handle->config.downloadWindow =
+        config->downloadWindow;
+    if (handle->config.downloadWindow == GHOTA_DOWNLOAD_WINDOW_DEFAULT)
+#ifdef CONFIG_GHOTA_DOWNLOAD_WINDOW
+        handle->config.downloadWindow = CONFIG_GHOTA_DOWNLOAD_WINDOW;
+#else
+        handle->config.downloadWindow = 0;
+#endif
     handle->config.interface =
         config->interface;
 }
@@ -222,17 +479,29 @@ void ghota_client_set_current_version(
     handle->current_version = curr_ver;
 }
 
-TaskHandle_t ghota_client_get_task_handle(
-    ghota_client_handle_t *client_handle)
+ghota_phase_t ghota_client_get_phase(
+    ghota_client_handle_t *handle)
+{
+    return (ghota_phase_t)atomic_load(&handle->phase);
+}
+
+void ghota_client_set_phase(
+    ghota_client_handle_t *handle,
+    ghota_phase_t phase)
 {
-    return client_handle->task_handle;
+    atomic_store(&handle->phase, phase);
 }
 
-void ghota_client_set_task_handle(
-    ghota_client_handle_t *client_handle,
-    TaskHandle_t task_handle)
+ghota_phase_t ghota_client_claim_phase(
+    ghota_client_handle_t *handle,
+    ghota_phase_t phase)
 {
-    client_handle->task_handle = task_handle;
+    int current = GHOTA_PHASE_IDLE;
+    atomic_compare_exchange_strong(
+        &handle->phase,
+        &current,
+        phase);
+    return (ghota_phase_t)current;
 }
 
 semver_t *ghota_client_get_latest_version(
@@ -280,6 +549,51 @@ void ghota_client_set_scratch_url(
         CONFIG_MAX_URL_LEN);
 }
 
+uint32_t ghota_client_get_scratch_size(
+    ghota_client_handle_t *handle)
+{
+    return handle->scratch.size;
+}
+
+void ghota_client_set_scratch_size(
+    ghota_client_handle_t *handle,
+    uint32_t size)
+{
+    handle->scratch.size = size;
+}
+
+char *ghota_client_get_scratch_digest(
+    ghota_client_handle_t *handle)
+{
+    return handle->scratch.digest;
+}
+
+void ghota_client_set_scratch_digest(
+    ghota_client_handle_t *handle,
+    const char *digest)
+{
+    strlcpy(
+        handle->scratch.digest,
+        digest,
+        GHOTA_SHA256_HEX_LEN);
+}
+
+char *ghota_client_get_scratch_notes(
+    ghota_client_handle_t *handle)
+{
+    return handle->scratch.notes;
+}
+
+void ghota_client_set_scratch_notes(
+    ghota_client_handle_t *handle,
+    const char *notes)
+{
+    strlcpy(
+        handle->scratch.notes,
+        notes,
+        GHOTA_NOTES_TAIL_LEN);
+}
+
 const esp_partition_t *ghota_client_get_storage_partition(
     ghota_client_handle_t *handle)
 {
@@ -294,17 +608,94 @@ void ghota_client_set_partition(
         storage_partition;
 }
 
-uint32_t ghota_client_get_countdown(
+void *ghota_client_get_interface_ctx(
     ghota_client_handle_t *handle)
 {
-    return handle->countdown;
+    return handle->interface_ctx;
 }
 
-uint32_t ghota_client_set_countdown(
+void ghota_client_set_interface_ctx(
     ghota_client_handle_t *handle,
-    uint32_t countdown)
+    void *ctx)
 {
-    handle->countdown = countdown;
+    handle->interface_ctx = ctx;
+}
 
-    return handle->countdown;
+ghota_connection_stats_t *ghota_client_get_connection_stats(
+    ghota_client_handle_t *handle)
+{
+    return &handle->connection_stats;
+}
+
+ghota_rate_limit_t *ghota_client_get_rate_limit(
+    ghota_client_handle_t *handle)
+{
+    return &handle->rate_limit;
+}
+
+ghota_schedule_t *ghota_client_get_schedule(
+    ghota_client_handle_t *handle)
+{
+    return &handle->schedule;
+}
+
+/* the timer and the deadline are shared with the timer task */
+TimerHandle_t ghota_client_get_timer(
+    ghota_client_handle_t *handle)
+{
+    return atomic_load(&handle->timer);
+}
+
+void ghota_client_set_timer(
+    ghota_client_handle_t *handle,
+    TimerHandle_t timer)
+{
+    atomic_store(&handle->timer, timer);
+}
+
+bool ghota_client_claim_timer(
+    ghota_client_handle_t *handle,
+    TimerHandle_t timer)
+{
+    TimerHandle_t none = NULL;
+    return atomic_compare_exchange_strong(&handle->timer, &none, timer);
+}
+
+bool ghota_client_get_scheduled(
+    ghota_client_handle_t *handle)
+{
+    return handle->scheduled;
+}
+
+void ghota_client_set_scheduled(
+    ghota_client_handle_t *handle,
+    bool scheduled)
+{
+    handle->scheduled = scheduled;
+}
+
+bool ghota_client_get_download_due(
+    ghota_client_handle_t *handle)
+{
+    return handle->download_due;
+}
+
+void ghota_client_set_download_due(
+    ghota_client_handle_t *handle,
+    bool download_due)
+{
+    handle->download_due = download_due;
+}
+
+int64_t ghota_client_get_deadline(
+    ghota_client_handle_t *handle)
+{
+    return atomic_load(&handle->deadline);
+}
+
+void ghota_client_set_deadline(
+    ghota_client_handle_t *handle,
+    int64_t deadline)
+{
+    atomic_store(&handle->deadline, deadline);
 }
@@ -0,0 +1,601 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <esp_rom_crc.h>
+#include <esp_idf_version.h>
+#include <mbedtls/sha256.h>
+#include "sdkconfig.h"
+#ifdef CONFIG_GHOTA_DECOMPRESS_GZIP
+#include "rom/miniz.h"
+#endif
+
+#include "esp_ghota_decompress.h"
+
+#if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(5, 0, 0)
+#define mbedtls_sha256_starts mbedtls_sha256_starts_ret
+#define mbedtls_sha256_update mbedtls_sha256_update_ret
+#define mbedtls_sha256_finish mbedtls_sha256_finish_ret
+#endif
+
+#define GHOTA_DECOMPRESS_OUT_SIZE 256
+
+/* gzip member header, RFC 1952 */
+#define GHOTA_GZIP_HEADER_LEN 10
+#define GHOTA_GZIP_TRAILER_LEN 8
+#define GHOTA_GZIP_FHCRC 0x02
+#define GHOTA_GZIP_FEXTRA 0x04
+#define GHOTA_GZIP_FNAME 0x08
+#define GHOTA_GZIP_FCOMMENT 0x10
+
+typedef enum
+{
+    GHOTA_GZIP_STATE_HEADER,
+    GHOTA_GZIP_STATE_EXTRA_LEN,
+    GHOTA_GZIP_STATE_EXTRA,
+    GHOTA_GZIP_STATE_NAME,
+    GHOTA_GZIP_STATE_COMMENT,
+    GHOTA_GZIP_STATE_HCRC,
+    GHOTA_GZIP_STATE_DEFLATE,
+    GHOTA_GZIP_STATE_TRAILER,
+    GHOTA_GZIP_STATE_DONE,
+} ghota_gzip_state_t;
+
+typedef enum
+{
+    GHOTA_HS_STATE_TAG,
+    GHOTA_HS_STATE_LITERAL,
+    GHOTA_HS_STATE_INDEX,
+    GHOTA_HS_STATE_COUNT,
+} ghota_hs_state_t;
+
+struct ghota_decompress
+{
+    ghota_compression_t type;
+    ghota_decompress_write_t write;
+    void *ctx;
+    uint32_t in;
+    uint32_t out;
+    mbedtls_sha256_context *sha256;
+    uint8_t digest[32];
+    bool finished;
+#ifdef CONFIG_GHOTA_DECOMPRESS_GZIP
+    struct
+    {
+        ghota_gzip_state_t state;
+        uint8_t buf[GHOTA_GZIP_HEADER_LEN];
+        size_t buf_len;
+        uint8_t flags;
+        uint32_t skip;
+        uint32_t crc;
+        tinfl_decompressor *inflator;
+        tinfl_status status;
+        uint8_t *dict;
+        size_t dict_ofs;
+    } gzip;
+#endif
+#ifdef CONFIG_GHOTA_DECOMPRESS_HEATSHRINK
+    struct
+    {
+        ghota_hs_state_t state;
+        uint32_t bits;
+        uint8_t bit_count;
+        /* bits of the token being decoded, only zero padding may be left at the end */
+        uint8_t token_bits;
+        uint16_t index;
+        uint8_t *window;
+        uint32_t pos;
+        uint32_t flushed;
+    } hs;
+#endif
+};
+
+ghota_compression_t ghota_compression_from_name(
+    const char *name)
+{
+    static const struct
+    {
+        const char *suffix;
+        ghota_compression_t type;
+    } suffixes[] = {
+#ifdef CONFIG_GHOTA_DECOMPRESS_GZIP
+        {".gz", GHOTA_COMPRESSION_GZIP},
+#endif
+#ifdef CONFIG_GHOTA_DECOMPRESS_HEATSHRINK
+        {".hs", GHOTA_COMPRESSION_HEATSHRINK},
+#endif
+        {".gz", GHOTA_COMPRESSION_UNSUPPORTED},
+        {".hs", GHOTA_COMPRESSION_UNSUPPORTED},
+        {".xz", GHOTA_COMPRESSION_UNSUPPORTED},
+        {".zst", GHOTA_COMPRESSION_UNSUPPORTED},
+        {".lz4", GHOTA_COMPRESSION_UNSUPPORTED},
+        {".bz2", GHOTA_COMPRESSION_UNSUPPORTED},
+    };
+    size_t len = strlen(name);
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++)
+    {
+        size_t suffix_len = strlen(suffixes[i].suffix);
+        if (len >= suffix_len &&
+            strcasecmp(&name[len - suffix_len], suffixes[i].suffix) == 0)
+        {
+            return suffixes[i].type;
+        }
+    }
+    return GHOTA_COMPRESSION_NONE;
+}
+
+static esp_err_t ghota_decompress_emit(
+    ghota_decompress_t *dec,
+    const uint8_t *data,
+    size_t len)
+{
+    if (len == 0)
+    {
+        return ESP_OK;
+    }
+    dec->out += len;
+    return dec->write(dec->ctx, data, len);
+}
+
+#ifdef CONFIG_GHOTA_DECOMPRESS_GZIP
+static esp_err_t ghota_gzip_inflate(
+    ghota_decompress_t *dec,
+    const uint8_t *p,
+    size_t *len)
+{
+    size_t left = *len;
+    do
+    {
+        size_t in = left;
+        size_t out = TINFL_LZ_DICT_SIZE - dec->gzip.dict_ofs;
+        dec->gzip.status = tinfl_decompress(
+            dec->gzip.inflator,
+            p,
+            &in,
+            dec->gzip.dict,
+            &dec->gzip.dict[dec->gzip.dict_ofs],
+            &out,
+            TINFL_FLAG_HAS_MORE_INPUT);
+        p += in;
+        left -= in;
+        if (out)
+        {
+            dec->gzip.crc = esp_rom_crc32_le(
+                dec->gzip.crc,
+                &dec->gzip.dict[dec->gzip.dict_ofs],
+                out);
+            esp_err_t err = ghota_decompress_emit(
+                dec,
+                &dec->gzip.dict[dec->gzip.dict_ofs],
+                out);
+            if (err != ESP_OK)
+            {
+                return err;
+            }
+            dec->gzip.dict_ofs =
+                (dec->gzip.dict_ofs + out) & (TINFL_LZ_DICT_SIZE - 1);
+        }
+        if (dec->gzip.status < TINFL_STATUS_DONE)
+        {
+            return ESP_ERR_INVALID_STATE;
+        }
+        if (dec->gzip.status == TINFL_STATUS_DONE)
+        {
+            dec->gzip.state = GHOTA_GZIP_STATE_TRAILER;
+            break;
+        }
+    } while (left || dec->gzip.status == TINFL_STATUS_HAS_MORE_OUTPUT);
+    /* the trailer follows in the remaining input */
+    *len -= left;
+    return ESP_OK;
+}
+
+static esp_err_t ghota_gzip_feed(
+    ghota_decompress_t *dec,
+    const uint8_t *p,
+    size_t len)
+{
+    while (len)
+    {
+        size_t n = 1;
+        switch (dec->gzip.state)
+        {
+        case GHOTA_GZIP_STATE_HEADER:
+            dec->gzip.buf[dec->gzip.buf_len++] = *p;
+            if (dec->gzip.buf_len < GHOTA_GZIP_HEADER_LEN)
+            {
+                break;
+            }
+            /* magic and deflate */
+            if (dec->gzip.buf[0] != 0x1f ||
+                dec->gzip.buf[1] != 0x8b ||
+                dec->gzip.buf[2] != 8)
+            {
+                return ESP_ERR_INVALID_VERSION;
+            }
+            dec->gzip.flags = dec->gzip.buf[3];
+            dec->gzip.buf_len = 0;
+            dec->gzip.skip = 0;
+            dec->gzip.state = GHOTA_GZIP_STATE_EXTRA_LEN;
+            break;
+        case GHOTA_GZIP_STATE_EXTRA_LEN:
+            if (!(dec->gzip.flags & GHOTA_GZIP_FEXTRA))
+            {
+                dec->gzip.state = GHOTA_GZIP_STATE_NAME;
+                n = 0;
+                break;
+            }
+            dec->gzip.skip |= (uint32_t)*p << (8 * dec->gzip.buf_len++);
+            if (dec->gzip.buf_len == 2)
+            {
+                dec->gzip.buf_len = 0;
+                dec->gzip.state = GHOTA_GZIP_STATE_EXTRA;
+            }
+            break;
+        case GHOTA_GZIP_STATE_EXTRA:
+            n = len < dec->gzip.skip ? len : dec->gzip.skip;
+            dec->gzip.skip -= n;
+            if (dec->gzip.skip == 0)
+            {
+                dec->gzip.state = GHOTA_GZIP_STATE_NAME;
+            }
+            break;
+        case GHOTA_GZIP_STATE_NAME:
+        case GHOTA_GZIP_STATE_COMMENT:
+            if (!(dec->gzip.flags & (dec->gzip.state == GHOTA_GZIP_STATE_NAME
+                                         ? GHOTA_GZIP_FNAME
+                                         : GHOTA_GZIP_FCOMMENT)))
+            {
+                n = 0;
+            }
+            if (n == 0 || *p == '\0')
+            {
+                dec->gzip.state++;
+            }
+            break;
+        case GHOTA_GZIP_STATE_HCRC:
+            if (!(dec->gzip.flags & GHOTA_GZIP_FHCRC))
+            {
+                n = 0;
+                dec->gzip.state = GHOTA_GZIP_STATE_DEFLATE;
+            }
+            else if (++dec->gzip.buf_len == 2)
+            {
+                dec->gzip.buf_len = 0;
+                dec->gzip.state = GHOTA_GZIP_STATE_DEFLATE;
+            }
+            break;
+        case GHOTA_GZIP_STATE_DEFLATE:
+        {
+            n = len;
+            esp_err_t err = ghota_gzip_inflate(dec, p, &n);
+            if (err != ESP_OK)
+            {
+                return err;
+            }
+            break;
+        }
+        case GHOTA_GZIP_STATE_TRAILER:
+            n = GHOTA_GZIP_TRAILER_LEN - dec->gzip.buf_len;
+            n = len < n ? len : n;
+            memcpy(&dec->gzip.buf[dec->gzip.buf_len], p, n);
+            dec->gzip.buf_len += n;
+            if (dec->gzip.buf_len == GHOTA_GZIP_TRAILER_LEN)
+            {
+                dec->gzip.state = GHOTA_GZIP_STATE_DONE;
+            }
+            break;
+        default:
+            /* data after the gzip member */
+            return ESP_ERR_INVALID_SIZE;
+        }
+        p += n;
+        len -= n;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t ghota_gzip_finish(
+    ghota_decompress_t *dec)
+{
+    if (dec->gzip.state != GHOTA_GZIP_STATE_DONE)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    const uint8_t *t = dec->gzip.buf;
+    uint32_t crc = (uint32_t)t[0] | (uint32_t)t[1] << 8 |
+                   (uint32_t)t[2] << 16 | (uint32_t)t[3] << 24;
+    uint32_t size = (uint32_t)t[4] | (uint32_t)t[5] << 8 |
+                    (uint32_t)t[6] << 16 | (uint32_t)t[7] << 24;
+    if (crc != dec->gzip.crc || size != dec->out)
+    {
+        return ESP_ERR_INVALID_CRC;
+    }
+    return ESP_OK;
+}
+#endif
+
+#ifdef CONFIG_GHOTA_DECOMPRESS_HEATSHRINK
+#define GHOTA_HS_WINDOW_SIZE (1u << CONFIG_GHOTA_HEATSHRINK_WINDOW)
+#define GHOTA_HS_WINDOW_MASK (GHOTA_HS_WINDOW_SIZE - 1)
+
+/* pass the part of the window produced since the last flush on */
+static esp_err_t ghota_hs_flush(
+    ghota_decompress_t *dec)
+{
+    uint32_t start = dec->hs.flushed & GHOTA_HS_WINDOW_MASK;
+    uint32_t len = dec->hs.pos - dec->hs.flushed;
+    dec->hs.flushed = dec->hs.pos;
+    return ghota_decompress_emit(dec, &dec->hs.window[start], len);
+}
+
+static esp_err_t ghota_hs_put(
+    ghota_decompress_t *dec,
+    uint8_t byte)
+{
+    dec->hs.window[dec->hs.pos & GHOTA_HS_WINDOW_MASK] = byte;
+    dec->hs.pos++;
+    /* flush at the end of the window, before it is overwritten */
+    if ((dec->hs.pos & GHOTA_HS_WINDOW_MASK) == 0 ||
+        dec->hs.pos - dec->hs.flushed >= GHOTA_DECOMPRESS_OUT_SIZE)
+    {
+        return ghota_hs_flush(dec);
+    }
+    return ESP_OK;
+}
+
+/* take count bits, MSB first, false if they did not arrive yet */
+static bool ghota_hs_bits(
+    ghota_decompress_t *dec,
+    uint8_t count,
+    uint32_t *value)
+{
+    if (dec->hs.bit_count < count)
+    {
+        return false;
+    }
+    dec->hs.bit_count -= count;
+    *value = (dec->hs.bits >> dec->hs.bit_count) & ((1u << count) - 1);
+    dec->hs.token_bits += count;
+    return true;
+}
+
+static esp_err_t ghota_hs_feed(
+    ghota_decompress_t *dec,
+    const uint8_t *p,
+    size_t len)
+{
+    esp_err_t err = ESP_OK;
+    while (err == ESP_OK)
+    {
+        uint32_t value;
+        bool got;
+        switch (dec->hs.state)
+        {
+        case GHOTA_HS_STATE_TAG:
+            dec->hs.token_bits = 0;
+            got = ghota_hs_bits(dec, 1, &value);
+            if (got)
+            {
+                dec->hs.state = value ? GHOTA_HS_STATE_LITERAL
+                                      : GHOTA_HS_STATE_INDEX;
+            }
+            break;
+        case GHOTA_HS_STATE_LITERAL:
+            got = ghota_hs_bits(dec, 8, &value);
+            if (got)
+            {
+                err = ghota_hs_put(dec, value);
+                dec->hs.state = GHOTA_HS_STATE_TAG;
+            }
+            break;
+        case GHOTA_HS_STATE_INDEX:
+            got = ghota_hs_bits(dec, CONFIG_GHOTA_HEATSHRINK_WINDOW, &value);
+            if (got)
+            {
+                dec->hs.index = value;
+                dec->hs.state = GHOTA_HS_STATE_COUNT;
+            }
+            break;
+        default:
+            got = ghota_hs_bits(dec, CONFIG_GHOTA_HEATSHRINK_LOOKAHEAD, &value);
+            if (got)
+            {
+                /* both are stored minus one, a reference before the start reads zeros */
+                uint32_t from = dec->hs.pos - (dec->hs.index + 1);
+                for (uint32_t i = 0; i <= value && err == ESP_OK; i++)
+                {
+                    err = ghota_hs_put(
+                        dec,
+                        dec->hs.window[(from + i) & GHOTA_HS_WINDOW_MASK]);
+                }
+                dec->hs.state = GHOTA_HS_STATE_TAG;
+            }
+            break;
+        }
+        if (!got)
+        {
+            if (len == 0)
+            {
+                break;
+            }
+            dec->hs.bits = dec->hs.bits << 8 | *p++;
+            dec->hs.bit_count += 8;
+            len--;
+        }
+    }
+    if (err == ESP_OK)
+    {
+        err = ghota_hs_flush(dec);
+    }
+    return err;
+}
+
+static esp_err_t ghota_hs_finish(
+    ghota_decompress_t *dec)
+{
+    /* the encoder pads the last byte with zeros */
+    if (dec->hs.state == GHOTA_HS_STATE_LITERAL ||
+        dec->hs.token_bits + dec->hs.bit_count >= 8 ||
+        (dec->hs.bits & ((1u << dec->hs.bit_count) - 1)))
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return ESP_OK;
+}
+#endif
+
+ghota_decompress_t *ghota_decompress_create(
+    ghota_compression_t type,
+    ghota_decompress_write_t write,
+    void *ctx)
+{
+    ghota_decompress_t *dec =
+        calloc(1, sizeof(ghota_decompress_t));
+    if (dec == NULL)
+    {
+        return NULL;
+    }
+    dec->type = type;
+    dec->write = write;
+    dec->ctx = ctx;
+    switch (type)
+    {
+#ifdef CONFIG_GHOTA_DECOMPRESS_GZIP
+    case GHOTA_COMPRESSION_GZIP:
+        dec->gzip.inflator = malloc(sizeof(tinfl_decompressor));
+        dec->gzip.dict = malloc(TINFL_LZ_DICT_SIZE);
+        if (dec->gzip.inflator == NULL || dec->gzip.dict == NULL)
+        {
+            ghota_decompress_free(dec);
+            return NULL;
+        }
+        tinfl_init(dec->gzip.inflator);
+        return dec;
+#endif
+#ifdef CONFIG_GHOTA_DECOMPRESS_HEATSHRINK
+    case GHOTA_COMPRESSION_HEATSHRINK:
+        dec->hs.window = calloc(1, GHOTA_HS_WINDOW_SIZE);
+        if (dec->hs.window == NULL)
+        {
+            ghota_decompress_free(dec);
+            return NULL;
+        }
+        return dec;
+#endif
+    default:
+        ghota_decompress_free(dec);
+        return NULL;
+    }
+}
+
+esp_err_t ghota_decompress_set_sha256(
+    ghota_decompress_t *dec,
+    bool enable)
+{
+    if (enable && dec->sha256 == NULL)
+    {
+        dec->sha256 = malloc(sizeof(mbedtls_sha256_context));
+        if (dec->sha256 == NULL)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+        mbedtls_sha256_init(dec->sha256);
+        mbedtls_sha256_starts(dec->sha256, 0);
+    }
+    else if (!enable && dec->sha256)
+    {
+        mbedtls_sha256_free(dec->sha256);
+        free(dec->sha256);
+        dec->sha256 = NULL;
+    }
+    return ESP_OK;
+}
+
+const uint8_t *ghota_decompress_get_sha256(
+    ghota_decompress_t *dec)
+{
+    return dec->sha256 && dec->finished ? dec->digest : NULL;
+}
+
+esp_err_t ghota_decompress_feed(
+    ghota_decompress_t *dec,
+    const void *data,
+    size_t len)
+{
+    dec->in += len;
+    if (dec->sha256)
+    {
+        mbedtls_sha256_update(dec->sha256, data, len);
+    }
+    switch (dec->type)
+    {
+#ifdef CONFIG_GHOTA_DECOMPRESS_GZIP
+    case GHOTA_COMPRESSION_GZIP:
+        return ghota_gzip_feed(dec, data, len);
+#endif
+#ifdef CONFIG_GHOTA_DECOMPRESS_HEATSHRINK
+    case GHOTA_COMPRESSION_HEATSHRINK:
+        return ghota_hs_feed(dec, data, len);
+#endif
+    default:
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+}
+
+esp_err_t ghota_decompress_finish(
+    ghota_decompress_t *dec)
+{
+    esp_err_t err;
+    switch (dec->type)
+    {
+#ifdef CONFIG_GHOTA_DECOMPRESS_GZIP
+    case GHOTA_COMPRESSION_GZIP:
+        err = ghota_gzip_finish(dec);
+        break;
+#endif
+#ifdef CONFIG_GHOTA_DECOMPRESS_HEATSHRINK
+    case GHOTA_COMPRESSION_HEATSHRINK:
+        err = ghota_hs_finish(dec);
+        break;
+#endif
+    default:
+        err = ESP_ERR_NOT_SUPPORTED;
+        break;
+    }
+    if (err == ESP_OK && dec->sha256)
+    {
+        mbedtls_sha256_finish(dec->sha256, dec->digest);
+    }
+    dec->finished = err == ESP_OK;
+    return err;
+}
+
+uint32_t ghota_decompress_get_in(
+    ghota_decompress_t *dec)
+{
+    return dec->in;
+}
+
+uint32_t ghota_decompress_get_out(
+    ghota_decompress_t *dec)
+{
+    return dec->out;
+}
+
+void ghota_decompress_free(
+    ghota_decompress_t *dec)
+{
+    if (dec == NULL)
+    {
+        return;
+    }
+    ghota_decompress_set_sha256(dec, false);
+#ifdef CONFIG_GHOTA_DECOMPRESS_GZIP
+    free(dec->gzip.inflator);
+    free(dec->gzip.dict);
+#endif
+#ifdef CONFIG_GHOTA_DECOMPRESS_HEATSHRINK
+    free(dec->hs.window);
+#endif
+    free(dec);
+}
@@ -28,6 +28,8 @@ char *ghota_get_event_str(ghota_event_e event)
         return "GHOTA_EVENT_STORAGE_UPDATE_PROGRESS";
     case GHOTA_EVENT_PENDING_REBOOT:
         return "GHOTA_EVENT_PENDING_REBOOT";
+    case GHOTA_EVENT_CHECK_SCHEDULED:
+        return "GHOTA_EVENT_CHECK_SCHEDULED";
     }
     return "Unknown Event";
 }
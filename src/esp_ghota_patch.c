@@ -0,0 +1,271 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_ghota_patch.h"
+
+#define GHOTA_PATCH_HEADER_LEN (4 + 4 + 4 + 32)
+#define GHOTA_PATCH_COPY_SIZE 512
+
+enum ghota_patch_op
+{
+    GHOTA_PATCH_OP_END = 0x00,
+    GHOTA_PATCH_OP_COPY = 0x01,
+    GHOTA_PATCH_OP_INSERT = 0x02,
+};
+
+typedef enum
+{
+    GHOTA_PATCH_STATE_HEADER,
+    GHOTA_PATCH_STATE_OP,
+    GHOTA_PATCH_STATE_INSERT,
+    GHOTA_PATCH_STATE_DONE,
+} ghota_patch_state_t;
+
+struct ghota_patch
+{
+    uint32_t source_size;
+    ghota_patch_read_t read;
+    ghota_patch_write_t write;
+    void *ctx;
+    ghota_patch_state_t state;
+    /* header or operation being received */
+    uint8_t buf[GHOTA_PATCH_HEADER_LEN];
+    size_t buf_len;
+    uint32_t target_size;
+    uint8_t sha256[32];
+    uint32_t insert_left;
+    uint32_t received;
+    uint32_t written;
+    uint8_t copy[GHOTA_PATCH_COPY_SIZE];
+};
+
+static uint32_t ghota_patch_u32(
+    const uint8_t *p)
+{
+    return (uint32_t)p[0] |
+           (uint32_t)p[1] << 8 |
+           (uint32_t)p[2] << 16 |
+           (uint32_t)p[3] << 24;
+}
+
+/* length of the operation starting with opcode, 0 if it is unknown */
+static size_t ghota_patch_op_len(
+    uint8_t opcode)
+{
+    switch (opcode)
+    {
+    case GHOTA_PATCH_OP_END:
+        return 1;
+    case GHOTA_PATCH_OP_COPY:
+        return 1 + 4 + 4;
+    case GHOTA_PATCH_OP_INSERT:
+        return 1 + 4;
+    default:
+        return 0;
+    }
+}
+
+static esp_err_t ghota_patch_emit(
+    ghota_patch_t *patch,
+    const void *data,
+    size_t len)
+{
+    if (len > patch->target_size - patch->written)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    esp_err_t err = patch->write(patch->ctx, data, len);
+    if (err == ESP_OK)
+    {
+        patch->written += len;
+    }
+    return err;
+}
+
+static esp_err_t ghota_patch_copy(
+    ghota_patch_t *patch,
+    uint32_t offset,
+    uint32_t len)
+{
+    if (offset > patch->source_size ||
+        len > patch->source_size - offset)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    while (len)
+    {
+        size_t chunk = len < GHOTA_PATCH_COPY_SIZE ? len : GHOTA_PATCH_COPY_SIZE;
+        esp_err_t err = patch->read(
+            patch->ctx,
+            offset,
+            patch->copy,
+            chunk);
+        if (err == ESP_OK)
+        {
+            err = ghota_patch_emit(patch, patch->copy, chunk);
+        }
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        offset += chunk;
+        len -= chunk;
+    }
+    return ESP_OK;
+}
+
+/* run the operation collected in buf */
+static esp_err_t ghota_patch_execute(
+    ghota_patch_t *patch)
+{
+    switch (patch->buf[0])
+    {
+    case GHOTA_PATCH_OP_COPY:
+        return ghota_patch_copy(
+            patch,
+            ghota_patch_u32(&patch->buf[1]),
+            ghota_patch_u32(&patch->buf[5]));
+    case GHOTA_PATCH_OP_INSERT:
+        patch->insert_left = ghota_patch_u32(&patch->buf[1]);
+        if (patch->insert_left)
+        {
+            patch->state = GHOTA_PATCH_STATE_INSERT;
+        }
+        return ESP_OK;
+    default:
+        patch->state = GHOTA_PATCH_STATE_DONE;
+        return ESP_OK;
+    }
+}
+
+ghota_patch_t *ghota_patch_create(
+    uint32_t source_size,
+    ghota_patch_read_t read,
+    ghota_patch_write_t write,
+    void *ctx)
+{
+    ghota_patch_t *patch =
+        calloc(1, sizeof(ghota_patch_t));
+    if (patch == NULL)
+    {
+        return NULL;
+    }
+    patch->source_size = source_size;
+    patch->read = read;
+    patch->write = write;
+    patch->ctx = ctx;
+    patch->state = GHOTA_PATCH_STATE_HEADER;
+    return patch;
+}
+
+esp_err_t ghota_patch_feed(
+    ghota_patch_t *patch,
+    const void *data,
+    size_t len)
+{
+    const uint8_t *p = data;
+    esp_err_t err = ESP_OK;
+    patch->received += len;
+    while (len && err == ESP_OK)
+    {
+        size_t need;
+        size_t n;
+        switch (patch->state)
+        {
+        case GHOTA_PATCH_STATE_HEADER:
+            need = GHOTA_PATCH_HEADER_LEN - patch->buf_len;
+            n = len < need ? len : need;
+            memcpy(&patch->buf[patch->buf_len], p, n);
+            patch->buf_len += n;
+            if (patch->buf_len < GHOTA_PATCH_HEADER_LEN)
+            {
+                break;
+            }
+            if (memcmp(patch->buf, GHOTA_PATCH_MAGIC, 4) != 0)
+            {
+                return ESP_ERR_INVALID_VERSION;
+            }
+            if (ghota_patch_u32(&patch->buf[4]) > patch->source_size)
+            {
+                /* made for a larger image than the one we run */
+                return ESP_ERR_INVALID_SIZE;
+            }
+            patch->target_size = ghota_patch_u32(&patch->buf[8]);
+            memcpy(patch->sha256, &patch->buf[12], sizeof(patch->sha256));
+            patch->buf_len = 0;
+            patch->state = GHOTA_PATCH_STATE_OP;
+            break;
+        case GHOTA_PATCH_STATE_OP:
+            if (patch->buf_len == 0 &&
+                ghota_patch_op_len(p[0]) == 0)
+            {
+                return ESP_ERR_INVALID_STATE;
+            }
+            need = ghota_patch_op_len(
+                       patch->buf_len ? patch->buf[0] : p[0]) -
+                   patch->buf_len;
+            n = len < need ? len : need;
+            memcpy(&patch->buf[patch->buf_len], p, n);
+            patch->buf_len += n;
+            if (n == need)
+            {
+                err = ghota_patch_execute(patch);
+                patch->buf_len = 0;
+            }
+            break;
+        case GHOTA_PATCH_STATE_INSERT:
+            n = len < patch->insert_left ? len : patch->insert_left;
+            err = ghota_patch_emit(patch, p, n);
+            patch->insert_left -= n;
+            if (patch->insert_left == 0)
+            {
+                patch->state = GHOTA_PATCH_STATE_OP;
+            }
+            break;
+        default:
+            /* data after the END operation */
+            return ESP_ERR_INVALID_SIZE;
+        }
+        p += n;
+        len -= n;
+    }
+    return err;
+}
+
+esp_err_t ghota_patch_finish(
+    ghota_patch_t *patch)
+{
+    if (patch->state != GHOTA_PATCH_STATE_DONE)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (patch->written != patch->target_size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+uint32_t ghota_patch_get_received(
+    ghota_patch_t *patch)
+{
+    return patch->received;
+}
+
+uint32_t ghota_patch_get_written(
+    ghota_patch_t *patch)
+{
+    return patch->written;
+}
+
+const uint8_t *ghota_patch_get_target_sha256(
+    ghota_patch_t *patch)
+{
+    return patch->state == GHOTA_PATCH_STATE_HEADER ? NULL : patch->sha256;
+}
+
+void ghota_patch_free(
+    ghota_patch_t *patch)
+{
+    free(patch);
+}
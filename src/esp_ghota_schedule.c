@@ -0,0 +1,127 @@
+#include <time.h>
+#include <inttypes.h>
+#include <esp_log.h>
+#include <string.h>
+#include <esp_random.h>
+#include <esp_rom_crc.h>
+
+#include "esp_ghota_schedule.h"
+
+static const char *SCHEDULE_TAG = "GHOTA_SCHEDULE";
+
+/* the clock is only trusted once it was set, e.g. by SNTP */
+#define GHOTA_SCHEDULE_VALID_TIME 1577836800
+
+/* a random number of seconds in [0, range) */
+static uint32_t ghota_schedule_jitter(
+    uint32_t range)
+{
+    return range ? esp_random() % range : 0;
+}
+
+/* seconds until the rate limit window resets, 0 if unknown */
+static uint32_t ghota_schedule_to_reset(
+    const ghota_rate_limit_t *rate_limit)
+{
+    time_t now = time(NULL);
+    if (rate_limit->reset == 0 ||
+        now < GHOTA_SCHEDULE_VALID_TIME ||
+        rate_limit->reset <= (uint32_t)now)
+    {
+        return 0;
+    }
+    return rate_limit->reset - (uint32_t)now;
+}
+
+void ghota_schedule_next(
+    ghota_schedule_t *schedule,
+    const ghota_rate_limit_t *rate_limit,
+    uint32_t interval,
+    bool failed)
+{
+    uint32_t to_reset = ghota_schedule_to_reset(rate_limit);
+    uint32_t delay;
+
+    schedule->remaining = rate_limit->remaining;
+    if (rate_limit->limited)
+    {
+        schedule->failures++;
+        schedule->reason = GHOTA_SCHEDULE_RATE_LIMITED;
+        if (rate_limit->retry_after)
+            delay = rate_limit->retry_after;
+        else if (to_reset)
+            delay = to_reset;
+        else
+            delay = CONFIG_GHOTA_BACKOFF_MAX;
+        /* spread the devices sharing the limit over the start of the new window */
+        delay += ghota_schedule_jitter(delay / 4 + 60);
+    }
+    else if (failed)
+    {
+        schedule->failures++;
+        schedule->reason = GHOTA_SCHEDULE_BACKOFF;
+        uint32_t shift = schedule->failures - 1;
+        delay = shift < 16 ? CONFIG_GHOTA_BACKOFF_MIN << shift : CONFIG_GHOTA_BACKOFF_MAX;
+        if (delay > CONFIG_GHOTA_BACKOFF_MAX)
+            delay = CONFIG_GHOTA_BACKOFF_MAX;
+        if (interval && delay > interval)
+            delay = interval;
+        /* equal jitter, half fixed and half random */
+        delay = delay / 2 + ghota_schedule_jitter(delay / 2 + 1);
+    }
+    else
+    {
+        schedule->failures = 0;
+        schedule->reason = GHOTA_SCHEDULE_INTERVAL;
+        delay = interval;
+        if (rate_limit->remaining >= 0 &&
+            rate_limit->remaining < CONFIG_GHOTA_RATE_LIMIT_RESERVE &&
+            to_reset > delay)
+        {
+            /* leave what is left of the window to other clients behind the same address */
+            schedule->reason = GHOTA_SCHEDULE_STRETCHED;
+            delay = to_reset + ghota_schedule_jitter(to_reset / 4 + 60);
+        }
+    }
+    schedule->delay = delay;
+    ESP_LOGD(
+        SCHEDULE_TAG,
+        "Next check in %" PRIu32 " s (reason %d, %" PRIu32 " failures, %" PRId32 " requests left)",
+        schedule->delay,
+        schedule->reason,
+        schedule->failures,
+        schedule->remaining);
+}
+
+uint32_t ghota_schedule_device_hash(
+    const char *deviceid)
+{
+    return esp_rom_crc32_le(
+        0,
+        (const uint8_t *)deviceid,
+        strlen(deviceid));
+}
+
+uint32_t ghota_schedule_phase(
+    const char *deviceid,
+    uint32_t spread)
+{
+    return spread ? ghota_schedule_device_hash(deviceid) % spread : 0;
+}
+
+uint32_t ghota_schedule_cohort(
+    const char *deviceid,
+    const char *release)
+{
+    return esp_rom_crc32_le(
+               ghota_schedule_device_hash(deviceid),
+               (const uint8_t *)release,
+               strlen(release)) %
+           100;
+}
+
+uint32_t ghota_schedule_download_delay(
+    uint32_t window)
+{
+    return ghota_schedule_jitter(window);
+}
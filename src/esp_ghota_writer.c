@@ -0,0 +1,552 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+#include <nvs.h>
+#include <esp_idf_version.h>
+#include <mbedtls/sha256.h>
+
+#include "esp_ghota_writer.h"
+#include "interface/ghota_interface.h"
+
+static const char *WRITER_TAG = "GHOTA_WRITER";
+
+#define GHOTA_WRITER_NAMESPACE "ghota"
+#define GHOTA_WRITER_SECTOR_SIZE 4096
+#define GHOTA_WRITER_COMPARE_SIZE 256
+
+#if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(5, 0, 0)
+#define mbedtls_sha256_starts mbedtls_sha256_starts_ret
+#define mbedtls_sha256_update mbedtls_sha256_update_ret
+#define mbedtls_sha256_finish mbedtls_sha256_finish_ret
+#endif
+#define GHOTA_JOURNAL_VERSION 1
+
+typedef struct
+{
+    uint32_t version;
+    uint32_t address;
+    uint32_t url_crc;
+    uint32_t size;
+    uint32_t committed;
+    char etag[GHOTA_VALIDATOR_LEN];
+} ghota_journal_t;
+
+struct ghota_writer
+{
+    const esp_partition_t *partition;
+    ghota_journal_t journal;
+    uint32_t resume;
+    uint32_t offset;
+    uint32_t flushed;
+    uint32_t erased;
+    bool finished;
+    bool diff;
+    bool no_journal;
+    uint32_t writes;
+    uint32_t skipped;
+    TickType_t started;
+    TickType_t max_stall;
+    uint8_t *sector;
+    mbedtls_sha256_context *sha256;
+    uint8_t digest[32];
+};
+
+#ifdef CONFIG_GHOTA_RESUME_DOWNLOADS
+/* one journal per partition, NVS keys are limited to 15 characters */
+static void ghota_journal_key(
+    const esp_partition_t *partition,
+    char *key,
+    size_t len)
+{
+    snprintf(
+        key,
+        len,
+        "jrn%08" PRIx32,
+        partition->address);
+}
+
+static esp_err_t ghota_journal_save(
+    ghota_writer_t *writer)
+{
+    char key[16];
+    nvs_handle_t nvs;
+    if (writer->no_journal)
+    {
+        return ESP_OK;
+    }
+    ghota_journal_key(writer->partition, key, sizeof(key));
+    esp_err_t err = nvs_open(
+        GHOTA_WRITER_NAMESPACE,
+        NVS_READWRITE,
+        &nvs);
+    if (err == ESP_OK)
+    {
+        err = nvs_set_blob(
+            nvs,
+            key,
+            &writer->journal,
+            sizeof(ghota_journal_t));
+        if (err == ESP_OK)
+            err = nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(
+            WRITER_TAG,
+            "Failed to store download journal: %s",
+            esp_err_to_name(err));
+    }
+    return err;
+}
+
+static void ghota_journal_erase(
+    ghota_writer_t *writer)
+{
+    char key[16];
+    nvs_handle_t nvs;
+    ghota_journal_key(writer->partition, key, sizeof(key));
+    if (nvs_open(
+            GHOTA_WRITER_NAMESPACE,
+            NVS_READWRITE,
+            &nvs) == ESP_OK)
+    {
+        if (nvs_erase_key(nvs, key) == ESP_OK)
+            nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+}
+
+static void ghota_journal_load(
+    ghota_writer_t *writer,
+    uint32_t url_crc,
+    uint32_t size)
+{
+    char key[16];
+    nvs_handle_t nvs;
+    ghota_journal_t journal;
+    size_t len = sizeof(journal);
+
+    ghota_journal_key(writer->partition, key, sizeof(key));
+    if (nvs_open(
+            GHOTA_WRITER_NAMESPACE,
+            NVS_READONLY,
+            &nvs) != ESP_OK)
+    {
+        return;
+    }
+    esp_err_t err = nvs_get_blob(nvs, key, &journal, &len);
+    nvs_close(nvs);
+    if (err != ESP_OK ||
+        len != sizeof(journal) ||
+        journal.version != GHOTA_JOURNAL_VERSION ||
+        journal.address != writer->partition->address ||
+        journal.url_crc != url_crc ||
+        journal.size != size ||
+        journal.committed % GHOTA_WRITER_SECTOR_SIZE ||
+        journal.committed > writer->partition->size)
+    {
+        return;
+    }
+    writer->resume = journal.committed;
+    strlcpy(
+        writer->journal.etag,
+        journal.etag,
+        sizeof(writer->journal.etag));
+    ESP_LOGI(
+        WRITER_TAG,
+        "Download to %s can resume at %" PRIu32,
+        writer->partition->label,
+        writer->resume);
+}
+#endif
+
+static esp_err_t ghota_writer_erase_next(
+    ghota_writer_t *writer)
+{
+    esp_err_t err = esp_partition_erase_range(
+        writer->partition,
+        writer->erased,
+        GHOTA_WRITER_SECTOR_SIZE);
+    if (err == ESP_OK)
+    {
+        writer->erased += GHOTA_WRITER_SECTOR_SIZE;
+    }
+    return err;
+}
+
+ghota_writer_t *ghota_writer_open(
+    const esp_partition_t *partition,
+    const char *url,
+    uint32_t size)
+{
+    ghota_writer_t *writer =
+        calloc(1, sizeof(ghota_writer_t));
+    if (writer == NULL)
+    {
+        return NULL;
+    }
+    writer->sector = malloc(GHOTA_WRITER_SECTOR_SIZE);
+    if (writer->sector == NULL)
+    {
+        free(writer);
+        return NULL;
+    }
+    writer->partition = partition;
+    writer->journal.version = GHOTA_JOURNAL_VERSION;
+    writer->journal.address = partition->address;
+    writer->journal.url_crc = esp_rom_crc32_le(
+        0,
+        (const uint8_t *)url,
+        strlen(url));
+    writer->journal.size = size;
+#ifdef CONFIG_GHOTA_RESUME_DOWNLOADS
+    ghota_journal_load(
+        writer,
+        writer->journal.url_crc,
+        size);
+#endif
+    return writer;
+}
+
+void ghota_writer_set_diff(
+    ghota_writer_t *writer,
+    bool enable)
+{
+    writer->diff = enable;
+}
+
+void ghota_writer_set_journal(
+    ghota_writer_t *writer,
+    bool enable)
+{
+    writer->no_journal = !enable;
+    if (!enable)
+    {
+        writer->resume = 0;
+        writer->journal.etag[0] = '\0';
+    }
+}
+
+esp_err_t ghota_writer_set_sha256(
+    ghota_writer_t *writer,
+    bool enable)
+{
+    if (enable && writer->sha256 == NULL)
+    {
+        writer->sha256 = malloc(sizeof(mbedtls_sha256_context));
+        if (writer->sha256 == NULL)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+        mbedtls_sha256_init(writer->sha256);
+    }
+    else if (!enable && writer->sha256)
+    {
+        mbedtls_sha256_free(writer->sha256);
+        free(writer->sha256);
+        writer->sha256 = NULL;
+    }
+    return ESP_OK;
+}
+
+const uint8_t *ghota_writer_get_sha256(
+    ghota_writer_t *writer)
+{
+    return writer->sha256 && writer->finished ? writer->digest : NULL;
+}
+
+uint32_t ghota_writer_get_skipped(
+    ghota_writer_t *writer)
+{
+    return writer->skipped;
+}
+
+uint32_t ghota_writer_get_resume_offset(
+    ghota_writer_t *writer)
+{
+    return writer->resume;
+}
+
+const char *ghota_writer_get_etag(
+    ghota_writer_t *writer)
+{
+    return writer->journal.etag;
+}
+
+esp_err_t ghota_writer_begin(
+    ghota_writer_t *writer,
+    uint32_t offset,
+    const char *etag)
+{
+    if (offset % GHOTA_WRITER_SECTOR_SIZE ||
+        offset > writer->partition->size)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    writer->offset = offset;
+    writer->flushed = offset;
+    writer->erased = offset;
+    writer->writes = 0;
+    writer->skipped = 0;
+    writer->started = xTaskGetTickCount();
+    writer->max_stall = 0;
+    writer->journal.committed = offset;
+    strlcpy(
+        writer->journal.etag,
+        etag ? etag : "",
+        sizeof(writer->journal.etag));
+    if (writer->sha256)
+    {
+        mbedtls_sha256_starts(writer->sha256, 0);
+        /* the resumed part is only in flash, hash it from there */
+        for (uint32_t pos = 0; pos < offset; pos += GHOTA_WRITER_SECTOR_SIZE)
+        {
+            esp_err_t err = esp_partition_read(
+                writer->partition,
+                pos,
+                writer->sector,
+                GHOTA_WRITER_SECTOR_SIZE);
+            if (err != ESP_OK)
+            {
+                return err;
+            }
+            mbedtls_sha256_update(
+                writer->sha256,
+                writer->sector,
+                GHOTA_WRITER_SECTOR_SIZE);
+        }
+    }
+#ifdef CONFIG_GHOTA_RESUME_DOWNLOADS
+    /* a restart must not leave the journal of the old data behind */
+    if (writer->no_journal)
+        ghota_journal_erase(writer);
+    else
+        ghota_journal_save(writer);
+#endif
+    return ESP_OK;
+}
+
+/* compare the buffered sector with the flash it would replace */
+static bool ghota_writer_sector_unchanged(
+    ghota_writer_t *writer)
+{
+    uint8_t flash[GHOTA_WRITER_COMPARE_SIZE];
+    for (size_t pos = 0;
+         pos < GHOTA_WRITER_SECTOR_SIZE;
+         pos += sizeof(flash))
+    {
+        if (esp_partition_read(
+                writer->partition,
+                writer->flushed + pos,
+                flash,
+                sizeof(flash)) != ESP_OK ||
+            memcmp(flash, &writer->sector[pos], sizeof(flash)) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* write the buffered part of the current sector to flash */
+static esp_err_t ghota_writer_flush(
+    ghota_writer_t *writer)
+{
+    size_t len = writer->offset - writer->flushed;
+    if (len == 0)
+    {
+        return ESP_OK;
+    }
+    if (writer->diff &&
+        len == GHOTA_WRITER_SECTOR_SIZE &&
+        writer->erased == writer->flushed &&
+        ghota_writer_sector_unchanged(writer))
+    {
+        writer->erased += GHOTA_WRITER_SECTOR_SIZE;
+        writer->flushed = writer->offset;
+        writer->skipped++;
+        return ESP_OK;
+    }
+    if (writer->partition->encrypted && len % 16)
+    {
+        /* encrypted writes must be a multiple of 16 bytes, pad the tail like erased flash */
+        size_t pad = 16 - len % 16;
+        memset(&writer->sector[len], 0xFF, pad);
+        len += pad;
+    }
+    while (writer->erased < writer->flushed + len)
+    {
+        esp_err_t err = ghota_writer_erase_next(writer);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+    }
+    esp_err_t err = esp_partition_write(
+        writer->partition,
+        writer->flushed,
+        writer->sector,
+        len);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    writer->writes++;
+    writer->flushed = writer->offset;
+    return ESP_OK;
+}
+
+esp_err_t ghota_writer_write(
+    ghota_writer_t *writer,
+    const void *data,
+    size_t len)
+{
+    if (writer->offset + len > writer->partition->size)
+    {
+        ESP_LOGE(
+            WRITER_TAG,
+            "Asset is larger than partition %s",
+            writer->partition->label);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    TickType_t start = xTaskGetTickCount();
+    if (writer->sha256)
+    {
+        mbedtls_sha256_update(writer->sha256, data, len);
+    }
+
+#if CONFIG_GHOTA_ERASE_AHEAD > 0
+    /* the sectors of this chunk and the look-ahead beyond it, however many sectors the
+    chunk spans. a differential writer must see the old content, so it never erases ahead */
+    uint32_t erase_end =
+        writer->offset + len + CONFIG_GHOTA_ERASE_AHEAD * GHOTA_WRITER_SECTOR_SIZE;
+    if (erase_end > writer->partition->size)
+    {
+        erase_end = writer->partition->size;
+    }
+    while (!writer->diff &&
+           writer->erased < erase_end)
+    {
+        esp_err_t err = ghota_writer_erase_next(writer);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+    }
+#endif
+
+    /* collect whole sectors, so flash sees one aligned write per sector */
+    const uint8_t *src = (const uint8_t *)data;
+    while (len)
+    {
+        size_t fill = writer->offset % GHOTA_WRITER_SECTOR_SIZE;
+        size_t copy = GHOTA_WRITER_SECTOR_SIZE - fill;
+        if (copy > len)
+        {
+            copy = len;
+        }
+        memcpy(&writer->sector[fill], src, copy);
+        writer->offset += copy;
+        src += copy;
+        len -= copy;
+        if (writer->offset % GHOTA_WRITER_SECTOR_SIZE == 0)
+        {
+            esp_err_t err = ghota_writer_flush(writer);
+            if (err != ESP_OK)
+            {
+                return err;
+            }
+        }
+    }
+
+    TickType_t stall = xTaskGetTickCount() - start;
+    if (stall > writer->max_stall)
+    {
+        writer->max_stall = stall;
+    }
+#ifdef CONFIG_GHOTA_RESUME_DOWNLOADS
+    /* only data in flash counts, a resume rewrites the buffered sector */
+    if (writer->flushed - writer->journal.committed >=
+        CONFIG_GHOTA_JOURNAL_INTERVAL * 1024)
+    {
+        writer->journal.committed = writer->flushed;
+        ghota_journal_save(writer);
+    }
+#endif
+    return ESP_OK;
+}
+
+uint32_t ghota_writer_get_offset(
+    ghota_writer_t *writer)
+{
+    return writer->offset;
+}
+
+esp_err_t ghota_writer_finish(
+    ghota_writer_t *writer)
+{
+    esp_err_t err = ghota_writer_flush(writer);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    if (writer->sha256)
+    {
+        mbedtls_sha256_finish(writer->sha256, writer->digest);
+    }
+    writer->finished = true;
+    ESP_LOGD(
+        WRITER_TAG,
+        "Wrote %" PRIu32 " bytes to %s in %" PRIu32 " flash writes, "
+        "%" PRIu32 " ms, longest write %" PRIu32 " ms",
+        writer->offset,
+        writer->partition->label,
+        writer->writes,
+        (uint32_t)pdTICKS_TO_MS(xTaskGetTickCount() - writer->started),
+        (uint32_t)pdTICKS_TO_MS(writer->max_stall));
+    if (writer->diff)
+    {
+        ESP_LOGI(
+            WRITER_TAG,
+            "%" PRIu32 " of %" PRIu32 " sectors of %s were unchanged and not rewritten",
+            writer->skipped,
+            writer->skipped + writer->writes,
+            writer->partition->label);
+    }
+#ifdef CONFIG_GHOTA_RESUME_DOWNLOADS
+    ghota_journal_erase(writer);
+#endif
+    return ESP_OK;
+}
+
+void ghota_writer_close(
+    ghota_writer_t *writer)
+{
+    if (writer == NULL)
+    {
+        return;
+    }
+    if (!writer->finished)
+    {
+        ESP_LOGW(
+            WRITER_TAG,
+            "Download to %s interrupted at %" PRIu32,
+            writer->partition->label,
+            writer->offset);
+#ifdef CONFIG_GHOTA_RESUME_DOWNLOADS
+        if (writer->flushed > writer->journal.committed)
+        {
+            writer->journal.committed = writer->flushed;
+            ghota_journal_save(writer);
+        }
+#endif
+    }
+    ghota_writer_set_sha256(writer, false);
+    free(writer->sector);
+    free(writer);
+}
@@ -0,0 +1,781 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+#include <esp_tls.h>
+#include <esp_crt_bundle.h>
+
+#include "interface/ghota_http_pool.h"
+#include "esp_ghota_client.h"
+
+static const char *POOL_TAG = "GHOTA_HTTP";
+
+/* one per host of an update: the API, github.com for the probe and the asset CDN */
+#define GHOTA_HTTP_POOL_SLOTS 3
+#define GHOTA_HTTP_POOL_MAX_REDIRECTS 5
+#define GHOTA_HTTP_POOL_HOST_LEN 64
+/* a clock before 2020 has not been set, an HTTP date can not be turned into a delay */
+#define GHOTA_HTTP_POOL_VALID_TIME 1577836800
+
+typedef struct ghota_http_slot
+{
+    ghota_http_pool_t *pool;
+    esp_http_client_handle_t client;
+    char host[GHOTA_HTTP_POOL_HOST_LEN];
+    bool connected;
+    bool has_session;
+    bool in_use;
+    ghota_compression_t encoding;
+    TickType_t connect_start;
+    uint32_t last_used;
+    char *location;
+    const ghota_http_request_t *request;
+} ghota_http_slot_t;
+
+struct ghota_http_pool
+{
+    ghota_client_handle_t *handle;
+    ghota_http_slot_t slots[GHOTA_HTTP_POOL_SLOTS];
+    uint32_t use_counter;
+};
+
+static void ghota_http_pool_get_host(
+    const char *url,
+    char *host,
+    size_t len)
+{
+    const char *start = strstr(url, "://");
+    start = start ? start + 3 : url;
+    snprintf(
+        host,
+        len,
+        "%.*s",
+        (int)strcspn(start, "/:?#"),
+        start);
+}
+
+/* seconds of a Retry-After header, in either the delay-seconds or the HTTP-date form.
+0 if it can not be used, the check is then retried by the backoff */
+static uint32_t ghota_http_pool_retry_after(
+    const char *value)
+{
+    char *end;
+    unsigned long seconds = strtoul(value, &end, 10);
+    if (end != value && *end == '\0')
+    {
+        return seconds;
+    }
+    struct tm tm = {0};
+    time_t now = time(NULL);
+    if (strptime(value, "%a, %d %b %Y %H:%M:%S GMT", &tm) == NULL ||
+        now < GHOTA_HTTP_POOL_VALID_TIME)
+    {
+        ESP_LOGW(
+            POOL_TAG,
+            "Ignoring Retry-After: %s",
+            value);
+        return 0;
+    }
+    /* days since 1970 of the date in UTC, mktime would apply the local time zone */
+    int year = tm.tm_year + 1900 - (tm.tm_mon < 2);
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int yoe = year - era * 400;
+    int doy = (153 * (tm.tm_mon + (tm.tm_mon < 2 ? 10 : -2)) + 2) / 5 + tm.tm_mday - 1;
+    int64_t days = (int64_t)era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+    int64_t date = days * 86400 + tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec;
+    return date > now ? (uint32_t)(date - now) : 0;
+}
+
+static esp_err_t ghota_http_pool_event_handler(
+    esp_http_client_event_t *evt)
+{
+    ghota_http_slot_t *slot =
+        (ghota_http_slot_t *)evt->user_data;
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wswitch"
+    switch (evt->event_id)
+    {
+    case HTTP_EVENT_ON_CONNECTED:
+    {
+        ghota_connection_stats_t *stats =
+            ghota_client_get_connection_stats(
+                slot->pool->handle);
+        stats->handshakes++;
+        if (slot->has_session)
+        {
+            stats->offered++;
+        }
+        ESP_LOGD(
+            POOL_TAG,
+            "New connection to %s, handshake %s took %" PRIu32 " ms",
+            slot->host,
+            slot->has_session ? "offering a session ticket" : "without a session ticket",
+            (uint32_t)pdTICKS_TO_MS(
+                xTaskGetTickCount() - slot->connect_start));
+#ifdef CONFIG_GHOTA_TLS_SESSION_RESUMPTION
+        /* the client keeps the session ticket of this connection for the next one */
+        slot->has_session = true;
+#endif
+        break;
+    }
+    case HTTP_EVENT_ON_HEADER:
+    {
+        ghota_release_validators_t *validators =
+            slot->request ? slot->request->validators : NULL;
+        if (strcasecmp(evt->header_key, "location") == 0)
+        {
+            free(slot->location);
+            slot->location = strdup(evt->header_value);
+        }
+        else if (strcasecmp(evt->header_key, "content-encoding") == 0)
+        {
+            if (strcasecmp(evt->header_value, "gzip") == 0 ||
+                strcasecmp(evt->header_value, "x-gzip") == 0)
+                slot->encoding = GHOTA_COMPRESSION_GZIP;
+            else if (strcasecmp(evt->header_value, "identity") != 0)
+                slot->encoding = GHOTA_COMPRESSION_UNSUPPORTED;
+        }
+        else if (validators &&
+                 strcasecmp(evt->header_key, "etag") == 0)
+        {
+            strlcpy(
+                validators->etag,
+                evt->header_value,
+                GHOTA_VALIDATOR_LEN);
+        }
+        else if (validators &&
+                 strcasecmp(evt->header_key, "last-modified") == 0)
+        {
+            strlcpy(
+                validators->last_modified,
+                evt->header_value,
+                GHOTA_VALIDATOR_LEN);
+        }
+        else if (strcasecmp(
+                     evt->header_key,
+                     "x-ratelimit-remaining") == 0)
+        {
+            int limit = atoi(evt->header_value);
+            ESP_LOGD(
+                POOL_TAG,
+                "Github API Rate Limit Remaining: %d",
+                limit);
+            if (limit < 10)
+            {
+                ESP_LOGW(
+                    POOL_TAG,
+                    "Github API Rate Limit Remaining is low: %d",
+                    limit);
+            }
+            ghota_client_get_rate_limit(
+                slot->pool->handle)
+                ->remaining = limit;
+        }
+        else if (strcasecmp(
+                     evt->header_key,
+                     "x-ratelimit-reset") == 0)
+        {
+            ghota_client_get_rate_limit(
+                slot->pool->handle)
+                ->reset = strtoul(evt->header_value, NULL, 10);
+        }
+        else if (strcasecmp(
+                     evt->header_key,
+                     "retry-after") == 0)
+        {
+            ghota_client_get_rate_limit(
+                slot->pool->handle)
+                ->retry_after = ghota_http_pool_retry_after(evt->header_value);
+        }
+        break;
+    }
+    case HTTP_EVENT_DISCONNECTED:
+    {
+        int mbedtls_err = 0;
+        esp_err_t err = esp_tls_get_and_clear_last_error(
+            evt->data,
+            &mbedtls_err,
+            NULL);
+        if (err != 0)
+        {
+            ESP_LOGE(
+                POOL_TAG,
+                "Last esp error code: 0x%x",
+                err);
+            ESP_LOGE(
+                POOL_TAG,
+                "Last mbedtls failure: 0x%x",
+                mbedtls_err);
+        }
+        break;
+    }
+    }
+#pragma GCC diagnostic pop
+    return ESP_OK;
+}
+
+ghota_http_pool_t *ghota_http_pool_create(
+    ghota_client_handle_t *handle)
+{
+    ghota_http_pool_t *pool =
+        calloc(1, sizeof(ghota_http_pool_t));
+    if (pool == NULL)
+    {
+        ESP_LOGE(
+            POOL_TAG,
+            "Failed to allocate connection pool");
+        return NULL;
+    }
+    pool->handle = handle;
+    for (int i = 0; i < GHOTA_HTTP_POOL_SLOTS; i++)
+    {
+        pool->slots[i].pool = pool;
+    }
+    return pool;
+}
+
+void ghota_http_pool_disconnect(
+    ghota_http_pool_t *pool)
+{
+    if (pool == NULL)
+    {
+        return;
+    }
+    for (int i = 0; i < GHOTA_HTTP_POOL_SLOTS; i++)
+    {
+        ghota_http_slot_t *slot = &pool->slots[i];
+        if (slot->client && slot->connected)
+        {
+            esp_http_client_close(slot->client);
+        }
+        slot->connected = false;
+        slot->in_use = false;
+    }
+}
+
+void ghota_http_pool_destroy(
+    ghota_http_pool_t *pool)
+{
+    if (pool == NULL)
+    {
+        return;
+    }
+    ghota_http_pool_disconnect(pool);
+    for (int i = 0; i < GHOTA_HTTP_POOL_SLOTS; i++)
+    {
+        ghota_http_slot_t *slot = &pool->slots[i];
+        if (slot->client)
+        {
+            esp_http_client_cleanup(slot->client);
+        }
+        free(slot->location);
+    }
+    free(pool);
+}
+
+/* find an idle slot for the host of url, or take over the least recently used one */
+static ghota_http_slot_t *ghota_http_pool_acquire(
+    ghota_http_pool_t *pool,
+    const char *url)
+{
+    char host[GHOTA_HTTP_POOL_HOST_LEN];
+    ghota_http_slot_t *slot = NULL;
+
+    ghota_http_pool_get_host(url, host, sizeof(host));
+    for (int i = 0; i < GHOTA_HTTP_POOL_SLOTS; i++)
+    {
+        ghota_http_slot_t *candidate = &pool->slots[i];
+        if (candidate->in_use)
+        {
+            continue;
+        }
+        if (candidate->client &&
+            strcasecmp(candidate->host, host) == 0)
+        {
+            slot = candidate;
+            break;
+        }
+        if (slot == NULL ||
+            candidate->client == NULL ||
+            (slot->client && candidate->last_used < slot->last_used))
+        {
+            slot = candidate;
+        }
+    }
+    if (slot == NULL)
+    {
+        ESP_LOGE(POOL_TAG, "No free connection for %s", host);
+        return NULL;
+    }
+
+    if (slot->client &&
+        strcasecmp(slot->host, host) != 0)
+    {
+        /* the client keeps the session ticket of the old host and would offer it to the new one */
+        ESP_LOGD(
+            POOL_TAG,
+            "Reusing connection slot of %s for %s",
+            slot->host,
+            host);
+        esp_http_client_cleanup(slot->client);
+        slot->client = NULL;
+    }
+    if (slot->client == NULL)
+    {
+        esp_http_client_config_t httpconfig = {
+            .url = url,
+            .crt_bundle_attach = esp_crt_bundle_attach,
+            .event_handler = ghota_http_pool_event_handler,
+            .user_data = slot,
+            .keep_alive_enable = true,
+            .disable_auto_redirect = true,
+#ifdef CONFIG_GHOTA_TLS_SESSION_RESUMPTION
+            .save_client_session = true,
+#endif
+            .buffer_size_tx = 4096,
+        };
+        slot->client = esp_http_client_init(&httpconfig);
+        if (slot->client == NULL)
+        {
+            return NULL;
+        }
+        slot->connected = false;
+        slot->has_session = false;
+    }
+    else if (esp_http_client_set_url(slot->client, url) != ESP_OK)
+    {
+        return NULL;
+    }
+    strlcpy(slot->host, host, sizeof(slot->host));
+    slot->in_use = true;
+    slot->last_used = ++pool->use_counter;
+    return slot;
+}
+
+static ghota_http_slot_t *ghota_http_pool_find(
+    ghota_http_pool_t *pool,
+    esp_http_client_handle_t client)
+{
+    for (int i = 0; i < GHOTA_HTTP_POOL_SLOTS; i++)
+    {
+        if (pool->slots[i].client == client)
+        {
+            return &pool->slots[i];
+        }
+    }
+    return NULL;
+}
+
+static void ghota_http_pool_set_header(
+    esp_http_client_handle_t client,
+    const char *key,
+    const char *value)
+{
+    /* headers stick to the client, so unused ones must be removed for the next request */
+    if (value && strlen(value))
+    {
+        esp_http_client_set_header(client, key, value);
+    }
+    else
+    {
+        esp_http_client_delete_header(client, key);
+    }
+}
+
+static void ghota_http_pool_prepare(
+    ghota_http_slot_t *slot,
+    const ghota_http_request_t *request,
+    bool first_hop,
+    bool same_host)
+{
+    ghota_client_handle_t *handle = slot->pool->handle;
+    esp_http_client_handle_t client = slot->client;
+    ghota_release_validators_t *validators =
+        first_hop ? request->validators : NULL;
+    char *username =
+        ghota_client_get_username(handle);
+
+    esp_http_client_set_method(
+        client,
+        request->post_data ? HTTP_METHOD_POST
+        : request->head    ? HTTP_METHOD_HEAD
+                           : HTTP_METHOD_GET);
+    ghota_http_pool_set_header(
+        client,
+        "Content-Type",
+        request->post_data ? request->content_type : NULL);
+    ghota_http_pool_set_header(
+        client,
+        "Accept",
+        request->accept);
+    ghota_http_pool_set_header(
+        client,
+        "Accept-Encoding",
+        request->accept_encoding);
+    ghota_http_pool_set_header(
+        client,
+        "If-None-Match",
+        validators ? validators->etag : NULL);
+    ghota_http_pool_set_header(
+        client,
+        "If-Modified-Since",
+        validators ? validators->last_modified : NULL);
+
+    char range[24] = "";
+    if (request->range_start)
+    {
+        snprintf(
+            range,
+            sizeof(range),
+            "bytes=%" PRIu32 "-",
+            request->range_start);
+    }
+    ghota_http_pool_set_header(
+        client,
+        "Range",
+        range);
+    ghota_http_pool_set_header(
+        client,
+        "If-Range",
+        request->range_start ? request->if_range : NULL);
+
+    /* credentials are never sent to the hosts we are redirected to */
+    if (request->authenticate && same_host && username)
+    {
+        ESP_LOGD(
+            POOL_TAG,
+            "Using Authenticated Request to %s",
+            slot->host);
+        esp_http_client_set_username(client, username);
+        esp_http_client_set_password(
+            client,
+            ghota_client_get_token(handle));
+        esp_http_client_set_authtype(
+            client,
+            HTTP_AUTH_TYPE_BASIC);
+    }
+    else
+    {
+        esp_http_client_set_authtype(
+            client,
+            HTTP_AUTH_TYPE_NONE);
+        esp_http_client_delete_header(
+            client,
+            "Authorization");
+    }
+
+    /* from here on the validators receive the response headers */
+    if (request->validators)
+    {
+        memset(
+            request->validators,
+            0,
+            sizeof(ghota_release_validators_t));
+    }
+    free(slot->location);
+    slot->location = NULL;
+    slot->encoding = GHOTA_COMPRESSION_NONE;
+    /* the rate limit is that of this request, the hosts it is redirected to report none */
+    if (first_hop)
+    {
+        ghota_client_get_rate_limit(handle)->remaining = -1;
+    }
+    ghota_client_get_rate_limit(handle)->retry_after = 0;
+    slot->request = request;
+}
+
+static esp_err_t ghota_http_pool_send(
+    ghota_http_slot_t *slot,
+    int *status_code)
+{
+    ghota_connection_stats_t *stats =
+        ghota_client_get_connection_stats(
+            slot->pool->handle);
+    bool reused = slot->connected;
+    esp_err_t err = ESP_FAIL;
+    const char *post_data = slot->request->post_data;
+    int post_len = post_data ? strlen(post_data) : 0;
+
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        stats->requests++;
+        slot->connect_start = xTaskGetTickCount();
+        err = esp_http_client_open(slot->client, post_len);
+        if (err == ESP_OK && post_len &&
+            esp_http_client_write(
+                slot->client,
+                post_data,
+                post_len) != post_len)
+        {
+            err = ESP_FAIL;
+        }
+        if (err == ESP_OK)
+        {
+            if (esp_http_client_fetch_headers(slot->client) >= 0 ||
+                esp_http_client_is_chunked_response(slot->client))
+            {
+                *status_code =
+                    esp_http_client_get_status_code(slot->client);
+                slot->connected = true;
+                return ESP_OK;
+            }
+            err = ESP_FAIL;
+        }
+        esp_http_client_close(slot->client);
+        slot->connected = false;
+        if (!reused)
+        {
+            break;
+        }
+        /* the server may have closed the idle connection, retry once on a new one */
+        ESP_LOGD(
+            POOL_TAG,
+            "Kept connection to %s failed, reconnecting",
+            slot->host);
+        reused = false;
+    }
+    return err;
+}
+
+static bool ghota_http_pool_is_redirect(
+    int status_code)
+{
+    return status_code == 301 ||
+           status_code == 302 ||
+           status_code == 303 ||
+           status_code == 307 ||
+           status_code == 308;
+}
+
+esp_err_t ghota_http_pool_open(
+    ghota_http_pool_t *pool,
+    const ghota_http_request_t *request,
+    esp_http_client_handle_t *client,
+    int *status_code)
+{
+    char origin[GHOTA_HTTP_POOL_HOST_LEN];
+    char *url = strdup(request->url);
+    if (url == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    ghota_http_pool_get_host(url, origin, sizeof(origin));
+
+    esp_err_t err = ESP_FAIL;
+    for (int hop = 0; hop <= GHOTA_HTTP_POOL_MAX_REDIRECTS; hop++)
+    {
+        ghota_http_slot_t *slot =
+            ghota_http_pool_acquire(pool, url);
+        if (slot == NULL)
+        {
+            err = ESP_ERR_NO_MEM;
+            break;
+        }
+        ghota_http_pool_prepare(
+            slot,
+            request,
+            hop == 0,
+            strcasecmp(slot->host, origin) == 0);
+
+        err = ghota_http_pool_send(slot, status_code);
+        if (err != ESP_OK)
+        {
+            slot->in_use = false;
+            break;
+        }
+        ghota_rate_limit_t *rate_limit =
+            ghota_client_get_rate_limit(pool->handle);
+        /* a 403 from a redirect target, like an expired CDN link, is no rate limit */
+        if (*status_code == 429 ||
+            (*status_code == 403 &&
+             strcasecmp(slot->host, origin) == 0 &&
+             (rate_limit->remaining == 0 || rate_limit->retry_after)))
+        {
+            ESP_LOGW(
+                POOL_TAG,
+                "Rate limited by %s (%d), retry after %" PRIu32 " s",
+                slot->host,
+                *status_code,
+                rate_limit->retry_after);
+            rate_limit->limited = true;
+        }
+        if (request->location &&
+            ghota_http_pool_is_redirect(*status_code))
+        {
+            strlcpy(
+                request->location,
+                slot->location ? slot->location : "",
+                request->location_len);
+        }
+        if (!ghota_http_pool_is_redirect(*status_code) ||
+            slot->location == NULL ||
+            request->location ||
+            hop == GHOTA_HTTP_POOL_MAX_REDIRECTS)
+        {
+            *client = slot->client;
+            free(url);
+            return ESP_OK;
+        }
+
+        /* drain the redirect body so the connection can be reused */
+        int drained = 0;
+        esp_http_client_flush_response(slot->client, &drained);
+        ESP_LOGD(
+            POOL_TAG,
+            "Redirected (%d) to %s",
+            *status_code,
+            slot->location);
+        if (strncasecmp(slot->location, "http", 4) != 0)
+        {
+            /* relative location, let the client resolve it against the current url */
+            esp_http_client_set_redirection(slot->client);
+            char resolved[CONFIG_MAX_URL_LEN];
+            esp_http_client_get_url(
+                slot->client,
+                resolved,
+                sizeof(resolved));
+            free(url);
+            url = strdup(resolved);
+        }
+        else
+        {
+            free(url);
+            url = strdup(slot->location);
+        }
+        ghota_http_pool_release(pool, slot->client);
+        if (url == NULL)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    free(url);
+    return err;
+}
+
+void ghota_http_pool_release(
+    ghota_http_pool_t *pool,
+    esp_http_client_handle_t client)
+{
+    ghota_http_slot_t *slot =
+        ghota_http_pool_find(pool, client);
+    if (slot == NULL)
+    {
+        return;
+    }
+    /* a partly read response leaves the connection in an unknown state,
+    the client cannot tell a HEAD response from one with an unread body */
+    if ((slot->request && slot->request->head) ||
+        !esp_http_client_is_complete_data_received(client))
+    {
+        esp_http_client_close(client);
+        slot->connected = false;
+    }
+    slot->request = NULL;
+    slot->in_use = false;
+}
+
+/* the decompressor hands the decoded body to the callback */
+static esp_err_t ghota_http_body_decoded(
+    void *ctx,
+    const void *data,
+    size_t len)
+{
+    ghota_http_body_t *body =
+        (ghota_http_body_t *)ctx;
+    return body->cb(body->ctx, data, len);
+}
+
+esp_err_t ghota_http_body_begin(
+    ghota_http_body_t *body,
+    ghota_http_pool_t *pool,
+    esp_http_client_handle_t client,
+    ghota_http_body_cb_t cb,
+    void *ctx)
+{
+    ghota_http_slot_t *slot =
+        ghota_http_pool_find(pool, client);
+    memset(body, 0, sizeof(ghota_http_body_t));
+    body->client = client;
+    body->cb = cb;
+    body->ctx = ctx;
+    if (slot == NULL ||
+        slot->encoding == GHOTA_COMPRESSION_NONE)
+    {
+        return ESP_OK;
+    }
+    if (slot->encoding != GHOTA_COMPRESSION_GZIP)
+    {
+        ESP_LOGE(
+            POOL_TAG,
+            "Unsupported Content-Encoding from %s",
+            slot->host);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    body->dec = ghota_decompress_create(
+        GHOTA_COMPRESSION_GZIP,
+        ghota_http_body_decoded,
+        body);
+    if (body->dec == NULL)
+    {
+        ESP_LOGE(
+            POOL_TAG,
+            "Gzip encoded response from %s, but gzip is not available",
+            slot->host);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+int ghota_http_body_read(
+    ghota_http_body_t *body,
+    char *buf,
+    size_t len)
+{
+    /* esp_http_client_read removes the chunked framing */
+    int res = esp_http_client_read(
+        body->client,
+        buf,
+        len);
+    if (res > 0)
+    {
+        body->received += res;
+    }
+    return res;
+}
+
+esp_err_t ghota_http_body_write(
+    ghota_http_body_t *body,
+    const char *data,
+    size_t len)
+{
+    if (body->dec)
+    {
+        return ghota_decompress_feed(body->dec, data, len);
+    }
+    return body->cb(body->ctx, data, len);
+}
+
+esp_err_t ghota_http_body_end(
+    ghota_http_body_t *body,
+    esp_err_t err)
+{
+    if (body->dec == NULL)
+    {
+        return err;
+    }
+    if (err == ESP_OK)
+    {
+        err = ghota_decompress_finish(body->dec);
+    }
+    ESP_LOGD(
+        POOL_TAG,
+        "Received %" PRIu32 " gzip encoded bytes, %" PRIu32 " decoded",
+        body->received,
+        ghota_decompress_get_out(body->dec));
+    ghota_decompress_free(body->dec);
+    body->dec = NULL;
+    return err;
+}
@@ -1,11 +1,21 @@
+#include <string.h>
+#include <ctype.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
 #include <esp_http_client.h>
-#include <esp_tls.h>
-#include <esp_crt_bundle.h>
-#include <esp_https_ota.h>
 #include <esp_log.h>
 #include <esp_ota_ops.h>
+#include <esp_app_format.h>
+#ifdef CONFIG_BOOTLOADER_APP_ANTI_ROLLBACK
+#include <esp_efuse.h>
+#endif
 
 #include "interface/ghota_wifi_interface.h"
+#include "interface/ghota_http_pool.h"
+#include "esp_ghota_writer.h"
+#include "esp_ghota_patch.h"
+#include "esp_ghota_decompress.h"
 #include "esp_ghota_client.h"
 #include "esp_ghota_event.h"
 
@@ -18,154 +28,765 @@
 static char *WIFI_INTERFACE_TAG =
     "Ghota Wi-Fi Interface";
 
-static esp_err_t _http_event_handler(
-    esp_http_client_event_t *evt)
+#define WIFI_INTERFACE_RX_BUF_SIZE 1024
+#define WIFI_INTERFACE_SECTOR_SIZE 4096
+
+/* image header, first segment header and app description */
+#define WIFI_INTERFACE_IMG_HEADER_LEN       \
+    (sizeof(esp_image_header_t) +           \
+     sizeof(esp_image_segment_header_t) +   \
+     sizeof(esp_app_desc_t))
+
+static ghota_http_pool_t *wifi_get_pool(
+    ghota_client_handle_t *handle)
+{
+    ghota_http_pool_t *pool =
+        ghota_client_get_interface_ctx(handle);
+    if (pool == NULL)
+    {
+        pool = ghota_http_pool_create(handle);
+        ghota_client_set_interface_ctx(handle, pool);
+    }
+    return pool;
+}
+
+/* feeds the decoded release info to the parser */
+static esp_err_t wifi_release_info_write(
+    void *ctx,
+    const char *data,
+    size_t len)
+{
+    lwjsonr_t res = lwjson_stream_parse_buf(
+        (lwjson_stream_parser_t *)ctx,
+        data,
+        len);
+    if (res == lwjsonSTREAMSTOP)
+    {
+        return GHOTA_HTTP_BODY_STOP;
+    }
+    if (!(res == lwjsonOK ||
+          res == lwjsonSTREAMDONE ||
+          res == lwjsonSTREAMINPROG))
+    {
+        ESP_LOGE(
+            WIFI_INTERFACE_TAG,
+            "Lwjson Error: %d",
+            res);
+    }
+    return ESP_OK;
+}
+
+/* send a release info request and feed the response to the parser */
+static esp_err_t wifi_read_release_info(
+    ghota_client_handle_t *handle,
+    const ghota_http_request_t *request,
+    lwjson_stream_parser_t *parser)
 {
-    lwjsonr_t res;
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wswitch"
-    switch (evt->event_id)
+    ghota_http_pool_t *pool = wifi_get_pool(handle);
+    if (pool == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(
+        WIFI_INTERFACE_TAG,
+        "Searching for Firmware from %s",
+        request->url);
+
+    char *buf = malloc(WIFI_INTERFACE_RX_BUF_SIZE);
+    if (buf == NULL)
     {
-    case HTTP_EVENT_ON_HEADER:
-        if (strncasecmp(
-                evt->header_key,
-                "x-ratelimit-remaining",
-                strlen("x-ratelimit-remaining")) == 0)
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_http_client_handle_t client = NULL;
+    int status_code = 0;
+    esp_err_t err = ghota_http_pool_open(
+        pool,
+        request,
+        &client,
+        &status_code);
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(
+            WIFI_INTERFACE_TAG,
+            "HTTP request failed: %s",
+            esp_err_to_name(err));
+        free(buf);
+        return err;
+    }
+    ESP_LOGD(
+        WIFI_INTERFACE_TAG,
+        "HTTP Status = %d, "
+        "content_length = %" PRICONTENT_LENGTH,
+        status_code,
+        esp_http_client_get_content_length(client));
+
+    if (status_code == 200)
+    {
+        ghota_http_body_t body;
+        err = ghota_http_body_begin(
+            &body,
+            pool,
+            client,
+            wifi_release_info_write,
+            parser);
+        int len = 0;
+        while (err == ESP_OK &&
+               (len = ghota_http_body_read(
+                    &body,
+                    buf,
+                    WIFI_INTERFACE_RX_BUF_SIZE)) > 0)
         {
-            int limit = atoi(evt->header_value);
+            err = ghota_http_body_write(&body, buf, len);
+        }
+        if (err == GHOTA_HTTP_BODY_STOP)
+        {
+            /* the parser has everything it needs,
+            the rest of the response is not read */
             ESP_LOGD(
                 WIFI_INTERFACE_TAG,
-                "Github API Rate Limit Remaining: %d",
-                limit);
-            if (limit < 10)
-            {
-                ESP_LOGW(
-                    WIFI_INTERFACE_TAG,
-                    "Github API Rate Limit Remaining is low: %d",
-                    limit);
-            }
+                "Release info complete after %" PRIu32 " bytes, closing connection",
+                body.received);
         }
-        break;
-    case HTTP_EVENT_ON_DATA:
-        if (!esp_http_client_is_chunked_response(evt->client))
+        else if (err == ESP_OK && len < 0)
         {
-            char *buf = evt->data;
-            for (int i = 0; i < evt->data_len; i++)
-            {
-                res = lwjson_stream_parse(
-                    (lwjson_stream_parser_t *)evt->user_data,
-                    *buf);
-                if (!(res == lwjsonOK ||
-                      res == lwjsonSTREAMDONE ||
-                      res == lwjsonSTREAMINPROG))
-                {
-                    ESP_LOGE(
-                        WIFI_INTERFACE_TAG,
-                        "Lwjson Error: %d",
-                        res);
-                }
-                buf++;
-            }
-        }
-        break;
-    case HTTP_EVENT_DISCONNECTED:
-    {
-        int mbedtls_err = 0;
-        esp_err_t err = esp_tls_get_and_clear_last_error(
-            evt->data,
-            &mbedtls_err,
-            NULL);
-        if (err != 0)
-        {
-            ESP_LOGE(
-                WIFI_INTERFACE_TAG,
-                "Last esp error code: 0x%x",
-                err);
             ESP_LOGE(
                 WIFI_INTERFACE_TAG,
-                "Last mbedtls failure: 0x%x",
-                mbedtls_err);
+                "Failed to read release info");
+            err = ESP_FAIL;
+        }
+        err = ghota_http_body_end(&body, err);
+        if (err == GHOTA_HTTP_BODY_STOP)
+        {
+            err = ESP_OK;
         }
-        break;
     }
+    else if (status_code == 304 && request->validators)
+    {
+        ESP_LOGD(
+            WIFI_INTERFACE_TAG,
+            "Release info not modified");
+        request->validators->not_modified = true;
     }
-#pragma GCC diagnostic pop
-    return ESP_OK;
+    else
+    {
+        err = ESP_FAIL;
+    }
+
+    ghota_http_pool_release(pool, client);
+    free(buf);
+
+    return err;
 }
 
 static esp_err_t wifi_get_release_info(
     ghota_client_handle_t *handle,
     char *url,
+    lwjson_stream_parser_t *parser,
+    ghota_release_validators_t *validators)
+{
+    ghota_http_request_t request = {
+        .url = url,
+        .accept = NULL,
+#ifdef CONFIG_GHOTA_HTTP_GZIP
+        .accept_encoding = "gzip",
+#endif
+        .authenticate = true,
+        .validators = validators,
+    };
+    return wifi_read_release_info(handle, &request, parser);
+}
+
+static esp_err_t wifi_query_release_info(
+    ghota_client_handle_t *handle,
+    const char *url,
+    const char *query,
     lwjson_stream_parser_t *parser)
 {
-    esp_http_client_config_t httpconfig = {
+    ghota_http_request_t request = {
         .url = url,
-        .crt_bundle_attach = esp_crt_bundle_attach,
-        .event_handler = _http_event_handler,
-        .user_data = parser,
+        .accept = "application/json",
+#ifdef CONFIG_GHOTA_HTTP_GZIP
+        .accept_encoding = "gzip",
+#endif
+        .authenticate = true,
+        .post_data = query,
+        .content_type = "application/json",
+    };
+    return wifi_read_release_info(handle, &request, parser);
+}
+
+/* the latest release page redirects to ".../releases/tag/<tag>" */
+static esp_err_t wifi_get_latest_tag(
+    ghota_client_handle_t *handle,
+    const char *url,
+    char *tag,
+    size_t len)
+{
+    ghota_http_pool_t *pool = wifi_get_pool(handle);
+    if (pool == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    char location[CONFIG_MAX_URL_LEN] = "";
+    ghota_http_request_t request = {
+        .url = url,
+        .head = true,
+        .location = location,
+        .location_len = sizeof(location),
     };
-    char *username =
-        ghota_client_get_username(handle);
+    esp_http_client_handle_t client = NULL;
+    int status_code = 0;
+    esp_err_t err = ghota_http_pool_open(
+        pool,
+        &request,
+        &client,
+        &status_code);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    ghota_http_pool_release(pool, client);
 
-    if (username)
+    char *name = strrchr(location, '/');
+    if (name == NULL ||
+        strlen(name + 1) == 0 ||
+        strcmp(name + 1, "releases") == 0)
     {
         ESP_LOGD(
             WIFI_INTERFACE_TAG,
-            "Using Authenticated Request to %s",
-            url);
-        httpconfig.username = username;
-        httpconfig.password =
-            ghota_client_get_token(handle);
-        httpconfig.auth_type = HTTP_AUTH_TYPE_BASIC;
+            "No tag in the response to %s (%d)",
+            url,
+            status_code);
+        return ESP_ERR_NOT_FOUND;
     }
-    ESP_LOGI(
+    strlcpy(tag, name + 1, len);
+    return ESP_OK;
+}
+
+/* filters the downloaded asset before it is written, chunk by chunk */
+typedef esp_err_t (*wifi_sink_t)(
+    void *ctx,
+    ghota_writer_t *writer,
+    const char *data,
+    size_t len);
+
+typedef struct
+{
+    ghota_writer_t *writer;
+    wifi_sink_t sink;
+    void *ctx;
+    uint32_t size;
+    uint32_t received;
+    ghota_event_e progress_event;
+    int last_progress;
+    ghota_http_body_t body;
+} wifi_download_t;
+
+/* write one decoded chunk of the response and report the progress */
+static esp_err_t wifi_download_write(
+    void *pvdl,
+    const char *data,
+    size_t len)
+{
+    wifi_download_t *dl =
+        (wifi_download_t *)pvdl;
+    esp_err_t err;
+    if (dl->sink)
+        err = dl->sink(dl->ctx, dl->writer, data, len);
+    else
+        err = ghota_writer_write(dl->writer, data, len);
+    dl->received += len;
+    if (err != ESP_OK || dl->size == 0)
+    {
+        return err;
+    }
+    /* a sink may write more or less than it receives, count the download */
+    int progress = 100 * ((float)dl->received /
+                          (float)dl->size);
+    if ((progress % 5 == 0) &&
+        (progress != dl->last_progress))
+    {
+        err = esp_event_post(
+            GHOTA_EVENTS,
+            dl->progress_event,
+            &progress,
+            sizeof(progress),
+            portMAX_DELAY);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(
+                WIFI_INTERFACE_TAG,
+                "event %s post failed: %s",
+                ghota_get_event_str(dl->progress_event),
+                esp_err_to_name(err));
+            return err;
+        }
+        ESP_LOGV(
+            WIFI_INTERFACE_TAG,
+            "%s: %d%%",
+            ghota_get_event_str(dl->progress_event),
+            progress);
+        dl->last_progress = progress;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t wifi_download_sequential(
+    wifi_download_t *dl)
+{
+    char *buf = malloc(WIFI_INTERFACE_RX_BUF_SIZE);
+    if (buf == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    int len;
+    esp_err_t err = ESP_OK;
+    while ((len = ghota_http_body_read(
+                &dl->body,
+                buf,
+                WIFI_INTERFACE_RX_BUF_SIZE)) > 0)
+    {
+        err = ghota_http_body_write(&dl->body, buf, len);
+        if (err != ESP_OK)
+        {
+            break;
+        }
+    }
+    free(buf);
+    if (err == ESP_OK && len < 0)
+    {
+        err = ESP_FAIL;
+    }
+    return err;
+}
+
+#ifdef CONFIG_GHOTA_PIPELINE
+typedef struct
+{
+    char *data;
+    int len;
+} wifi_ring_buf_t;
+
+typedef struct
+{
+    wifi_download_t *dl;
+    QueueHandle_t free_bufs;
+    QueueHandle_t full_bufs;
+    TaskHandle_t receiver;
+    volatile esp_err_t err;
+} wifi_pipeline_t;
+
+/* flash stage, drains the ring until it receives an empty buffer */
+static void wifi_pipeline_task(
+    void *pvParameters)
+{
+    wifi_pipeline_t *pl =
+        (wifi_pipeline_t *)pvParameters;
+    wifi_ring_buf_t buf;
+    while (xQueueReceive(
+               pl->full_bufs,
+               &buf,
+               portMAX_DELAY) == pdTRUE &&
+           buf.len > 0)
+    {
+        /* after an error the ring is still drained, so the receiver never blocks */
+        if (pl->err == ESP_OK)
+        {
+            pl->err = ghota_http_body_write(
+                &pl->dl->body,
+                buf.data,
+                buf.len);
+        }
+        xQueueSend(pl->free_bufs, &buf, portMAX_DELAY);
+    }
+    xTaskNotifyGive(pl->receiver);
+    vTaskDelete(NULL);
+}
+
+/* receive stage, runs on the calling task while wifi_pipeline_task writes to flash */
+static esp_err_t wifi_download_pipelined(
+    wifi_download_t *dl)
+{
+    wifi_pipeline_t pl = {
+        .dl = dl,
+        .free_bufs = xQueueCreate(
+            CONFIG_GHOTA_PIPELINE_DEPTH,
+            sizeof(wifi_ring_buf_t)),
+        .full_bufs = xQueueCreate(
+            CONFIG_GHOTA_PIPELINE_DEPTH + 1,
+            sizeof(wifi_ring_buf_t)),
+        .receiver = xTaskGetCurrentTaskHandle(),
+        .err = ESP_OK,
+    };
+    char *ring = malloc(
+        CONFIG_GHOTA_PIPELINE_DEPTH *
+        CONFIG_GHOTA_PIPELINE_BUF_SIZE);
+    esp_err_t err = ESP_OK;
+    if (pl.free_bufs == NULL ||
+        pl.full_bufs == NULL ||
+        ring == NULL)
+    {
+        goto fallback;
+    }
+    for (int i = 0; i < CONFIG_GHOTA_PIPELINE_DEPTH; i++)
+    {
+        wifi_ring_buf_t buf = {
+            .data = &ring[i * CONFIG_GHOTA_PIPELINE_BUF_SIZE],
+            .len = 0,
+        };
+        xQueueSend(pl.free_bufs, &buf, 0);
+    }
+#if CONFIG_FREERTOS_UNICORE
+    BaseType_t res = xTaskCreate(
+        wifi_pipeline_task,
+        "ghota_writer",
+        4096,
+        &pl,
+        5,
+        NULL);
+#else
+    BaseType_t res = xTaskCreatePinnedToCore(
+        wifi_pipeline_task,
+        "ghota_writer",
+        4096,
+        &pl,
+        5,
+        NULL,
+        CONFIG_GHOTA_PIPELINE_WRITER_CORE);
+#endif
+    if (res != pdPASS)
+    {
+        goto fallback;
+    }
+
+    int len = 0;
+    uint32_t total = 0;
+    TickType_t start = xTaskGetTickCount();
+    TickType_t stalled = 0;
+    UBaseType_t max_used = 0;
+    wifi_ring_buf_t buf;
+    while (pl.err == ESP_OK)
+    {
+        /* waiting here means flash is slower than the network */
+        TickType_t wait = xTaskGetTickCount();
+        xQueueReceive(pl.free_bufs, &buf, portMAX_DELAY);
+        stalled += xTaskGetTickCount() - wait;
+
+        len = ghota_http_body_read(
+            &dl->body,
+            buf.data,
+            CONFIG_GHOTA_PIPELINE_BUF_SIZE);
+        if (len <= 0)
+        {
+            break;
+        }
+        total += len;
+        buf.len = len;
+        xQueueSend(pl.full_bufs, &buf, portMAX_DELAY);
+        UBaseType_t used =
+            uxQueueMessagesWaiting(pl.full_bufs);
+        if (used > max_used)
+        {
+            max_used = used;
+        }
+    }
+    buf.len = 0;
+    xQueueSend(pl.full_bufs, &buf, portMAX_DELAY);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    ESP_LOGD(
         WIFI_INTERFACE_TAG,
-        "Searching for Firmware from %s",
-        url);
+        "Pipeline received %" PRIu32 " bytes in %" PRIu32 " ms, "
+        "stalled on flash for %" PRIu32 " ms, ring peak %u/%d",
+        total,
+        (uint32_t)pdTICKS_TO_MS(xTaskGetTickCount() - start),
+        (uint32_t)pdTICKS_TO_MS(stalled),
+        (unsigned)max_used,
+        CONFIG_GHOTA_PIPELINE_DEPTH);
 
-    esp_http_client_handle_t client =
-        esp_http_client_init(&httpconfig);
+    err = pl.err;
+    if (err == ESP_OK && len < 0)
+    {
+        err = ESP_FAIL;
+    }
+    goto cleanup;
 
-    esp_err_t err = esp_http_client_perform(client);
+fallback:
+    ESP_LOGW(
+        WIFI_INTERFACE_TAG,
+        "Not enough memory for the download pipeline, writing sequentially");
+    err = wifi_download_sequential(dl);
 
-    int status_code =
-        esp_http_client_get_status_code(client);
+cleanup:
+    if (pl.free_bufs)
+        vQueueDelete(pl.free_bufs);
+    if (pl.full_bufs)
+        vQueueDelete(pl.full_bufs);
+    free(ring);
+    return err;
+}
+#endif
 
-    if (err == ESP_OK)
+/* download url into writer, continuing an interrupted download when the server allows it */
+static esp_err_t wifi_download(
+    ghota_client_handle_t *handle,
+    const char *url,
+    uint32_t size,
+    ghota_event_e progress_event,
+    ghota_writer_t *writer,
+    wifi_sink_t sink,
+    void *ctx)
+{
+    ghota_http_pool_t *pool = wifi_get_pool(handle);
+    if (pool == NULL)
     {
-        ESP_LOGD(
-            WIFI_INTERFACE_TAG,
-            "HTTP GET Status = %d, "
-            "content_length = %" PRICONTENT_LENGTH,
-            status_code,
-            esp_http_client_get_content_length(client));
+        return ESP_ERR_NO_MEM;
     }
-    else
+    ghota_release_validators_t validators = {0};
+    ghota_http_request_t request = {
+        .url = url,
+        .accept = "application/octet-stream",
+        /* offsets in an encoded body are not offsets in the image */
+        .accept_encoding = "identity",
+        .authenticate = true,
+        .validators = &validators,
+        .range_start = ghota_writer_get_resume_offset(writer),
+        .if_range = ghota_writer_get_etag(writer),
+    };
+    ESP_LOGD(
+        WIFI_INTERFACE_TAG,
+        "Downloading %s from %" PRIu32,
+        url,
+        request.range_start);
+
+    esp_http_client_handle_t client = NULL;
+    int status_code = 0;
+    esp_err_t err = ghota_http_pool_open(
+        pool,
+        &request,
+        &client,
+        &status_code);
+    if (err != ESP_OK)
     {
         ESP_LOGE(
             WIFI_INTERFACE_TAG,
             "HTTP GET request failed: %s",
             esp_err_to_name(err));
+        return err;
+    }
+    ESP_LOGD(
+        WIFI_INTERFACE_TAG,
+        "HTTP GET Status = %d, "
+        "content_length = %" PRICONTENT_LENGTH,
+        status_code,
+        esp_http_client_get_content_length(client));
+
+    uint32_t offset = 0;
+    if (status_code == 206 && request.range_start)
+    {
+        offset = request.range_start;
+        ESP_LOGI(
+            WIFI_INTERFACE_TAG,
+            "Resuming download at %" PRIu32,
+            offset);
+    }
+    else if (status_code != 200)
+    {
+        ghota_http_pool_release(pool, client);
+        return ESP_FAIL;
+    }
+    wifi_download_t dl = {
+        .writer = writer,
+        .sink = sink,
+        .ctx = ctx,
+        .size = size,
+        .received = offset,
+        .progress_event = progress_event,
+        .last_progress = -1,
+    };
+    err = ghota_http_body_begin(
+        &dl.body,
+        pool,
+        client,
+        wifi_download_write,
+        &dl);
+    if (err == ESP_OK && dl.body.dec)
+    {
+        /* encoded although identity was asked for, it cannot be resumed */
+        ESP_LOGW(
+            WIFI_INTERFACE_TAG,
+            "Server sent a gzip encoded download");
+        if (offset)
+        {
+            err = ESP_ERR_NOT_SUPPORTED;
+        }
+        ghota_writer_set_journal(writer, false);
+    }
+    else if (err == ESP_OK)
+    {
+        int64_t content_length =
+            esp_http_client_get_content_length(client);
+        if (content_length > 0)
+        {
+            dl.size = offset + content_length;
+        }
+    }
+    if (err == ESP_OK)
+    {
+        err = ghota_writer_begin(
+            writer,
+            offset,
+            validators.etag);
+    }
+    if (err != ESP_OK)
+    {
+        ghota_http_body_end(&dl.body, err);
+        ghota_http_pool_release(pool, client);
+        return err;
     }
 
-    if (status_code != 200)
+#ifdef CONFIG_GHOTA_PIPELINE
+    err = wifi_download_pipelined(&dl);
+#else
+    err = wifi_download_sequential(&dl);
+#endif
+    if (err == ESP_OK &&
+        !esp_http_client_is_complete_data_received(client))
+    {
         err = ESP_FAIL;
+    }
+    err = ghota_http_body_end(&dl.body, err);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(
+            WIFI_INTERFACE_TAG,
+            "Download failed: %s",
+            esp_err_to_name(err));
+    }
+
+    ghota_http_pool_release(pool, client);
+    return err;
+}
+
+typedef struct
+{
+    ghota_decompress_t *dec;
+    ghota_writer_t *writer;
+    wifi_sink_t sink;
+    void *ctx;
+} wifi_decompress_sink_t;
+
+/* passes the decompressed image on to the next sink or the writer */
+static esp_err_t wifi_decompress_write(
+    void *ctx,
+    const void *data,
+    size_t len)
+{
+    wifi_decompress_sink_t *ds =
+        (wifi_decompress_sink_t *)ctx;
+    if (ds->sink)
+        return ds->sink(ds->ctx, ds->writer, data, len);
+    return ghota_writer_write(ds->writer, data, len);
+}
 
-    if (esp_http_client_cleanup(client) != ESP_OK)
+static esp_err_t wifi_decompress_sink(
+    void *ctx,
+    ghota_writer_t *writer,
+    const char *data,
+    size_t len)
+{
+    esp_err_t err = ghota_decompress_feed(
+        ((wifi_decompress_sink_t *)ctx)->dec,
+        data,
+        len);
+    if (err != ESP_OK)
+    {
         ESP_LOGE(
             WIFI_INTERFACE_TAG,
-            "HTTP client cleanup failed");
+            "Failed to decompress asset: %s",
+            esp_err_to_name(err));
+    }
+    return err;
+}
 
+/* put a decompressor in front of sink, the download then no longer maps to the partition */
+static esp_err_t wifi_decompress_begin(
+    wifi_decompress_sink_t *ds,
+    ghota_compression_t compression,
+    ghota_writer_t *writer,
+    wifi_sink_t sink,
+    void *ctx)
+{
+    ds->writer = writer;
+    ds->sink = sink;
+    ds->ctx = ctx;
+    ds->dec = ghota_decompress_create(
+        compression,
+        wifi_decompress_write,
+        ds);
+    if (ds->dec == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    ghota_writer_set_journal(writer, false);
+    return ESP_OK;
+}
+
+static esp_err_t wifi_decompress_end(
+    wifi_decompress_sink_t *ds,
+    esp_err_t err)
+{
+    if (ds->dec == NULL)
+    {
+        return err;
+    }
+    if (err == ESP_OK)
+    {
+        err = ghota_decompress_finish(ds->dec);
+        ESP_LOGI(
+            WIFI_INTERFACE_TAG,
+            "Decompressed %" PRIu32 " downloaded bytes to %" PRIu32 " bytes",
+            ghota_decompress_get_in(ds->dec),
+            ghota_decompress_get_out(ds->dec));
+    }
     return err;
 }
 
-static esp_err_t http_client_set_header_cb(
-    esp_http_client_handle_t http_client)
+static esp_err_t wifi_verify_digest(
+    const char *what,
+    const char *expected,
+    const uint8_t *sha256)
 {
-    return esp_http_client_set_header(
-        http_client,
-        "Accept",
-        "application/octet-stream");
+    char digest[GHOTA_SHA256_HEX_LEN];
+    for (int i = 0; i < 32; i++)
+    {
+        snprintf(&digest[i * 2], 3, "%02x", sha256[i]);
+    }
+    ESP_LOGI(
+        WIFI_INTERFACE_TAG,
+        "%s image SHA-256: %s",
+        what,
+        digest);
+    if (!strlen(expected))
+    {
+        ESP_LOGW(
+            WIFI_INTERFACE_TAG,
+            "The release has no %s digest, the image is not verified",
+            what);
+        return ESP_OK;
+    }
+    if (strcasecmp(expected, digest) != 0)
+    {
+        ESP_LOGE(
+            WIFI_INTERFACE_TAG,
+            "%s image digest mismatch, expected %s",
+            what,
+            expected);
+        return ESP_ERR_INVALID_CRC;
+    }
+    return ESP_OK;
 }
 
 static esp_err_t validate_image_header(
@@ -224,174 +845,602 @@ static esp_err_t validate_image_header(
         update->address);
 
 #ifdef CONFIG_BOOTLOADER_APP_ANTI_ROLLBACK
-    /**
-     * Secure version check from firmware image header prevents subsequent download and flash write of
-     * entire firmware image. However this is optional because it is also taken care in API
-     * esp_https_ota_finish at the end of OTA update procedure.
-     */
-    const uint32_t hw_sec_version =
-        esp_efuse_read_secure_version();
-    if (new_app_info->secure_version < hw_sec_version)
+    /* the bootloader does not boot an image below the secure version in eFuse. The
+    images are written with esp_partition_write and esp_ota_set_boot_partition does
+    not compare the versions, so this is the only check before the device restarts */
+    if (!esp_efuse_check_secure_version(new_app_info->secure_version))
     {
-        ESP_LOGW(
-            TAG,
-            "New firmware security version is less than eFuse programmed, %d < %d",
+        ESP_LOGE(
+            WIFI_INTERFACE_TAG,
+            "New firmware security version is less than eFuse programmed, %" PRIu32 " < %" PRIu32,
             new_app_info->secure_version,
-            hw_sec_version);
-        return ESP_FAIL;
+            esp_efuse_read_secure_version());
+        return ESP_ERR_INVALID_VERSION;
     }
 #endif
 
     return ESP_OK;
 }
 
-static esp_err_t wifi_install_firmware(
-    ghota_client_handle_t *handle)
+typedef struct
 {
-    esp_http_client_config_t httpconfig = {
-        .url = ghota_client_get_result_url(handle),
-        .crt_bundle_attach = esp_crt_bundle_attach,
-        .keep_alive_enable = true,
-        .buffer_size_tx = 4096};
+    bool started;
+    bool resumed;
+    size_t header_len;
+    uint8_t header[WIFI_INTERFACE_IMG_HEADER_LEN];
+} wifi_firmware_sink_t;
 
-    char *username = ghota_client_get_username(handle);
-    if (username)
+/* buffers the image until its app description can be checked, then streams it to the OTA partition */
+static esp_err_t wifi_firmware_sink(
+    void *ctx,
+    ghota_writer_t *writer,
+    const char *data,
+    size_t len)
+{
+    wifi_firmware_sink_t *fw =
+        (wifi_firmware_sink_t *)ctx;
+    if (!fw->started &&
+        ghota_writer_get_offset(writer) > 0)
     {
-        ESP_LOGD(
-            WIFI_INTERFACE_TAG,
-            "Using Authenticated Request to %s",
-            httpconfig.url);
-        httpconfig.username = username;
-        httpconfig.password =
-            ghota_client_get_token(handle);
-        httpconfig.auth_type = HTTP_AUTH_TYPE_BASIC;
+        /* resumed download, the header is checked in flash once the image is complete */
+        fw->started = true;
+        fw->resumed = true;
+    }
+    if (fw->started)
+    {
+        return ghota_writer_write(
+            writer,
+            data,
+            len);
     }
 
-    esp_https_ota_config_t ota_config = {
-        .http_config = &httpconfig,
-        .http_client_init_cb = http_client_set_header_cb,
-    };
+    size_t copy = WIFI_INTERFACE_IMG_HEADER_LEN - fw->header_len;
+    if (copy > len)
+    {
+        copy = len;
+    }
+    memcpy(&fw->header[fw->header_len], data, copy);
+    fw->header_len += copy;
+    if (fw->header_len < WIFI_INTERFACE_IMG_HEADER_LEN)
+    {
+        return ESP_OK;
+    }
 
-    esp_https_ota_handle_t https_ota_handle = NULL;
-    esp_err_t err = esp_https_ota_begin(
-        &ota_config,
-        &https_ota_handle);
+    esp_app_desc_t app_desc;
+    memcpy(
+        &app_desc,
+        &fw->header[sizeof(esp_image_header_t) +
+                    sizeof(esp_image_segment_header_t)],
+        sizeof(esp_app_desc_t));
+    esp_err_t err = validate_image_header(&app_desc);
     if (err != ESP_OK)
     {
         ESP_LOGE(
             WIFI_INTERFACE_TAG,
-            "ESP HTTPS OTA Begin failed: %s",
+            "image header verification failed: %s",
             esp_err_to_name(err));
-
-        esp_https_ota_abort(https_ota_handle);
         return err;
     }
 
-    esp_app_desc_t app_desc;
-    err = esp_https_ota_get_img_desc(
-        https_ota_handle,
-        &app_desc);
-    if (err != ESP_OK)
+    fw->started = true;
+    err = ghota_writer_write(
+        writer,
+        fw->header,
+        fw->header_len);
+    if (err == ESP_OK && len > copy)
+    {
+        err = ghota_writer_write(
+            writer,
+            &data[copy],
+            len - copy);
+    }
+    return err;
+}
+
+static esp_err_t wifi_install_firmware(
+    ghota_client_handle_t *handle)
+{
+    const esp_partition_t *partition =
+        esp_ota_get_next_update_partition(NULL);
+    if (partition == NULL)
     {
         ESP_LOGE(
             WIFI_INTERFACE_TAG,
-            "esp_https_ota_read_img_desc failed: %d",
-            err);
+            "No OTA update partition");
+        return ESP_FAIL;
+    }
+    wifi_firmware_sink_t *fw =
+        calloc(1, sizeof(wifi_firmware_sink_t));
+    ghota_writer_t *writer = ghota_writer_open(
+        partition,
+        ghota_client_get_result_url(handle),
+        ghota_client_get_result_size(handle));
+    if (fw == NULL || writer == NULL)
+    {
+        free(fw);
+        ghota_writer_close(writer);
+        return ESP_ERR_NO_MEM;
+    }
 
-        esp_https_ota_abort(https_ota_handle);
+    wifi_sink_t sink = wifi_firmware_sink;
+    void *sink_ctx = fw;
+    /* the published digest is the one of the asset, compressed or not */
+    wifi_decompress_sink_t ds = {0};
+    esp_err_t err;
+    if (ghota_client_get_result_compression(handle) != GHOTA_COMPRESSION_NONE)
+    {
+        err = wifi_decompress_begin(
+            &ds,
+            ghota_client_get_result_compression(handle),
+            writer,
+            sink,
+            sink_ctx);
+        if (err == ESP_OK)
+            err = ghota_decompress_set_sha256(ds.dec, true);
+        sink = wifi_decompress_sink;
+        sink_ctx = &ds;
+    }
+    else
+    {
+        err = ghota_writer_set_sha256(writer, true);
+    }
+    if (err == ESP_OK)
+    {
+        err = wifi_download(
+            handle,
+            ghota_client_get_result_url(handle),
+            ghota_client_get_result_size(handle),
+            GHOTA_EVENT_FIRMWARE_UPDATE_PROGRESS,
+            writer,
+            sink,
+            sink_ctx);
+    }
+    err = wifi_decompress_end(&ds, err);
+    if (err == ESP_OK && !fw->started)
+    {
+        ESP_LOGE(
+            WIFI_INTERFACE_TAG,
+            "Firmware image is too short");
+        err = ESP_FAIL;
+    }
+    bool resumed = fw->resumed;
+    free(fw);
+    if (err == ESP_OK)
+    {
+        err = ghota_writer_finish(writer);
+    }
+    /* the digest is recorded as installed, it must be the one of this image */
+    if (err == ESP_OK)
+    {
+        ghota_client_set_phase(handle, GHOTA_PHASE_VERIFYING);
+        err = wifi_verify_digest(
+            "Firmware",
+            ghota_client_get_result_digest(handle),
+            ds.dec ? ghota_decompress_get_sha256(ds.dec)
+                   : ghota_writer_get_sha256(writer));
+    }
+    ghota_decompress_free(ds.dec);
+    ghota_writer_close(writer);
+    if (err != ESP_OK)
+    {
         return err;
     }
 
-    err = validate_image_header(&app_desc);
-    if (err != ESP_OK)
+    /* the header of a resumed download was written by an earlier run, which may have
+    had another release or another secure version in eFuse */
+    if (resumed)
+    {
+        esp_app_desc_t app_desc;
+        err = esp_ota_get_partition_description(partition, &app_desc);
+        if (err == ESP_OK)
+        {
+            err = validate_image_header(&app_desc);
+        }
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(
+                WIFI_INTERFACE_TAG,
+                "resumed image header verification failed: %s",
+                esp_err_to_name(err));
+            return err;
+        }
+    }
+
+    /* verifies the whole image before it is made bootable */
+    err = esp_ota_set_boot_partition(partition);
+    if (err == ESP_ERR_OTA_VALIDATE_FAILED)
     {
         ESP_LOGE(
             WIFI_INTERFACE_TAG,
-            "image header verification failed: %s",
-            esp_err_to_name(err));
+            "Image validation failed, image is corrupted");
+    }
+    return err;
+}
 
-        esp_https_ota_abort(https_ota_handle);
-        return err;
+typedef struct
+{
+    char buf[GHOTA_SHA256_HEX_LEN];
+    int len;
+} wifi_digest_t;
+
+/* collects the hex digest at the start of the sidecar */
+static esp_err_t wifi_digest_write(
+    void *ctx,
+    const char *data,
+    size_t len)
+{
+    wifi_digest_t *d =
+        (wifi_digest_t *)ctx;
+    size_t n = GHOTA_SHA256_HEX_LEN - 1 - d->len;
+    if (len < n)
+    {
+        n = len;
     }
+    memcpy(&d->buf[d->len], data, n);
+    d->len += n;
+    return d->len < GHOTA_SHA256_HEX_LEN - 1 ? ESP_OK : GHOTA_HTTP_BODY_STOP;
+}
 
-    int last_progress = -1;
-    while (1)
+/* read the digest from a sha256sum style "<hex>  <name>" sidecar */
+static esp_err_t wifi_get_digest(
+    ghota_client_handle_t *handle,
+    const char *url,
+    char *digest)
+{
+    ghota_http_pool_t *pool = wifi_get_pool(handle);
+    if (pool == NULL)
     {
-        err = esp_https_ota_perform(https_ota_handle);
-        if (err != ESP_ERR_HTTPS_OTA_IN_PROGRESS)
+        return ESP_ERR_NO_MEM;
+    }
+    ghota_http_request_t request = {
+        .url = url,
+        .accept = "application/octet-stream",
+        .authenticate = true,
+    };
+    esp_http_client_handle_t client = NULL;
+    int status_code = 0;
+    esp_err_t err = ghota_http_pool_open(
+        pool,
+        &request,
+        &client,
+        &status_code);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    wifi_digest_t d = {0};
+    if (status_code == 200)
+    {
+        char buf[GHOTA_SHA256_HEX_LEN];
+        ghota_http_body_t body;
+        int len;
+        err = ghota_http_body_begin(
+            &body,
+            pool,
+            client,
+            wifi_digest_write,
+            &d);
+        while (err == ESP_OK &&
+               (len = ghota_http_body_read(
+                    &body,
+                    buf,
+                    sizeof(buf))) > 0)
         {
-            break;
+            err = ghota_http_body_write(&body, buf, len);
         }
-        int32_t dl = esp_https_ota_get_image_len_read(
-            https_ota_handle);
-        int32_t size = esp_https_ota_get_image_size(
-            https_ota_handle);
-        int progress = 100 * ((float)dl / (float)size);
-        if ((progress % 5 == 0) &&
-            (progress != last_progress))
+        ghota_http_body_end(&body, err);
+    }
+    ghota_http_pool_release(pool, client);
+
+    for (int i = 0; i < GHOTA_SHA256_HEX_LEN - 1; i++)
+    {
+        if (!isxdigit((unsigned char)d.buf[i]))
         {
-            err = esp_event_post(
-                GHOTA_EVENTS,
-                GHOTA_EVENT_FIRMWARE_UPDATE_PROGRESS,
-                &progress,
-                sizeof(progress),
-                portMAX_DELAY);
-            if (err != ESP_OK)
-            {
-                ESP_LOGE(
-                    WIFI_INTERFACE_TAG,
-                    "event %s post failed: %s",
-                    ghota_get_event_str(
-                        GHOTA_EVENT_FIRMWARE_UPDATE_PROGRESS),
-                    esp_err_to_name(err));
-
-                esp_https_ota_abort(https_ota_handle);
-                return err;
-            }
-            ESP_LOGV(
+            ESP_LOGE(
                 WIFI_INTERFACE_TAG,
-                "Firmware Update Progress: %d%%",
-                progress);
-            last_progress = progress;
+                "No SHA-256 digest in %s",
+                url);
+            return ESP_FAIL;
         }
     }
+    strlcpy(digest, d.buf, GHOTA_SHA256_HEX_LEN);
+    return ESP_OK;
+}
+
+/* the running image is the source of the patch */
+static esp_err_t wifi_patch_read(
+    void *ctx,
+    uint32_t offset,
+    void *data,
+    size_t len)
+{
+    return esp_partition_read(
+        esp_ota_get_running_partition(),
+        offset,
+        data,
+        len);
+}
+
+static esp_err_t wifi_patch_write(
+    void *ctx,
+    const void *data,
+    size_t len)
+{
+    return ghota_writer_write(
+        (ghota_writer_t *)ctx,
+        data,
+        len);
+}
 
-    if (esp_https_ota_is_complete_data_received(
-            https_ota_handle) != true)
+/* the downloaded patch goes to the decoder, which writes the new image */
+static esp_err_t wifi_patch_sink(
+    void *ctx,
+    ghota_writer_t *writer,
+    const char *data,
+    size_t len)
+{
+    esp_err_t err = ghota_patch_feed(
+        (ghota_patch_t *)ctx,
+        data,
+        len);
+    if (err != ESP_OK)
     {
-        // the OTA image was not completely received and
-        // user can customise the response to this situation.
         ESP_LOGE(
             WIFI_INTERFACE_TAG,
-            "Complete data was not received.");
+            "Failed to apply patch at %" PRIu32 ": %s",
+            ghota_patch_get_received((ghota_patch_t *)ctx),
+            esp_err_to_name(err));
+    }
+    return err;
+}
 
-        esp_https_ota_abort(https_ota_handle);
+static esp_err_t wifi_install_firmware_patch(
+    ghota_client_handle_t *handle)
+{
+    const esp_partition_t *running =
+        esp_ota_get_running_partition();
+    const esp_partition_t *partition =
+        esp_ota_get_next_update_partition(NULL);
+    if (running == NULL || partition == NULL)
+    {
+        ESP_LOGE(
+            WIFI_INTERFACE_TAG,
+            "No OTA update partition");
         return ESP_FAIL;
     }
+    ghota_writer_t *writer = ghota_writer_open(
+        partition,
+        ghota_client_get_result_patch_url(handle),
+        ghota_client_get_result_size(handle));
+    if (writer == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    /* the writer offset is no offset into the patch, a retry starts over */
+    ghota_writer_set_journal(writer, false);
+    ghota_patch_t *patch = ghota_patch_create(
+        running->size,
+        wifi_patch_read,
+        wifi_patch_write,
+        writer);
+    esp_err_t err = ghota_writer_set_sha256(writer, true);
+    if (patch == NULL)
+    {
+        err = ESP_ERR_NO_MEM;
+    }
+    if (err == ESP_OK)
+    {
+        err = wifi_download(
+            handle,
+            ghota_client_get_result_patch_url(handle),
+            ghota_client_get_result_patch_size(handle),
+            GHOTA_EVENT_FIRMWARE_UPDATE_PROGRESS,
+            writer,
+            wifi_patch_sink,
+            patch);
+    }
+    if (err == ESP_OK)
+    {
+        err = ghota_patch_finish(patch);
+    }
+    if (err == ESP_OK)
+    {
+        err = ghota_writer_finish(writer);
+    }
+    /* the patch carries the digest of the image it builds, the release may publish it too,
+    unless the full image asset is compressed */
+    if (err == ESP_OK &&
+        memcmp(
+            ghota_writer_get_sha256(writer),
+            ghota_patch_get_target_sha256(patch),
+            32) != 0)
+    {
+        ESP_LOGE(
+            WIFI_INTERFACE_TAG,
+            "Patched image does not match the digest of the patch");
+        err = ESP_ERR_INVALID_CRC;
+    }
+    if (err == ESP_OK &&
+        ghota_client_get_result_compression(handle) == GHOTA_COMPRESSION_NONE)
+    {
+        err = wifi_verify_digest(
+            "Firmware",
+            ghota_client_get_result_digest(handle),
+            ghota_writer_get_sha256(writer));
+    }
+    if (patch)
+    {
+        uint32_t received = ghota_patch_get_received(patch);
+        uint32_t written = ghota_patch_get_written(patch);
+        ESP_LOGI(
+            WIFI_INTERFACE_TAG,
+            "Patch: downloaded %" PRIu32 " bytes, wrote %" PRIu32 " bytes (%" PRIu32 "%%)",
+            received,
+            written,
+            written ? (uint32_t)((uint64_t)received * 100 / written) : 0);
+    }
+    ghota_patch_free(patch);
+    ghota_writer_close(writer);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
 
-    err = esp_https_ota_finish(
-        https_ota_handle);
-    if (err ==
-        ESP_ERR_OTA_VALIDATE_FAILED)
+    ghota_client_set_phase(handle, GHOTA_PHASE_VERIFYING);
+    /* the image was rebuilt in flash and never streamed past the header check of a full one */
+    esp_app_desc_t app_desc;
+    err = esp_ota_get_partition_description(partition, &app_desc);
+    if (err == ESP_OK)
+    {
+        err = validate_image_header(&app_desc);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(
+            WIFI_INTERFACE_TAG,
+            "patched image header verification failed: %s",
+            esp_err_to_name(err));
+        return err;
+    }
+    err = esp_ota_set_boot_partition(partition);
+    if (err == ESP_ERR_OTA_VALIDATE_FAILED)
     {
         ESP_LOGE(
             WIFI_INTERFACE_TAG,
             "Image validation failed, image is corrupted");
     }
-
     return err;
 }
 
 static esp_err_t wifi_install_storage(
     ghota_client_handle_t *handle)
 {
-    return ESP_OK;
+    const esp_partition_t *partition =
+        ghota_client_get_storage_partition(handle);
+    if (partition == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    char *expected =
+        ghota_client_get_result_storage_digest(handle);
+    char *digest_url =
+        ghota_client_get_result_storage_digest_url(handle);
+    if (!strlen(expected) && strlen(digest_url))
+    {
+        char digest[GHOTA_SHA256_HEX_LEN];
+        esp_err_t err = wifi_get_digest(
+            handle,
+            digest_url,
+            digest);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        ghota_client_set_result_storage_digest(handle, digest);
+    }
+
+    ghota_writer_t *writer = ghota_writer_open(
+        partition,
+        ghota_client_get_result_storage_url(handle),
+        ghota_client_get_result_storage_size(handle));
+    if (writer == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+#ifdef CONFIG_GHOTA_STORAGE_DIFF
+    ghota_writer_set_diff(writer, true);
+#endif
+    /* the published digest is the one of the asset, compressed or not */
+    wifi_decompress_sink_t ds = {0};
+    esp_err_t err;
+    if (ghota_client_get_result_storage_compression(handle) != GHOTA_COMPRESSION_NONE)
+    {
+        err = wifi_decompress_begin(
+            &ds,
+            ghota_client_get_result_storage_compression(handle),
+            writer,
+            NULL,
+            NULL);
+        if (err == ESP_OK)
+            err = ghota_decompress_set_sha256(ds.dec, true);
+    }
+    else
+    {
+        err = ghota_writer_set_sha256(writer, true);
+    }
+    if (err == ESP_OK)
+    {
+        err = wifi_download(
+            handle,
+            ghota_client_get_result_storage_url(handle),
+            ghota_client_get_result_storage_size(handle),
+            GHOTA_EVENT_STORAGE_UPDATE_PROGRESS,
+            writer,
+            ds.dec ? wifi_decompress_sink : NULL,
+            &ds);
+    }
+    err = wifi_decompress_end(&ds, err);
+    if (err == ESP_OK)
+    {
+        err = ghota_writer_finish(writer);
+    }
+    if (err == ESP_OK)
+    {
+        ghota_client_set_phase(handle, GHOTA_PHASE_VERIFYING);
+        err = wifi_verify_digest(
+            "Storage",
+            expected,
+            ds.dec ? ghota_decompress_get_sha256(ds.dec)
+                   : ghota_writer_get_sha256(writer));
+    }
+    ghota_decompress_free(ds.dec);
+    if (err != ESP_OK)
+    {
+        ghota_writer_close(writer);
+        return err;
+    }
+
+#ifdef CONFIG_GHOTA_STORAGE_ERASE_TAIL
+    /* the writer only erased what it wrote, clear the rest like a fresh image */
+    uint32_t end = ghota_writer_get_offset(writer);
+    end += (WIFI_INTERFACE_SECTOR_SIZE - end % WIFI_INTERFACE_SECTOR_SIZE) %
+           WIFI_INTERFACE_SECTOR_SIZE;
+    if (end < partition->size)
+    {
+        err = esp_partition_erase_range(
+            partition,
+            end,
+            partition->size - end);
+    }
+#endif
+    ghota_writer_close(writer);
+    return err;
+}
+
+static void wifi_disconnect(
+    ghota_client_handle_t *handle)
+{
+    ghota_http_pool_disconnect(
+        ghota_client_get_interface_ctx(handle));
+}
+
+static void wifi_cleanup(
+    ghota_client_handle_t *handle)
+{
+    ghota_http_pool_destroy(
+        ghota_client_get_interface_ctx(handle));
+    ghota_client_set_interface_ctx(handle, NULL);
 }
 
 static ghota_interface_t ghota_wifi_interface = {
     .get_release_info = &wifi_get_release_info,
+    .get_latest_tag = &wifi_get_latest_tag,
+    .query_release_info = &wifi_query_release_info,
     .install_firmware = &wifi_install_firmware,
-    .install_storage = &wifi_install_storage};
+    .install_firmware_patch = &wifi_install_firmware_patch,
+    .install_storage = &wifi_install_storage,
+    .disconnect = &wifi_disconnect,
+    .cleanup = &wifi_cleanup};
 
 ghota_interface_t *get_ghota_wifi_interface()
 {
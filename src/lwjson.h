@@ -116,6 +116,8 @@ typedef enum {
     lwjsonSTREAMDONE,          /*!< Streaming parser is done,
                                     closing character matched the stream opening one */
     lwjsonSTREAMINPROG,        /*!< Stream parsing is still in progress */
+    lwjsonSTREAMSTOP,          /*!< Streaming parser was stopped by the user with \ref lwjson_stream_stop,
+                                    remaining data does not need to be received */
 }
 
 lwjsonr_t;
@@ -179,8 +181,31 @@ typedef enum {
     LWJSON_STREAM_STATE_PARSING,        /*!< In parsing of the first char state - detecting next character state */
     LWJSON_STREAM_STATE_PARSING_STRING, /*!< Parse string primitive */
     LWJSON_STREAM_STATE_PARSING_PRIMITIVE, /*!< Parse any primitive that is non-string, either "true", "false", "null" or a number */
+    LWJSON_STREAM_STATE_SKIPPING, /*!< Skip value of a key no subscribed path goes through */
 } lwjson_stream_state_t;
 
+/**
+ * \brief           Single segment of a compiled stream path
+ */
+typedef struct {
+    lwjson_stream_type_t type; /*!< Expected stack entry type: object, array or key */
+    const char* name;          /*!< Key name for \ref LWJSON_STREAM_TYPE_KEY type, points into path expression */
+    size_t name_len;           /*!< Length of key name in units of bytes */
+} lwjson_stream_path_seg_t;
+
+/**
+ * \brief           Compiled path subscription for the streaming parser
+ *
+ * Path expressions are dot separated key names with `[*]` for any array entry,
+ * for example `tag_name`, `assets[*]` or `assets[*].name`.
+ * Compiled path is the stack layout on which the value is reported.
+ */
+typedef struct {
+    const char* path;                                            /*!< Path expression, must stay valid while in use */
+    lwjson_stream_path_seg_t segs[LWJSON_CFG_STREAM_STACK_SIZE]; /*!< Expected stack entries from the root */
+    size_t depth;                                                /*!< Number of used entries in `segs` */
+} lwjson_stream_path_t;
+
 /* Forward declaration */
 struct lwjson_stream_parser;
 
@@ -218,16 +243,35 @@ typedef struct lwjson_stream_parser {
             size_t buff_pos;                                    /*!< Buffer position for next write */
         } prim; /*!< Primitive object. Used for all types, except key or string */
 
+        struct {
+            size_t depth;    /*!< Nesting level of objects and arrays inside skipped value */
+            uint8_t started; /*!< Status indicates first character of the value was received */
+            uint8_t in_str;  /*!< Status indicates scanner is inside a string */
+            uint8_t esc;     /*!< Status indicates previous string character was a backslash */
+            uint8_t prim;    /*!< Status indicates skipped value is a primitive */
+        } skip;              /*!< Skip state. Used when value of a key is not subscribed */
+
         /* Todo: Add other types */
     } data; /*!< Data union used to parse various */
 
     char prev_c; /*!< History of characters */
     void *udata; /*!< User data */
+
+    const lwjson_stream_path_t* paths; /*!< Subscribed paths or `NULL` to report every event */
+    size_t paths_len;                  /*!< Number of entries in `paths` */
+    size_t path_idx;                   /*!< Index of subscribed path the current event belongs to */
+    uint8_t stop;                      /*!< Status indicates user requested to stop parsing */
+    uint32_t path_mask[LWJSON_CFG_STREAM_STACK_SIZE + 1]; /*!< Paths still matching the stack, per stack level */
+    uint32_t path_end[LWJSON_CFG_STREAM_STACK_SIZE + 1];  /*!< Paths reporting values at given stack level */
 } lwjson_stream_parser_t;
 
 lwjsonr_t lwjson_stream_init(lwjson_stream_parser_t* jsp, lwjson_stream_parser_callback_fn evt_fn);
 lwjsonr_t lwjson_stream_reset(lwjson_stream_parser_t* jsp);
 lwjsonr_t lwjson_stream_parse(lwjson_stream_parser_t* jsp, char c);
+lwjsonr_t lwjson_stream_parse_buf(lwjson_stream_parser_t* jsp, const char* buf, size_t len);
+lwjsonr_t lwjson_stream_stop(lwjson_stream_parser_t* jsp);
+lwjsonr_t lwjson_stream_path_compile(lwjson_stream_path_t* path, const char* expr);
+lwjsonr_t lwjson_stream_set_paths(lwjson_stream_parser_t* jsp, const lwjson_stream_path_t* paths, size_t paths_len);
 
 /**
  * \brief           Get number of tokens used to parse JSON
@@ -121,6 +121,15 @@ extern "C" {
 #define LWJSON_CFG_STREAM_PRIMITIVE_MAX_LEN 32
 #endif
 
+/**
+ * \brief           Max number of paths that can be subscribed to on a single stream parser.
+ *
+ * Paths are tracked as bits in a `uint32_t` mask per stack level, value must not exceed `32`
+ */
+#ifndef LWJSON_CFG_STREAM_PATH_MAX
+#define LWJSON_CFG_STREAM_PATH_MAX 32
+#endif
+
 /**
  * \}
  */
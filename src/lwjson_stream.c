@@ -67,10 +67,12 @@ static const char* type_strings[] = {
 /**
  * \brief           Sends an event to user for further processing
  * 
+ * \note            `level` is the stack level the value is reported on,
+ *                  used to filter events against subscribed paths
  */
-#define SEND_EVT(jsp, type)                                                                                            \
+#define SEND_EVT(jsp, type, level)                                                                                     \
     if ((jsp) != NULL && (jsp)->evt_fn != NULL) {                                                                      \
-        (jsp)->evt_fn((jsp), (type));                                                                                  \
+        prv_send_evt((jsp), (type), (level));                                                                          \
     }
 
 /**
@@ -132,6 +134,213 @@ prv_stack_get_top(lwjson_stream_parser_t* jsp) {
     return LWJSON_STREAM_TYPE_NONE;
 }
 
+/**
+ * \brief           Call user event function, once for every subscribed path matching the value
+ * \param           jsp: JSON stream parser instance
+ * \param           type: Stream type to report
+ * \param           level: Stack level the value is reported on
+ */
+static void
+prv_send_evt(lwjson_stream_parser_t* jsp, lwjson_stream_type_t type, size_t level) {
+    uint32_t m;
+
+    if (jsp->paths == NULL) {
+        jsp->evt_fn(jsp, type);
+        return;
+    }
+    m = jsp->path_mask[level] & jsp->path_end[level];
+    for (size_t i = 0; m != 0; ++i, m >>= 1) {
+        if (m & 1) {
+            jsp->path_idx = i;
+            jsp->evt_fn(jsp, type);
+        }
+    }
+}
+
+/**
+ * \brief           Update subscribed path mask for the entry just pushed to the stack
+ *
+ * Paths are compared only against the new top entry, the lower levels
+ * were already matched when they were pushed.
+ * Key entries must have their name set before calling this function.
+ *
+ * \param           jsp: JSON stream parser instance
+ */
+static void
+prv_path_update(lwjson_stream_parser_t* jsp) {
+    size_t level = jsp->stack_pos - 1;
+    const lwjson_stream_stack_t* entry = &jsp->stack[level];
+    uint32_t m = jsp->path_mask[level], res = 0;
+
+    if (jsp->paths == NULL) {
+        return;
+    }
+    for (size_t i = 0; m != 0; ++i, m >>= 1) {
+        const lwjson_stream_path_seg_t* seg = &jsp->paths[i].segs[level];
+        if (!(m & 1) || level >= jsp->paths[i].depth || seg->type != entry->type) {
+            continue;
+        }
+        if (seg->type == LWJSON_STREAM_TYPE_KEY
+            && (strncmp(seg->name, entry->meta.name, seg->name_len) != 0 || entry->meta.name[seg->name_len] != '\0')) {
+            continue;
+        }
+        res |= (uint32_t)1 << i;
+    }
+    jsp->path_mask[level + 1] = res;
+}
+
+/**
+ * \brief           Scan past the value of an unsubscribed key
+ *
+ * Only quotes, escapes and brackets are tracked, nothing is stored and no events are sent.
+ * Key is removed from the stack once the end of the value is found.
+ *
+ * \param           jsp: JSON stream parser instance
+ * \param[in]       buf: Data to scan
+ * \param[in]       len: Number of bytes in `buf`
+ * \param[out]      done: Set to `1` when end of value was found, `0` otherwise
+ * \return          Number of bytes consumed. Character terminating a primitive is not consumed
+ */
+static size_t
+prv_skip_value(lwjson_stream_parser_t* jsp, const char* buf, size_t len, uint8_t* done) {
+    size_t i = 0;
+
+    *done = 0;
+    for (; i < len; ++i) {
+        char c = buf[i];
+
+        if (!jsp->data.skip.started) {
+            if (c == ':' || prv_is_space_char_ext(c)) {
+                continue;
+            }
+            jsp->data.skip.started = 1;
+            if (c == '"') {
+                jsp->data.skip.in_str = 1;
+            } else if (c == '{' || c == '[') {
+                jsp->data.skip.depth = 1;
+            } else {
+                jsp->data.skip.prim = 1;
+            }
+        } else if (jsp->data.skip.in_str) {
+            if (jsp->data.skip.esc) {
+                jsp->data.skip.esc = 0;
+            } else if (c == '\\') {
+                jsp->data.skip.esc = 1;
+            } else if (c == '"') {
+                jsp->data.skip.in_str = 0;
+                if (jsp->data.skip.depth == 0) {
+                    *done = 1;
+                    ++i;
+                    break;
+                }
+            }
+        } else if (jsp->data.skip.prim) {
+            if (prv_is_space_char_ext(c) || c == ',' || c == '}' || c == ']') {
+                *done = 1;
+                break;
+            }
+        } else if (c == '"') {
+            jsp->data.skip.in_str = 1;
+        } else if (c == '{' || c == '[') {
+            jsp->data.skip.depth++;
+        } else if ((c == '}' || c == ']') && --jsp->data.skip.depth == 0) {
+            *done = 1;
+            ++i;
+            break;
+        }
+    }
+    if (i > 0) {
+        jsp->prev_c = buf[i - 1];
+    }
+    if (*done) {
+        LWJSON_DEBUG(jsp, "End of skipped value\r\n");
+        prv_stack_pop(jsp);
+        jsp->parse_state = LWJSON_STREAM_STATE_PARSING;
+    }
+    return i;
+}
+
+/**
+ * \brief           Compile path expression for use with \ref lwjson_stream_set_paths
+ *
+ * Expression is a dot separated list of key names, where `[*]` matches any entry of an array.
+ * Empty expression matches the root object or array.
+ *
+ * \param[out]      path: Compiled path
+ * \param[in]       expr: Path expression, for example `assets[*].name`.
+ *                      It is referenced by compiled path and must stay valid
+ * \return          \ref lwjsonOK on success, member of \ref lwjsonr_t otherwise
+ */
+lwjsonr_t
+lwjson_stream_path_compile(lwjson_stream_path_t* path, const char* expr) {
+    const char* p = expr;
+
+    memset(path, 0x00, sizeof(*path));
+    path->path = expr;
+    while (*p != '\0') {
+        if (strncmp(p, "[*]", 3) == 0) {
+            if (path->depth >= LWJSON_ARRAYSIZE(path->segs)) {
+                return lwjsonERRMEM;
+            }
+            path->segs[path->depth++].type = LWJSON_STREAM_TYPE_ARRAY;
+            p += 3;
+        } else {
+            const char* name;
+
+            /* Keys are separated by dot, except for the very first one */
+            if (*p == '.' && path->depth > 0) {
+                ++p;
+            } else if (path->depth > 0) {
+                return lwjsonERRPAR;
+            }
+            name = p;
+            while (*p != '\0' && *p != '.' && *p != '[') {
+                ++p;
+            }
+            if (p == name || (size_t)(p - name) > LWJSON_CFG_STREAM_KEY_MAX_LEN) {
+                return lwjsonERRPAR;
+            }
+            if (path->depth + 2 > LWJSON_ARRAYSIZE(path->segs)) {
+                return lwjsonERRMEM;
+            }
+            path->segs[path->depth++].type = LWJSON_STREAM_TYPE_OBJECT;
+            path->segs[path->depth].type = LWJSON_STREAM_TYPE_KEY;
+            path->segs[path->depth].name = name;
+            path->segs[path->depth].name_len = (size_t)(p - name);
+            path->depth++;
+        }
+    }
+    return lwjsonOK;
+}
+
+/**
+ * \brief           Subscribe stream parser to a set of compiled paths
+ *
+ * Once set, event function is only called for values located on one of the paths,
+ * with `path_idx` member of parser set to index of the matching path.
+ * Key events and values outside of the paths are not reported.
+ *
+ * \param[in,out]   jsp: Stream JSON structure
+ * \param[in]       paths: Array of compiled paths, must stay valid while parsing.
+ *                      Set to `NULL` to report every event again
+ * \param[in]       paths_len: Number of entries in `paths`
+ * \return          \ref lwjsonOK on success, member of \ref lwjsonr_t otherwise
+ */
+lwjsonr_t
+lwjson_stream_set_paths(lwjson_stream_parser_t* jsp, const lwjson_stream_path_t* paths, size_t paths_len) {
+    if (paths_len > LWJSON_CFG_STREAM_PATH_MAX || paths_len > 32) {
+        return lwjsonERRPAR;
+    }
+    memset(jsp->path_end, 0x00, sizeof(jsp->path_end));
+    jsp->paths = (paths != NULL && paths_len > 0) ? paths : NULL;
+    jsp->paths_len = jsp->paths != NULL ? paths_len : 0;
+    for (size_t i = 0; i < jsp->paths_len; ++i) {
+        jsp->path_end[paths[i].depth] |= (uint32_t)1 << i;
+    }
+    jsp->path_mask[0] = jsp->paths_len == 32 ? 0xFFFFFFFFUL : (((uint32_t)1 << jsp->paths_len) - 1);
+    return lwjsonOK;
+}
+
 /**
  * \brief           Initialize LwJSON stream object before parsing takes place
  * \param[in,out]   jsp: Stream JSON structure 
@@ -155,6 +364,23 @@ lwjsonr_t
 lwjson_stream_reset(lwjson_stream_parser_t* jsp) {
     jsp->parse_state = LWJSON_STREAM_STATE_WAITINGFIRSTCHAR;
     jsp->stack_pos = 0;
+    jsp->stop = 0;
+    return lwjsonOK;
+}
+
+/**
+ * \brief           Stop parsing, typically called from event function once all needed values were received
+ *
+ * Every following call to \ref lwjson_stream_parse or \ref lwjson_stream_parse_buf
+ * returns \ref lwjsonSTREAMSTOP without processing data, until parser is reset.
+ * Caller feeding the parser can use it to stop receiving the rest of the stream.
+ *
+ * \param           jsp: LwJSON stream parser
+ * \return          \ref lwjsonOK on success, member of \ref lwjsonr_t otherwise
+ */
+lwjsonr_t
+lwjson_stream_stop(lwjson_stream_parser_t* jsp) {
+    jsp->stop = 1;
     return lwjsonOK;
 }
 
@@ -164,9 +390,14 @@ lwjson_stream_reset(lwjson_stream_parser_t* jsp) {
  * \param[in]       c: Character to parse
  * \return          \ref lwjsonOK if parsing is in progress and no hard error detected
  *                  \ref lwjsonSTREAMDONE when valid JSON was detected and stack level reached back `0` level
+ *                  \ref lwjsonSTREAMSTOP when parsing was stopped with \ref lwjson_stream_stop
  */
 lwjsonr_t
 lwjson_stream_parse(lwjson_stream_parser_t* jsp, char c) {
+    if (jsp->stop) {
+        return lwjsonSTREAMSTOP;
+    }
+
     /* Get first character first */
     if (jsp->parse_state == LWJSON_STREAM_STATE_WAITINGFIRSTCHAR && c != '{' && c != '[') {
         return lwjsonSTREAMDONE;
@@ -194,12 +425,14 @@ start_over:
                     LWJSON_DEBUG(jsp, "Cannot push object/array to stack\r\n");
                     return lwjsonERRMEM;
                 }
+                prv_path_update(jsp);
                 jsp->parse_state = LWJSON_STREAM_STATE_PARSING;
-                SEND_EVT(jsp, c == '{' ? LWJSON_STREAM_TYPE_OBJECT : LWJSON_STREAM_TYPE_ARRAY);
+                SEND_EVT(jsp, c == '{' ? LWJSON_STREAM_TYPE_OBJECT : LWJSON_STREAM_TYPE_ARRAY, jsp->stack_pos - 1);
 
                 /* Determine end of object or an array */
             } else if (c == '}' || c == ']') {
                 lwjson_stream_type_t t = prv_stack_get_top(jsp);
+                size_t level;
 
                 /* 
                  * If it is a key last entry on closing area,
@@ -225,6 +458,9 @@ start_over:
                     return lwjsonERRJSON;
                 }
 
+                /* End is reported on the level of the container, like its start */
+                level = jsp->stack_pos;
+
                 /*
                  * Check if above is a key type
                  * and remove it too as we finished with processing of potential case.
@@ -234,7 +470,7 @@ start_over:
                 if (prv_stack_get_top(jsp) == LWJSON_STREAM_TYPE_KEY) {
                     prv_stack_pop(jsp);
                 }
-                SEND_EVT(jsp, c == '}' ? LWJSON_STREAM_TYPE_OBJECT_END : LWJSON_STREAM_TYPE_ARRAY_END);
+                SEND_EVT(jsp, c == '}' ? LWJSON_STREAM_TYPE_OBJECT_END : LWJSON_STREAM_TYPE_ARRAY_END, level);
 
                 /* If that is the end of JSON */
                 if (jsp->stack_pos == 0) {
@@ -317,7 +553,7 @@ start_over:
                  * When top of stack is an array - string is one type - notify user and don't do anything
                  */
                 if (t == LWJSON_STREAM_TYPE_OBJECT) {
-                    SEND_EVT(jsp, LWJSON_STREAM_TYPE_KEY);
+                    SEND_EVT(jsp, LWJSON_STREAM_TYPE_KEY, jsp->stack_pos);
                     if (prv_stack_push(jsp, LWJSON_STREAM_TYPE_KEY)) {
                         size_t len = jsp->data.str.buff_pos;
                         if (len > (sizeof(jsp->stack[0].meta.name) - 1)) {
@@ -325,16 +561,26 @@ start_over:
                         }
                         memcpy(jsp->stack[jsp->stack_pos - 1].meta.name, jsp->data.str.buff, len);
                         jsp->stack[jsp->stack_pos - 1].meta.name[len] = '\0';
+                        prv_path_update(jsp);
+
+                        /* No subscribed path goes through this key, skip over its value */
+                        if (jsp->paths != NULL && jsp->path_mask[jsp->stack_pos] == 0) {
+                            LWJSON_DEBUG(jsp, "Skipping value of key \"%s\"\r\n",
+                                         jsp->stack[jsp->stack_pos - 1].meta.name);
+                            memset(&jsp->data.skip, 0x00, sizeof(jsp->data.skip));
+                            jsp->parse_state = LWJSON_STREAM_STATE_SKIPPING;
+                            break;
+                        }
                     } else {
                         LWJSON_DEBUG(jsp, "Cannot push key to stack\r\n");
                         return lwjsonERRMEM;
                     }
                 } else if (t == LWJSON_STREAM_TYPE_KEY) {
-                    SEND_EVT(jsp, LWJSON_STREAM_TYPE_STRING);
+                    SEND_EVT(jsp, LWJSON_STREAM_TYPE_STRING, jsp->stack_pos);
                     prv_stack_pop(jsp);
                     /* Next character to wait for is either space or comma or end of object */
                 } else if (t == LWJSON_STREAM_TYPE_ARRAY) {
-                    SEND_EVT(jsp, LWJSON_STREAM_TYPE_STRING);
+                    SEND_EVT(jsp, LWJSON_STREAM_TYPE_STRING, jsp->stack_pos);
                     jsp->stack[jsp->stack_pos - 1].meta.index++;
                 }
                 jsp->parse_state = LWJSON_STREAM_STATE_PARSING;
@@ -353,7 +599,8 @@ start_over:
                      */
                     SEND_EVT(jsp, (t == LWJSON_STREAM_TYPE_KEY || t == LWJSON_STREAM_TYPE_ARRAY)
                                       ? LWJSON_STREAM_TYPE_STRING
-                                      : LWJSON_STREAM_TYPE_KEY);
+                                      : LWJSON_STREAM_TYPE_KEY,
+                             jsp->stack_pos);
                     jsp->data.str.buff_pos = 0;
                 }
             }
@@ -396,17 +643,17 @@ start_over:
                  */
                 if (jsp->data.prim.buff_pos == 4 && strncmp(jsp->data.prim.buff, "true", 4) == 0) {
                     LWJSON_DEBUG(jsp, "Primitive parsed as %s\r\n", "true");
-                    SEND_EVT(jsp, LWJSON_STREAM_TYPE_TRUE);
+                    SEND_EVT(jsp, LWJSON_STREAM_TYPE_TRUE, jsp->stack_pos);
                 } else if (jsp->data.prim.buff_pos == 4 && strncmp(jsp->data.prim.buff, "null", 4) == 0) {
                     LWJSON_DEBUG(jsp, "Primitive parsed as %s\r\n", "null");
-                    SEND_EVT(jsp, LWJSON_STREAM_TYPE_NULL);
+                    SEND_EVT(jsp, LWJSON_STREAM_TYPE_NULL, jsp->stack_pos);
                 } else if (jsp->data.prim.buff_pos == 5 && strncmp(jsp->data.prim.buff, "false", 5) == 0) {
                     LWJSON_DEBUG(jsp, "Primitive parsed as %s\r\n", "false");
-                    SEND_EVT(jsp, LWJSON_STREAM_TYPE_FALSE);
+                    SEND_EVT(jsp, LWJSON_STREAM_TYPE_FALSE, jsp->stack_pos);
                 } else if (jsp->data.prim.buff[0] == '-'
                            || (jsp->data.prim.buff[0] >= '0' && jsp->data.prim.buff[0] <= '9')) {
                     LWJSON_DEBUG(jsp, "Primitive parsed - number\r\n");
-                    SEND_EVT(jsp, LWJSON_STREAM_TYPE_NUMBER);
+                    SEND_EVT(jsp, LWJSON_STREAM_TYPE_NUMBER, jsp->stack_pos);
                 } else {
                     LWJSON_DEBUG(jsp, "Invalid primitive type. Got: %s\r\n", jsp->data.prim.buff);
                 }
@@ -427,10 +674,101 @@ start_over:
             break;
         }
 
+        /*
+         * Skip value of a key that is not on any subscribed path
+         */
+        case LWJSON_STREAM_STATE_SKIPPING: {
+            uint8_t done;
+            if (prv_skip_value(jsp, &c, 1, &done) == 0 && done) {
+                /* Character terminated a primitive and must be processed again */
+                goto start_over;
+            }
+            break;
+        }
+
         /* TODO: Add other case statements */
         default:
             break;
     }
     jsp->prev_c = c; /* Save current c as previous for next round */
-    return lwjsonSTREAMINPROG;
+    return jsp->stop ? lwjsonSTREAMSTOP : lwjsonSTREAMINPROG;
+}
+
+/**
+ * \brief           Parse a block of JSON data in streaming mode
+ *
+ * Functionally equivalent to calling \ref lwjson_stream_parse for every character in `buf`,
+ * but string bodies and whitespace between tokens are consumed in tight loops
+ * without going through the full state machine for every character.
+ *
+ * \param[in,out]   jsp: Stream JSON structure
+ * \param[in]       buf: Data to parse
+ * \param[in]       len: Number of bytes in `buf`
+ * \return          \ref lwjsonSTREAMINPROG or \ref lwjsonSTREAMDONE as returned for the last character,
+ *                  \ref lwjsonSTREAMSTOP as soon as parsing was stopped with \ref lwjson_stream_stop,
+ *                  member of \ref lwjsonr_t on hard error (parsing stops at the offending character)
+ */
+lwjsonr_t
+lwjson_stream_parse_buf(lwjson_stream_parser_t* jsp, const char* buf, size_t len) {
+    lwjsonr_t res = lwjsonSTREAMINPROG;
+    const char* end = buf + len;
+
+    if (jsp->stop) {
+        return lwjsonSTREAMSTOP;
+    }
+    while (buf < end) {
+        if (jsp->parse_state == LWJSON_STREAM_STATE_PARSING_STRING) {
+            /*
+             * Copy a run of plain string characters directly to the buffer.
+             * Run stops before closing quote and one character before the buffer
+             * would fill up, so the closing quote and buffer overflow events
+             * are still handled by the regular state machine below.
+             */
+            size_t room = (LWJSON_CFG_STREAM_STRING_MAX_LEN - 1) - jsp->data.str.buff_pos;
+            const char* p = buf;
+            char prev_c = jsp->prev_c;
+
+            if (room > 1) {
+                const char* run_end = (size_t)(end - buf) < (room - 1) ? end : buf + (room - 1);
+                while (p < run_end && !(*p == '"' && prev_c != '\\')) {
+                    prev_c = *p++;
+                }
+            }
+            if (p > buf) {
+                size_t n = (size_t)(p - buf);
+                memcpy(&jsp->data.str.buff[jsp->data.str.buff_pos], buf, n);
+                jsp->data.str.buff_pos += n;
+                jsp->data.str.buff_total_pos += n;
+                jsp->prev_c = prev_c;
+                buf = p;
+                continue;
+            }
+        } else if (jsp->parse_state == LWJSON_STREAM_STATE_SKIPPING) {
+            uint8_t done;
+            size_t n = prv_skip_value(jsp, buf, (size_t)(end - buf), &done);
+            buf += n;
+            if (n > 0 || done) {
+                continue;
+            }
+        } else if (jsp->parse_state == LWJSON_STREAM_STATE_PARSING) {
+            /* Whitespace and separators between tokens carry no state */
+            const char* p = buf;
+            while (p < end && (prv_is_space_char_ext(*p) || *p == ',')) {
+                ++p;
+            }
+            if (p > buf) {
+                jsp->prev_c = p[-1];
+                buf = p;
+                continue;
+            }
+        }
+
+        res = lwjson_stream_parse(jsp, *buf++);
+        if (res == lwjsonSTREAMSTOP) {
+            return res;
+        } else if (res != lwjsonOK && res != lwjsonSTREAMINPROG && res != lwjsonSTREAMDONE) {
+            return res;
+        }
+    }
+    return res;
 }
@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+"""Compress ghota release assets and compare them with the raw image.
+
+Usage:
+  ghota_compress.py compress [-w BITS] [-l BITS] IMAGE...
+      writes IMAGE.gz and IMAGE.hs next to each image
+  ghota_compress.py bench [-w BITS] [-l BITS] IMAGE...
+      prints bytes on the wire and the time to download and decompress each
+      variant at several link speeds
+
+The heatshrink window (-w) and lookahead (-l) must match
+CONFIG_GHOTA_HEATSHRINK_WINDOW and CONFIG_GHOTA_HEATSHRINK_LOOKAHEAD.
+Name the assets so filenamematch / storagenamematch still match them, e.g. "fw-esp32.bin*".
+"""
+
+import argparse
+import gzip
+import time
+
+# link speeds in kbit/s
+LINKS = [250, 1000, 5000, 20000]
+
+
+def hs_compress(data, window, lookahead):
+    """Greedy heatshrink encoder, output is compatible with the reference encoder."""
+    out = bytearray()
+    acc = 0
+    nbits = 0
+
+    def put(bits, value):
+        nonlocal acc, nbits
+        acc = (acc << bits | value) & 0xFFFFFF
+        nbits += bits
+        while nbits >= 8:
+            nbits -= 8
+            out.append(acc >> nbits & 0xFF)
+
+    wsize = 1 << window
+    maxlen = 1 << lookahead
+    # a back reference only pays off when it replaces more bits than it costs
+    minlen = max(3, (1 + window + lookahead) // 9 + 1)
+    data = bytes(data)
+    chains = {}
+    pos = 0
+    while pos < len(data):
+        best_len = 0
+        best_off = 0
+        limit = min(maxlen, len(data) - pos)
+        for cand in reversed(chains.get(data[pos:pos + minlen], ())):
+            off = pos - cand
+            if off > wsize:
+                break
+            if data[cand + best_len:cand + best_len + 1] != data[pos + best_len:pos + best_len + 1]:
+                continue
+            length = minlen
+            while length < limit and data[cand + length] == data[pos + length]:
+                length += 1
+            if length > best_len:
+                best_len = length
+                best_off = off
+                if length == limit:
+                    break
+        step = best_len if best_len >= minlen else 1
+        if step > 1:
+            put(1, 0)
+            put(window, best_off - 1)
+            put(lookahead, best_len - 1)
+        else:
+            put(1, 1)
+            put(8, data[pos])
+        for i in range(pos, pos + step):
+            chain = chains.setdefault(data[i:i + minlen], [])
+            chain.append(i)
+            if len(chain) > 8:
+                del chain[0]
+        pos += step
+    if nbits:
+        put(8 - nbits, 0)
+    return bytes(out)
+
+
+def hs_decompress(data, window, lookahead):
+    out = bytearray()
+    acc = 0
+    nbits = 0
+    it = iter(data)
+
+    def get(bits):
+        nonlocal acc, nbits
+        while nbits < bits:
+            acc = (acc << 8 | next(it)) & 0xFFFFFF
+            nbits += 8
+        nbits -= bits
+        return acc >> nbits & ((1 << bits) - 1)
+
+    try:
+        while True:
+            if get(1):
+                out.append(get(8))
+            else:
+                off = get(window) + 1
+                count = get(lookahead) + 1
+                for _ in range(count):
+                    out.append(out[-off] if off <= len(out) else 0)
+    except StopIteration:
+        pass
+    return bytes(out)
+
+
+def variants(image, window, lookahead):
+    yield "raw", image, lambda d: d
+    yield "gzip", gzip.compress(image, 9, mtime=0), gzip.decompress
+    yield "heatshrink", hs_compress(image, window, lookahead), \
+        lambda d: hs_decompress(d, window, lookahead)
+
+
+def compress(args):
+    for name in args.images:
+        with open(name, "rb") as f:
+            image = f.read()
+        with open(name + ".gz", "wb") as f:
+            f.write(gzip.compress(image, 9, mtime=0))
+        with open(name + ".hs", "wb") as f:
+            f.write(hs_compress(image, args.window, args.lookahead))
+        print("%s: wrote %s.gz and %s.hs" % (name, name, name))
+
+
+def bench(args):
+    header = "%-12s %10s %7s %10s" % ("format", "bytes", "ratio", "decode ms")
+    header += "".join(" %9s" % ("%gMb/s" % (k / 1000)) for k in LINKS)
+    for name in args.images:
+        with open(name, "rb") as f:
+            image = f.read()
+        print("%s (%d bytes), wall time in s at each link speed:" % (name, len(image)))
+        print(header)
+        for fmt, data, decode in variants(image, args.window, args.lookahead):
+            start = time.perf_counter()
+            if decode(data) != image:
+                raise SystemExit("%s round trip failed" % fmt)
+            decode_s = time.perf_counter() - start if fmt != "raw" else 0.0
+            row = "%-12s %10d %6.1f%% %10.1f" % (
+                fmt, len(data), 100.0 * len(data) / len(image), decode_s * 1000)
+            for kbit in LINKS:
+                # host decode time, the device decompresses while it receives
+                row += " %9.2f" % (len(data) * 8 / (kbit * 1000) + decode_s)
+            print(row)
+        print()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("command", choices=["compress", "bench"])
+    parser.add_argument("-w", "--window", type=int, default=10)
+    parser.add_argument("-l", "--lookahead", type=int, default=4)
+    parser.add_argument("images", nargs="+")
+    args = parser.parse_args()
+    if args.command == "compress":
+        compress(args)
+    else:
+        bench(args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+"""Simulate a fleet booting together and measure the load on the release server.
+
+Usage:
+  ghota_fleet_sim.py [-n CLIENTS] [-i MINUTES] [-s MINUTES] [-w SECONDS] [--scale MS]
+
+Starts a local HTTP server and N simulated devices that all boot at the same moment,
+then run the update timer for three intervals. A new release is published halfway
+through the second interval. Each device checks (GET /check) and downloads the new
+release (GET /download). The run is done once without and once with the fleet jitter
+of CONFIG_GHOTA_FLEET_JITTER, and the peak number of concurrent requests is printed.
+
+The schedule is the one of the device: the first check min(interval, 60 s) +
+crc32(deviceid) % (checkSpread * 60) seconds after boot, with the MAC as deviceid, and a
+release found by the timer checked again and downloaded after a random part of the
+download window. One simulated minute takes --scale ms.
+"""
+
+import argparse
+import http.server
+import json
+import random
+import threading
+import time
+import zlib
+
+
+class Server(http.server.ThreadingHTTPServer):
+    daemon_threads = True
+    request_queue_size = 1024
+
+    def __init__(self, latency):
+        super().__init__(("127.0.0.1", 0), Handler)
+        self.latency = latency
+        self.version = 1
+        self.lock = threading.Lock()
+        self.active = {"/check": 0, "/download": 0}
+        self.peak = {"/check": 0, "/download": 0}
+
+    def reset(self):
+        self.version = 1
+        self.peak = {"/check": 0, "/download": 0}
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.0"
+
+    def log_message(self, *args):
+        pass
+
+    def do_GET(self):
+        srv = self.server
+        with srv.lock:
+            srv.active[self.path] += 1
+            srv.peak[self.path] = max(srv.peak[self.path], srv.active[self.path])
+        # a download holds the connection much longer than a check
+        time.sleep(srv.latency * (10 if self.path == "/download" else 1))
+        body = json.dumps({"version": srv.version}).encode()
+        with srv.lock:
+            srv.active[self.path] -= 1
+        self.send_response(200)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+
+def get(url):
+    import urllib.request
+    with urllib.request.urlopen(url) as r:
+        return json.load(r)
+
+
+def device(n, args, url, start, jitter):
+    mac = "24a160%06x" % n
+    second = args.scale / 1000.0 / 60
+    interval = args.interval * 60
+    if jitter:
+        # ghota_start_update_timer: min(interval, 60) + crc32(deviceid) % (checkSpread * 60)
+        first = min(interval, 60) + zlib.crc32(mac.encode()) % (args.spread * 60)
+    else:
+        first = interval
+    installed = 1
+    due = False
+    at = start + first * second
+    end = start + 3 * interval * second
+    while at < end:
+        time.sleep(max(0.0, at - time.time()))
+        at += interval * second
+        if get(url + "/check")["version"] <= installed:
+            continue
+        # ghota_task: the timer checks again at the end of a random wait and downloads then
+        wait = random.randrange(args.window) if jitter and args.window and not due else 0
+        if wait and time.time() + wait * second < at:
+            time.sleep(wait * second)
+            get(url + "/check")
+        elif wait:
+            # the next regular check comes first and downloads
+            due = True
+            continue
+        due = False
+        installed = get(url + "/download")["version"]
+
+
+def run(args, srv, jitter):
+    srv.reset()
+    url = "http://127.0.0.1:%d" % srv.server_address[1]
+    start = time.time() + 0.5
+    minute = args.scale / 1000.0
+    threads = [threading.Thread(target=device, args=(n, args, url, start, jitter))
+               for n in range(args.clients)]
+    for t in threads:
+        t.start()
+    time.sleep(max(0.0, start + 1.5 * args.interval * minute - time.time()))
+    srv.version = 2
+    for t in threads:
+        t.join()
+    return dict(srv.peak)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("-n", "--clients", type=int, default=200)
+    parser.add_argument("-i", "--interval", type=int, default=60, help="updateInterval in minutes")
+    parser.add_argument("-s", "--spread", type=int, default=0, help="checkSpread in minutes, 0 for the interval")
+    parser.add_argument("-w", "--window", type=int, default=600, help="downloadWindow in seconds")
+    parser.add_argument("--scale", type=float, default=20, help="ms per simulated minute")
+    parser.add_argument("--latency", type=float, default=20, help="ms to answer a check")
+    args = parser.parse_args()
+    args.spread = args.spread or args.interval
+
+    srv = Server(args.latency / 1000.0)
+    threading.Thread(target=srv.serve_forever, daemon=True).start()
+    print("%d devices, interval %d min, spread %d min, download window %d s"
+          % (args.clients, args.interval, args.spread, args.window))
+    print("%-12s %12s %15s" % ("", "peak checks", "peak downloads"))
+    for jitter in (False, True):
+        peak = run(args, srv, jitter)
+        print("%-12s %12d %15d" % ("jitter" if jitter else "no jitter",
+                                   peak["/check"], peak["/download"]))
+    srv.shutdown()
+
+
+if __name__ == "__main__":
+    main()
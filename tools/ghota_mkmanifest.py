@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+"""Write a ghota release manifest for static hosting.
+
+Usage:
+  ghota_mkmanifest.py -v VERSION -u BASE_URL [-r PERCENT] [-o manifest.json] VARIANT=FILE[,FILE...]...
+
+Each asset is expected at BASE_URL/VERSION/VARIANT/<file name>. Upload the files
+there and the manifest to CONFIG_GHOTA_MANIFEST_URL, e.g.
+
+  ghota_mkmanifest.py -v 1.4.0 -u https://updates.example.com/myapp \\
+      esp32=build-esp32/app.bin esp32s3=build-s3/app.bin,build-s3/storage.bin
+
+With -r only PERCENT percent of the devices install the release. Raise it and upload
+the manifest again to roll the release out further.
+"""
+
+import argparse
+import hashlib
+import json
+import os
+
+
+def asset(path, url):
+    with open(path, "rb") as f:
+        data = f.read()
+    return {
+        "name": os.path.basename(path),
+        "url": url,
+        "size": len(data),
+        "digest": "sha256:" + hashlib.sha256(data).hexdigest(),
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("-v", "--version", required=True)
+    parser.add_argument("-u", "--base-url", required=True)
+    parser.add_argument("-r", "--rollout", type=int, help="percentage of devices to install the release")
+    parser.add_argument("-o", "--output", default="manifest.json")
+    parser.add_argument("variants", nargs="+", metavar="VARIANT=FILE[,FILE...]")
+    args = parser.parse_args()
+
+    variants = []
+    for spec in args.variants:
+        name, _, files = spec.partition("=")
+        if not files:
+            parser.error("%s: expected VARIANT=FILE" % spec)
+        base = "%s/%s/%s" % (args.base_url.rstrip("/"), args.version, name)
+        # the device only reads the assets after the variant name
+        variants.append({
+            "name": name,
+            "assets": [asset(f, "%s/%s" % (base, os.path.basename(f)))
+                       for f in files.split(",")],
+        })
+
+    manifest = {"version": args.version}
+    if args.rollout is not None:
+        if not 0 <= args.rollout <= 100:
+            parser.error("rollout must be between 0 and 100")
+        manifest["rollout"] = args.rollout
+    manifest["variants"] = variants
+    with open(args.output, "w") as f:
+        json.dump(manifest, f, indent=2)
+    print("%s: %s with %d variants" % (args.output, args.version, len(variants)))
+
+
+if __name__ == "__main__":
+    main()
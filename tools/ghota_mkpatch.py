@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+"""Create a ghota delta patch that rebuilds NEW from OLD.
+
+Usage: ghota_mkpatch.py OLD.bin NEW.bin OUT.patch
+
+Publish the patch with the release, named after the base version it applies to,
+e.g. fw-1.4.2-to-1.5.0.patch, and set patchnamematch to match it (e.g. "fw-*.patch").
+See include/esp_ghota_patch.h for the format.
+"""
+
+import hashlib
+import struct
+import sys
+
+MAGIC = b"GHP1"
+OP_END = 0x00
+OP_COPY = 0x01
+OP_INSERT = 0x02
+BLOCK = 32
+
+
+def make_patch(old, new):
+    index = {}
+    for pos in range(0, len(old) - BLOCK + 1, BLOCK):
+        index.setdefault(old[pos:pos + BLOCK], pos)
+
+    out = bytearray(MAGIC)
+    out += struct.pack("<II", len(old), len(new))
+    out += hashlib.sha256(new).digest()
+
+    literal = bytearray()
+
+    def flush_literal():
+        if literal:
+            out.extend(struct.pack("<BI", OP_INSERT, len(literal)))
+            out.extend(literal)
+            literal.clear()
+
+    pos = 0
+    while pos < len(new):
+        src = index.get(new[pos:pos + BLOCK])
+        if src is None:
+            literal.append(new[pos])
+            pos += 1
+            continue
+        length = BLOCK
+        while (pos + length < len(new) and src + length < len(old) and
+               new[pos + length] == old[src + length]):
+            length += 1
+        flush_literal()
+        out += struct.pack("<BII", OP_COPY, src, length)
+        pos += length
+    flush_literal()
+    out.append(OP_END)
+    return bytes(out)
+
+
+def main():
+    if len(sys.argv) != 4:
+        sys.exit(__doc__)
+    with open(sys.argv[1], "rb") as f:
+        old = f.read()
+    with open(sys.argv[2], "rb") as f:
+        new = f.read()
+    patch = make_patch(old, new)
+    with open(sys.argv[3], "wb") as f:
+        f.write(patch)
+    print("%s: %d bytes for a %d byte image" % (sys.argv[3], len(patch), len(new)))
+
+
+if __name__ == "__main__":
+    main()
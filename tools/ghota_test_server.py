@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+"""Serve a release JSON and its assets the way the Github API and CDNs do.
+
+Usage:
+  ghota_test_server.py [-p PORT] [--cert CERT --key KEY] [--chunked] RELEASE.json [ASSET_DIR]
+
+"/repos/<org>/<repo>/releases/latest" returns RELEASE.json, like the API.
+"/<org>/<repo>/releases/latest" redirects to the tag of RELEASE.json, like the
+release page the device probes (CONFIG_GHOTA_PROBE_URL). A POST to "/graphql"
+answers the query of CONFIG_GHOTA_GRAPHQL with the same release. Any other path is
+looked up in ASSET_DIR. With --chunked, bodies are sent with chunked transfer
+framing and without Content-Length. A client sending "Accept-Encoding: gzip"
+gets a gzip encoded body.
+
+Point the device at it with the hostname config (host:port) and a probeurl of
+"https://{host}/{org}/{repo}/releases/latest", and add the
+certificate to the bundle (CONFIG_MBEDTLS_CUSTOM_CERTIFICATE_BUNDLE).
+"""
+
+import argparse
+import gzip
+import http.server
+import json
+import os
+import ssl
+
+CHUNK = 1000
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def graphql_reply(self):
+        """The release in the shape of the GraphQL reply, with the fields ghota asks for."""
+        with open(self.server.release) as f:
+            release = json.load(f)
+        nodes = [{
+            "name": asset["name"],
+            "url": asset.get("browser_download_url", asset.get("url")),
+            "size": asset.get("size", 0),
+            "digest": asset.get("digest"),
+        } for asset in release.get("assets", [])]
+        return json.dumps({"data": {"repository": {"latestRelease": {
+            "tagName": release["tag_name"],
+            "description": release.get("body"),
+            "releaseAssets": {"nodes": nodes},
+        }}}}).encode()
+
+    def do_POST(self):
+        self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        if self.path.split("?")[0] != "/graphql":
+            self.send_error(404)
+            return
+        self.send_body(self.graphql_reply(), "application/json")
+
+    def do_HEAD(self):
+        self.do_GET(head=True)
+
+    def do_GET(self, head=False):
+        path = self.path.split("?")[0]
+        if path.endswith("/releases/latest") and not path.startswith("/repos/"):
+            with open(self.server.release) as f:
+                tag = json.load(f)["tag_name"]
+            self.send_response(302)
+            self.send_header("Location", path[:-len("latest")] + "tag/" + tag)
+            self.send_header("Content-Length", "0")
+            self.end_headers()
+            return
+        if path.endswith("/releases/latest"):
+            name = self.server.release
+            ctype = "application/json"
+        else:
+            name = os.path.join(self.server.assets, os.path.basename(self.path))
+            ctype = "application/octet-stream"
+        if not os.path.isfile(name):
+            self.send_error(404)
+            return
+        with open(name, "rb") as f:
+            body = f.read()
+        self.send_body(body, ctype, head)
+
+    def send_body(self, body, ctype, head=False):
+        size = len(body)
+        self.send_response(200)
+        self.send_header("Content-Type", ctype)
+        if "gzip" in self.headers.get("Accept-Encoding", ""):
+            body = gzip.compress(body, 9)
+            self.send_header("Content-Encoding", "gzip")
+        if self.server.chunked:
+            self.send_header("Transfer-Encoding", "chunked")
+        else:
+            self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        if head:
+            return
+
+        if self.server.chunked:
+            for pos in range(0, len(body), CHUNK):
+                part = body[pos:pos + CHUNK]
+                self.wfile.write(b"%x\r\n%s\r\n" % (len(part), part))
+            self.wfile.write(b"0\r\n\r\n")
+        else:
+            self.wfile.write(body)
+        self.log_message("%s: %d bytes, %d on the wire", self.path, size, len(body))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("-p", "--port", type=int, default=8443)
+    parser.add_argument("--cert")
+    parser.add_argument("--key")
+    parser.add_argument("--chunked", action="store_true")
+    parser.add_argument("release")
+    parser.add_argument("assets", nargs="?", default=".")
+    args = parser.parse_args()
+
+    server = http.server.ThreadingHTTPServer(("", args.port), Handler)
+    server.release = args.release
+    server.assets = args.assets
+    server.chunked = args.chunked
+    if args.cert:
+        ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        ctx.load_cert_chain(args.cert, args.key)
+        server.socket = ctx.wrap_socket(server.socket, server_side=True)
+    print("Serving %s on port %d" % (args.release, args.port))
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
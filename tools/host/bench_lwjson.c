@@ -0,0 +1,162 @@
+/* parsing throughput of the release JSON
+ *
+ * GitHub release objects of 30 to 80 KB, mostly release notes, parsed one
+ * lwjson_stream_parse call per byte as the HTTP handler once did and with
+ * lwjson_stream_parse_buf per 1 KB receive buffer. Once reporting every
+ * event, once subscribed to the release paths like ghota_check.
+ */
+#include <inttypes.h>
+#include <stdarg.h>
+#include <string.h>
+#include "lwjson.h"
+#include "common.h"
+
+#define CHUNK 1024
+/* parse each payload this many bytes per measurement */
+#define BENCH_BYTES (32 * 1024 * 1024)
+
+static const char *release_path_exprs[] = {
+    "tag_name",
+    "assets[*]",
+    "assets[*].name",
+    "assets[*].url",
+    "assets[*].size",
+    "assets[*].digest",
+    "body",
+};
+#define RELEASE_PATHS (sizeof(release_path_exprs) / sizeof(release_path_exprs[0]))
+
+static uint32_t events;
+
+static void bench_event(lwjson_stream_parser_t *jsp, lwjson_stream_type_t type)
+{
+    events++;
+}
+
+static int bench_append(char *json, size_t size, int len, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+static int bench_append(char *json, size_t size, int len, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    len += vsnprintf(json + len, size - len, fmt, args);
+    va_end(args);
+    CHECK((size_t)len < size);
+    return len;
+}
+
+/* a release as api.github.com returns it, padded with release notes to about size bytes */
+static char *bench_release(size_t size, size_t *json_len)
+{
+    static const char *user =
+        "{\"login\":\"github-actions[bot]\",\"id\":41898282,\"node_id\":\"MDM6Qm90NDE4OTgyODI=\","
+        "\"avatar_url\":\"https://avatars.githubusercontent.com/in/15368?v=4\",\"gravatar_id\":\"\","
+        "\"url\":\"https://api.github.com/users/github-actions%5Bbot%5D\","
+        "\"html_url\":\"https://github.com/apps/github-actions\",\"type\":\"Bot\",\"site_admin\":false}";
+    size_t alloc = size + 4096;
+    char *json = malloc(alloc);
+    int len = bench_append(json, alloc, 0,
+                           "{\"url\":\"" API_URL "esp_ghota/releases/152436271\","
+                           "\"html_url\":\"https://github.com/Fishwaldo/esp_ghota/releases/tag/1.4.0\","
+                           "\"id\":152436271,\"author\":%s,\"node_id\":\"RE_kwDOJ8aBKM4JFfMv\","
+                           "\"tag_name\":\"1.4.0\",\"target_commitish\":\"main\",\"name\":\"1.4.0\","
+                           "\"draft\":false,\"prerelease\":false,"
+                           "\"created_at\":\"2026-04-11T09:12:44Z\",\"published_at\":\"2026-04-11T09:31:02Z\","
+                           "\"assets\":[",
+                           user);
+    static const char *targets[] = {"esp32", "esp32s2", "esp32s3", "esp32c3", "esp32c6", "esp32h2"};
+    for (int i = 0; i < 12; i++)
+    {
+        len = bench_append(json, alloc, len,
+                           "%s{\"url\":\"" API_URL "esp_ghota/releases/assets/%d\",\"id\":%d,"
+                           "\"node_id\":\"RA_kwDOJ8aBKM4Gw%05d\",\"name\":\"esp_ghota-%s%s\",\"label\":null,"
+                           "\"uploader\":%s,\"content_type\":\"application/octet-stream\",\"state\":\"uploaded\","
+                           "\"size\":%d,\"digest\":\"sha256:9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08\","
+                           "\"download_count\":%d,\"created_at\":\"2026-04-11T09:30:12Z\","
+                           "\"updated_at\":\"2026-04-11T09:30:13Z\","
+                           "\"browser_download_url\":\"https://github.com/Fishwaldo/esp_ghota/releases/download/1.4.0/esp_ghota-%s%s\"}",
+                           i ? "," : "", 170000000 + i, 170000000 + i, i, targets[i % 6],
+                           i < 6 ? ".bin" : "-storage.bin", user, 900000 + i * 4096, 1200 + i,
+                           targets[i % 6], i < 6 ? ".bin" : "-storage.bin");
+    }
+    len = bench_append(json, alloc, len,
+                       "],\"tarball_url\":\"" API_URL "esp_ghota/tarball/1.4.0\","
+                       "\"zipball_url\":\"" API_URL "esp_ghota/zipball/1.4.0\",\"body\":\"## What's Changed\\r\\n");
+    for (int i = 0; (size_t)len < size - 256; i++)
+    {
+        len = bench_append(json, alloc, len,
+                           "* Fix the \\\"%s\\\" sensor readings after a deep sleep wakeup by @contributor%d in "
+                           "https://github.com/Fishwaldo/esp_ghota/pull/%d\\r\\n",
+                           targets[i % 6], i % 17, 400 + i);
+    }
+    len = bench_append(json, alloc, len,
+                       "\\r\\n**Full Changelog**: https://github.com/Fishwaldo/esp_ghota/compare/1.3.2...1.4.0\","
+                       "\"reactions\":{\"total_count\":3,\"+1\":2,\"heart\":1},\"mentions_count\":4}");
+    *json_len = len;
+    return json;
+}
+
+static void bench_parser(lwjson_stream_parser_t *jsp, const lwjson_stream_path_t *paths)
+{
+    lwjson_stream_init(jsp, bench_event);
+    if (paths)
+        CHECK(lwjson_stream_set_paths(jsp, paths, RELEASE_PATHS) == lwjsonOK);
+}
+
+/* MB/s of parsing json repeatedly, the events of one parse in *count */
+static double bench_parse(const char *json, size_t len, const lwjson_stream_path_t *paths, bool buffered,
+                          uint32_t *count)
+{
+    lwjson_stream_parser_t jsp;
+    size_t runs = BENCH_BYTES / len + 1;
+    events = 0;
+    int64_t start = ghota_host_time_us();
+    for (size_t run = 0; run < runs; run++)
+    {
+        bench_parser(&jsp, paths);
+        lwjsonr_t res = lwjsonSTREAMINPROG;
+        if (buffered)
+        {
+            for (size_t pos = 0; pos < len; pos += CHUNK)
+                res = lwjson_stream_parse_buf(&jsp, json + pos, len - pos < CHUNK ? len - pos : CHUNK);
+        }
+        else
+        {
+            for (size_t pos = 0; pos < len; pos++)
+                res = lwjson_stream_parse(&jsp, json[pos]);
+        }
+        CHECK(res == lwjsonSTREAMDONE);
+    }
+    int64_t elapsed = ghota_host_time_us() - start;
+    *count = events / runs;
+    return (double)len * runs / elapsed;
+}
+
+int main(void)
+{
+    static lwjson_stream_path_t paths[RELEASE_PATHS];
+    for (size_t i = 0; i < RELEASE_PATHS; i++)
+        CHECK(lwjson_stream_path_compile(&paths[i], release_path_exprs[i]) == lwjsonOK);
+
+    printf("%-8s %-10s %8s %14s %14s %8s\n",
+           "payload", "events", "count", "per byte MB/s", "buffer MB/s", "speedup");
+    static const size_t sizes[] = {30 * 1024, 50 * 1024, 80 * 1024};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        size_t len;
+        char *json = bench_release(sizes[i], &len);
+        for (int subscribed = 0; subscribed < 2; subscribed++)
+        {
+            uint32_t bytewise_events, buffered_events;
+            double bytewise = bench_parse(json, len, subscribed ? paths : NULL, false, &bytewise_events);
+            double buffered = bench_parse(json, len, subscribed ? paths : NULL, true, &buffered_events);
+            CHECK(bytewise_events == buffered_events);
+            printf("%5zu KB %-10s %8" PRIu32 " %14.1f %14.1f %7.1fx\n",
+                   len / 1024, subscribed ? "release" : "all", buffered_events,
+                   bytewise, buffered, buffered / bytewise);
+        }
+        free(json);
+    }
+    return 0;
+}
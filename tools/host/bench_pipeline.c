@@ -0,0 +1,95 @@
+/* firmware download over a link about as fast as the flash
+ *
+ * Built twice, bench_pipeline writes each received buffer before it reads
+ * the next one, bench_pipeline_ring with CONFIG_GHOTA_PIPELINE receives into
+ * the ring while a second task writes to flash. The stall is the longest time
+ * the socket was not read, the ring peak the most full buffers waiting for
+ * flash.
+ */
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include "esp_log.h"
+#include "common.h"
+
+#define IMAGE_SIZE (256 * 1024)
+#define LINK_RATE (400 * 1024)
+
+/* ESP32 class NOR flash, a sector erase, the command of a write, programming 1 KB */
+#define ERASE_SECTOR_US 10000
+#define WRITE_CALL_US 40
+#define WRITE_KB_US 800
+
+static unsigned ring_peak;
+static unsigned ring_stalled_ms;
+
+/* keeps errors, picks the ring statistics from the debug log of the pipeline */
+static int bench_log(const char *fmt, va_list args)
+{
+    char line[256];
+    vsnprintf(line, sizeof(line), fmt, args);
+    const char *stats = strstr(line, "Pipeline received");
+    if (stats)
+        sscanf(stats, "Pipeline received %*u bytes in %*u ms, stalled on flash for %u ms, ring peak %u",
+               &ring_stalled_ms, &ring_peak);
+    else if (line[0] == 'E')
+        fputs(line, stderr);
+    return 0;
+}
+
+int main(void)
+{
+    ghota_host_log_level = 3;
+    esp_log_set_vprintf(bench_log);
+
+    uint8_t *image = test_make_image(IMAGE_SIZE, "esp_ghota", "0.0.2", 0, 5);
+    const test_asset_t assets[] = {
+        {.name = "esp_ghota.bin", .data = image, .len = IMAGE_SIZE, .id = 1},
+    };
+    ghota_host_set_app("esp_ghota", "0.0.1", 0);
+    test_serve_release("esp_ghota", "0.0.2", "", assets, 1);
+    ghota_host_flash_timing(ERASE_SECTOR_US, WRITE_CALL_US, WRITE_KB_US);
+    ghota_host_http_rate(LINK_RATE);
+
+    ghota_config_t config = {
+        .filenamematch = "esp_ghota.bin",
+    };
+    ghota_client_handle_t *handle = ghota_init(&config);
+    CHECK(handle != NULL);
+    int64_t start = ghota_host_time_us();
+    CHECK(ghota_start_update_task(handle) == ESP_OK);
+    /* the task waits a second between PENDING_REBOOT and the restart */
+    for (int waited = 0; ghota_host_event_count(GHOTA_EVENT_PENDING_REBOOT) == 0; waited++)
+    {
+        CHECK(waited < 60000);
+        usleep(1000);
+    }
+    int64_t elapsed = ghota_host_time_us() - start;
+    CHECK(test_wait_restarts(1, 10000));
+    CHECK(memcmp(ghota_host_partition_data(ghota_host_partition("ota_1")), image, IMAGE_SIZE) == 0);
+
+    printf("%d bytes, link %d KB/s, flash %d us per sector erase and %d us per KB\n",
+           IMAGE_SIZE, LINK_RATE / 1024, ERASE_SECTOR_US, WRITE_KB_US);
+    printf("%-10s %8s %10s %10s %12s %10s\n",
+           "mode", "KB/s", "wall ms", "stall ms", "ring stall", "ring peak");
+#ifdef CONFIG_GHOTA_PIPELINE
+    printf("%-10s %8.1f %10.1f %10.1f %9u ms %7u/%d\n",
+           "pipelined",
+           IMAGE_SIZE / 1024.0 / (elapsed / 1e6),
+           elapsed / 1000.0,
+           ghota_host_http_max_read_gap() / 1000.0,
+           ring_stalled_ms,
+           ring_peak,
+           CONFIG_GHOTA_PIPELINE_DEPTH);
+#else
+    printf("%-10s %8.1f %10.1f %10.1f %12s %10s\n",
+           "sequential",
+           IMAGE_SIZE / 1024.0 / (elapsed / 1e6),
+           elapsed / 1000.0,
+           ghota_host_http_max_read_gap() / 1000.0,
+           "-",
+           "-");
+#endif
+    free(image);
+    return 0;
+}
@@ -0,0 +1,157 @@
+/* flash writes of a storage download
+ *
+ * Feeds a 256 KB image in the chunk sizes the 1 KB HTTP receive buffer
+ * produces to the storage partition: erasing the whole partition on the first
+ * chunk as the storage handler once did, with a flash write per chunk as
+ * before the writer collected sectors, and through ghota_writer. The stall is
+ * the longest time one chunk keeps the receive path from reading the socket.
+ */
+#include <inttypes.h>
+#include <string.h>
+#include "esp_ghota_writer.h"
+#include "common.h"
+
+#define SECTOR 4096
+#define IMAGE_SIZE (256 * 1024)
+
+/* ESP32 class NOR flash, a sector erase, the command of a write, programming 1 KB */
+#define ERASE_SECTOR_US 10000
+#define WRITE_CALL_US 40
+#define WRITE_KB_US 800
+
+typedef esp_err_t (*bench_write_t)(const esp_partition_t *partition,
+                                   const uint8_t *data, const size_t *chunks, size_t count,
+                                   int64_t *stall);
+
+static void bench_stall(int64_t start, int64_t *stall)
+{
+    int64_t elapsed = ghota_host_time_us() - start;
+    if (elapsed > *stall)
+        *stall = elapsed;
+}
+
+/* the whole partition is erased before the first chunk is written */
+static esp_err_t bench_erase_first(const esp_partition_t *partition,
+                                   const uint8_t *data, const size_t *chunks, size_t count,
+                                   int64_t *stall)
+{
+    size_t offset = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        int64_t start = ghota_host_time_us();
+        if (i == 0)
+        {
+            esp_err_t err = esp_partition_erase_range(partition, 0, partition->size);
+            if (err != ESP_OK)
+                return err;
+        }
+        esp_err_t err = esp_partition_write(partition, offset, data + offset, chunks[i]);
+        if (err != ESP_OK)
+            return err;
+        offset += chunks[i];
+        bench_stall(start, stall);
+    }
+    return ESP_OK;
+}
+
+/* each chunk goes to esp_partition_write, sectors are erased as they are reached */
+static esp_err_t bench_direct(const esp_partition_t *partition,
+                              const uint8_t *data, const size_t *chunks, size_t count,
+                              int64_t *stall)
+{
+    size_t offset = 0;
+    size_t erased = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        int64_t start = ghota_host_time_us();
+        while (erased < offset + chunks[i])
+        {
+            esp_err_t err = esp_partition_erase_range(partition, erased, SECTOR);
+            if (err != ESP_OK)
+                return err;
+            erased += SECTOR;
+        }
+        esp_err_t err = esp_partition_write(partition, offset, data + offset, chunks[i]);
+        if (err != ESP_OK)
+            return err;
+        offset += chunks[i];
+        bench_stall(start, stall);
+    }
+    return ESP_OK;
+}
+
+static esp_err_t bench_writer(const esp_partition_t *partition,
+                              const uint8_t *data, const size_t *chunks, size_t count,
+                              int64_t *stall)
+{
+    ghota_writer_t *writer = ghota_writer_open(partition, "https://example.com/storage.bin", IMAGE_SIZE);
+    if (writer == NULL)
+        return ESP_ERR_NO_MEM;
+    ghota_writer_set_journal(writer, false);
+    esp_err_t err = ghota_writer_begin(writer, 0, NULL);
+    size_t offset = 0;
+    for (size_t i = 0; i < count && err == ESP_OK; i++)
+    {
+        int64_t start = ghota_host_time_us();
+        err = ghota_writer_write(writer, data + offset, chunks[i]);
+        offset += chunks[i];
+        bench_stall(start, stall);
+    }
+    if (err == ESP_OK)
+    {
+        int64_t start = ghota_host_time_us();
+        err = ghota_writer_finish(writer);
+        bench_stall(start, stall);
+    }
+    ghota_writer_close(writer);
+    return err;
+}
+
+static void bench_run(const char *name, bench_write_t write,
+                      const uint8_t *data, const size_t *chunks, size_t count)
+{
+    const esp_partition_t *partition = ghota_host_partition("storage");
+    ghota_host_flash_reset();
+    int64_t stall = 0;
+    int64_t start = ghota_host_time_us();
+    CHECK(write(partition, data, chunks, count, &stall) == ESP_OK);
+    int64_t elapsed = ghota_host_time_us() - start;
+
+    ghota_host_flash_stats_t flash = ghota_host_flash_stats();
+    CHECK(flash.unerased == 0);
+    CHECK(memcmp(ghota_host_partition_data(partition), data, IMAGE_SIZE) == 0);
+    printf("%-12s %8" PRIu32 " %12.1f %10" PRIu32 " %10" PRIu32 " %10.1f %10.1f\n",
+           name,
+           flash.writes,
+           (double)flash.write_bytes / flash.writes,
+           flash.max_write,
+           flash.erase_bytes / SECTOR,
+           elapsed / 1000.0,
+           stall / 1000.0);
+}
+
+int main(void)
+{
+    uint8_t *data = test_make_data(IMAGE_SIZE, 11);
+
+    /* TLS records and the receive buffer cut the body into chunks of up to 1 KB */
+    static size_t chunks[IMAGE_SIZE];
+    size_t count = 0;
+    uint32_t seed = 1;
+    for (size_t len = 0; len < IMAGE_SIZE; len += chunks[count++])
+    {
+        seed = seed * 1103515245 + 12345;
+        size_t chunk = (seed >> 16) % 4 ? 1024 : 1 + (seed >> 8) % 1024;
+        chunks[count] = chunk < IMAGE_SIZE - len ? chunk : IMAGE_SIZE - len;
+    }
+
+    ghota_host_flash_timing(ERASE_SECTOR_US, WRITE_CALL_US, WRITE_KB_US);
+    printf("%zu bytes in %zu chunks\n", (size_t)IMAGE_SIZE, count);
+    printf("%-12s %8s %12s %10s %10s %10s %10s\n",
+           "mode", "writes", "bytes/write", "max write", "sectors", "wall ms", "stall ms");
+    bench_run("erase first", bench_erase_first, data, chunks, count);
+    bench_run("direct", bench_direct, data, chunks, count);
+    bench_run("coalesced", bench_writer, data, chunks, count);
+    free(data);
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include <string.h>
+#include <unistd.h>
+#include "esp_app_format.h"
+#include "common.h"
+
+static uint32_t test_next(uint32_t *state)
+{
+    *state = *state * 1664525 + 1013904223;
+    return *state >> 8;
+}
+
+uint8_t *test_make_image(size_t size, const char *project, const char *version,
+                         uint32_t secure_version, uint32_t seed)
+{
+    uint8_t *image = test_make_data(size, seed);
+    esp_image_header_t header = {.magic = 0xe9, .segment_count = 1};
+    esp_image_segment_header_t segment = {.data_len = size - sizeof(header) - sizeof(segment)};
+    esp_app_desc_t desc = {.magic_word = ESP_APP_DESC_MAGIC_WORD, .secure_version = secure_version};
+    strlcpy(desc.project_name, project, sizeof(desc.project_name));
+    strlcpy(desc.version, version, sizeof(desc.version));
+    strlcpy(desc.idf_ver, "v5.1", sizeof(desc.idf_ver));
+    memcpy(image, &header, sizeof(header));
+    memcpy(image + sizeof(header), &segment, sizeof(segment));
+    memcpy(image + sizeof(header) + sizeof(segment), &desc, sizeof(desc));
+    return image;
+}
+
+uint8_t *test_make_data(size_t size, uint32_t seed)
+{
+    uint8_t *data = malloc(size);
+    uint32_t state = seed;
+    /* runs of repeated and random bytes */
+    for (size_t i = 0; i < size;)
+    {
+        size_t run = 1 + test_next(&state) % 64;
+        uint8_t value = test_next(&state);
+        bool repeat = test_next(&state) % 2;
+        for (size_t j = 0; j < run && i < size; j++, i++)
+            data[i] = repeat ? value : (uint8_t)test_next(&state);
+    }
+    return data;
+}
+
+void test_serve_release(const char *repo, const char *tag, const char *body, const test_asset_t *assets, size_t count)
+{
+    size_t size = 1024 + (body ? strlen(body) : 0) + count * 512;
+    char *json = malloc(size);
+    int len = snprintf(json, size, "{\"tag_name\":\"%s\",\"assets\":[", tag);
+    for (size_t i = 0; i < count; i++)
+    {
+        char digest[65];
+        ghota_host_sha256_hex(assets[i].data, assets[i].len, digest);
+        len += snprintf(json + len, size - len,
+                        "%s{\"url\":\"" API_URL "%s/releases/assets/%u\",\"id\":%u,"
+                        "\"name\":\"%s\",\"content_type\":\"application/octet-stream\","
+                        "\"size\":%zu,\"digest\":\"sha256:%s\"}",
+                        i ? "," : "", repo, assets[i].id, assets[i].id, assets[i].name,
+                        assets[i].len, digest);
+
+        char *url;
+        if (asprintf(&url, API_URL "%s/releases/assets/%u", repo, assets[i].id) < 0)
+            abort();
+        if (assets[i].cdn)
+        {
+            char *cdn;
+            if (asprintf(&cdn, "https://%s/%u?sig=%u", assets[i].cdn, assets[i].id, assets[i].id) < 0)
+                abort();
+            ghota_host_http_add(&(ghota_host_response_t){
+                .url = url, .status = 302, .location = cdn});
+            url = cdn;
+        }
+        ghota_host_http_add(&(ghota_host_response_t){
+            .url = url, .status = 200, .body = assets[i].data, .body_len = assets[i].len,
+            .etag = "\"asset\"", .ranges = true});
+    }
+    snprintf(json + len, size - len, "],\"body\":\"%s\"}", body ? body : "");
+    char *latest;
+    if (asprintf(&latest, API_URL "%s/releases/latest", repo) < 0)
+        abort();
+    ghota_host_http_add(&(ghota_host_response_t){
+        .url = latest, .status = 200, .body = json, .body_len = strlen(json),
+        .headers = {"x-ratelimit-remaining: 4999", "x-ratelimit-reset: 1700000000"}});
+}
+
+bool test_wait_restarts(uint32_t restarts, uint32_t timeout_ms)
+{
+    for (uint32_t waited = 0; ghota_host_restarts() < restarts; waited++)
+    {
+        if (waited >= timeout_ms)
+            return false;
+        usleep(1000);
+    }
+    return true;
+}
+
+bool test_wait_idle(ghota_client_handle_t *handle, uint32_t timeout_ms)
+{
+    /* ghota_start_update_task has claimed the handle before it returns */
+    for (uint32_t waited = 0; ghota_get_phase(handle) != GHOTA_PHASE_IDLE; waited++)
+    {
+        if (waited >= timeout_ms)
+            return false;
+        usleep(1000);
+    }
+    return true;
+}
@@ -0,0 +1,41 @@
+/* helpers shared by the host tests and benchmarks */
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "esp_ghota.h"
+#include "host.h"
+
+#define CHECK(cond)                                                     \
+    do                                                                  \
+    {                                                                   \
+        if (!(cond))                                                    \
+        {                                                               \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n",                \
+                    __FILE__, __LINE__, #cond);                         \
+            exit(1);                                                    \
+        }                                                               \
+    } while (0)
+
+#define API_URL "https://api.github.com/repos/Fishwaldo/"
+
+typedef struct
+{
+    const char *name;
+    const void *data;
+    size_t len;
+    uint32_t id;      /* served at API_URL<repo>/releases/assets/<id> */
+    const char *cdn;  /* the asset redirects there, NULL to serve it from the API */
+} test_asset_t;
+
+/* an app image of the given size with an esp_app_desc_t, the rest filled from seed */
+uint8_t *test_make_image(size_t size, const char *project, const char *version,
+                         uint32_t secure_version, uint32_t seed);
+/* deterministic bytes that compress like a filesystem image */
+uint8_t *test_make_data(size_t size, uint32_t seed);
+/* serve the latest Github release of repo with the assets, answers Range requests */
+void test_serve_release(const char *repo, const char *tag, const char *body, const test_asset_t *assets, size_t count);
+/* wait for the update task to restart the device or go idle, false on timeout */
+bool test_wait_restarts(uint32_t restarts, uint32_t timeout_ms);
+bool test_wait_idle(ghota_client_handle_t *handle, uint32_t timeout_ms);
@@ -0,0 +1,7 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+/* set with ghota_host_set_secure_version */
+uint32_t esp_efuse_read_secure_version(void);
+bool esp_efuse_check_secure_version(uint32_t secure_version);
@@ -0,0 +1,26 @@
+#pragma once
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdarg.h>
+
+/* 0 errors only, 1 warnings, 2 info, 3 debug, set with GHOTA_HOST_LOG */
+extern int ghota_host_log_level;
+
+typedef int (*vprintf_like_t)(const char *, va_list);
+/* where log lines go instead of stderr, returns the previous function */
+vprintf_like_t esp_log_set_vprintf(vprintf_like_t func);
+void ghota_host_log(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#define GHOTA_HOST_LOG(level, letter, tag, fmt, ...)                               \
+    do                                                                            \
+    {                                                                             \
+        if (ghota_host_log_level >= level)                                        \
+            ghota_host_log(letter " (%s) " fmt "\n", tag, ##__VA_ARGS__);         \
+    } while (0)
+
+#define ESP_LOGE(tag, fmt, ...) GHOTA_HOST_LOG(0, "E", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) GHOTA_HOST_LOG(1, "W", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) GHOTA_HOST_LOG(2, "I", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) GHOTA_HOST_LOG(3, "D", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGV(tag, fmt, ...) GHOTA_HOST_LOG(4, "V", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOG_BUFFER_HEX(tag, buf, len) ((void)(buf), (void)(len))
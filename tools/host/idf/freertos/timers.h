@@ -0,0 +1,19 @@
+#pragma once
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* callbacks run on one timer thread, like the FreeRTOS timer service task */
+typedef struct ghota_host_timer *TimerHandle_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t timer);
+typedef void (*PendedFunction_t)(void *param1, uint32_t param2);
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t reload, void *id, TimerCallbackFunction_t cb);
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t wait);
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t wait);
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t wait);
+BaseType_t xTimerDelete(TimerHandle_t timer, TickType_t wait);
+void *pvTimerGetTimerID(TimerHandle_t timer);
+void vTimerSetTimerID(TimerHandle_t timer, void *id);
+/* runs on the timer thread after the callback that is running, in the order of the calls */
+BaseType_t xTimerPendFunctionCall(PendedFunction_t fn, void *param1, uint32_t param2, TickType_t wait);
+TaskHandle_t xTimerGetTimerDaemonTaskHandle(void);
@@ -0,0 +1,79 @@
+/* control and counters of the host stand-ins for ESP-IDF */
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_partition.h"
+
+/* partitions: "ota_0" runs the app, "ota_1" receives updates, "storage" is data */
+typedef struct
+{
+    uint32_t reads;
+    uint32_t writes;      /* esp_partition_write calls */
+    uint32_t write_bytes;
+    uint32_t max_write;   /* largest single write */
+    uint32_t erases;      /* esp_partition_erase_range calls */
+    uint32_t erase_bytes;
+    uint32_t unerased;    /* writes that had to clear bits that were not erased */
+} ghota_host_flash_stats_t;
+
+/* erase all partitions and clear the counters */
+void ghota_host_flash_reset(void);
+/* time a 4 KB sector erase, the command of a write call and each 1 KB it writes take, 0 for no delay */
+void ghota_host_flash_timing(uint32_t erase_sector_us, uint32_t write_call_us, uint32_t write_kb_us);
+ghota_host_flash_stats_t ghota_host_flash_stats(void);
+const esp_partition_t *ghota_host_partition(const char *label);
+uint8_t *ghota_host_partition_data(const esp_partition_t *partition);
+void ghota_host_set_app(const char *project_name, const char *version, uint32_t secure_version);
+void ghota_host_set_secure_version(uint32_t efuse_secure_version);
+const esp_partition_t *ghota_host_boot_partition(void);
+
+/* esp_event_post calls per event id */
+uint32_t ghota_host_event_count(int32_t id);
+void ghota_host_events_reset(void);
+
+/* esp_restart calls, each ends the calling thread */
+uint32_t ghota_host_restarts(void);
+
+/* a response of the simulated servers, matched by method and url */
+typedef struct
+{
+    const char *url;
+    int status;
+    const char *location;     /* Location header or NULL */
+    const void *body;
+    size_t body_len;
+    const char *etag;         /* ETag header or NULL, also the If-Range validator */
+    const char *encoding;     /* Content-Encoding header or NULL */
+    const char *headers[8];   /* more "Key: value" headers, NULL terminated */
+    bool chunked;             /* no Content-Length */
+    bool ranges;              /* answers Range requests with 206 */
+    bool close;               /* closes the connection after the response */
+} ghota_host_response_t;
+
+typedef struct
+{
+    uint32_t requests;
+    uint32_t connects;        /* TLS handshakes */
+    uint32_t full;            /* handshakes without a session ticket */
+    uint32_t resumed;         /* handshakes that resumed a ticket of the same host */
+    uint32_t stale;           /* tickets offered to a host they were not issued by */
+    uint32_t auth_elsewhere;  /* credentials sent to a host other than api.github.com */
+    uint32_t read_bytes;      /* body bytes returned by esp_http_client_read */
+} ghota_host_http_stats_t;
+
+/* forget all responses, tickets and counters */
+void ghota_host_http_reset(void);
+void ghota_host_http_add(const ghota_host_response_t *response);
+/* body bytes per second the servers send, 0 for no limit */
+void ghota_host_http_rate(uint32_t bytes_per_second);
+ghota_host_http_stats_t ghota_host_http_stats(void);
+void ghota_host_http_stats_reset(void);
+/* the server forgets the tickets it issued, as after a restart of the server */
+void ghota_host_http_forget_tickets(void);
+/* longest time in us between two esp_http_client_read calls of a download */
+uint32_t ghota_host_http_max_read_gap(void);
+
+int64_t ghota_host_time_us(void);
+void ghota_host_sha256(const void *data, size_t len, uint8_t digest[32]);
+void ghota_host_sha256_hex(const void *data, size_t len, char hex[65]);
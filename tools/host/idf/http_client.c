@@ -0,0 +1,523 @@
+/* esp_http_client against simulated servers in the same process
+ *
+ * Each client keeps one connection like the real one: it stays open between
+ * requests to the same host, esp_http_client_set_url closes it when the host
+ * changes, and a connection the server closed fails on the next request. Every
+ * new connection is counted as a TLS handshake. With save_client_session, the
+ * client keeps the ticket of its last handshake and offers it on the next one,
+ * whatever the host, until esp_http_client_cleanup frees it.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_tls.h"
+#include "esp_crt_bundle.h"
+#include "host.h"
+
+#define HOST_LEN 128
+#define URL_LEN 512
+#define MAX_HEADERS 16
+
+typedef struct server_response
+{
+    ghota_host_response_t r;
+    struct server_response *next;
+} server_response_t;
+
+typedef struct server_ticket
+{
+    char host[HOST_LEN];
+    uint32_t id;
+    struct server_ticket *next;
+} server_ticket_t;
+
+static pthread_mutex_t server_lock = PTHREAD_MUTEX_INITIALIZER;
+static server_response_t *responses;
+static server_ticket_t *tickets;
+static uint32_t next_ticket = 1;
+static uint32_t rate;
+static ghota_host_http_stats_t stats;
+static uint32_t max_read_gap;
+
+static const ghota_host_response_t not_found = {
+    .status = 404,
+    .body = "{\"message\": \"Not Found\"}",
+    .body_len = 24,
+};
+
+struct esp_http_client
+{
+    http_event_handle_cb handler;
+    void *user_data;
+    bool save_session;
+    char url[URL_LEN];
+    char host[HOST_LEN];
+    esp_http_client_method_t method;
+    char *headers[MAX_HEADERS];
+    bool auth;
+    /* connection */
+    bool connected;
+    bool peer_closed;
+    char ticket_host[HOST_LEN];
+    uint32_t ticket;
+    /* response */
+    const ghota_host_response_t *response;
+    int status;
+    size_t pos;
+    size_t end;
+    char *location;
+    int64_t next_read;
+    int64_t last_read;
+};
+
+static void get_host(const char *url, char *host)
+{
+    const char *start = strstr(url, "://");
+    start = start ? start + 3 : url;
+    snprintf(host, HOST_LEN, "%.*s", (int)strcspn(start, "/?#"), start);
+}
+
+static void sleep_until(int64_t us)
+{
+    int64_t now = ghota_host_time_us();
+    if (us > now)
+    {
+        struct timespec ts = {
+            .tv_sec = (us - now) / 1000000,
+            .tv_nsec = ((us - now) % 1000000) * 1000,
+        };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void fire(esp_http_client_handle_t client, esp_http_client_event_id_t id, char *key, char *value)
+{
+    esp_http_client_event_t evt = {
+        .event_id = id,
+        .client = client,
+        .user_data = client->user_data,
+        .header_key = key,
+        .header_value = value,
+    };
+    if (client->handler)
+        client->handler(&evt);
+}
+
+void ghota_host_http_reset(void)
+{
+    pthread_mutex_lock(&server_lock);
+    while (responses)
+    {
+        server_response_t *next = responses->next;
+        free(responses);
+        responses = next;
+    }
+    while (tickets)
+    {
+        server_ticket_t *next = tickets->next;
+        free(tickets);
+        tickets = next;
+    }
+    memset(&stats, 0, sizeof(stats));
+    max_read_gap = 0;
+    rate = 0;
+    pthread_mutex_unlock(&server_lock);
+}
+
+void ghota_host_http_add(const ghota_host_response_t *response)
+{
+    server_response_t *entry = calloc(1, sizeof(server_response_t));
+    entry->r = *response;
+    pthread_mutex_lock(&server_lock);
+    entry->next = responses;
+    responses = entry;
+    pthread_mutex_unlock(&server_lock);
+}
+
+void ghota_host_http_rate(uint32_t bytes_per_second)
+{
+    rate = bytes_per_second;
+}
+
+ghota_host_http_stats_t ghota_host_http_stats(void)
+{
+    pthread_mutex_lock(&server_lock);
+    ghota_host_http_stats_t s = stats;
+    pthread_mutex_unlock(&server_lock);
+    return s;
+}
+
+void ghota_host_http_stats_reset(void)
+{
+    pthread_mutex_lock(&server_lock);
+    memset(&stats, 0, sizeof(stats));
+    max_read_gap = 0;
+    pthread_mutex_unlock(&server_lock);
+}
+
+void ghota_host_http_forget_tickets(void)
+{
+    pthread_mutex_lock(&server_lock);
+    while (tickets)
+    {
+        server_ticket_t *next = tickets->next;
+        free(tickets);
+        tickets = next;
+    }
+    pthread_mutex_unlock(&server_lock);
+}
+
+uint32_t ghota_host_http_max_read_gap(void)
+{
+    return max_read_gap;
+}
+
+esp_err_t esp_tls_get_and_clear_last_error(esp_tls_error_handle_t h, int *code, int *flags)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_crt_bundle_attach(void *conf)
+{
+    return ESP_OK;
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+    esp_http_client_handle_t client = calloc(1, sizeof(struct esp_http_client));
+    client->handler = config->event_handler;
+    client->user_data = config->user_data;
+    client->save_session = config->save_client_session;
+    esp_http_client_set_url(client, config->url);
+    return client;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client)
+{
+    if (client->connected)
+    {
+        client->connected = false;
+        fire(client, HTTP_EVENT_DISCONNECTED, NULL, NULL);
+    }
+    client->peer_closed = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    esp_http_client_close(client);
+    for (int i = 0; i < MAX_HEADERS; i++)
+        free(client->headers[i]);
+    free(client->location);
+    free(client);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char *url)
+{
+    char host[HOST_LEN];
+    get_host(url, host);
+    if (client->connected && strcasecmp(host, client->host) != 0)
+        esp_http_client_close(client);
+    snprintf(client->url, sizeof(client->url), "%s", url);
+    strcpy(client->host, host);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_get_url(esp_http_client_handle_t client, char *url, const int len)
+{
+    snprintf(url, len, "%s", client->url);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_method(esp_http_client_handle_t client, esp_http_client_method_t method)
+{
+    client->method = method;
+    return ESP_OK;
+}
+
+static char **find_header(esp_http_client_handle_t client, const char *key)
+{
+    size_t len = strlen(key);
+    for (int i = 0; i < MAX_HEADERS; i++)
+    {
+        if (client->headers[i] &&
+            strncasecmp(client->headers[i], key, len) == 0 &&
+            client->headers[i][len] == ':')
+            return &client->headers[i];
+    }
+    return NULL;
+}
+
+static const char *get_header(esp_http_client_handle_t client, const char *key)
+{
+    char **header = find_header(client, key);
+    return header ? *header + strlen(key) + 2 : NULL;
+}
+
+esp_err_t esp_http_client_delete_header(esp_http_client_handle_t client, const char *key)
+{
+    char **header = find_header(client, key);
+    if (header)
+    {
+        free(*header);
+        *header = NULL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value)
+{
+    esp_http_client_delete_header(client, key);
+    for (int i = 0; i < MAX_HEADERS; i++)
+    {
+        if (client->headers[i] == NULL)
+        {
+            asprintf(&client->headers[i], "%s: %s", key, value);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_http_client_set_username(esp_http_client_handle_t client, const char *username)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_password(esp_http_client_handle_t client, const char *password)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_authtype(esp_http_client_handle_t client, esp_http_client_auth_type_t type)
+{
+    client->auth = type != HTTP_AUTH_TYPE_NONE;
+    return ESP_OK;
+}
+
+/* the handshake of a new connection, resumed if the server knows the offered ticket */
+static void connect(esp_http_client_handle_t client)
+{
+    pthread_mutex_lock(&server_lock);
+    stats.connects++;
+    bool resumed = false;
+    if (client->ticket && strcasecmp(client->ticket_host, client->host) != 0)
+    {
+        stats.stale++;
+    }
+    else if (client->ticket)
+    {
+        for (server_ticket_t *t = tickets; t; t = t->next)
+        {
+            if (t->id == client->ticket && strcasecmp(t->host, client->host) == 0)
+                resumed = true;
+        }
+    }
+    if (resumed)
+        stats.resumed++;
+    else
+        stats.full++;
+    if (client->save_session)
+    {
+        server_ticket_t *t = calloc(1, sizeof(server_ticket_t));
+        strcpy(t->host, client->host);
+        t->id = next_ticket++;
+        t->next = tickets;
+        tickets = t;
+        client->ticket = t->id;
+        strcpy(client->ticket_host, client->host);
+    }
+    pthread_mutex_unlock(&server_lock);
+    client->connected = true;
+    fire(client, HTTP_EVENT_ON_CONNECTED, NULL, NULL);
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len)
+{
+    if (client->connected && client->peer_closed)
+    {
+        /* writing the request to a connection the server closed */
+        esp_http_client_close(client);
+        return ESP_FAIL;
+    }
+    if (!client->connected)
+        connect(client);
+
+    const char *method =
+        client->method == HTTP_METHOD_HEAD   ? "HEAD"
+        : client->method == HTTP_METHOD_POST ? "POST"
+                                             : "GET";
+    pthread_mutex_lock(&server_lock);
+    stats.requests++;
+    if (client->auth && strcasecmp(client->host, "api.github.com") != 0)
+        stats.auth_elsewhere++;
+    client->response = &not_found;
+    for (server_response_t *r = responses; r; r = r->next)
+    {
+        if (strcmp(r->r.url, client->url) == 0)
+        {
+            client->response = &r->r;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&server_lock);
+    if (ghota_host_log_level >= 3)
+        ghota_host_log("S (server) %s %s -> %d\n", method, client->url, client->response->status);
+
+    const ghota_host_response_t *r = client->response;
+    client->status = r->status;
+    client->pos = 0;
+    client->end = r->body_len;
+    const char *range = get_header(client, "Range");
+    const char *if_range = get_header(client, "If-Range");
+    if (r->ranges && r->status == 200 && range &&
+        (if_range == NULL || (r->etag && strcmp(if_range, r->etag) == 0)))
+    {
+        size_t start = strtoul(range + strlen("bytes="), NULL, 10);
+        if (start <= r->body_len)
+        {
+            client->status = 206;
+            client->pos = start;
+        }
+    }
+    if (client->method == HTTP_METHOD_HEAD)
+        client->end = client->pos;
+    client->next_read = ghota_host_time_us();
+    client->last_read = 0;
+    return ESP_OK;
+}
+
+int esp_http_client_write(esp_http_client_handle_t client, const char *buffer, int len)
+{
+    return len;
+}
+
+static void header(esp_http_client_handle_t client, const char *key, const char *value)
+{
+    char *k = strdup(key);
+    char *v = strdup(value);
+    fire(client, HTTP_EVENT_ON_HEADER, k, v);
+    free(k);
+    free(v);
+}
+
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client)
+{
+    const ghota_host_response_t *r = client->response;
+    free(client->location);
+    client->location = r->location ? strdup(r->location) : NULL;
+    if (r->location)
+        header(client, "Location", r->location);
+    if (r->etag)
+        header(client, "ETag", r->etag);
+    if (r->encoding)
+        header(client, "Content-Encoding", r->encoding);
+    for (int i = 0; i < 8 && r->headers[i]; i++)
+    {
+        char *key = strdup(r->headers[i]);
+        char *value = strchr(key, ':');
+        *value++ = '\0';
+        while (*value == ' ')
+            value++;
+        header(client, key, value);
+        free(key);
+    }
+    return r->chunked ? -1 : (int64_t)(r->body_len - client->pos);
+}
+
+bool esp_http_client_is_chunked_response(esp_http_client_handle_t client)
+{
+    return client->response->chunked;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+    return client->status;
+}
+
+int64_t esp_http_client_get_content_length(esp_http_client_handle_t client)
+{
+    return client->response->chunked ? -1 : (int64_t)(client->response->body_len - client->pos);
+}
+
+static int ghota_host_http_read(esp_http_client_handle_t client, char *buffer, int len)
+{
+    int64_t now = ghota_host_time_us();
+    if (client->last_read)
+    {
+        uint32_t gap = now - client->last_read;
+        pthread_mutex_lock(&server_lock);
+        if (gap > max_read_gap)
+            max_read_gap = gap;
+        pthread_mutex_unlock(&server_lock);
+    }
+    size_t n = client->end - client->pos;
+    if ((size_t)len < n)
+        n = len;
+    if (n && rate)
+    {
+        /* the link delivers rate bytes per second, whether or not they are read */
+        if (client->next_read < now)
+            client->next_read = now;
+        client->next_read += (int64_t)n * 1000000 / rate;
+        sleep_until(client->next_read);
+    }
+    memcpy(buffer, (const char *)client->response->body + client->pos, n);
+    client->pos += n;
+    if (client->pos == client->end && client->response->close)
+        client->peer_closed = true;
+    client->last_read = ghota_host_time_us();
+    return n;
+}
+
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len)
+{
+    int n = ghota_host_http_read(client, buffer, len);
+    pthread_mutex_lock(&server_lock);
+    stats.read_bytes += n;
+    pthread_mutex_unlock(&server_lock);
+    return n;
+}
+
+bool esp_http_client_is_complete_data_received(esp_http_client_handle_t client)
+{
+    return client->pos == client->end;
+}
+
+esp_err_t esp_http_client_flush_response(esp_http_client_handle_t client, int *len)
+{
+    char buf[512];
+    int n;
+    int total = 0;
+    while ((n = ghota_host_http_read(client, buf, sizeof(buf))) > 0)
+        total += n;
+    if (len)
+        *len = total;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_redirection(esp_http_client_handle_t client)
+{
+    if (client->location == NULL)
+        return ESP_ERR_INVALID_ARG;
+    char url[URL_LEN];
+    if (client->location[0] == '/')
+    {
+        const char *path = strstr(client->url, "://");
+        path = strchr(path ? path + 3 : client->url, '/');
+        int origin = path ? (int)(path - client->url) : (int)strlen(client->url);
+        snprintf(url, sizeof(url), "%.*s%s", origin, client->url, client->location);
+    }
+    else
+    {
+        snprintf(url, sizeof(url), "%s", client->location);
+    }
+    return esp_http_client_set_url(client, url);
+}
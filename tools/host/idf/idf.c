@@ -0,0 +1,1115 @@
+/* host stand-ins for the parts of ESP-IDF and FreeRTOS the component uses */
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
+#include "mbedtls/sha256.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_ota_ops.h"
+#include "esp_efuse.h"
+#include "esp_random.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "host.h"
+
+int ghota_host_log_level = 0;
+static int64_t boot_us;
+
+static int ghota_host_log_stderr(const char *fmt, va_list args)
+{
+    return vfprintf(stderr, fmt, args);
+}
+
+static vprintf_like_t log_vprintf = ghota_host_log_stderr;
+
+vprintf_like_t esp_log_set_vprintf(vprintf_like_t func)
+{
+    vprintf_like_t previous = log_vprintf;
+    log_vprintf = func;
+    return previous;
+}
+
+void ghota_host_log(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    log_vprintf(fmt, args);
+    va_end(args);
+}
+
+static int64_t ghota_host_clock_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+__attribute__((constructor)) static void ghota_host_init(void)
+{
+    const char *level = getenv("GHOTA_HOST_LOG");
+    if (level)
+        ghota_host_log_level = atoi(level);
+    boot_us = ghota_host_clock_us();
+}
+
+/* time since the program started, like the time since boot on the device */
+int64_t ghota_host_time_us(void)
+{
+    return ghota_host_clock_us() - boot_us;
+}
+
+static void ghota_host_sleep_us(int64_t us)
+{
+    if (us <= 0)
+        return;
+    struct timespec ts = {
+        .tv_sec = us / 1000000,
+        .tv_nsec = (us % 1000000) * 1000,
+    };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+        ;
+}
+
+/* a deadline for the pthread timed waits, NULL for portMAX_DELAY */
+static struct timespec *ghota_host_deadline(
+    TickType_t wait,
+    struct timespec *ts)
+{
+    if (wait == portMAX_DELAY)
+        return NULL;
+    clock_gettime(CLOCK_REALTIME, ts);
+    uint64_t ns = (uint64_t)ts->tv_nsec + (uint64_t)pdTICKS_TO_MS(wait) * 1000000;
+    ts->tv_sec += ns / 1000000000;
+    ts->tv_nsec = ns % 1000000000;
+    return ts;
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_FAIL:
+        return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+        return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+        return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:
+        return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:
+        return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED:
+        return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:
+        return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_CRC:
+        return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_INVALID_VERSION:
+        return "ESP_ERR_INVALID_VERSION";
+    case ESP_ERR_NVS_NOT_FOUND:
+        return "ESP_ERR_NVS_NOT_FOUND";
+    case ESP_ERR_OTA_VALIDATE_FAILED:
+        return "ESP_ERR_OTA_VALIDATE_FAILED";
+    }
+    return "UNKNOWN ERROR";
+}
+
+/* tasks */
+
+struct ghota_host_task
+{
+    TaskFunction_t fn;
+    void *arg;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notified;
+};
+
+static __thread struct ghota_host_task *current_task;
+
+static struct ghota_host_task *ghota_host_task_new(void)
+{
+    struct ghota_host_task *task = calloc(1, sizeof(*task));
+    pthread_mutex_init(&task->lock, NULL);
+    pthread_cond_init(&task->cond, NULL);
+    return task;
+}
+
+static void *ghota_host_task_main(void *arg)
+{
+    current_task = arg;
+    current_task->fn(current_task->arg);
+    /* a task function must not return, but end the thread if it does */
+    return NULL;
+}
+
+BaseType_t xTaskCreate(
+    TaskFunction_t fn,
+    const char *name,
+    uint32_t stack,
+    void *arg,
+    UBaseType_t prio,
+    TaskHandle_t *handle)
+{
+    struct ghota_host_task *task = ghota_host_task_new();
+    task->fn = fn;
+    task->arg = arg;
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int res = pthread_create(&thread, &attr, ghota_host_task_main, task);
+    pthread_attr_destroy(&attr);
+    if (res != 0)
+    {
+        free(task);
+        return pdFAIL;
+    }
+    if (handle)
+        *handle = task;
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(
+    TaskFunction_t fn,
+    const char *name,
+    uint32_t stack,
+    void *arg,
+    UBaseType_t prio,
+    TaskHandle_t *handle,
+    BaseType_t core)
+{
+    return xTaskCreate(fn, name, stack, arg, prio, handle);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL || task == current_task)
+    {
+        /* the task struct stays, a notification may still be on its way */
+        pthread_exit(NULL);
+    }
+    fprintf(stderr, "vTaskDelete of another task is not supported on the host\n");
+    abort();
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    ghota_host_sleep_us((int64_t)pdTICKS_TO_MS(ticks) * 1000);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)pdMS_TO_TICKS(ghota_host_time_us() / 1000);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    if (current_task == NULL)
+        current_task = ghota_host_task_new();
+    return current_task;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notified++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait)
+{
+    struct ghota_host_task *task = xTaskGetCurrentTaskHandle();
+    struct timespec ts;
+    struct timespec *deadline = ghota_host_deadline(wait, &ts);
+    pthread_mutex_lock(&task->lock);
+    while (task->notified == 0)
+    {
+        int res = deadline
+                      ? pthread_cond_timedwait(&task->cond, &task->lock, deadline)
+                      : pthread_cond_wait(&task->cond, &task->lock);
+        if (res == ETIMEDOUT)
+            break;
+    }
+    uint32_t value = task->notified;
+    if (value)
+        task->notified = clear ? 0 : value - 1;
+    pthread_mutex_unlock(&task->lock);
+    return value;
+}
+
+/* queues */
+
+struct ghota_host_queue
+{
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+    uint8_t *items;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct ghota_host_queue *queue = calloc(1, sizeof(*queue));
+    queue->items = malloc(length * item_size);
+    queue->length = length;
+    queue->item_size = item_size;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->changed);
+    free(queue->items);
+    free(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait)
+{
+    struct timespec ts;
+    struct timespec *deadline = ghota_host_deadline(wait, &ts);
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->length)
+    {
+        if (wait == 0 ||
+            (deadline
+                 ? pthread_cond_timedwait(&queue->changed, &queue->lock, deadline)
+                 : pthread_cond_wait(&queue->changed, &queue->lock)) == ETIMEDOUT)
+        {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFAIL;
+        }
+    }
+    UBaseType_t tail = (queue->head + queue->count) % queue->length;
+    memcpy(&queue->items[tail * queue->item_size], item, queue->item_size);
+    queue->count++;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait)
+{
+    struct timespec ts;
+    struct timespec *deadline = ghota_host_deadline(wait, &ts);
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0)
+    {
+        if (wait == 0 ||
+            (deadline
+                 ? pthread_cond_timedwait(&queue->changed, &queue->lock, deadline)
+                 : pthread_cond_wait(&queue->changed, &queue->lock)) == ETIMEDOUT)
+        {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFAIL;
+        }
+    }
+    memcpy(item, &queue->items[queue->head * queue->item_size], queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
+
+/* mutexes */
+
+struct ghota_host_mutex
+{
+    pthread_mutex_t lock;
+};
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    struct ghota_host_mutex *mutex = calloc(1, sizeof(*mutex));
+    pthread_mutex_init(&mutex->lock, NULL);
+    return mutex;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t mutex)
+{
+    pthread_mutex_destroy(&mutex->lock);
+    free(mutex);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t wait)
+{
+    if (wait == portMAX_DELAY)
+        return pthread_mutex_lock(&mutex->lock) == 0 ? pdTRUE : pdFALSE;
+    if (wait == 0)
+        return pthread_mutex_trylock(&mutex->lock) == 0 ? pdTRUE : pdFALSE;
+    struct timespec ts;
+    return pthread_mutex_timedlock(&mutex->lock, ghota_host_deadline(wait, &ts)) == 0
+               ? pdTRUE
+               : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex)
+{
+    return pthread_mutex_unlock(&mutex->lock) == 0 ? pdTRUE : pdFALSE;
+}
+
+/* software timers, all callbacks run on one service thread */
+
+struct ghota_host_timer
+{
+    TimerCallbackFunction_t cb;
+    void *id;
+    TickType_t period;
+    bool reload;
+    bool active;
+    bool deleted;
+    int64_t expiry;
+    struct ghota_host_timer *next;
+};
+
+static pthread_mutex_t timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_changed = PTHREAD_COND_INITIALIZER;
+static struct ghota_host_timer *timers;
+static struct ghota_host_task *timer_task;
+
+typedef struct ghota_host_pended
+{
+    PendedFunction_t fn;
+    void *param1;
+    uint32_t param2;
+    struct ghota_host_pended *next;
+} ghota_host_pended_t;
+
+static ghota_host_pended_t *pended;
+
+static void *ghota_host_timer_main(void *arg)
+{
+    current_task = timer_task;
+    pthread_mutex_lock(&timer_lock);
+    for (;;)
+    {
+        if (pended)
+        {
+            ghota_host_pended_t *call = pended;
+            pended = call->next;
+            pthread_mutex_unlock(&timer_lock);
+            call->fn(call->param1, call->param2);
+            free(call);
+            pthread_mutex_lock(&timer_lock);
+            continue;
+        }
+        struct ghota_host_timer **link = &timers;
+        struct ghota_host_timer *next = NULL;
+        while (*link)
+        {
+            struct ghota_host_timer *timer = *link;
+            if (timer->deleted)
+            {
+                *link = timer->next;
+                free(timer);
+                continue;
+            }
+            if (timer->active && (next == NULL || timer->expiry < next->expiry))
+                next = timer;
+            link = &timer->next;
+        }
+        if (next == NULL)
+        {
+            pthread_cond_wait(&timer_changed, &timer_lock);
+            continue;
+        }
+        int64_t now = ghota_host_time_us();
+        if (next->expiry > now)
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            uint64_t ns = (uint64_t)ts.tv_nsec + (uint64_t)(next->expiry - now) * 1000;
+            ts.tv_sec += ns / 1000000000;
+            ts.tv_nsec = ns % 1000000000;
+            pthread_cond_timedwait(&timer_changed, &timer_lock, &ts);
+            continue;
+        }
+        if (next->reload)
+            next->expiry += (int64_t)pdTICKS_TO_MS(next->period) * 1000;
+        else
+            next->active = false;
+        pthread_mutex_unlock(&timer_lock);
+        next->cb(next);
+        pthread_mutex_lock(&timer_lock);
+    }
+    return NULL;
+}
+
+/* called with timer_lock held */
+static void ghota_host_timer_thread_start(void)
+{
+    if (timer_task)
+        return;
+    timer_task = ghota_host_task_new();
+    pthread_t thread;
+    pthread_create(&thread, NULL, ghota_host_timer_main, NULL);
+    pthread_detach(thread);
+}
+
+TimerHandle_t xTimerCreate(
+    const char *name,
+    TickType_t period,
+    UBaseType_t reload,
+    void *id,
+    TimerCallbackFunction_t cb)
+{
+    struct ghota_host_timer *timer = calloc(1, sizeof(*timer));
+    timer->cb = cb;
+    timer->id = id;
+    timer->period = period;
+    timer->reload = reload;
+    pthread_mutex_lock(&timer_lock);
+    ghota_host_timer_thread_start();
+    timer->next = timers;
+    timers = timer;
+    pthread_mutex_unlock(&timer_lock);
+    return timer;
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t wait)
+{
+    pthread_mutex_lock(&timer_lock);
+    timer->period = period;
+    timer->expiry = ghota_host_time_us() + (int64_t)pdTICKS_TO_MS(period) * 1000;
+    timer->active = true;
+    pthread_cond_signal(&timer_changed);
+    pthread_mutex_unlock(&timer_lock);
+    return pdPASS;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t wait)
+{
+    return xTimerChangePeriod(timer, timer->period, wait);
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t wait)
+{
+    pthread_mutex_lock(&timer_lock);
+    timer->active = false;
+    pthread_cond_signal(&timer_changed);
+    pthread_mutex_unlock(&timer_lock);
+    return pdPASS;
+}
+
+BaseType_t xTimerDelete(TimerHandle_t timer, TickType_t wait)
+{
+    /* freed by the service thread, a running callback keeps its timer */
+    pthread_mutex_lock(&timer_lock);
+    timer->active = false;
+    timer->deleted = true;
+    pthread_cond_signal(&timer_changed);
+    pthread_mutex_unlock(&timer_lock);
+    return pdPASS;
+}
+
+void *pvTimerGetTimerID(TimerHandle_t timer)
+{
+    pthread_mutex_lock(&timer_lock);
+    void *id = timer->id;
+    pthread_mutex_unlock(&timer_lock);
+    return id;
+}
+
+void vTimerSetTimerID(TimerHandle_t timer, void *id)
+{
+    pthread_mutex_lock(&timer_lock);
+    timer->id = id;
+    pthread_mutex_unlock(&timer_lock);
+}
+
+BaseType_t xTimerPendFunctionCall(PendedFunction_t fn, void *param1, uint32_t param2, TickType_t wait)
+{
+    ghota_host_pended_t *call = calloc(1, sizeof(*call));
+    call->fn = fn;
+    call->param1 = param1;
+    call->param2 = param2;
+    pthread_mutex_lock(&timer_lock);
+    ghota_host_timer_thread_start();
+    ghota_host_pended_t **link = &pended;
+    while (*link)
+        link = &(*link)->next;
+    *link = call;
+    pthread_cond_signal(&timer_changed);
+    pthread_mutex_unlock(&timer_lock);
+    return pdPASS;
+}
+
+TaskHandle_t xTimerGetTimerDaemonTaskHandle(void)
+{
+    pthread_mutex_lock(&timer_lock);
+    struct ghota_host_task *task = timer_task;
+    pthread_mutex_unlock(&timer_lock);
+    return task;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return ghota_host_time_us();
+}
+
+/* system */
+
+static atomic_uint restarts;
+
+void esp_restart(void)
+{
+    atomic_fetch_add(&restarts, 1);
+    pthread_exit(NULL);
+}
+
+uint32_t ghota_host_restarts(void)
+{
+    return atomic_load(&restarts);
+}
+
+uint32_t esp_random(void)
+{
+    return (uint32_t)random();
+}
+
+esp_err_t esp_efuse_mac_get_default(uint8_t *mac)
+{
+    static const uint8_t host_mac[6] = {0x24, 0xa1, 0x60, 0x00, 0x00, 0x01};
+    memcpy(mac, host_mac, sizeof(host_mac));
+    return ESP_OK;
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    return crc32(crc, buf, len);
+}
+
+/* events */
+
+static atomic_uint event_counts[32];
+
+esp_err_t esp_event_post(
+    esp_event_base_t base,
+    int32_t id,
+    const void *data,
+    size_t size,
+    TickType_t wait)
+{
+    if (id > 0)
+        atomic_fetch_add(&event_counts[__builtin_ctz(id)], 1);
+    return ESP_OK;
+}
+
+uint32_t ghota_host_event_count(int32_t id)
+{
+    return id > 0 ? atomic_load(&event_counts[__builtin_ctz(id)]) : 0;
+}
+
+void ghota_host_events_reset(void)
+{
+    for (int i = 0; i < 32; i++)
+        atomic_store(&event_counts[i], 0);
+}
+
+/* flash */
+
+#define GHOTA_HOST_SECTOR 4096
+#define GHOTA_HOST_PARTITION_SIZE (1024 * 1024)
+
+static esp_partition_t partitions[] = {
+    {.type = ESP_PARTITION_TYPE_APP, .subtype = 0x10, .address = 0x10000, .size = GHOTA_HOST_PARTITION_SIZE, .erase_size = GHOTA_HOST_SECTOR, .label = "ota_0"},
+    {.type = ESP_PARTITION_TYPE_APP, .subtype = 0x11, .address = 0x110000, .size = GHOTA_HOST_PARTITION_SIZE, .erase_size = GHOTA_HOST_SECTOR, .label = "ota_1"},
+    {.type = ESP_PARTITION_TYPE_DATA, .subtype = 0x82, .address = 0x210000, .size = GHOTA_HOST_PARTITION_SIZE, .erase_size = GHOTA_HOST_SECTOR, .label = "storage"},
+};
+#define GHOTA_HOST_PARTITIONS (sizeof(partitions) / sizeof(partitions[0]))
+
+static uint8_t *flash[GHOTA_HOST_PARTITIONS];
+static pthread_mutex_t flash_lock = PTHREAD_MUTEX_INITIALIZER;
+static ghota_host_flash_stats_t flash_stats;
+static uint32_t erase_sector_us;
+static uint32_t write_call_us;
+static uint32_t write_kb_us;
+static const esp_partition_t *boot_partition = &partitions[0];
+static esp_app_desc_t app_desc = {
+    .magic_word = ESP_APP_DESC_MAGIC_WORD,
+    .project_name = "esp_ghota_host",
+    .version = "0.0.1",
+};
+static uint32_t efuse_secure_version;
+
+static int ghota_host_partition_index(const esp_partition_t *partition)
+{
+    for (size_t i = 0; i < GHOTA_HOST_PARTITIONS; i++)
+    {
+        if (partition == &partitions[i])
+            return i;
+    }
+    abort();
+}
+
+uint8_t *ghota_host_partition_data(const esp_partition_t *partition)
+{
+    int i = ghota_host_partition_index(partition);
+    pthread_mutex_lock(&flash_lock);
+    if (flash[i] == NULL)
+    {
+        flash[i] = malloc(partition->size);
+        memset(flash[i], 0xff, partition->size);
+    }
+    pthread_mutex_unlock(&flash_lock);
+    return flash[i];
+}
+
+void ghota_host_flash_reset(void)
+{
+    for (size_t i = 0; i < GHOTA_HOST_PARTITIONS; i++)
+        memset(ghota_host_partition_data(&partitions[i]), 0xff, partitions[i].size);
+    pthread_mutex_lock(&flash_lock);
+    memset(&flash_stats, 0, sizeof(flash_stats));
+    boot_partition = &partitions[0];
+    pthread_mutex_unlock(&flash_lock);
+}
+
+void ghota_host_flash_timing(uint32_t erase_us, uint32_t call_us, uint32_t write_us)
+{
+    erase_sector_us = erase_us;
+    write_call_us = call_us;
+    write_kb_us = write_us;
+}
+
+ghota_host_flash_stats_t ghota_host_flash_stats(void)
+{
+    pthread_mutex_lock(&flash_lock);
+    ghota_host_flash_stats_t stats = flash_stats;
+    pthread_mutex_unlock(&flash_lock);
+    return stats;
+}
+
+const esp_partition_t *ghota_host_partition(const char *label)
+{
+    for (size_t i = 0; i < GHOTA_HOST_PARTITIONS; i++)
+    {
+        if (strcmp(partitions[i].label, label) == 0)
+            return &partitions[i];
+    }
+    return NULL;
+}
+
+const esp_partition_t *esp_partition_find_first(
+    esp_partition_type_t type,
+    int subtype,
+    const char *label)
+{
+    for (size_t i = 0; i < GHOTA_HOST_PARTITIONS; i++)
+    {
+        if (partitions[i].type == type &&
+            (subtype == ESP_PARTITION_SUBTYPE_ANY || partitions[i].subtype == subtype) &&
+            (label == NULL || strcmp(partitions[i].label, label) == 0))
+            return &partitions[i];
+    }
+    return NULL;
+}
+
+esp_err_t esp_partition_read(
+    const esp_partition_t *partition,
+    size_t offset,
+    void *dst,
+    size_t size)
+{
+    if (offset + size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+    uint8_t *data = ghota_host_partition_data(partition);
+    pthread_mutex_lock(&flash_lock);
+    flash_stats.reads++;
+    memcpy(dst, &data[offset], size);
+    pthread_mutex_unlock(&flash_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(
+    const esp_partition_t *partition,
+    size_t offset,
+    const void *src,
+    size_t size)
+{
+    if (offset + size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+    uint8_t *data = ghota_host_partition_data(partition);
+    const uint8_t *bytes = src;
+    pthread_mutex_lock(&flash_lock);
+    flash_stats.writes++;
+    flash_stats.write_bytes += size;
+    if (size > flash_stats.max_write)
+        flash_stats.max_write = size;
+    bool unerased = false;
+    for (size_t i = 0; i < size; i++)
+    {
+        /* NOR flash can only clear bits */
+        if ((data[offset + i] & bytes[i]) != bytes[i])
+            unerased = true;
+        data[offset + i] &= bytes[i];
+    }
+    if (unerased)
+        flash_stats.unerased++;
+    pthread_mutex_unlock(&flash_lock);
+    ghota_host_sleep_us(write_call_us + (int64_t)write_kb_us * size / 1024);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(
+    const esp_partition_t *partition,
+    size_t offset,
+    size_t size)
+{
+    if (offset % GHOTA_HOST_SECTOR || size % GHOTA_HOST_SECTOR)
+        return ESP_ERR_INVALID_ARG;
+    if (offset + size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+    uint8_t *data = ghota_host_partition_data(partition);
+    pthread_mutex_lock(&flash_lock);
+    flash_stats.erases++;
+    flash_stats.erase_bytes += size;
+    memset(&data[offset], 0xff, size);
+    pthread_mutex_unlock(&flash_lock);
+    ghota_host_sleep_us((int64_t)erase_sector_us * (size / GHOTA_HOST_SECTOR));
+    return ESP_OK;
+}
+
+/* app images */
+
+void ghota_host_set_app(const char *project_name, const char *version, uint32_t secure_version)
+{
+    strncpy(app_desc.project_name, project_name, sizeof(app_desc.project_name) - 1);
+    strncpy(app_desc.version, version, sizeof(app_desc.version) - 1);
+    app_desc.secure_version = secure_version;
+}
+
+void ghota_host_set_secure_version(uint32_t secure_version)
+{
+    efuse_secure_version = secure_version;
+}
+
+const esp_partition_t *ghota_host_boot_partition(void)
+{
+    pthread_mutex_lock(&flash_lock);
+    const esp_partition_t *partition = boot_partition;
+    pthread_mutex_unlock(&flash_lock);
+    return partition;
+}
+
+const esp_app_desc_t *esp_app_get_description(void)
+{
+    return &app_desc;
+}
+
+const esp_partition_t *esp_ota_get_running_partition(void)
+{
+    return &partitions[0];
+}
+
+const esp_partition_t *esp_ota_get_boot_partition(void)
+{
+    return ghota_host_boot_partition();
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from)
+{
+    return &partitions[1];
+}
+
+esp_err_t esp_ota_get_partition_description(
+    const esp_partition_t *partition,
+    esp_app_desc_t *desc)
+{
+    esp_err_t err = esp_partition_read(
+        partition,
+        sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t),
+        desc,
+        sizeof(*desc));
+    if (err == ESP_OK && desc->magic_word != ESP_APP_DESC_MAGIC_WORD)
+        return ESP_ERR_NOT_FOUND;
+    return err;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition)
+{
+    /* the bootloader checks the image magic and the app description */
+    esp_app_desc_t desc;
+    if (ghota_host_partition_data(partition)[0] != 0xe9 ||
+        esp_ota_get_partition_description(partition, &desc) != ESP_OK)
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    pthread_mutex_lock(&flash_lock);
+    boot_partition = partition;
+    pthread_mutex_unlock(&flash_lock);
+    return ESP_OK;
+}
+
+uint32_t esp_efuse_read_secure_version(void)
+{
+    return efuse_secure_version;
+}
+
+bool esp_efuse_check_secure_version(uint32_t secure_version)
+{
+    return secure_version >= efuse_secure_version;
+}
+
+/* NVS, in RAM */
+
+typedef struct ghota_host_nvs_entry
+{
+    char name[16];
+    char key[16];
+    void *value;
+    size_t len;
+    struct ghota_host_nvs_entry *next;
+} ghota_host_nvs_entry_t;
+
+static pthread_mutex_t nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+static ghota_host_nvs_entry_t *nvs_entries;
+static char nvs_names[16][16];
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *handle)
+{
+    pthread_mutex_lock(&nvs_lock);
+    for (nvs_handle_t i = 0; i < 16; i++)
+    {
+        if (nvs_names[i][0] == '\0')
+            strncpy(nvs_names[i], name, 15);
+        if (strcmp(nvs_names[i], name) == 0)
+        {
+            *handle = i;
+            pthread_mutex_unlock(&nvs_lock);
+            return ESP_OK;
+        }
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return ESP_ERR_NO_MEM;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+static ghota_host_nvs_entry_t **ghota_host_nvs_find(nvs_handle_t handle, const char *key)
+{
+    ghota_host_nvs_entry_t **link = &nvs_entries;
+    while (*link &&
+           (strcmp((*link)->name, nvs_names[handle]) || strcmp((*link)->key, key)))
+        link = &(*link)->next;
+    return link;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value, size_t *len)
+{
+    pthread_mutex_lock(&nvs_lock);
+    ghota_host_nvs_entry_t *entry = *ghota_host_nvs_find(handle, key);
+    esp_err_t err = ESP_ERR_NVS_NOT_FOUND;
+    if (entry && value && *len < entry->len)
+    {
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    else if (entry)
+    {
+        if (value)
+            memcpy(value, entry->value, entry->len);
+        *len = entry->len;
+        err = ESP_OK;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return err;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t len)
+{
+    pthread_mutex_lock(&nvs_lock);
+    ghota_host_nvs_entry_t **link = ghota_host_nvs_find(handle, key);
+    if (*link == NULL)
+    {
+        *link = calloc(1, sizeof(ghota_host_nvs_entry_t));
+        strncpy((*link)->name, nvs_names[handle], 15);
+        strncpy((*link)->key, key, 15);
+    }
+    free((*link)->value);
+    (*link)->value = malloc(len);
+    memcpy((*link)->value, value, len);
+    (*link)->len = len;
+    pthread_mutex_unlock(&nvs_lock);
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    pthread_mutex_lock(&nvs_lock);
+    ghota_host_nvs_entry_t **link = ghota_host_nvs_find(handle, key);
+    ghota_host_nvs_entry_t *entry = *link;
+    if (entry)
+    {
+        *link = entry->next;
+        free(entry->value);
+        free(entry);
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return entry ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return ESP_OK;
+}
+
+/* SHA-256 */
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(mbedtls_sha256_context *ctx, const uint8_t *p)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t)p[i * 4] << 24 | p[i * 4 + 1] << 16 | p[i * 4 + 2] << 8 | p[i * 4 + 3];
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t s[8];
+    memcpy(s, ctx->state, sizeof(s));
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t t1 = s[7] + (ROR(s[4], 6) ^ ROR(s[4], 11) ^ ROR(s[4], 25)) +
+                      ((s[4] & s[5]) ^ (~s[4] & s[6])) + sha256_k[i] + w[i];
+        uint32_t t2 = (ROR(s[0], 2) ^ ROR(s[0], 13) ^ ROR(s[0], 22)) +
+                      ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+        memmove(&s[1], &s[0], 7 * sizeof(uint32_t));
+        s[4] += t1;
+        s[0] = t1 + t2;
+    }
+    for (int i = 0; i < 8; i++)
+        ctx->state[i] += s[i];
+}
+
+void mbedtls_sha256_init(mbedtls_sha256_context *ctx)
+{
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+void mbedtls_sha256_free(mbedtls_sha256_context *ctx)
+{
+}
+
+int mbedtls_sha256_starts(mbedtls_sha256_context *ctx, int is224)
+{
+    static const uint32_t init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(ctx->state, init, sizeof(init));
+    ctx->total = 0;
+    return 0;
+}
+
+int mbedtls_sha256_update(mbedtls_sha256_context *ctx, const unsigned char *input, size_t len)
+{
+    while (len)
+    {
+        size_t used = ctx->total % 64;
+        size_t n = 64 - used < len ? 64 - used : len;
+        memcpy(&ctx->buf[used], input, n);
+        ctx->total += n;
+        input += n;
+        len -= n;
+        if (ctx->total % 64 == 0)
+            sha256_block(ctx, ctx->buf);
+    }
+    return 0;
+}
+
+int mbedtls_sha256_finish(mbedtls_sha256_context *ctx, unsigned char output[32])
+{
+    uint64_t bits = ctx->total * 8;
+    uint8_t pad[72] = {0x80};
+    size_t padlen = (ctx->total % 64 < 56 ? 56 : 120) - ctx->total % 64;
+    for (int i = 0; i < 8; i++)
+        pad[padlen + i] = bits >> (56 - i * 8);
+    mbedtls_sha256_update(ctx, pad, padlen + 8);
+    for (int i = 0; i < 8; i++)
+    {
+        output[i * 4] = ctx->state[i] >> 24;
+        output[i * 4 + 1] = ctx->state[i] >> 16;
+        output[i * 4 + 2] = ctx->state[i] >> 8;
+        output[i * 4 + 3] = ctx->state[i];
+    }
+    return 0;
+}
+
+void ghota_host_sha256(const void *data, size_t len, uint8_t digest[32])
+{
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts(&ctx, 0);
+    mbedtls_sha256_update(&ctx, data, len);
+    mbedtls_sha256_finish(&ctx, digest);
+}
+
+void ghota_host_sha256_hex(const void *data, size_t len, char hex[65])
+{
+    uint8_t digest[32];
+    ghota_host_sha256(data, len, digest);
+    for (int i = 0; i < 32; i++)
+        snprintf(&hex[i * 2], 3, "%02x", digest[i]);
+}
+
+size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t len = strlen(src);
+    if (size)
+    {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
@@ -0,0 +1,8 @@
+/* what the newlib headers of ESP-IDF declare and glibc may not, included before every source */
+#pragma once
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+size_t strlcpy(char *dst, const char *src, size_t size);
@@ -0,0 +1,61 @@
+/* the tinfl interface of the ROM miniz, on zlib */
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+
+#define TINFL_LZ_DICT_SIZE 32768
+#define TINFL_FLAG_HAS_MORE_INPUT 2
+
+typedef enum
+{
+    TINFL_STATUS_FAILED = -1,
+    TINFL_STATUS_DONE = 0,
+    TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+    TINFL_STATUS_HAS_MORE_OUTPUT = 2,
+} tinfl_status;
+
+typedef struct
+{
+    z_stream z;
+    int init;
+} tinfl_decompressor;
+
+#define tinfl_init(r) ((r)->init = 0)
+
+static inline tinfl_status tinfl_decompress(
+    tinfl_decompressor *r,
+    const uint8_t *in,
+    size_t *in_size,
+    uint8_t *start,
+    uint8_t *next,
+    size_t *out_size,
+    uint32_t flags)
+{
+    (void)start;
+    (void)flags;
+    if (!r->init)
+    {
+        memset(&r->z, 0, sizeof(r->z));
+        inflateInit2(&r->z, -15);
+        r->init = 1;
+    }
+    r->z.next_in = (Bytef *)in;
+    r->z.avail_in = *in_size;
+    r->z.next_out = next;
+    r->z.avail_out = *out_size;
+    int ret = inflate(&r->z, Z_NO_FLUSH);
+    *in_size -= r->z.avail_in;
+    *out_size -= r->z.avail_out;
+    if (ret == Z_STREAM_END)
+    {
+        inflateEnd(&r->z);
+        return TINFL_STATUS_DONE;
+    }
+    if (ret != Z_OK && ret != Z_BUF_ERROR)
+    {
+        inflateEnd(&r->z);
+        return TINFL_STATUS_FAILED;
+    }
+    return r->z.avail_out == 0 ? TINFL_STATUS_HAS_MORE_OUTPUT : TINFL_STATUS_NEEDS_MORE_INPUT;
+}
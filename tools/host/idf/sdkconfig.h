@@ -0,0 +1,37 @@
+/* host build configuration, the boolean options and those that differ between programs are set by the Makefile */
+#pragma once
+
+#define CONFIG_IDF_TARGET "linux"
+#define CONFIG_FREERTOS_UNICORE 0
+#define CONFIG_MAX_FILENAME_LEN 64
+#define CONFIG_MAX_URL_LEN 128
+#define CONFIG_GITHUB_HOSTNAME "api.github.com"
+#define CONFIG_GITHUB_OWNER "Fishwaldo"
+#define CONFIG_GITHUB_REPO "esp_ghota"
+#define CONFIG_GHOTA_MANIFEST_URL ""
+#define CONFIG_GHOTA_MANIFEST_VARIANT ""
+#define CONFIG_GHOTA_BACKOFF_MIN 60
+#define CONFIG_GHOTA_BACKOFF_MAX 3600
+#define CONFIG_GHOTA_RATE_LIMIT_RESERVE 10
+#define CONFIG_GHOTA_PROBE_URL "https://{host}/{org}/{repo}/releases/latest"
+#define CONFIG_GHOTA_GRAPHQL_MAX_ASSETS 20
+#define CONFIG_GHOTA_HEATSHRINK_WINDOW 10
+#define CONFIG_GHOTA_HEATSHRINK_LOOKAHEAD 4
+#ifndef CONFIG_GHOTA_ERASE_AHEAD
+#define CONFIG_GHOTA_ERASE_AHEAD 0
+#endif
+#ifndef CONFIG_GHOTA_JOURNAL_INTERVAL
+#define CONFIG_GHOTA_JOURNAL_INTERVAL 64
+#endif
+#ifdef CONFIG_GHOTA_FLEET_JITTER
+#define CONFIG_GHOTA_DOWNLOAD_WINDOW 600
+#endif
+#ifdef CONFIG_GHOTA_PIPELINE
+#ifndef CONFIG_GHOTA_PIPELINE_DEPTH
+#define CONFIG_GHOTA_PIPELINE_DEPTH 4
+#endif
+#ifndef CONFIG_GHOTA_PIPELINE_BUF_SIZE
+#define CONFIG_GHOTA_PIPELINE_BUF_SIZE 4096
+#endif
+#define CONFIG_GHOTA_PIPELINE_WRITER_CORE 0
+#endif
@@ -0,0 +1,82 @@
+/* the wait of a download the update timer found
+ *
+ * With CONFIG_GHOTA_FLEET_JITTER the update timer does not download a new
+ * release at once. The handle is idle during the wait, so it can be used and
+ * freed, and the timer checks the release again before it downloads.
+ */
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include "esp_log.h"
+#include "common.h"
+
+#define WINDOW 4
+
+static atomic_uint waits;
+
+/* counts the waits in the info log, keeps errors */
+static int test_log(const char *fmt, va_list args)
+{
+    char line[256];
+    vsnprintf(line, sizeof(line), fmt, args);
+    if (strstr(line, "Starting download in"))
+        atomic_fetch_add(&waits, 1);
+    else if (line[0] == 'E')
+        fputs(line, stderr);
+    return 0;
+}
+
+static bool test_wait_events(int32_t id, uint32_t count, uint32_t timeout_ms)
+{
+    for (uint32_t waited = 0; ghota_host_event_count(id) < count; waited++)
+    {
+        if (waited >= timeout_ms)
+            return false;
+        usleep(1000);
+    }
+    return true;
+}
+
+int main(void)
+{
+    ghota_host_log_level = 3;
+    esp_log_set_vprintf(test_log);
+
+    size_t len = 16 * 1024;
+    uint8_t *firmware = test_make_image(len, "esp_ghota", "0.0.2", 0, 3);
+    const test_asset_t assets[] = {
+        {.name = "esp_ghota.bin", .data = firmware, .len = len, .id = 1},
+    };
+    ghota_host_flash_reset();
+    ghota_host_set_app("esp_ghota", "0.0.1", 0);
+    ghota_host_http_reset();
+    test_serve_release("esp_ghota", "0.0.2", "", assets, 1);
+
+    ghota_config_t config = {
+        .filenamematch = "esp_ghota.bin",
+        .updateIntervalSeconds = 3600,
+        .downloadWindow = WINDOW,
+    };
+    ghota_client_handle_t *handle = ghota_init(&config);
+    CHECK(handle != NULL);
+    CHECK(ghota_start_update_timer(handle) == ESP_OK);
+    CHECK(ghota_reschedule_update_timer(handle, 0) == ESP_OK);
+
+    /* the check finds the release and leaves the handle idle until the download */
+    CHECK(test_wait_events(GHOTA_EVENT_UPDATE_AVAILABLE, 1, 5000));
+    CHECK(test_wait_idle(handle, 5000));
+    CHECK(atomic_load(&waits) == 1);
+    CHECK(ghota_host_restarts() == 0);
+    CHECK(ghota_set_auth(handle, "user", "token") == ESP_OK);
+    printf("waiting for the download: handle idle\n");
+
+    /* the timer checks again at the end of the wait and downloads without another one */
+    CHECK(test_wait_restarts(1, (WINDOW + 5) * 1000));
+    CHECK(ghota_host_event_count(GHOTA_EVENT_UPDATE_AVAILABLE) == 2);
+    CHECK(atomic_load(&waits) == 1);
+    CHECK(memcmp(ghota_host_partition_data(ghota_host_partition("ota_1")), firmware, len) == 0);
+    printf("checked again and downloaded after the wait\n");
+
+    printf("ok\n");
+    return 0;
+}
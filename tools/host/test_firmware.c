@@ -0,0 +1,157 @@
+/* the checks a firmware image passes before the device boots it
+ *
+ * An image below the secure version in eFuse is refused before the boot
+ * partition changes, the running firmware stays the boot firmware. An image
+ * rebuilt from a delta patch or resumed from an earlier run gets the same
+ * checks as a downloaded one.
+ */
+#include <string.h>
+#include "esp_app_format.h"
+#include "esp_ghota_patch.h"
+#include "esp_ghota_writer.h"
+#include "common.h"
+
+#define DESC_OFFSET (sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t))
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = v >> (8 * i);
+}
+
+/* a patch that inserts the first head bytes of target and copies the rest from source */
+static uint8_t *make_patch(size_t source_len, const uint8_t *target, size_t len, size_t head, size_t *patch_len)
+{
+    uint8_t *patch = malloc(44 + 5 + head + 9 + 1);
+    uint8_t *p = patch;
+    memcpy(p, GHOTA_PATCH_MAGIC, 4);
+    put_u32(p + 4, source_len);
+    put_u32(p + 8, len);
+    ghota_host_sha256(target, len, p + 12);
+    p += 44;
+    *p = 0x02;
+    put_u32(p + 1, head);
+    memcpy(p + 5, target, head);
+    p += 5 + head;
+    *p = 0x01;
+    put_u32(p + 1, head);
+    put_u32(p + 5, len - head);
+    p += 9;
+    *p++ = 0x00;
+    *patch_len = p - patch;
+    return patch;
+}
+
+/* the running 0.0.1 image and a 0.0.2 release below the eFuse secure version, as a patch and a full image */
+static ghota_client_handle_t *test_patch_release(void)
+{
+    size_t len = 64 * 1024 + 17;
+    uint8_t *running = test_make_image(len, "esp_ghota", "0.0.1", 2, 20);
+    memcpy(ghota_host_partition_data(ghota_host_partition("ota_0")), running, len);
+
+    uint8_t *revoked = malloc(len);
+    memcpy(revoked, running, len);
+    esp_app_desc_t *desc = (esp_app_desc_t *)(revoked + DESC_OFFSET);
+    strlcpy(desc->version, "0.0.2", sizeof(desc->version));
+    desc->secure_version = 1;
+    size_t patch_len;
+    uint8_t *patch = make_patch(len, revoked, len, 512, &patch_len);
+
+    const test_asset_t assets[] = {
+        {.name = "esp_ghota-0.0.1-to-0.0.2.patch", .data = patch, .len = patch_len, .id = 1},
+        {.name = "esp_ghota.bin", .data = revoked, .len = len, .id = 2},
+    };
+    ghota_host_events_reset();
+    ghota_host_http_reset();
+    test_serve_release("esp_ghota", "0.0.2", "", assets, 2);
+
+    ghota_config_t config = {
+        .filenamematch = "esp_ghota.bin",
+        .patchnamematch = "esp_ghota-*.patch",
+    };
+    ghota_client_handle_t *handle = ghota_init(&config);
+    CHECK(handle != NULL);
+    return handle;
+}
+
+static ghota_client_handle_t *test_release(uint32_t secure_version, const uint8_t **image, size_t *image_len)
+{
+    static int release;
+    size_t len = 64 * 1024 + 17;
+    uint8_t *firmware = test_make_image(len, "esp_ghota", "0.0.2", secure_version, 10 + release++);
+    const test_asset_t assets[] = {
+        {.name = "esp_ghota.bin", .data = firmware, .len = len, .id = 1},
+    };
+    ghota_host_flash_reset();
+    ghota_host_events_reset();
+    ghota_host_http_reset();
+    test_serve_release("esp_ghota", "0.0.2", "", assets, 1);
+    *image = firmware;
+    *image_len = len;
+
+    ghota_config_t config = {
+        .filenamematch = "esp_ghota.bin",
+    };
+    ghota_client_handle_t *handle = ghota_init(&config);
+    CHECK(handle != NULL);
+    return handle;
+}
+
+int main(void)
+{
+    const esp_partition_t *ota_0 = ghota_host_partition("ota_0");
+    const esp_partition_t *ota_1 = ghota_host_partition("ota_1");
+    const uint8_t *image = NULL;
+    size_t len = 0;
+    ghota_host_set_app("esp_ghota", "0.0.1", 2);
+    ghota_host_set_secure_version(2);
+
+    /* a release that would roll the device back to a revoked version */
+    ghota_client_handle_t *handle = test_release(1, &image, &len);
+    CHECK(ghota_start_update_task(handle) == ESP_OK);
+    CHECK(test_wait_idle(handle, 10000));
+    CHECK(ghota_host_restarts() == 0);
+    CHECK(ghota_host_boot_partition() == ota_0);
+    CHECK(ghota_host_event_count(GHOTA_EVENT_UPDATE_FAILED) == 1);
+    CHECK(ghota_host_event_count(GHOTA_EVENT_FINISH_UPDATE) == 0);
+    CHECK(ghota_free(handle) == ESP_OK);
+    printf("secure version 1 below eFuse 2: refused\n");
+
+    /* an earlier run wrote most of the image while eFuse allowed it, the resumed download
+    checks the header in flash */
+    handle = test_release(1, &image, &len);
+    ghota_writer_t *writer = ghota_writer_open(ota_1, API_URL "esp_ghota/releases/assets/1", len);
+    CHECK(writer != NULL);
+    CHECK(ghota_writer_begin(writer, 0, "\"asset\"") == ESP_OK);
+    CHECK(ghota_writer_write(writer, image, 64 * 1024) == ESP_OK);
+    ghota_writer_close(writer);
+    CHECK(ghota_start_update_task(handle) == ESP_OK);
+    CHECK(test_wait_idle(handle, 10000));
+    CHECK(ghota_host_http_stats().read_bytes < len);
+    CHECK(ghota_host_restarts() == 0);
+    CHECK(ghota_host_boot_partition() == ota_0);
+    CHECK(ghota_host_event_count(GHOTA_EVENT_UPDATE_FAILED) == 1);
+    CHECK(ghota_free(handle) == ESP_OK);
+    printf("resumed secure version 1 below eFuse 2: refused\n");
+
+    /* the same secure version installs */
+    handle = test_release(2, &image, &len);
+    CHECK(ghota_start_update_task(handle) == ESP_OK);
+    CHECK(test_wait_restarts(1, 10000));
+    CHECK(ghota_host_boot_partition() == ota_1);
+    CHECK(memcmp(ghota_host_partition_data(ota_1), image, len) == 0);
+    printf("secure version 2: installed\n");
+
+    /* the patch rebuilds the image with a matching digest, and is refused like the full image */
+    ghota_host_flash_reset();
+    handle = test_patch_release();
+    CHECK(ghota_start_update_task(handle) == ESP_OK);
+    CHECK(test_wait_idle(handle, 10000));
+    CHECK(ghota_host_restarts() == 1);
+    CHECK(ghota_host_boot_partition() == ota_0);
+    CHECK(ghota_host_event_count(GHOTA_EVENT_UPDATE_FAILED) == 1);
+    printf("patch to secure version 1: refused\n");
+
+    printf("ok\n");
+    return 0;
+}
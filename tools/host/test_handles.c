@@ -0,0 +1,161 @@
+/* several handles used from several tasks at once
+ *
+ * Each handle has its own update timer, an update task started by hand and
+ * threads that check and read its phase. Every handle runs one operation at a
+ * time, and ghota_free waits for a busy handle instead of freeing it under a
+ * running check or timer callback, and of the tasks that start its timer at
+ * once one gets it. Built with -fsanitize=thread by make tsan.
+ */
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include "esp_log.h"
+#include "common.h"
+
+#define HANDLES 4
+#define CHECKERS 2
+#define RUN_MS 3000
+
+static ghota_client_handle_t *handles[HANDLES];
+static atomic_bool running = true;
+static atomic_uint checks;
+
+static void *checker(void *arg)
+{
+    while (atomic_load(&running))
+    {
+        for (int i = 0; i < HANDLES; i++)
+        {
+            if (ghota_check(handles[i]) == ESP_OK)
+                atomic_fetch_add(&checks, 1);
+            CHECK(ghota_get_phase(handles[i]) <= GHOTA_PHASE_PENDING_REBOOT);
+        }
+    }
+    return NULL;
+}
+
+#define STARTERS 4
+#define START_ROUNDS 2000
+
+static pthread_barrier_t start_barrier;
+static atomic_uint timers_started;
+
+static void *timer_starter(void *arg)
+{
+    pthread_barrier_wait(&start_barrier);
+    esp_err_t err = ghota_start_update_timer(arg);
+    CHECK(err == ESP_OK || err == ESP_ERR_INVALID_STATE);
+    if (err == ESP_OK)
+        atomic_fetch_add(&timers_started, 1);
+    return NULL;
+}
+
+/* tasks that start the timer of one handle at once get one timer between them */
+static void test_timer_starts(void)
+{
+    ghota_config_t config = {
+        .filenamematch = "esp_ghota.bin",
+        .orgname = "Fishwaldo",
+        .reponame = "repo0",
+        .updateIntervalSeconds = 3600,
+    };
+    for (int round = 0; round < START_ROUNDS; round++)
+    {
+        ghota_client_handle_t *handle = ghota_init(&config);
+        CHECK(handle != NULL);
+        atomic_store(&timers_started, 0);
+        pthread_t threads[STARTERS];
+        CHECK(pthread_barrier_init(&start_barrier, NULL, STARTERS) == 0);
+        for (int i = 0; i < STARTERS; i++)
+            CHECK(pthread_create(&threads[i], NULL, timer_starter, handle) == 0);
+        for (int i = 0; i < STARTERS; i++)
+            pthread_join(threads[i], NULL);
+        pthread_barrier_destroy(&start_barrier);
+        CHECK(atomic_load(&timers_started) == 1);
+        CHECK(ghota_stop_update_timer(handle) == ESP_OK);
+        CHECK(ghota_stop_update_timer(handle) == ESP_ERR_INVALID_STATE);
+        CHECK(ghota_free(handle) == ESP_OK);
+    }
+    printf("%d rounds of %d tasks starting one timer: one timer each\n", START_ROUNDS, STARTERS);
+}
+
+int main(void)
+{
+    /* the busy handles refuse most calls, and log an error for each */
+    if (getenv("GHOTA_HOST_LOG") == NULL)
+        ghota_host_log_level = -1;
+    size_t firmware_len = 4096;
+    uint8_t *firmware = test_make_image(firmware_len, "esp_ghota", "0.0.1", 0, 1);
+    const test_asset_t assets[] = {
+        {.name = "esp_ghota.bin", .data = firmware, .len = firmware_len, .id = 1},
+    };
+
+    ghota_host_flash_reset();
+    ghota_host_set_app("esp_ghota", "0.0.1", 0);
+    ghota_host_http_reset();
+    for (int i = 0; i < HANDLES; i++)
+    {
+        char repo[16];
+        snprintf(repo, sizeof(repo), "repo%d", i);
+        test_serve_release(repo, "0.0.1", "", assets, 1);
+
+        ghota_config_t config = {
+            .filenamematch = "esp_ghota.bin",
+            .orgname = "Fishwaldo",
+            .reponame = repo,
+            .updateIntervalSeconds = 1,
+        };
+        handles[i] = ghota_init(&config);
+        CHECK(handles[i] != NULL);
+        CHECK(ghota_start_update_timer(handles[i]) == ESP_OK);
+    }
+
+    pthread_t threads[CHECKERS];
+    for (int i = 0; i < CHECKERS; i++)
+        CHECK(pthread_create(&threads[i], NULL, checker, NULL) == 0);
+
+    /* the update tasks and the credentials race with the checks and the timers */
+    uint32_t started = 0;
+    int64_t end = ghota_host_time_us() + RUN_MS * 1000;
+    while (ghota_host_time_us() < end)
+    {
+        for (int i = 0; i < HANDLES; i++)
+        {
+            if (ghota_start_update_task(handles[i]) == ESP_OK)
+                started++;
+            ghota_set_auth(handles[i], "user", "token");
+            CHECK(ghota_get_phase(handles[i]) <= GHOTA_PHASE_PENDING_REBOOT);
+        }
+        usleep(1000);
+    }
+    atomic_store(&running, false);
+    for (int i = 0; i < CHECKERS; i++)
+        pthread_join(threads[i], NULL);
+
+    /* the timers keep firing while the handles are freed */
+    for (int i = 0; i < HANDLES; i++)
+    {
+        esp_err_t err;
+        for (int waited = 0; (err = ghota_free(handles[i])) == ESP_ERR_INVALID_STATE; waited++)
+        {
+            CHECK(waited < 10000);
+            usleep(1000);
+        }
+        CHECK(err == ESP_OK);
+    }
+    /* a timer that fired during ghota_free finds no handle */
+    usleep(1500 * 1000);
+
+    uint32_t noupdate = ghota_host_event_count(GHOTA_EVENT_NOUPDATE_AVAILABLE);
+    printf("%u checks, %" PRIu32 " update tasks, %" PRIu32 " no update events\n",
+           atomic_load(&checks), started, noupdate);
+    CHECK(atomic_load(&checks) > 0);
+    CHECK(started > 0);
+    CHECK(noupdate >= started);
+
+    test_timer_starts();
+
+    printf("ok\n");
+    return 0;
+}
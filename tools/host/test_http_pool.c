@@ -0,0 +1,184 @@
+/* the connections of a check and an update of firmware and storage
+ *
+ * The release info and both assets come from api.github.com, the assets
+ * redirect to a CDN. Each host costs one TLS handshake for the whole update,
+ * and the credentials for the API never reach the CDN. Checks that close their
+ * connections resume the TLS session of each host on the next check. A 403
+ * counts as a rate limit only from the API.
+ */
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include "interface/ghota_http_pool.h"
+#include "common.h"
+
+#define CDN "objects.githubusercontent.com"
+
+/* the probe, the API and the CDN, in two checks that each end with
+ghota_http_pool_disconnect like the update task */
+static void test_periodic_checks(ghota_client_handle_t *handle)
+{
+    static const char *urls[] = {
+        "https://github.com/Fishwaldo/esp_ghota/releases/latest",
+        API_URL "esp_ghota/releases/latest",
+        "https://" CDN "/1?sig=1",
+        API_URL "esp_ghota/releases/latest",
+    };
+    for (int i = 0; i < 3; i++)
+    {
+        ghota_host_http_add(&(ghota_host_response_t){
+            .url = urls[i], .status = 200, .body = "{}", .body_len = 2});
+    }
+
+    ghota_http_pool_t *pool = ghota_http_pool_create(handle);
+    CHECK(pool != NULL);
+    for (int check = 0; check < 2; check++)
+    {
+        ghota_host_http_stats_reset();
+        for (int i = 0; i < 4; i++)
+        {
+            ghota_http_request_t request = {.url = urls[i], .authenticate = i == 1};
+            esp_http_client_handle_t client;
+            int status;
+            CHECK(ghota_http_pool_open(pool, &request, &client, &status) == ESP_OK);
+            CHECK(status == 200);
+            char body[8];
+            CHECK(esp_http_client_read(client, body, sizeof(body)) == 2);
+            ghota_http_pool_release(pool, client);
+        }
+        ghota_http_pool_disconnect(pool);
+
+        ghota_host_http_stats_t server = ghota_host_http_stats();
+        printf("check %d: handshakes %" PRIu32 " (%" PRIu32 " resumed), stale tickets %" PRIu32 "\n",
+               check + 1, server.connects, server.resumed, server.stale);
+        CHECK(server.connects == 3);
+        CHECK(server.resumed == (check ? 3 : 0));
+        CHECK(server.stale == 0);
+    }
+    ghota_http_pool_destroy(pool);
+}
+
+/* a 403 is a rate limit only from the API, with the limit of that response */
+static void test_rate_limits(ghota_client_handle_t *handle)
+{
+    char date[64];
+    time_t later = time(NULL) + 120;
+    strftime(date, sizeof(date), "Retry-After: %a, %d %b %Y %H:%M:%S GMT", gmtime(&later));
+    ghota_host_http_reset();
+    ghota_host_http_add(&(ghota_host_response_t){
+        .url = API_URL "esp_ghota/releases/latest", .status = 200, .body = "{}", .body_len = 2,
+        .headers = {"x-ratelimit-remaining: 0"}});
+    ghota_host_http_add(&(ghota_host_response_t){
+        .url = "https://github.com/Fishwaldo/esp_ghota/releases/latest", .status = 403});
+    ghota_host_http_add(&(ghota_host_response_t){
+        .url = API_URL "esp_ghota/releases/assets/1", .status = 302,
+        .location = "https://" CDN "/1?sig=1", .headers = {"x-ratelimit-remaining: 0"}});
+    ghota_host_http_add(&(ghota_host_response_t){
+        .url = "https://" CDN "/1?sig=1", .status = 403, .headers = {"Retry-After: 60"}});
+    ghota_host_http_add(&(ghota_host_response_t){
+        .url = API_URL "esp_ghota/releases/assets/2", .status = 429, .headers = {date}});
+    ghota_host_http_add(&(ghota_host_response_t){
+        .url = API_URL "esp_ghota/releases/assets/3", .status = 429,
+        .headers = {"Retry-After: tomorrow"}});
+
+    static const struct
+    {
+        const char *url;
+        int status;
+        bool limited;
+    } requests[] = {
+        /* the remaining 0 of this response does not stay with the next one */
+        {API_URL "esp_ghota/releases/latest", 200, false},
+        {"https://github.com/Fishwaldo/esp_ghota/releases/latest", 403, false},
+        /* an expired CDN link */
+        {API_URL "esp_ghota/releases/assets/1", 403, false},
+        {API_URL "esp_ghota/releases/assets/2", 429, true},
+        {API_URL "esp_ghota/releases/assets/3", 429, true},
+    };
+    ghota_http_pool_t *pool = ghota_http_pool_create(handle);
+    CHECK(pool != NULL);
+    for (size_t i = 0; i < sizeof(requests) / sizeof(requests[0]); i++)
+    {
+        ghota_rate_limit_t *rate_limit = ghota_client_get_rate_limit(handle);
+        rate_limit->limited = false;
+        ghota_http_request_t request = {.url = requests[i].url};
+        esp_http_client_handle_t client;
+        int status;
+        CHECK(ghota_http_pool_open(pool, &request, &client, &status) == ESP_OK);
+        CHECK(status == requests[i].status);
+        CHECK(rate_limit->limited == requests[i].limited);
+        ghota_http_pool_release(pool, client);
+        if (i == 3)
+        {
+            /* the HTTP-date form, give or take the time the request took */
+            printf("Retry-After %s: %" PRIu32 " s\n", date + 13, rate_limit->retry_after);
+            CHECK(rate_limit->retry_after > 100 && rate_limit->retry_after <= 120);
+        }
+        if (i == 4)
+            CHECK(rate_limit->retry_after == 0);
+    }
+    ghota_http_pool_destroy(pool);
+}
+
+int main(void)
+{
+    size_t firmware_len = 300 * 1024 + 123;
+    size_t storage_len = 128 * 1024;
+    uint8_t *firmware = test_make_image(firmware_len, "esp_ghota", "0.0.2", 0, 1);
+    uint8_t *storage = test_make_data(storage_len, 2);
+    const test_asset_t assets[] = {
+        {.name = "esp_ghota.bin", .data = firmware, .len = firmware_len, .id = 1, .cdn = CDN},
+        {.name = "storage.bin", .data = storage, .len = storage_len, .id = 2, .cdn = CDN},
+    };
+
+    ghota_host_flash_reset();
+    ghota_host_set_app("esp_ghota", "0.0.1", 0);
+    ghota_host_http_reset();
+    test_serve_release("esp_ghota", "0.0.2", "", assets, 2);
+
+    ghota_config_t config = {
+        .filenamematch = "esp_ghota.bin",
+        .storagenamematch = "storage.bin",
+        .storagepartitionname = "storage",
+        /* only an update the timer found waits for it */
+        .downloadWindow = GHOTA_DOWNLOAD_WINDOW_DEFAULT,
+    };
+    ghota_client_handle_t *handle = ghota_init(&config);
+    CHECK(handle != NULL);
+    CHECK(ghota_set_auth(handle, "user", "token") == ESP_OK);
+
+    CHECK(ghota_start_update_task(handle) == ESP_OK);
+    CHECK(test_wait_restarts(1, 10000));
+
+    const esp_partition_t *ota_1 = ghota_host_partition("ota_1");
+    const esp_partition_t *data = ghota_host_partition("storage");
+    CHECK(memcmp(ghota_host_partition_data(ota_1), firmware, firmware_len) == 0);
+    CHECK(memcmp(ghota_host_partition_data(data), storage, storage_len) == 0);
+    CHECK(ghota_host_boot_partition() == ota_1);
+    CHECK(ghota_host_event_count(GHOTA_EVENT_FINISH_UPDATE) == 1);
+    CHECK(ghota_host_event_count(GHOTA_EVENT_FINISH_STORAGE_UPDATE) == 1);
+
+    /* the release info, then the API url and the CDN url of each asset */
+    ghota_host_http_stats_t server = ghota_host_http_stats();
+    ghota_connection_stats_t client;
+    CHECK(ghota_get_connection_stats(handle, &client) == ESP_OK);
+    printf("requests %" PRIu32 ", handshakes %" PRIu32 " (%" PRIu32 " resumed), "
+           "stale tickets %" PRIu32 ", credentials elsewhere %" PRIu32 "\n",
+           server.requests, server.connects, server.resumed, server.stale, server.auth_elsewhere);
+    CHECK(server.requests == 5);
+    CHECK(server.connects == 2);
+    CHECK(client.requests == server.requests);
+    CHECK(client.handshakes == server.connects);
+    CHECK(server.auth_elsewhere == 0);
+
+    CHECK(client.offered == 0);
+
+    test_periodic_checks(handle);
+    /* the second check offered the ticket of each host, which the servers took */
+    CHECK(ghota_get_connection_stats(handle, &client) == ESP_OK);
+    CHECK(client.offered == 3);
+    test_rate_limits(handle);
+
+    printf("ok\n");
+    return 0;
+}
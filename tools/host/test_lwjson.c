@@ -0,0 +1,105 @@
+/* begin and end events of subscribed containers
+ *
+ * Every object or array on a subscribed path gets its end event on the same
+ * path as its begin event, whether it is the value of a key or an entry of
+ * an array, and fed byte by byte or in buffers.
+ */
+#include <string.h>
+#include "lwjson.h"
+#include "common.h"
+
+static const char *json =
+    "{\"foo\":{\"a\":1,\"b\":[1,{\"c\":2}]},\"skip\":{\"foo\":{}},"
+    "\"list\":[{\"x\":{\"y\":[]}},{\"x\":{}}],\"arr\":[],\"n\":{\"m\":{\"k\":{}}}}";
+
+static const char *exprs[] = {
+    "foo",
+    "foo.b",
+    "list[*]",
+    "list[*].x",
+    "arr",
+    "n.m",
+};
+#define PATHS (sizeof(exprs) / sizeof(exprs[0]))
+
+static const struct
+{
+    lwjson_stream_type_t begin;
+    lwjson_stream_type_t end;
+    int count;
+} expected[PATHS] = {
+    {LWJSON_STREAM_TYPE_OBJECT, LWJSON_STREAM_TYPE_OBJECT_END, 1},
+    {LWJSON_STREAM_TYPE_ARRAY, LWJSON_STREAM_TYPE_ARRAY_END, 1},
+    {LWJSON_STREAM_TYPE_OBJECT, LWJSON_STREAM_TYPE_OBJECT_END, 2},
+    {LWJSON_STREAM_TYPE_OBJECT, LWJSON_STREAM_TYPE_OBJECT_END, 2},
+    {LWJSON_STREAM_TYPE_ARRAY, LWJSON_STREAM_TYPE_ARRAY_END, 1},
+    {LWJSON_STREAM_TYPE_OBJECT, LWJSON_STREAM_TYPE_OBJECT_END, 1},
+};
+
+static int begins[PATHS];
+static int ends[PATHS];
+static int open[PATHS];
+
+static void test_event(lwjson_stream_parser_t *jsp, lwjson_stream_type_t type)
+{
+    size_t i = jsp->path_idx;
+    CHECK(i < PATHS);
+    if (type == expected[i].begin)
+    {
+        begins[i]++;
+        open[i]++;
+    }
+    else if (type == expected[i].end)
+    {
+        CHECK(open[i] > 0);
+        ends[i]++;
+        open[i]--;
+    }
+    else
+    {
+        /* only the containers themselves are on the paths */
+        CHECK(false);
+    }
+}
+
+static void test_parse(const lwjson_stream_path_t *paths, size_t chunk)
+{
+    lwjson_stream_parser_t jsp;
+    memset(begins, 0, sizeof(begins));
+    memset(ends, 0, sizeof(ends));
+    memset(open, 0, sizeof(open));
+    lwjson_stream_init(&jsp, test_event);
+    CHECK(lwjson_stream_set_paths(&jsp, paths, PATHS) == lwjsonOK);
+
+    size_t len = strlen(json);
+    lwjsonr_t res = lwjsonSTREAMINPROG;
+    for (size_t pos = 0; pos < len; pos += chunk)
+    {
+        if (chunk == 1)
+            res = lwjson_stream_parse(&jsp, json[pos]);
+        else
+            res = lwjson_stream_parse_buf(&jsp, json + pos, len - pos < chunk ? len - pos : chunk);
+    }
+    CHECK(res == lwjsonSTREAMDONE);
+    for (size_t i = 0; i < PATHS; i++)
+    {
+        CHECK(begins[i] == expected[i].count);
+        CHECK(ends[i] == expected[i].count);
+    }
+}
+
+int main(void)
+{
+    static lwjson_stream_path_t paths[PATHS];
+    for (size_t i = 0; i < PATHS; i++)
+        CHECK(lwjson_stream_path_compile(&paths[i], exprs[i]) == lwjsonOK);
+
+    test_parse(paths, 1);
+    printf("byte by byte: every begin has its end\n");
+    test_parse(paths, 7);
+    test_parse(paths, 4096);
+    printf("buffered: every begin has its end\n");
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,154 @@
+/* reading the rollout of a release
+ *
+ * The Github releases API lists the release notes after the assets. A
+ * "rollout-N" asset stages the release without reading the notes, the
+ * "rollout: N%" line in the notes needs CONFIG_GHOTA_ROLLOUT_NOTES and is
+ * found in any part of them. A manifest may put its rollout after the
+ * variants. A response that ends before the rollout is known updates no device.
+ */
+#include <inttypes.h>
+#include <string.h>
+#include "common.h"
+
+/* assets of other variants, which the Github API lists before the notes */
+#define OTHER_ASSETS 20
+#define NOTES_LEN 8192
+#define MANIFEST_URL "https://example.com/esp_ghota/manifest.json"
+
+static test_asset_t assets[2 + OTHER_ASSETS];
+
+/* release notes of filler bytes, then the line when given */
+static char *test_notes(size_t filler, const char *line)
+{
+    char *notes = malloc(filler + 64);
+    memset(notes, 'x', filler);
+    snprintf(notes + filler, 64, "%s", line ? line : "");
+    return notes;
+}
+
+/* runs ghota_check against what the server was given, returns the bytes read */
+static uint32_t test_check(const char *manifesturl)
+{
+    ghota_host_events_reset();
+    ghota_config_t config = {
+        .filenamematch = "esp_ghota.bin",
+        .variant = "esp32",
+    };
+    config.manifesturl = (char *)manifesturl;
+    ghota_client_handle_t *handle = ghota_init(&config);
+    CHECK(handle != NULL);
+    ghota_check(handle);
+    CHECK(ghota_free(handle) == ESP_OK);
+    return ghota_host_http_stats().read_bytes;
+}
+
+static void test_serve(const char *notes, size_t count)
+{
+    ghota_host_http_reset();
+    test_serve_release("esp_ghota", "0.0.2", notes, assets, count);
+}
+
+static bool test_updates(void)
+{
+    CHECK(ghota_host_event_count(GHOTA_EVENT_UPDATE_AVAILABLE) +
+              ghota_host_event_count(GHOTA_EVENT_NOUPDATE_AVAILABLE) <=
+          1);
+    return ghota_host_event_count(GHOTA_EVENT_UPDATE_AVAILABLE) == 1;
+}
+
+static void test_serve_manifest(const char *json)
+{
+    ghota_host_http_reset();
+    ghota_host_http_add(&(ghota_host_response_t){
+        .url = MANIFEST_URL, .status = 200, .body = json, .body_len = strlen(json)});
+}
+
+int main(void)
+{
+    size_t len = 4096;
+    uint8_t *firmware = test_make_image(len, "esp_ghota", "0.0.2", 0, 1);
+    assets[0] = (test_asset_t){.name = "esp_ghota.bin", .data = firmware, .len = len, .id = 1};
+    for (int i = 1; i <= OTHER_ASSETS; i++)
+    {
+        char *name = malloc(32);
+        snprintf(name, 32, "esp_ghota-variant%d.bin", i);
+        assets[i] = (test_asset_t){.name = name, .data = firmware, .len = len, .id = 1 + i};
+    }
+    /* an empty asset after all others stages the release */
+    assets[1 + OTHER_ASSETS] = (test_asset_t){.name = "rollout-0", .data = "", .len = 0, .id = 99};
+
+    ghota_host_flash_reset();
+    ghota_host_set_app("esp_ghota", "0.0.1", 0);
+
+    /* the marker is read with the assets, before the long notes */
+    char *notes = test_notes(NOTES_LEN, NULL);
+    test_serve(notes, 2 + OTHER_ASSETS);
+    uint32_t read = test_check(NULL);
+    printf("marker: read %" PRIu32 " bytes, %s\n", read, test_updates() ? "update" : "no update");
+    CHECK(!test_updates());
+    CHECK(ghota_host_event_count(GHOTA_EVENT_NOUPDATE_AVAILABLE) == 1);
+#ifndef CONFIG_GHOTA_ROLLOUT_NOTES
+    CHECK(read < NOTES_LEN);
+#endif
+
+    /* without a marker the release goes to all devices, unless the notes say otherwise */
+    test_serve(notes, 1 + OTHER_ASSETS);
+    read = test_check(NULL);
+    printf("no rollout: read %" PRIu32 " bytes, %s\n", read, test_updates() ? "update" : "no update");
+    CHECK(test_updates());
+#ifdef CONFIG_GHOTA_ROLLOUT_NOTES
+    CHECK(read > NOTES_LEN);
+#else
+    CHECK(read < NOTES_LEN);
+#endif
+    free(notes);
+
+    /* the line deep in the notes and across each possible split of the notes into parts */
+    static const size_t fillers[] = {0, 1000, NOTES_LEN};
+    for (size_t i = 0; i < sizeof(fillers) / sizeof(fillers[0]) + 40; i++)
+    {
+        size_t filler = i < 3 ? fillers[i] : 230 + i - 3;
+        notes = test_notes(filler, "\\nrollout: 0%\\nThanks");
+        test_serve(notes, 1 + OTHER_ASSETS);
+        test_check(NULL);
+#ifdef CONFIG_GHOTA_ROLLOUT_NOTES
+        CHECK(!test_updates());
+#else
+        CHECK(test_updates());
+#endif
+        free(notes);
+    }
+    printf("rollout line: found after up to %d bytes of notes\n", NOTES_LEN);
+
+    /* a response cut off after our asset must not count as a full rollout */
+    ghota_host_http_reset();
+    test_serve_release("esp_ghota", "0.0.2", "", assets, 2 + OTHER_ASSETS);
+    static const char *cut =
+        "{\"tag_name\":\"0.0.2\",\"assets\":[{\"url\":\"" API_URL "esp_ghota/releases/assets/1\","
+        "\"name\":\"esp_ghota.bin\",\"size\":4096},{\"name\":\"esp_ghota-variant1.bin\"";
+    ghota_host_http_add(&(ghota_host_response_t){
+        .url = API_URL "esp_ghota/releases/latest", .status = 200, .body = cut, .body_len = strlen(cut)});
+    test_check(NULL);
+    printf("cut off: %s\n", test_updates() ? "update" : "no update");
+    CHECK(!test_updates());
+
+    /* a manifest with its rollout after the variants */
+    test_serve_manifest(
+        "{\"version\":\"0.0.2\",\"variants\":[{\"name\":\"esp32\",\"assets\":["
+        "{\"name\":\"esp_ghota.bin\",\"url\":\"https://example.com/fw.bin\",\"size\":4096}]}],"
+        "\"rollout\":0}");
+    test_check(MANIFEST_URL);
+    printf("manifest rollout after the variants: %s\n", test_updates() ? "update" : "no update");
+    CHECK(!test_updates());
+    CHECK(ghota_host_event_count(GHOTA_EVENT_NOUPDATE_AVAILABLE) == 1);
+
+    test_serve_manifest(
+        "{\"version\":\"0.0.2\",\"variants\":[{\"name\":\"esp32\",\"assets\":["
+        "{\"name\":\"esp_ghota.bin\",\"url\":\"https://example.com/fw.bin\",\"size\":4096}]}]}");
+    test_check(MANIFEST_URL);
+    printf("manifest without a rollout: %s\n", test_updates() ? "update" : "no update");
+    CHECK(test_updates());
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,50 @@
+/* erasing ahead of the write position
+ *
+ * With CONFIG_GHOTA_ERASE_AHEAD, every write leaves the sectors up to its end
+ * and the look-ahead beyond erased, also when one chunk spans several sectors
+ * like the 16 KB buffers of the pipeline.
+ */
+#include <inttypes.h>
+#include <string.h>
+#include "esp_ghota_writer.h"
+#include "common.h"
+
+#define SECTOR 4096
+#define AHEAD (CONFIG_GHOTA_ERASE_AHEAD * SECTOR)
+
+int main(void)
+{
+    static const size_t chunks[] = {16384, 100, 5000, 16384, 12288, 1, 16383, 16384};
+    size_t len = 0;
+    for (int i = 0; i < 8; i++)
+        len += chunks[i];
+    uint8_t *data = test_make_data(len, 3);
+
+    ghota_host_flash_reset();
+    const esp_partition_t *partition = ghota_host_partition("ota_1");
+    ghota_writer_t *writer = ghota_writer_open(partition, "https://example.com/fw.bin", len);
+    CHECK(writer != NULL);
+    ghota_writer_set_journal(writer, false);
+    CHECK(ghota_writer_begin(writer, 0, NULL) == ESP_OK);
+
+    size_t offset = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        CHECK(ghota_writer_write(writer, data + offset, chunks[i]) == ESP_OK);
+        offset += chunks[i];
+        ghota_host_flash_stats_t flash = ghota_host_flash_stats();
+        printf("wrote %6zu bytes, %6zu in total, erased %6" PRIu32 "\n",
+               chunks[i], offset, flash.erase_bytes);
+        CHECK(flash.erase_bytes >= offset + AHEAD);
+        CHECK(flash.erase_bytes < offset + AHEAD + SECTOR);
+    }
+    CHECK(ghota_writer_finish(writer) == ESP_OK);
+    ghota_writer_close(writer);
+
+    ghota_host_flash_stats_t flash = ghota_host_flash_stats();
+    CHECK(flash.unerased == 0);
+    CHECK(memcmp(ghota_host_partition_data(partition), data, len) == 0);
+
+    printf("ok\n");
+    return 0;
+}